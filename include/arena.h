@@ -282,7 +282,8 @@ static void arena_restore(Arena** a) {
  *   *Push(&fibs, arena) = 2;
  *   *Push(&fibs, arena) = 3;
  */
-#define Push(arena, slice)                                                            \
+#define Push(arena, slice) _Push(arena, slice)
+#define _Push(arena, slice)                                                           \
   ({                                                                                  \
     __auto_type _s = slice;                                                           \
     Assert(_s->len >= 0 && "slice.len must be non-negative");                         \
@@ -361,15 +362,23 @@ ARENA_INLINE Arena arena_init(byte* buf, isize size) {
   return a;
 }
 
+// Defined by ARENA_REGISTRY_STATE(); null in programs without the registry
+__attribute__((weak)) void arena_registry_forget(Arena* arena);
+
 /**
  * @brief Release arena memory back to OS.
  * @param arena Arena to release
  *
- * Invalidates all allocations. Arena struct is zeroed.
+ * Invalidates all allocations. Arena struct is zeroed, and dropped from the
+ * arena registry if it was registered.
  */
 ARENA_INLINE void arena_release(Arena* arena) {
+  if (arena_registry_forget)
+    arena_registry_forget(arena);
 #ifdef OOM_COMMIT
   if (arena->commit_size) {
+    // ASan keeps the poison of unmapped pages; the next mapping there would inherit it
+    ASAN_UNPOISON_MEMORY_REGION(arena->beg, arena->end - arena->beg);
     munmap(arena->beg, arena->reserve_size);
   } else {
     free(arena->beg);
@@ -483,6 +492,10 @@ HANDLE_OOM:
  *
  * Fast path is inlined. Memory is zeroed unless NO_INIT flag is set.
  */
+#ifdef ARENA_PROFILE
+static void arena_prof_record(int64_t bytes);  // arena_prof.h
+#endif
+
 ARENA_INLINE void* arena_alloc(Arena* arena, isize size, isize align, isize count, ArenaFlag flags) {
   Assert(size > 0 && "size must be positive");
   Assert(count >= 0 && "count must be non-negative");
@@ -499,10 +512,20 @@ ARENA_INLINE void* arena_alloc(Arena* arena, isize size, isize align, isize coun
     arena->cur += pad + total_size;
     current += pad;
     ASAN_UNPOISON_MEMORY_REGION(current, total_size);
+#ifdef ARENA_PROFILE
+    arena_prof_record(total_size);
+#endif
     return flags.mask & _NO_INIT ? current : memset(current, 0, total_size);
   }
 
+#ifdef ARENA_PROFILE
+  void* ptr = arena_alloc_grow(arena, size, align, count, flags);
+  if (!(flags.mask & _OOM_NULL) || ptr)  // Failed OOM_NULL requests are not charged
+    arena_prof_record(size * count);
+  return ptr;
+#else
   return arena_alloc_grow(arena, size, align, count, flags);
+#endif
 }
 
 /**
@@ -993,6 +1016,144 @@ ARENA_INLINE uint64_t astr_hash(astr key) {
   return hash;
 }
 
+/*
+ * Counting kernels for wc-style statistics. They work on 8 bytes at a
+ * time in a uint64_t (SWAR) and flag matching bytes in bit 7 of each
+ * byte, so there is no per-byte branch and no dependence on SIMD
+ * extensions. Flags are summed into per-byte counters, which are
+ * flushed every 255 words before they can overflow.
+ */
+
+#define _ASTR_ONES  0x0101010101010101ull
+#define _ASTR_HIGHS 0x8080808080808080ull
+
+// 8 bytes with s[0] in the low byte, whatever the host byte order
+ARENA_INLINE uint64_t _astr_load64(const char* s) {
+  uint64_t w;
+  memcpy(&w, s, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
+
+// Bit 7 set in each byte of w that is zero
+ARENA_INLINE uint64_t _astr_zero_bytes(uint64_t w) {
+  return ~(((w & ~_ASTR_HIGHS) + ~_ASTR_HIGHS) | w) & _ASTR_HIGHS;
+}
+
+// Bit 7 set in each byte of w that is ASCII whitespace: ' ', '\t', '\n', '\v', '\f' or '\r'
+ARENA_INLINE uint64_t _astr_space_bytes(uint64_t w) {
+  uint64_t low = w & ~_ASTR_HIGHS;
+  uint64_t ctrl = (low + (0x80 - '\t') * _ASTR_ONES) & ~(low + (0x80 - '\r' - 1) * _ASTR_ONES);
+  return (ctrl | _astr_zero_bytes(w ^ (' ' * _ASTR_ONES))) & ~w & _ASTR_HIGHS;
+}
+
+// Sum of the per-byte counters in acc
+ARENA_INLINE isize _astr_sum_bytes(uint64_t acc) {
+  acc = (acc & 0x00ff00ff00ff00ffull) + ((acc >> 8) & 0x00ff00ff00ff00ffull);
+  return (isize)((acc * 0x0001000100010001ull) >> 48);
+}
+
+/**
+ * @brief Count occurrences of a byte, such as the newlines in a buffer.
+ * @param s String to scan
+ * @param c Byte to count
+ * @return Number of bytes of s equal to c
+ */
+ARENA_INLINE isize astr_count_char(astr s, char c) {
+  uint64_t pattern = (byte)c * _ASTR_ONES;
+  isize n = 0, i = 0;
+  while (i + 8 <= s.len) {
+    uint64_t acc = 0;
+    for (isize end = Min(s.len - 7, i + 255 * 8); i < end; i += 8)
+      acc += _astr_zero_bytes(_astr_load64(s.data + i) ^ pattern) >> 7;
+    n += _astr_sum_bytes(acc);
+  }
+  for (; i < s.len; i++)
+    n += s.data[i] == c;
+  return n;
+}
+
+/**
+ * @brief Count words: maximal runs of bytes other than ASCII whitespace.
+ * @param s String to scan
+ * @param in_word In: whether the byte before s was part of a word; out: whether the last byte of s is
+ * @return Number of words that start in s
+ *
+ * Passing in_word from one call to the next counts a word split across
+ * buffers once. Bytes of multibyte UTF-8 characters are never whitespace.
+ */
+ARENA_INLINE isize astr_count_words(astr s, bool* in_word) {
+  uint64_t before = *in_word ? 0 : 0x80;  // Bit 7: the byte before is whitespace
+  isize n = 0, i = 0;
+  while (i + 8 <= s.len) {
+    uint64_t acc = 0;
+    for (isize end = Min(s.len - 7, i + 255 * 8); i < end; i += 8) {
+      uint64_t space = _astr_space_bytes(_astr_load64(s.data + i));
+      acc += (((space << 8) | before) & ~space & _ASTR_HIGHS) >> 7;
+      before = space >> 56;
+    }
+    n += _astr_sum_bytes(acc);
+  }
+  for (; i < s.len; i++) {
+    uint64_t space = _astr_space_bytes((byte)s.data[i]) & 0x80;
+    n += before & ~space & 0x80 ? 1 : 0;
+    before = space;
+  }
+  *in_word = s.len ? !before : *in_word;
+  return n;
+}
+
+// Length of the valid UTF-8 sequence at s[0, len), which starts with a non-ASCII byte, or 0
+ARENA_INLINE int _astr_utf8_sequence(const byte* s, isize len) {
+  byte c = s[0];
+  int n = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc2 ? 2 : 0;
+  if (n == 0 || c > 0xf4 || len < n)
+    return 0;
+  // The second byte's range excludes overlong forms, surrogates and code points past U+10FFFF
+  byte lo = c == 0xe0 ? 0xa0 : c == 0xf0 ? 0x90 : 0x80;
+  byte hi = c == 0xed ? 0x9f : c == 0xf4 ? 0x8f : 0xbf;
+  if (s[1] < lo || s[1] > hi)
+    return 0;
+  for (int i = 2; i < n; i++) {
+    if ((s[i] & 0xc0) != 0x80)
+      return 0;
+  }
+  return n;
+}
+
+/**
+ * @brief Count UTF-8 characters and validate the encoding.
+ * @param s String to scan
+ * @param invalid Set to the number of bytes that are not part of a valid
+ *                character (overlong forms, surrogates and truncated
+ *                sequences included)
+ * @return Number of valid characters
+ *
+ * Runs of ASCII are skipped 8 bytes at a time. A character split across
+ * two buffers counts as invalid bytes, so split text at a line or other
+ * ASCII boundary first.
+ */
+ARENA_INLINE isize astr_utf8_count(astr s, isize* invalid) {
+  const byte* p = (const byte*)s.data;
+  isize n = 0, bad = 0, i = 0;
+  while (i < s.len) {
+    if (i + 8 <= s.len && !(_astr_load64(s.data + i) & _ASTR_HIGHS)) {
+      n += 8, i += 8;
+    } else if (p[i] < 0x80) {
+      n++, i++;
+    } else {
+      int len = _astr_utf8_sequence(p + i, s.len - i);
+      n += len > 0;
+      bad += len == 0;
+      i += len ? len : 1;
+    }
+  }
+  *invalid = bad;
+  return n;
+}
+
 /**
  * Hash table integration example:
  *
@@ -1017,4 +1178,9 @@ ARENA_INLINE uint64_t astr_hash(astr key) {
  * @endcode
  */
 
+// Per-call-site allocation profile: wraps the allocating macros above
+#ifdef ARENA_PROFILE
+#include "arena_prof.h"
+#endif
+
 #endif  // ARENA_H_
@@ -0,0 +1,386 @@
+/**
+ * @file arena_prof.h
+ * @brief Per-call-site arena allocation profile, enabled with -DARENA_PROFILE.
+ *
+ * In translation units compiled with ARENA_PROFILE, arena.h wraps New(),
+ * Push(), Clone() and the allocating astr_*() functions so that every
+ * arena_alloc() underneath is charged to the outermost macro's
+ * __FILE__:__LINE__. Direct arena_alloc() calls are charged to the address
+ * they were made from. Each thread counts into its own table without locks
+ * or atomic read-modify-writes; snapshots read every table and merge them
+ * by site. Tables of exited threads are handed to new threads, so their
+ * counts are kept.
+ *
+ * Usage:
+ *   // once per program, next to UTEST_STATE()
+ *   ARENA_PROF_STATE();
+ *   ...
+ *   ArenaProfile before = arena_prof_snapshot(arena);
+ *   run_job();
+ *   ArenaProfile grown = arena_prof_diff(arena, before, arena_prof_snapshot(arena));
+ *   arena_prof_report(stderr, grown, 10);     // top 10 sites by bytes
+ *   arena_prof_write_folded(out, grown);      // flamegraph.pl, speedscope
+ *   arena_prof_write_pprof(out, grown);       // pprof legacy heap profile
+ *
+ * An allocation that longjmps out on OOM leaves its site current, so the
+ * handler's own allocations are charged to it as well.
+ */
+
+#ifndef ARENA_PROF_H_
+#define ARENA_PROF_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+// Distinct sites each thread table can hold; the rest go to one overflow entry
+#ifndef ARENA_PROF_SITES
+#define ARENA_PROF_SITES 4096
+#endif
+
+typedef struct {
+  const char *file;
+  int line;
+  const char *func;
+} ArenaProfSite;
+
+typedef struct {
+  const ArenaProfSite *site;  // NULL for a direct arena_alloc() call
+  void *pc;                   // Code address of the allocation
+  int64_t bytes, count;
+} ArenaProfEntry;
+
+// Sites sorted by bytes, largest first
+typedef struct {
+  ArenaProfEntry *entries;
+  isize len;
+  int64_t bytes, count;  // Totals over all entries
+} ArenaProfile;
+
+typedef struct {
+  _Atomic uintptr_t key;  // Site or pc, 0 while the slot is unused
+  const ArenaProfSite *site;
+  void *pc;
+  _Atomic int64_t bytes, count;
+} ArenaProfSlot;
+
+typedef struct ArenaProfTable ArenaProfTable;
+struct ArenaProfTable {
+  ArenaProfTable *next;  // Immutable once published
+  _Atomic int owned;     // A live thread is counting into this table
+  ArenaProfSlot slots[ARENA_PROF_SITES];
+};
+
+struct arena_prof_state_s {
+  _Atomic(ArenaProfTable *) tables;
+  pthread_once_t once;
+  pthread_key_t key;
+};
+
+extern struct arena_prof_state_s arena_prof_state;
+extern __thread const ArenaProfSite *arena_prof_site;  // Outermost macro in progress
+extern __thread ArenaProfTable *arena_prof_table;
+
+// Define the profile state; exactly once per program
+#define ARENA_PROF_STATE()                                                                  \
+  struct arena_prof_state_s arena_prof_state = {.once = PTHREAD_ONCE_INIT};                 \
+  __thread const ArenaProfSite *arena_prof_site = NULL;                                     \
+  __thread ArenaProfTable *arena_prof_table = NULL
+
+/**
+ * Evaluate an allocating expression with its allocations charged to this
+ * line, unless an enclosing ARENA_PROF_CALL already claimed them.
+ */
+#define ARENA_PROF_CALL(...)                                                      \
+  ({                                                                              \
+    static const ArenaProfSite _prof_site = {__FILE__, __LINE__, __func__};       \
+    const ArenaProfSite *_prof_prev = arena_prof_site;                            \
+    if (!_prof_prev)                                                              \
+      arena_prof_site = &_prof_site;                                              \
+    __auto_type _prof_r = (__VA_ARGS__);                                          \
+    arena_prof_site = _prof_prev;                                                 \
+    _prof_r;                                                                      \
+  })
+
+#ifdef ARENA_PROFILE
+#undef New
+#define New(...) ARENA_PROF_CALL(_NEWX(__VA_ARGS__, _NEW4, _NEW3, _NEW2)(__VA_ARGS__))
+#undef Push
+#define Push(arena, slice) ARENA_PROF_CALL(_Push(arena, slice))
+#undef Clone
+#define Clone(...) ARENA_PROF_CALL(_CloneX(__VA_ARGS__, _Clone4, _Clone3, _Clone2)(__VA_ARGS__))
+
+#define astr_clone(...)      ARENA_PROF_CALL((astr_clone)(__VA_ARGS__))
+#define astr_concat(...)     ARENA_PROF_CALL((astr_concat)(__VA_ARGS__))
+#define astr_from_bytes(...) ARENA_PROF_CALL((astr_from_bytes)(__VA_ARGS__))
+#define astr_from_cstr(...)  ARENA_PROF_CALL((astr_from_cstr)(__VA_ARGS__))
+#define astr_cat_bytes(...)  ARENA_PROF_CALL((astr_cat_bytes)(__VA_ARGS__))
+#define astr_cat_cstr(...)   ARENA_PROF_CALL((astr_cat_cstr)(__VA_ARGS__))
+#define astr_format(...)     ARENA_PROF_CALL((astr_format)(__VA_ARGS__))
+#endif
+
+static void arena_prof_thread_exit(void *table) {
+  atomic_store_explicit(&((ArenaProfTable *)table)->owned, 0, memory_order_release);
+}
+
+static void arena_prof_init_key(void) {
+  pthread_key_create(&arena_prof_state.key, arena_prof_thread_exit);
+}
+
+// Adopt a table left by an exited thread, or publish a new one
+static ArenaProfTable *arena_prof_claim(void) {
+  pthread_once(&arena_prof_state.once, arena_prof_init_key);
+  ArenaProfTable *t = atomic_load_explicit(&arena_prof_state.tables, memory_order_acquire);
+  for (; t; t = t->next) {
+    int unowned = 0;
+    if (atomic_compare_exchange_strong(&t->owned, &unowned, 1))
+      break;
+  }
+  if (!t) {
+    t = calloc(1, sizeof(*t));
+    if (!t) {
+      perror("arena_prof_claim calloc");
+      abort();
+    }
+    t->owned = 1;
+    t->next = atomic_load_explicit(&arena_prof_state.tables, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&arena_prof_state.tables, &t->next, t, memory_order_release,
+                                                  memory_order_relaxed)) {
+    }
+  }
+  pthread_setspecific(arena_prof_state.key, t);
+  return t;
+}
+
+// Only the owning thread writes a slot, so plain load/store counting suffices
+static inline void arena_prof_add(_Atomic int64_t *counter, int64_t n) {
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/**
+ * @brief Charge one allocation to the current site (called by arena_alloc).
+ * @param bytes Bytes requested
+ *
+ * Not inlined, so its return address lies in the allocating function.
+ */
+__attribute__((noinline)) static void arena_prof_record(int64_t bytes) {
+  void *pc = __builtin_return_address(0);
+  ArenaProfTable *t = arena_prof_table;
+  if (!t)
+    t = arena_prof_table = arena_prof_claim();
+  const ArenaProfSite *site = arena_prof_site;
+  uintptr_t key = site ? (uintptr_t)site : (uintptr_t)pc;
+
+  uint64_t h = key * 0x9e3779b97f4a7c15u;
+  for (uint32_t i = (uint32_t)(h >> 32), n = 0; n < ARENA_PROF_SITES - 1; i++, n++) {
+    ArenaProfSlot *s = &t->slots[i % (ARENA_PROF_SITES - 1)];
+    uintptr_t k = atomic_load_explicit(&s->key, memory_order_relaxed);
+    if (k == key) {
+      arena_prof_add(&s->bytes, bytes);
+      arena_prof_add(&s->count, 1);
+      return;
+    }
+    if (!k) {
+      s->site = site;
+      s->pc = pc;
+      arena_prof_add(&s->bytes, bytes);
+      arena_prof_add(&s->count, 1);
+      atomic_store_explicit(&s->key, key, memory_order_release);  // Publish to snapshots
+      return;
+    }
+  }
+  // Table full: the last slot collects everything else
+  ArenaProfSlot *s = &t->slots[ARENA_PROF_SITES - 1];
+  arena_prof_add(&s->bytes, bytes);
+  arena_prof_add(&s->count, 1);
+}
+
+/* --- Snapshots --- */
+
+static int arena_prof_cmp_key(const void *a, const void *b) {
+  const ArenaProfEntry *x = a, *y = b;
+  uintptr_t kx = x->site ? (uintptr_t)x->site : (uintptr_t)x->pc;
+  uintptr_t ky = y->site ? (uintptr_t)y->site : (uintptr_t)y->pc;
+  return (kx > ky) - (kx < ky);
+}
+
+static int arena_prof_cmp_bytes(const void *a, const void *b) {
+  const ArenaProfEntry *x = a, *y = b;
+  if (x->bytes != y->bytes)
+    return x->bytes < y->bytes ? 1 : -1;
+  return arena_prof_cmp_key(a, b);
+}
+
+// Merge entries with the same site, drop empty ones and sort by bytes
+static ArenaProfile arena_prof_finish(ArenaProfEntry *e, isize n) {
+  ArenaProfile p = {e, 0, 0, 0};
+  qsort(e, n, sizeof(*e), arena_prof_cmp_key);
+  for (isize i = 0; i < n; i++) {
+    if (p.len && !arena_prof_cmp_key(&e[p.len - 1], &e[i])) {
+      e[p.len - 1].bytes += e[i].bytes;
+      e[p.len - 1].count += e[i].count;
+    } else {
+      e[p.len++] = e[i];
+    }
+  }
+  isize kept = 0;
+  for (isize i = 0; i < p.len; i++) {
+    if (e[i].bytes || e[i].count) {
+      e[kept++] = e[i];
+      p.bytes += e[i].bytes;
+      p.count += e[i].count;
+    }
+  }
+  p.len = kept;
+  qsort(e, p.len, sizeof(*e), arena_prof_cmp_bytes);
+  return p;
+}
+
+/**
+ * @brief Read the counts of all threads, merged by site.
+ * @param arena Arena for the entries
+ * @return Profile sorted by bytes
+ *
+ * Counting threads are not stopped, so each site's numbers are as of some
+ * moment during the call.
+ */
+static ArenaProfile arena_prof_snapshot(Arena *arena) {
+  ArenaProfTable *head = atomic_load_explicit(&arena_prof_state.tables, memory_order_acquire);
+  isize cap = 0;
+  for (ArenaProfTable *t = head; t; t = t->next) {
+    for (int i = 0; i < ARENA_PROF_SITES; i++) {
+      cap += i == ARENA_PROF_SITES - 1 || atomic_load_explicit(&t->slots[i].key, memory_order_relaxed);
+    }
+  }
+  // Sites first seen after counting, this allocation's included, go to the last entry
+  ArenaProfEntry *e = New(arena, ArenaProfEntry, cap + 1);
+  isize n = 0;
+  for (ArenaProfTable *t = head; t; t = t->next) {
+    for (int i = 0; i < ARENA_PROF_SITES; i++) {
+      ArenaProfSlot *s = &t->slots[i];
+      bool overflow = i == ARENA_PROF_SITES - 1;
+      if (!overflow && !atomic_load_explicit(&s->key, memory_order_acquire))
+        continue;
+      ArenaProfEntry *out = n < cap ? &e[n++] : &e[cap];
+      if (!overflow && out != &e[cap]) {
+        out->site = s->site;
+        out->pc = s->pc;
+      }
+      out->bytes += atomic_load_explicit(&s->bytes, memory_order_relaxed);
+      out->count += atomic_load_explicit(&s->count, memory_order_relaxed);
+    }
+  }
+  if (e[cap].count)
+    e[n++] = e[cap];  // n <= cap
+  return arena_prof_finish(e, n);
+}
+
+/**
+ * @brief Allocations made between two snapshots.
+ * @param arena Arena for the entries
+ * @param before Earlier snapshot
+ * @param after Later snapshot
+ * @return Per-site growth, sorted by bytes
+ */
+static ArenaProfile arena_prof_diff(Arena *arena, ArenaProfile before, ArenaProfile after) {
+  ArenaProfEntry *e = New(arena, ArenaProfEntry, before.len + after.len, NO_INIT);
+  isize n = 0;
+  for (isize i = 0; i < after.len; i++) {
+    e[n++] = after.entries[i];
+  }
+  for (isize i = 0; i < before.len; i++) {
+    e[n] = before.entries[i];
+    e[n].bytes = -e[n].bytes;
+    e[n].count = -e[n].count;
+    n++;
+  }
+  return arena_prof_finish(e, n);
+}
+
+/* --- Output --- */
+
+static void arena_prof_fmt_site(char *buf, size_t size, const ArenaProfEntry *e) {
+  if (e->site)
+    snprintf(buf, size, "%s:%d (%s)", e->site->file, e->site->line, e->site->func);
+  else if (e->pc)
+    snprintf(buf, size, "%p", e->pc);
+  else
+    snprintf(buf, size, "(other sites)");
+}
+
+/**
+ * @brief Print the top sites with their share of the bytes.
+ * @param out Output stream
+ * @param p Profile
+ * @param limit Maximum rows, 0 for all
+ */
+static void arena_prof_report(FILE *out, ArenaProfile p, isize limit) {
+  if (limit <= 0 || limit > p.len)
+    limit = p.len;
+  fprintf(out, "%16s %6s %6s %12s  %s\n", "bytes", "%", "cum%", "count", "site");
+  int64_t cum = 0;
+  for (isize i = 0; i < limit; i++) {
+    const ArenaProfEntry *e = &p.entries[i];
+    char site[256];
+    arena_prof_fmt_site(site, sizeof(site), e);
+    cum += e->bytes;
+    double total = p.bytes ? (double)p.bytes : 1;
+    fprintf(out, "%16lld %6.2f %6.2f %12lld  %s\n", (long long)e->bytes, 100.0 * e->bytes / total, 100.0 * cum / total,
+            (long long)e->count, site);
+  }
+  fprintf(out, "%16lld %6s %6s %12lld  total (%td sites)\n", (long long)p.bytes, "", "", (long long)p.count, p.len);
+}
+
+/**
+ * @brief Write one "func;file:line bytes" line per site.
+ *
+ * Collapsed-stack input for flamegraph.pl, inferno or speedscope.
+ */
+static void arena_prof_write_folded(FILE *out, ArenaProfile p) {
+  for (isize i = 0; i < p.len; i++) {
+    const ArenaProfEntry *e = &p.entries[i];
+    if (e->bytes <= 0)
+      continue;
+    if (e->site)
+      fprintf(out, "%s;%s:%d %lld\n", e->site->func, e->site->file, e->site->line, (long long)e->bytes);
+    else if (e->pc)
+      fprintf(out, "%p %lld\n", e->pc, (long long)e->bytes);
+    else
+      fprintf(out, "(other sites) %lld\n", (long long)e->bytes);
+  }
+}
+
+/**
+ * @brief Write a legacy-format heap profile that `pprof <binary> <file>` reads.
+ *
+ * Each site is one single-frame stack at its allocation address; pprof
+ * symbolizes it against the binary using the appended /proc/self/maps.
+ * Arena memory is never freed individually, so in-use equals allocated.
+ */
+static void arena_prof_write_pprof(FILE *out, ArenaProfile p) {
+  fprintf(out, "heap profile: %lld: %lld [%lld: %lld] @ heap\n", (long long)p.count, (long long)p.bytes,
+          (long long)p.count, (long long)p.bytes);
+  for (isize i = 0; i < p.len; i++) {
+    const ArenaProfEntry *e = &p.entries[i];
+    if (e->bytes <= 0 || !e->pc)
+      continue;
+    fprintf(out, "%lld: %lld [%lld: %lld] @ %p\n", (long long)e->count, (long long)e->bytes, (long long)e->count,
+            (long long)e->bytes, e->pc);
+  }
+  fputs("\nMAPPED_LIBRARIES:\n", out);
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (maps) {
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), maps)) > 0) {
+      fwrite(buf, 1, n, out);
+    }
+    fclose(maps);
+  }
+}
+
+#endif  // ARENA_PROF_H_
@@ -0,0 +1,333 @@
+/**
+ * @file arena_registry.h
+ * @brief Process-wide registry of named arenas, with memory accounting dumps.
+ *
+ * Arenas opt in by name. A report walks the registered ones and shows, per
+ * name, how many bytes are handed out (used), backed by accessible pages
+ * (committed), actually in RAM (resident, from mincore) and set aside as
+ * address space (reserved), next to the process RSS from
+ * /proc/self/smaps_rollup. The gap between used and resident is what a
+ * reset or a smaller reservation would give back.
+ *
+ * arena_release() unregisters automatically. An arena embedded in memory
+ * that goes away without a release (a thread-local, a freed struct) must be
+ * unregistered first: the report reads the Arena struct itself.
+ *
+ * Usage:
+ *   // once per program, next to UTEST_STATE()
+ *   ARENA_REGISTRY_STATE();
+ *   ...
+ *   Arena arena = arena_init(NULL, GB(1));
+ *   arena_register(&arena, "parser");      // name must outlive the registration
+ *   ...
+ *   arena_registry_report(stderr);         // on demand
+ *   arena_registry_watch(SIGUSR2, NULL);   // or on `kill -USR2 <pid>`
+ *
+ * Figures are a snapshot taken without stopping the owning threads, so a
+ * busy arena may be a few allocations ahead by the time it is printed.
+ */
+
+#ifndef ARENA_REGISTRY_H_
+#define ARENA_REGISTRY_H_
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "arena.h"
+
+// Arenas the registry can hold at once; arena_register() fails past it
+#ifndef ARENA_REGISTRY_MAX
+#define ARENA_REGISTRY_MAX 4096
+#endif
+
+typedef struct {
+  Arena *arena;
+  const char *name;
+} ArenaRegistryEntry;
+
+// Byte counts of one arena, or of all arenas sharing a name in a report
+typedef struct {
+  const char *name;
+  isize count;        // Arenas summed into this row
+  int64_t used;       // Handed out: cur - beg
+  int64_t committed;  // Accessible: end - beg
+  int64_t resident;   // Committed pages currently in RAM
+  int64_t reserved;   // Address space held, committed or not
+} ArenaUsage;
+
+struct arena_registry_state_s {
+  pthread_mutex_t lock;
+  _Atomic isize len;
+  ArenaRegistryEntry entries[ARENA_REGISTRY_MAX];
+  // Signal-triggered reports: the handler only posts, the watcher writes
+  sem_t wake;
+  pid_t watcher;  // Process the watcher thread runs in; forks start their own
+  const char *path;
+};
+
+extern struct arena_registry_state_s arena_registry_state;
+
+// Define the registry state and arena_release()'s hook; exactly once per program
+#define ARENA_REGISTRY_STATE()                                                                  \
+  struct arena_registry_state_s arena_registry_state = {.lock = PTHREAD_MUTEX_INITIALIZER};     \
+  void arena_registry_forget(Arena *arena) {                                                    \
+    arena_unregister(arena);                                                                    \
+  }                                                                                             \
+  extern struct arena_registry_state_s arena_registry_state
+
+/**
+ * @brief Add an arena to the registry under a name.
+ * @return false when the registry is full
+ *
+ * Registering an arena again renames it. Names are not copied.
+ */
+static bool arena_register(Arena *arena, const char *name) {
+  bool ok = true;
+  pthread_mutex_lock(&arena_registry_state.lock);
+  isize len = atomic_load_explicit(&arena_registry_state.len, memory_order_relaxed);
+  isize i = 0;
+  while (i < len && arena_registry_state.entries[i].arena != arena) {
+    i++;
+  }
+  if (i < len) {
+    arena_registry_state.entries[i].name = name;
+  } else if (len < ARENA_REGISTRY_MAX) {
+    arena_registry_state.entries[len] = (ArenaRegistryEntry){arena, name};
+    atomic_store_explicit(&arena_registry_state.len, len + 1, memory_order_relaxed);
+  } else {
+    ok = false;
+  }
+  pthread_mutex_unlock(&arena_registry_state.lock);
+  return ok;
+}
+
+/**
+ * @brief Remove an arena from the registry; unregistered arenas are ignored.
+ *
+ * Cheap when nothing is registered, since arena_release() calls it for
+ * every arena.
+ */
+static void arena_unregister(Arena *arena) {
+  if (!atomic_load_explicit(&arena_registry_state.len, memory_order_relaxed))
+    return;
+  pthread_mutex_lock(&arena_registry_state.lock);
+  isize len = atomic_load_explicit(&arena_registry_state.len, memory_order_relaxed);
+  for (isize i = 0; i < len; i++) {
+    if (arena_registry_state.entries[i].arena == arena) {
+      arena_registry_state.entries[i] = arena_registry_state.entries[len - 1];
+      atomic_store_explicit(&arena_registry_state.len, len - 1, memory_order_relaxed);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&arena_registry_state.lock);
+}
+
+// Pages of [beg, end) in RAM, counted a chunk of mincore() at a time
+static int64_t arena_registry_resident(const byte *beg, const byte *end) {
+  isize page = (isize)sysconf(_SC_PAGESIZE);
+  uintptr_t lo = (uintptr_t)beg & ~(uintptr_t)(page - 1);
+  uintptr_t hi = AlignPow2((uintptr_t)end, (uintptr_t)page);
+  unsigned char vec[4096];
+  int64_t pages = 0;
+  while (lo < hi) {
+    isize n = Min((isize)((hi - lo) / page), (isize)sizeof(vec));
+    if (!mincore((void *)lo, n * page, vec)) {
+      for (isize i = 0; i < n; i++) {
+        pages += vec[i] & 1;
+      }
+    }
+    lo += n * page;
+  }
+  return pages * page;
+}
+
+/**
+ * @brief Measure one arena, registered or not.
+ *
+ * Resident counts whole pages, so it is clamped to committed for buffers
+ * that do not start or end on a page boundary.
+ */
+static ArenaUsage arena_usage(const Arena *arena) {
+  ArenaUsage u = {.count = 1};
+  if (!arena->beg)
+    return u;
+  u.used = arena->cur - arena->beg;
+  u.committed = arena->end - arena->beg;
+  u.reserved = u.committed;
+#ifdef OOM_COMMIT
+  if (arena->commit_size)
+    u.reserved = arena->reserve_size;
+#endif
+  u.resident = Min(arena_registry_resident(arena->beg, arena->end), u.committed);
+  return u;
+}
+
+// Process RSS in bytes, -1 if /proc is unavailable
+static int64_t arena_registry_rss(void) {
+  static const struct {
+    const char *path, *key;
+  } sources[] = {{"/proc/self/smaps_rollup", "Rss:"}, {"/proc/self/status", "VmRSS:"}};
+  for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+    FILE *f = fopen(sources[i].path, "r");
+    if (!f)
+      continue;
+    char line[256];
+    long long kb = -1;
+    size_t keylen = strlen(sources[i].key);
+    while (kb < 0 && fgets(line, sizeof(line), f)) {
+      if (!strncmp(line, sources[i].key, keylen))
+        kb = atoll(line + keylen);
+    }
+    fclose(f);
+    if (kb >= 0)
+      return kb * 1024;
+  }
+  return -1;
+}
+
+static const char *arena_registry_fmt(char buf[static 16], int64_t bytes) {
+  static const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+  double v = (double)bytes;
+  int u = 0;
+  while (v >= 1024 && u < 4) {
+    v /= 1024;
+    u++;
+  }
+  snprintf(buf, 16, u ? "%.1f %s" : "%.0f %s", v, units[u]);
+  return buf;
+}
+
+static int arena_registry_cmp(const void *a, const void *b) {
+  const ArenaUsage *x = a, *y = b;
+  if (x->resident != y->resident)
+    return x->resident < y->resident ? 1 : -1;
+  return strcmp(x->name, y->name);
+}
+
+static void arena_registry_row(FILE *out, const ArenaUsage *u) {
+  char used[16], committed[16], resident[16], reserved[16];
+  fprintf(out, "%-24s %6td %11s %11s %11s %11s\n", u->name, u->count, arena_registry_fmt(used, u->used),
+          arena_registry_fmt(committed, u->committed), arena_registry_fmt(resident, u->resident),
+          arena_registry_fmt(reserved, u->reserved));
+}
+
+/**
+ * @brief Write the registered arenas, summed per name, largest resident first.
+ *
+ * Arenas cannot be released while they are measured. Takes no arena, so it
+ * is safe to call when the arenas themselves are what ran out.
+ */
+static void arena_registry_report(FILE *out) {
+  ArenaUsage *rows = malloc(ARENA_REGISTRY_MAX * sizeof(ArenaUsage));
+  if (!rows) {
+    fputs("arena_registry_report: out of memory\n", out);
+    return;
+  }
+  isize nrows = 0;
+  pthread_mutex_lock(&arena_registry_state.lock);
+  isize len = atomic_load_explicit(&arena_registry_state.len, memory_order_relaxed);
+  for (isize i = 0; i < len; i++) {
+    ArenaRegistryEntry *e = &arena_registry_state.entries[i];
+    ArenaUsage u = arena_usage(e->arena);
+    isize r = 0;
+    while (r < nrows && strcmp(rows[r].name, e->name)) {
+      r++;
+    }
+    if (r == nrows)
+      rows[nrows++] = (ArenaUsage){.name = e->name};
+    rows[r].count++;
+    rows[r].used += u.used;
+    rows[r].committed += u.committed;
+    rows[r].resident += u.resident;
+    rows[r].reserved += u.reserved;
+  }
+  pthread_mutex_unlock(&arena_registry_state.lock);
+  qsort(rows, nrows, sizeof(ArenaUsage), arena_registry_cmp);
+
+  ArenaUsage total = {.name = "total"};
+  fprintf(out, "%-24s %6s %11s %11s %11s %11s\n", "arena", "count", "used", "committed", "resident", "reserved");
+  for (isize r = 0; r < nrows; r++) {
+    arena_registry_row(out, &rows[r]);
+    total.count += rows[r].count;
+    total.used += rows[r].used;
+    total.committed += rows[r].committed;
+    total.resident += rows[r].resident;
+    total.reserved += rows[r].reserved;
+  }
+  arena_registry_row(out, &total);
+  free(rows);
+
+  int64_t rss = arena_registry_rss();
+  if (rss > 0) {
+    char buf[16];
+    fprintf(out, "process rss %s, %.1f%% in registered arenas\n", arena_registry_fmt(buf, rss),
+            100.0 * total.resident / rss);
+  }
+  fflush(out);
+}
+
+static void *arena_registry_watcher(void *arg) {
+  for (;;) {
+    while (sem_wait(&arena_registry_state.wake) && errno == EINTR) {
+    }
+    pthread_mutex_lock(&arena_registry_state.lock);
+    const char *path = arena_registry_state.path;
+    pthread_mutex_unlock(&arena_registry_state.lock);
+    FILE *out = path ? fopen(path, "a") : stderr;
+    if (!out) {
+      perror("arena_registry_watch fopen");
+      continue;
+    }
+    arena_registry_report(out);
+    if (out != stderr)
+      fclose(out);
+  }
+  return NULL;
+}
+
+// Async-signal-safe: sem_post is, the report is not
+static void arena_registry_on_signal(int sig) {
+  int saved = errno;
+  sem_post(&arena_registry_state.wake);
+  errno = saved;
+}
+
+/**
+ * @brief Write a report each time the process receives a signal.
+ * @param sig Signal to take over, usually SIGUSR2
+ * @param path File to append reports to, NULL for stderr; must outlive the watch
+ * @return false if the watcher thread could not be started
+ *
+ * A background thread does the writing. Calling again changes the path.
+ */
+static bool arena_registry_watch(int sig, const char *path) {
+  bool ok = true;
+  pthread_mutex_lock(&arena_registry_state.lock);
+  arena_registry_state.path = path;
+  if (arena_registry_state.watcher != getpid()) {
+    pthread_t thread;
+    sem_init(&arena_registry_state.wake, 0, 0);
+    ok = !pthread_create(&thread, NULL, arena_registry_watcher, NULL);
+    if (ok) {
+      pthread_detach(thread);
+      arena_registry_state.watcher = getpid();
+    }
+  }
+  pthread_mutex_unlock(&arena_registry_state.lock);
+  if (ok) {
+    struct sigaction sa = {.sa_handler = arena_registry_on_signal, .sa_flags = SA_RESTART};
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+  }
+  return ok;
+}
+
+#endif  // ARENA_REGISTRY_H_
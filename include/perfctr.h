@@ -0,0 +1,205 @@
+/**
+ * @file perfctr.h
+ * @brief Hardware performance counters for the calling thread via perf_event_open.
+ *
+ * Opens cycles, instructions, L1D read misses, last-level cache misses and
+ * branch misses as one event group (so they are scheduled onto the PMU
+ * together), plus page faults as a software event. Counting is limited to
+ * user space, which is what perf_event_paranoid <= 2 allows for a process's
+ * own threads. Events the machine or the sandbox refuses are skipped: a VM
+ * without a virtual PMU still gets page faults, and a seccomp-blocked
+ * process gets nothing, in which case every call below is a cheap no-op.
+ *
+ * Counters run from perf_open() on; regions take snapshots and accumulate
+ * the difference, scaled for multiplexing, so regions may nest.
+ *
+ * Usage:
+ *   PerfCounters pc;
+ *   if (!perf_open(&pc)) fprintf(stderr, "counters: %s\n", perf_status(&pc));
+ *   {
+ *     PerfScope(&pc);
+ *     json_get(doc, "a.b");
+ *   }  // pc.total += counts for the block
+ *   printf("IPC %.2f\n", pc.total.v[PERF_INSTRUCTIONS] / pc.total.v[PERF_CYCLES]);
+ *   perf_close(&pc);
+ */
+
+#ifndef PERFCTR_H_
+#define PERFCTR_H_
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_PAGE_FAULTS,
+  PERF_EVENT_COUNT,
+} PerfEvent;
+
+static const char *const perf_event_names[PERF_EVENT_COUNT] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "page_faults",
+};
+
+typedef struct {
+  double v[PERF_EVENT_COUNT];  // Counts, indexed by PerfEvent
+} PerfValues;
+
+typedef struct {
+  uint64_t value[PERF_EVENT_COUNT];
+  uint64_t running[PERF_EVENT_COUNT];  // Time the event was on the PMU
+  uint64_t enabled[PERF_EVENT_COUNT];  // Time the event was enabled
+} PerfSnapshot;
+
+typedef struct PerfCounters {
+  int fd[PERF_EVENT_COUNT];  // -1 when the event is unavailable
+  uint32_t mask;             // Bit i set when event i is counting
+  int err;                   // errno of the first refused hardware event
+  PerfValues total;          // Sum over PerfScope regions
+  int64_t regions;
+} PerfCounters;
+
+static inline int perf_event_open_fd(uint32_t type, uint64_t config, int group_fd) {
+  struct perf_event_attr attr = {0};
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = group_fd < 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * @brief Open and start the counters for the calling thread.
+ * @param pc Counters to initialize
+ * @return Mask of counting events (0 if perf is unavailable)
+ */
+static inline uint32_t perf_open(PerfCounters *pc) {
+  static const struct {
+    uint32_t type;
+    uint64_t config;
+  } events[PERF_EVENT_COUNT] = {
+      [PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      [PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      [PERF_L1D_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+      [PERF_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      [PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+      [PERF_PAGE_FAULTS] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+  };
+
+  memset(pc, 0, sizeof(*pc));
+  int leader = -1;
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    bool hw = events[i].type != PERF_TYPE_SOFTWARE;
+    pc->fd[i] = perf_event_open_fd(events[i].type, events[i].config, hw ? leader : -1);
+    if (pc->fd[i] < 0) {
+      if (hw && !pc->err)
+        pc->err = errno;
+      continue;
+    }
+    pc->mask |= 1u << i;
+    if (hw && leader < 0)
+      leader = pc->fd[i];
+    else if (!hw)
+      ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+  if (leader >= 0)
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return pc->mask;
+}
+
+static inline void perf_close(PerfCounters *pc) {
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    if (pc->fd[i] >= 0)
+      close(pc->fd[i]);
+    pc->fd[i] = -1;
+  }
+  pc->mask = 0;
+}
+
+// @return Why hardware events are missing, or "ok"
+static inline const char *perf_status(const PerfCounters *pc) {
+  if (pc->mask & (1u << PERF_CYCLES))
+    return "ok";
+  switch (pc->err) {
+    case ENOENT:
+    case EOPNOTSUPP:
+      return "no hardware PMU (virtual machine?)";
+    case EACCES:
+    case EPERM:
+      return "denied by perf_event_paranoid or seccomp";
+    case ENOSYS:
+      return "perf_event_open not supported";
+    default:
+      return strerror(pc->err);
+  }
+}
+
+static inline PerfSnapshot perf_snapshot(const PerfCounters *pc) {
+  PerfSnapshot s = {0};
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    uint64_t buf[3];
+    if (pc->fd[i] >= 0 && read(pc->fd[i], buf, sizeof(buf)) == sizeof(buf)) {
+      s.value[i] = buf[0];
+      s.enabled[i] = buf[1];
+      s.running[i] = buf[2];
+    }
+  }
+  return s;
+}
+
+// acc += b - a, scaled up when events were multiplexed off the PMU
+static inline void perf_accumulate(const PerfCounters *pc, const PerfSnapshot *a, const PerfSnapshot *b,
+                                   PerfValues *acc) {
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    if (!(pc->mask & (1u << i)))
+      continue;
+    uint64_t running = b->running[i] - a->running[i];
+    uint64_t enabled = b->enabled[i] - a->enabled[i];
+    double delta = (double)(b->value[i] - a->value[i]);
+    acc->v[i] += running && running < enabled ? delta * enabled / running : delta;
+  }
+}
+
+typedef struct {
+  PerfCounters *pc;
+  PerfSnapshot start;
+} PerfRegion;
+
+static inline void perf_region_end(PerfRegion *r) {
+  if (!r->pc->mask)
+    return;
+  PerfSnapshot end = perf_snapshot(r->pc);
+  perf_accumulate(r->pc, &r->start, &end, &r->pc->total);
+  r->pc->regions++;
+}
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b)  PERF_CONCAT_(a, b)
+
+/**
+ * Count events until the end of the enclosing block into pc->total.
+ *
+ * Usage:
+ *   {
+ *     PerfScope(&pc);
+ *     work();
+ *   }
+ */
+#define PerfScope(counters)                                                             \
+  __attribute__((__cleanup__(perf_region_end))) PerfRegion PERF_CONCAT(_perf_, __LINE__) = { \
+      .pc = (counters), .start = perf_snapshot(counters)}
+
+#endif  // PERFCTR_H_
@@ -0,0 +1,630 @@
+/**
+ * @file sampler.h
+ * @brief In-process sampling CPU profiler, exported as folded stacks.
+ *
+ * Each registered thread arms a timer on its own CPU-time clock that sends it
+ * SIGPROF at the configured rate. The handler walks the frame-pointer chain
+ * from the interrupted context and appends the return addresses to a ring
+ * owned by the thread: no locks, no allocation, nothing that is not
+ * async-signal-safe. Frames are checked against the thread's stack bounds, so
+ * code built without frame pointers yields short stacks, not crashes; build
+ * with -fno-omit-frame-pointer (debug and profile builds) for full ones.
+ *
+ * Symbols are resolved only at export, from /proc/self/maps and the ELF
+ * symbol tables of the mapped files. sampler_write_folded() writes one line
+ * per distinct stack, root first, with its sample count: the input of
+ * flamegraph.pl and speedscope. A thread that exits leaves its ring to the
+ * next thread that registers, which first counts the old samples into a
+ * shared table of stacks, so short-lived workers neither grow the process
+ * nor lose their samples. Stop the sampler before exporting.
+ *
+ * Usage:
+ *   // once per program, next to UTEST_STATE()
+ *   SAMPLER_STATE();
+ *
+ *   sampler_start(99);           // samples the calling thread
+ *   ...
+ *   static void *worker(void *arg) {
+ *     sampler_thread_start();    // threads opt in; a no-op while stopped
+ *     ...
+ *   }
+ *   ...
+ *   sampler_stop();
+ *   sampler_write_folded(fopen("cpu.folded", "w"), arena);
+ *
+ * main.c starts it for the whole run when SAMPLER_OUT=<file> is set
+ * (SAMPLER_HZ=<n>, default 99), and pool and pipeline workers opt in.
+ */
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "arena.h"
+#include "arena_registry.h"
+
+// Samples kept per thread, a power of 2; older samples are overwritten
+#ifndef SAMPLER_RING_SAMPLES
+#define SAMPLER_RING_SAMPLES 4096
+#endif
+
+// Frames kept per sample, innermost first
+#ifndef SAMPLER_MAX_DEPTH
+#define SAMPLER_MAX_DEPTH 63
+#endif
+
+// Folded stacks kept for exited threads; samples of new stacks past this are dropped
+#ifndef SAMPLER_FOLDED_SIZE
+#define SAMPLER_FOLDED_SIZE MB(64)
+#endif
+
+// Default rate; off the round numbers so samples do not lock onto periodic work
+#define SAMPLER_HZ 99
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+typedef struct {
+  uintptr_t depth;
+  uintptr_t pc[SAMPLER_MAX_DEPTH];
+} SamplerSample;
+
+// A distinct stack of exited threads' samples, chained in its hash bucket
+typedef struct SamplerStack SamplerStack;
+struct SamplerStack {
+  SamplerStack *next;
+  uint64_t hash;
+  int64_t count;
+  uintptr_t depth;
+  uintptr_t pc[];
+};
+
+typedef struct SamplerThread SamplerThread;
+struct SamplerThread {
+  SamplerThread *next;  // Immutable once published
+  _Atomic int owned;    // A live thread is sampled into this ring
+  int tid;
+  _Atomic int armed;  // The timer exists and may fire
+  timer_t timer;
+  uintptr_t stack_lo, stack_hi;
+  _Atomic uint64_t head;  // Samples ever written
+  SamplerSample *ring;    // Ring of SAMPLER_RING_SAMPLES
+  Arena arena;
+};
+
+struct sampler_state_s {
+  _Atomic(SamplerThread *) threads;
+  _Atomic int hz;  // 0 while stopped
+  pthread_once_t once;
+  pthread_key_t key;  // Disarms a thread's timer and releases its ring when it exits
+  pthread_mutex_t lock;  // Guards the folded stacks
+  Arena folded;
+  SamplerStack **buckets;
+  isize nbuckets, nstacks;
+};
+
+extern struct sampler_state_s sampler_state;
+extern __thread SamplerThread *sampler_thread;
+
+// Define the sampler state; exactly once per program
+#define SAMPLER_STATE()                                              \
+  struct sampler_state_s sampler_state = {                           \
+      .once = PTHREAD_ONCE_INIT, .lock = PTHREAD_MUTEX_INITIALIZER}; \
+  __thread SamplerThread *sampler_thread = NULL
+
+// Runs on the sampled thread. Stack reads may land on ASan redzones, which is
+// fine here: the frame check keeps them inside the thread's stack.
+__attribute__((no_sanitize_address)) static void sampler_on_sigprof(int sig, siginfo_t *info, void *context) {
+  SamplerThread *t = sampler_thread;
+  if (!t || !atomic_load_explicit(&t->armed, memory_order_relaxed))
+    return;
+  const ucontext_t *uc = context;
+#if defined(__x86_64__)
+  uintptr_t pc = uc->uc_mcontext.gregs[REG_RIP];
+  uintptr_t fp = uc->uc_mcontext.gregs[REG_RBP];
+  uintptr_t sp = uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+  uintptr_t pc = uc->uc_mcontext.pc;
+  uintptr_t fp = uc->uc_mcontext.regs[29];
+  uintptr_t sp = uc->uc_mcontext.sp;
+#else
+  uintptr_t pc = 0, fp = 0, sp = 0;
+  return;
+#endif
+  uint64_t h = atomic_load_explicit(&t->head, memory_order_relaxed);
+  SamplerSample *s = &t->ring[h & (SAMPLER_RING_SAMPLES - 1)];
+  uintptr_t depth = 0;
+  s->pc[depth++] = pc;
+  // On another stack (a fiber, sigaltstack) only the interrupted pc is safe
+  if (sp >= t->stack_lo && sp < t->stack_hi) {
+    // Each frame record {caller fp, return address} sits above the last one
+    uintptr_t lo = sp;
+    while (depth < SAMPLER_MAX_DEPTH && fp >= lo && fp <= t->stack_hi - 2 * sizeof(uintptr_t) &&
+           !(fp & (sizeof(uintptr_t) - 1))) {
+      const uintptr_t *frame = (const uintptr_t *)fp;
+      if (!frame[1])
+        break;
+      s->pc[depth++] = frame[1];
+      lo = fp + 2 * sizeof(uintptr_t);
+      fp = frame[0];
+    }
+  }
+  s->depth = depth;
+  atomic_store_explicit(&t->head, h + 1, memory_order_release);
+}
+
+static void sampler_disarm(SamplerThread *t) {
+  int armed = 1;
+  if (atomic_compare_exchange_strong(&t->armed, &armed, 0))
+    timer_delete(t->timer);
+}
+
+static void sampler_thread_exit(void *t) {
+  sampler_disarm(t);
+  atomic_store_explicit(&((SamplerThread *)t)->owned, 0, memory_order_release);
+}
+
+static void sampler_init(void) {
+  pthread_key_create(&sampler_state.key, sampler_thread_exit);
+  struct sigaction sa = {.sa_sigaction = sampler_on_sigprof, .sa_flags = SA_SIGINFO | SA_RESTART};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+}
+
+// Count one sample into the folded stacks; the caller holds the lock
+static void sampler_fold_sample(const SamplerSample *s) {
+  struct sampler_state_s *st = &sampler_state;
+  uintptr_t depth = Min(s->depth, SAMPLER_MAX_DEPTH);
+  uint64_t hash = astr_hash((astr){(char *)s->pc, (isize)(depth * sizeof(uintptr_t))});
+  if (st->nstacks >= st->nbuckets) {
+    isize n = st->nbuckets ? 2 * st->nbuckets : 1024;
+    SamplerStack **buckets = New(&st->folded, SamplerStack *, n, OOM_NULL);
+    if (buckets) {
+      for (isize i = 0; i < st->nbuckets; i++) {
+        for (SamplerStack *k = st->buckets[i], *next; k; k = next) {
+          next = k->next;
+          k->next = buckets[k->hash & (n - 1)];
+          buckets[k->hash & (n - 1)] = k;
+        }
+      }
+      st->buckets = buckets;
+      st->nbuckets = n;
+    }
+    if (!st->nbuckets)
+      return;
+  }
+  SamplerStack **bucket = &st->buckets[hash & (st->nbuckets - 1)];
+  for (SamplerStack *k = *bucket; k; k = k->next) {
+    if (k->hash == hash && k->depth == depth && !memcmp(k->pc, s->pc, depth * sizeof(uintptr_t))) {
+      k->count++;
+      return;
+    }
+  }
+  isize words = (isize)(sizeof(SamplerStack) / sizeof(uintptr_t) + depth);
+  SamplerStack *k = (SamplerStack *)New(&st->folded, uintptr_t, words, OOM_NULL);
+  if (!k)
+    return;
+  *k = (SamplerStack){.next = *bucket, .hash = hash, .count = 1, .depth = depth};
+  memcpy(k->pc, s->pc, depth * sizeof(uintptr_t));
+  *bucket = k;
+  st->nstacks++;
+}
+
+// Count the samples of an exited thread's ring into the folded stacks, emptying it
+static void sampler_fold(SamplerThread *t) {
+  uint64_t end = atomic_load_explicit(&t->head, memory_order_acquire);
+  pthread_mutex_lock(&sampler_state.lock);
+  if (!sampler_state.folded.beg) {
+#ifdef OOM_COMMIT
+    sampler_state.folded = arena_init(NULL, SAMPLER_FOLDED_SIZE);
+#else
+    byte *mem = malloc(SAMPLER_FOLDED_SIZE);
+    if (!mem) {
+      perror("sampler_fold malloc");
+      abort();
+    }
+    sampler_state.folded = arena_init(mem, SAMPLER_FOLDED_SIZE);
+#endif
+    arena_register(&sampler_state.folded, "sampler.folded");
+  }
+  for (uint64_t i = end > SAMPLER_RING_SAMPLES ? end - SAMPLER_RING_SAMPLES : 0; i < end; i++) {
+    sampler_fold_sample(&t->ring[i & (SAMPLER_RING_SAMPLES - 1)]);
+  }
+  atomic_store_explicit(&t->head, 0, memory_order_release);
+  pthread_mutex_unlock(&sampler_state.lock);
+}
+
+// Point the ring at the calling thread and its stack
+static void sampler_thread_bind(SamplerThread *t) {
+  t->tid = (int)syscall(SYS_gettid);
+  t->stack_lo = t->stack_hi = 0;
+  pthread_attr_t attr;
+  if (!pthread_getattr_np(pthread_self(), &attr)) {
+    void *lo;
+    size_t len;
+    pthread_attr_getstack(&attr, &lo, &len);
+    pthread_attr_destroy(&attr);
+    t->stack_lo = (uintptr_t)lo;
+    t->stack_hi = (uintptr_t)lo + len;
+  }
+}
+
+// Take over the ring of an exited thread, its samples folded first
+static SamplerThread *sampler_thread_adopt(void) {
+  SamplerThread *t = atomic_load_explicit(&sampler_state.threads, memory_order_acquire);
+  for (; t; t = t->next) {
+    int unowned = 0;
+    if (atomic_compare_exchange_strong(&t->owned, &unowned, 1))
+      break;
+  }
+  if (t) {
+    sampler_fold(t);
+    sampler_thread_bind(t);
+  }
+  return t;
+}
+
+// First registration on this thread: adopt a free ring, or carve one from a fresh arena and publish it
+static SamplerThread *sampler_thread_new(void) {
+  SamplerThread *t = sampler_thread_adopt();
+  if (t)
+    return sampler_thread = t;
+  // Headroom for the header and for OOM_COMMIT growing in whole commit chunks
+  isize size = SAMPLER_RING_SAMPLES * sizeof(SamplerSample) + MB(4);
+#ifdef OOM_COMMIT
+  Arena arena = arena_init(NULL, size);
+#else
+  byte *mem = malloc(size);
+  if (!mem) {
+    perror("sampler_thread_new malloc");
+    abort();
+  }
+  Arena arena = arena_init(mem, size);
+#endif
+  t = New(&arena, SamplerThread);
+  t->owned = 1;
+  t->ring = New(&arena, SamplerSample, SAMPLER_RING_SAMPLES, NO_INIT);
+  t->arena = arena;
+  arena_register(&t->arena, "sampler");
+  sampler_thread_bind(t);
+  t->next = atomic_load_explicit(&sampler_state.threads, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&sampler_state.threads, &t->next, t, memory_order_release,
+                                                memory_order_relaxed)) {
+  }
+  return sampler_thread = t;
+}
+
+/**
+ * @brief Sample the calling thread while the sampler runs.
+ * @return false if the sampler is stopped or the timer could not be created
+ */
+static bool sampler_thread_start(void) {
+  int hz = atomic_load(&sampler_state.hz);
+  if (!hz)
+    return false;
+  SamplerThread *t = sampler_thread ? sampler_thread : sampler_thread_new();
+  if (atomic_load(&t->armed))
+    return true;
+  struct sigevent sev = {.sigev_notify = SIGEV_THREAD_ID, .sigev_signo = SIGPROF};
+  sev.sigev_notify_thread_id = t->tid;
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &t->timer))
+    return false;
+  long ns = 1000000000L / hz;
+  struct itimerspec its = {.it_interval = {ns / 1000000000L, ns % 1000000000L}};
+  its.it_value = its.it_interval;
+  atomic_store(&t->armed, 1);
+  pthread_setspecific(sampler_state.key, t);
+  timer_settime(t->timer, 0, &its, NULL);
+  // A concurrent sampler_stop() may have missed this timer
+  if (!atomic_load(&sampler_state.hz))
+    sampler_disarm(t);
+  return true;
+}
+
+/**
+ * @brief Start sampling at hz samples per CPU-second, beginning with the calling thread.
+ * @param hz Rate, SAMPLER_HZ if 0
+ * @return false if the calling thread's timer could not be created
+ */
+static bool sampler_start(int hz) {
+  pthread_once(&sampler_state.once, sampler_init);
+  atomic_store(&sampler_state.hz, hz > 0 ? hz : SAMPLER_HZ);
+  return sampler_thread_start();
+}
+
+// Disarm every thread; the samples stay for export
+static void sampler_stop(void) {
+  atomic_store(&sampler_state.hz, 0);
+  for (SamplerThread *t = atomic_load(&sampler_state.threads); t; t = t->next) {
+    sampler_disarm(t);
+  }
+}
+
+/* --- Export --- */
+
+typedef struct {
+  uintptr_t addr;  // Link-time address
+  uintptr_t size;
+  const char *name;
+} SamplerSym;
+
+typedef struct {
+  const char *path;
+  const byte *image;  // The file, mapped read-only; NULL if it is not a readable ELF64
+  size_t image_size;
+  const Elf64_Phdr *phdrs;
+  int nphdrs;
+  SamplerSym *syms;  // Functions, by address
+  isize nsyms;
+} SamplerModule;
+
+typedef struct {
+  uintptr_t start, end, offset;
+  SamplerModule *module;
+} SamplerMap;
+
+typedef struct {
+  SamplerMap *maps;
+  isize nmaps;
+  SamplerModule *modules;
+  isize nmodules;
+} SamplerSymbols;
+
+static int sampler_sym_cmp(const void *a, const void *b) {
+  const SamplerSym *x = a, *y = b;
+  return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static void sampler_load_module(Arena *arena, SamplerModule *m) {
+  int fd = open(m->path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) || st.st_size < (off_t)sizeof(Elf64_Ehdr)) {
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+  void *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED)
+    return;
+  const Elf64_Ehdr *eh = image;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+      eh->e_phoff + (size_t)eh->e_phnum * sizeof(Elf64_Phdr) > (size_t)st.st_size ||
+      eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf64_Shdr) > (size_t)st.st_size) {
+    munmap(image, st.st_size);
+    return;
+  }
+  m->image = image;
+  m->image_size = st.st_size;
+  m->phdrs = (const Elf64_Phdr *)(m->image + eh->e_phoff);
+  m->nphdrs = eh->e_phnum;
+
+  // The full symbol table when the file has one, else the dynamic symbols
+  const Elf64_Shdr *sh = (const Elf64_Shdr *)(m->image + eh->e_shoff);
+  const Elf64_Shdr *symtab = NULL;
+  for (int i = 0; i < eh->e_shnum; i++) {
+    if (sh[i].sh_type == SHT_SYMTAB || (sh[i].sh_type == SHT_DYNSYM && !symtab))
+      symtab = &sh[i];
+  }
+  if (!symtab || symtab->sh_link >= eh->e_shnum || symtab->sh_offset + symtab->sh_size > m->image_size)
+    return;
+  const Elf64_Shdr *strtab = &sh[symtab->sh_link];
+  if (strtab->sh_offset + strtab->sh_size > m->image_size)
+    return;
+  const Elf64_Sym *syms = (const Elf64_Sym *)(m->image + symtab->sh_offset);
+  isize n = symtab->sh_size / sizeof(Elf64_Sym);
+  m->syms = New(arena, SamplerSym, n, NO_INIT);
+  for (isize i = 0; i < n; i++) {
+    int type = ELF64_ST_TYPE(syms[i].st_info);
+    if ((type != STT_FUNC && type != STT_GNU_IFUNC) || !syms[i].st_value || syms[i].st_name >= strtab->sh_size)
+      continue;
+    m->syms[m->nsyms++] = (SamplerSym){
+        .addr = syms[i].st_value,
+        .size = syms[i].st_size,
+        .name = (const char *)m->image + strtab->sh_offset + syms[i].st_name,
+    };
+  }
+  qsort(m->syms, m->nsyms, sizeof(SamplerSym), sampler_sym_cmp);
+}
+
+// Executable mappings of files, each file's symbols loaded once
+static SamplerSymbols sampler_symbols_load(Arena *arena) {
+  SamplerSymbols s = {0};
+  FILE *f = fopen("/proc/self/maps", "r");
+  if (!f)
+    return s;
+  char line[4096];
+  isize cap = 0;
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long start, end, offset;
+    char perms[5];
+    int path_at = 0;
+    if (sscanf(line, "%lx-%lx %4s %lx %*s %*s %n", &start, &end, perms, &offset, &path_at) < 4 || perms[2] != 'x' ||
+        !path_at || line[path_at] != '/')
+      continue;
+    line[strcspn(line, "\n")] = 0;
+    const char *path = line + path_at;
+    SamplerModule *m = NULL;
+    for (isize i = 0; i < s.nmodules && !m; i++) {
+      if (!strcmp(s.modules[i].path, path))
+        m = &s.modules[i];
+    }
+    // Every mapped file is a module and a map at most; 256 covers any sane process
+    if (!cap) {
+      cap = 256;
+      s.maps = New(arena, SamplerMap, cap);
+      s.modules = New(arena, SamplerModule, cap);
+    }
+    if (s.nmaps == cap)
+      break;
+    if (!m) {
+      m = &s.modules[s.nmodules++];
+      char *copy = New(arena, char, strlen(path) + 1, NO_INIT);
+      m->path = strcpy(copy, path);
+    }
+    s.maps[s.nmaps++] = (SamplerMap){.start = start, .end = end, .offset = offset, .module = m};
+  }
+  fclose(f);
+  for (isize i = 0; i < s.nmodules; i++) {
+    sampler_load_module(arena, &s.modules[i]);
+  }
+  return s;
+}
+
+static void sampler_symbols_release(SamplerSymbols *s) {
+  for (isize i = 0; i < s->nmodules; i++) {
+    if (s->modules[i].image)
+      munmap((void *)s->modules[i].image, s->modules[i].image_size);
+  }
+}
+
+/**
+ * @brief Name the function containing pc.
+ * @param s Symbols
+ * @param pc Code address
+ * @param buf Space for a synthesized "module+0xoffset" name
+ * @param size Size of buf
+ */
+static const char *sampler_symbolize(const SamplerSymbols *s, uintptr_t pc, char *buf, size_t size) {
+  for (isize i = 0; i < s->nmaps; i++) {
+    const SamplerMap *map = &s->maps[i];
+    if (pc < map->start || pc >= map->end)
+      continue;
+    const SamplerModule *m = map->module;
+    uintptr_t off = pc - map->start + map->offset;
+    const char *base = strrchr(m->path, '/') + 1;
+    snprintf(buf, size, "%s+0x%lx", base, (unsigned long)off);
+    // File offset to link-time address through the segment that maps it
+    for (int k = 0; k < m->nphdrs; k++) {
+      const Elf64_Phdr *ph = &m->phdrs[k];
+      if (ph->p_type != PT_LOAD || off < ph->p_offset || off >= ph->p_offset + ph->p_filesz)
+        continue;
+      uintptr_t addr = off - ph->p_offset + ph->p_vaddr;
+      isize lo = 0, hi = m->nsyms;  // Last symbol at or below addr
+      while (lo < hi) {
+        isize mid = lo + (hi - lo) / 2;
+        if (m->syms[mid].addr <= addr)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      if (lo) {
+        const SamplerSym *sym = &m->syms[lo - 1];
+        if (addr < sym->addr + sym->size || (!sym->size && (lo == m->nsyms || addr < m->syms[lo].addr)))
+          return sym->name;
+      }
+      break;
+    }
+    return buf;
+  }
+  snprintf(buf, size, "0x%lx", (unsigned long)pc);
+  return buf;
+}
+
+static bool sampler_is_code(const SamplerSymbols *s, uintptr_t pc) {
+  for (isize i = 0; i < s->nmaps; i++) {
+    if (pc >= s->maps[i].start && pc < s->maps[i].end)
+      return true;
+  }
+  return false;
+}
+
+// A stack as folded text, and its samples
+typedef struct {
+  astr line;
+  int64_t count;
+} SamplerFolded;
+
+static int sampler_folded_cmp(const void *a, const void *b) {
+  return astr_compare(((const SamplerFolded *)a)->line, ((const SamplerFolded *)b)->line);
+}
+
+// Root-first "a;b;c" of a sample's frames
+static astr sampler_fold_line(Arena *arena, const SamplerSymbols *syms, const uintptr_t *pc,
+                              uintptr_t depth) {
+  char buf[256];
+  // Code without frame pointers leaves stale words in the chain: keep the
+  // frames up to the first return address that is not in mapped code
+  uintptr_t n = 1;
+  while (n < Min(depth, SAMPLER_MAX_DEPTH) && sampler_is_code(syms, pc[n])) {
+    n++;
+  }
+  astr line = {0};
+  for (uintptr_t d = n; d-- > 0;) {
+    // Return addresses point past the call, possibly into the next function
+    line = astr_cat_cstr(arena, line, sampler_symbolize(syms, d ? pc[d] - 1 : pc[d], buf, sizeof(buf)));
+    if (d)
+      line = astr_cat_bytes(arena, line, ";", 1);
+  }
+  return line;
+}
+
+/**
+ * @brief Write the samples of every thread, live and exited, as folded stacks.
+ * @param out Output stream
+ * @param arena Scratch for symbol tables and stack strings
+ * @return Samples written
+ */
+static int64_t sampler_write_folded(FILE *out, Arena *arena) {
+  Arena scratch = *arena;
+  SamplerThread *head = atomic_load_explicit(&sampler_state.threads, memory_order_acquire);
+  pthread_mutex_lock(&sampler_state.lock);
+  isize total = sampler_state.nstacks;
+  for (SamplerThread *t = head; t; t = t->next) {
+    uint64_t end = atomic_load_explicit(&t->head, memory_order_acquire);
+    total += end > SAMPLER_RING_SAMPLES ? SAMPLER_RING_SAMPLES : end;
+  }
+  if (!total) {
+    pthread_mutex_unlock(&sampler_state.lock);
+    return 0;
+  }
+
+  SamplerSymbols syms = sampler_symbols_load(&scratch);
+  SamplerFolded *stacks = New(&scratch, SamplerFolded, total, NO_INIT);
+  isize n = 0;
+  for (isize b = 0; b < sampler_state.nbuckets; b++) {
+    for (SamplerStack *k = sampler_state.buckets[b]; k && n < total; k = k->next) {
+      stacks[n++] = (SamplerFolded){sampler_fold_line(&scratch, &syms, k->pc, k->depth), k->count};
+    }
+  }
+  pthread_mutex_unlock(&sampler_state.lock);
+  for (SamplerThread *t = head; t && n < total; t = t->next) {
+    uint64_t end = atomic_load_explicit(&t->head, memory_order_acquire);
+    for (uint64_t i = end > SAMPLER_RING_SAMPLES ? end - SAMPLER_RING_SAMPLES : 0; i < end && n < total; i++) {
+      const SamplerSample *s = &t->ring[i & (SAMPLER_RING_SAMPLES - 1)];
+      stacks[n++] = (SamplerFolded){sampler_fold_line(&scratch, &syms, s->pc, s->depth), 1};
+    }
+  }
+  sampler_symbols_release(&syms);
+
+  qsort(stacks, n, sizeof(SamplerFolded), sampler_folded_cmp);
+  int64_t samples = 0;
+  for (isize i = 0; i < n;) {
+    int64_t count = 0;
+    isize j = i;
+    for (; j < n && astr_equals(stacks[i].line, stacks[j].line); j++) {
+      count += stacks[j].count;
+    }
+    fprintf(out, "%.*s %lld\n", S(stacks[i].line), (long long)count);
+    samples += count;
+    i = j;
+  }
+  return samples;
+}
+
+#endif  // SAMPLER_H_
@@ -0,0 +1,317 @@
+/**
+ * @file trace.h
+ * @brief Per-thread event tracing, exported as Chrome trace-event JSON.
+ *
+ * In translation units compiled with TRACE, the macros below append 24-byte
+ * records stamped with the CPU cycle counter (rdtsc, cntvct_el0 on arm64) to
+ * a ring buffer owned by the calling thread: no locks, no atomics beyond a
+ * release store of the head, a few nanoseconds per event. Without TRACE
+ * they compile to nothing. A scope is recorded once, when it ends, as a
+ * complete event with its duration, so a ring that wrapped never holds a
+ * begin without its end.
+ *
+ * A buffer outlives its thread, so short-lived workers still appear in the
+ * export, until a thread started later adopts it: as with arena_prof's
+ * tables, there are only as many buffers as threads ever traced at once,
+ * however many come and go. trace_write_json() converts cycles to microseconds against the
+ * monotonic clock and writes the JSON that ui.perfetto.dev and
+ * chrome://tracing open. Export while the traced threads are idle: a ring
+ * being written concurrently may yield a torn oldest record.
+ *
+ * Usage:
+ *   // once per program, next to UTEST_STATE()
+ *   TRACE_STATE();
+ *
+ *   static void *worker(void *arg) {
+ *     TRACE_THREAD_NAME("parser");
+ *     for (...) {
+ *       TRACE_SCOPE("parse");
+ *       TRACE_COUNTER("queue_depth", len);
+ *       if (retry)
+ *         TRACE_INSTANT("retry");
+ *     }
+ *   }
+ *   ...
+ *   trace_write_json(fopen("trace.json", "w"));
+ *
+ * Names must outlive the export; string literals are the usual choice.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "arena_registry.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Events kept per thread, a power of 2; older events are overwritten
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 65536
+#endif
+
+enum { TRACE_KIND_SCOPE, TRACE_KIND_INSTANT, TRACE_KIND_COUNTER };
+
+typedef struct {
+  uint64_t tsc : 56;  // Start, in ticks
+  uint64_t kind : 8;
+  const char *name;
+  int64_t value;  // Duration in ticks for scopes, the value for counters
+} TraceEvent;
+
+typedef struct TraceBuffer TraceBuffer;
+struct TraceBuffer {
+  TraceBuffer *next;  // Immutable once published
+  _Atomic int owned;  // A live thread is writing into this buffer
+  int tid;
+  const char *thread_name;
+  _Atomic uint64_t head;  // Events ever written
+  TraceEvent *events;     // Ring of TRACE_BUFFER_EVENTS
+  Arena arena;
+};
+
+struct trace_state_s {
+  _Atomic(TraceBuffer *) buffers;
+  pthread_once_t once;
+  pthread_key_t key;  // Releases the buffer when its thread exits
+  uint64_t tsc0;  // Clock origin, paired for calibration
+  int64_t ns0;
+};
+
+extern struct trace_state_s trace_state;
+extern __thread TraceBuffer *trace_buffer;
+
+// Define the trace state; exactly once per program
+#define TRACE_STATE()                                                    \
+  struct trace_state_s trace_state = {.once = PTHREAD_ONCE_INIT};        \
+  __thread TraceBuffer *trace_buffer = NULL
+
+static inline uint64_t trace_tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t v;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+  return v;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline int64_t trace_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void trace_thread_exit(void *b) {
+  atomic_store_explicit(&((TraceBuffer *)b)->owned, 0, memory_order_release);
+}
+
+static void trace_init(void) {
+  pthread_key_create(&trace_state.key, trace_thread_exit);
+  trace_state.ns0 = trace_now_ns();
+  trace_state.tsc0 = trace_tsc();
+}
+
+// Take over the buffer of an exited thread, dropping its events
+static TraceBuffer *trace_buffer_adopt(void) {
+  TraceBuffer *b = atomic_load_explicit(&trace_state.buffers, memory_order_acquire);
+  for (; b; b = b->next) {
+    int unowned = 0;
+    if (atomic_compare_exchange_strong(&b->owned, &unowned, 1))
+      break;
+  }
+  if (b) {
+    b->tid = (int)syscall(SYS_gettid);
+    b->thread_name = NULL;
+    atomic_store_explicit(&b->head, 0, memory_order_release);
+  }
+  return b;
+}
+
+// First event on this thread: adopt a free ring, or carve one from a fresh arena and publish it
+__attribute__((noinline)) static TraceBuffer *trace_buffer_new(void) {
+  pthread_once(&trace_state.once, trace_init);
+  TraceBuffer *b = trace_buffer_adopt();
+  if (b) {
+    pthread_setspecific(trace_state.key, b);
+    return trace_buffer = b;
+  }
+  // Headroom for the header and for OOM_COMMIT growing in whole commit chunks
+  isize size = TRACE_BUFFER_EVENTS * sizeof(TraceEvent) + MB(4);
+#ifdef OOM_COMMIT
+  Arena arena = arena_init(NULL, size);
+#else
+  byte *mem = malloc(size);
+  if (!mem) {
+    perror("trace_buffer_new malloc");
+    abort();
+  }
+  Arena arena = arena_init(mem, size);
+#endif
+  b = New(&arena, TraceBuffer);
+  b->owned = 1;
+  b->events = New(&arena, TraceEvent, TRACE_BUFFER_EVENTS, NO_INIT);
+  b->arena = arena;
+  arena_register(&b->arena, "trace");
+  b->tid = (int)syscall(SYS_gettid);
+  b->next = atomic_load_explicit(&trace_state.buffers, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&trace_state.buffers, &b->next, b, memory_order_release,
+                                                memory_order_relaxed)) {
+  }
+  pthread_setspecific(trace_state.key, b);
+  return trace_buffer = b;
+}
+
+static inline void trace_emit(int kind, const char *name, uint64_t tsc, int64_t value) {
+  _Static_assert(IsPow2(TRACE_BUFFER_EVENTS), "TRACE_BUFFER_EVENTS must be a power of 2");
+  TraceBuffer *b = trace_buffer;
+  if (ARENA_UNLIKELY(!b))
+    b = trace_buffer_new();
+  uint64_t h = atomic_load_explicit(&b->head, memory_order_relaxed);
+  b->events[h & (TRACE_BUFFER_EVENTS - 1)] = (TraceEvent){.tsc = tsc, .kind = kind, .name = name, .value = value};
+  atomic_store_explicit(&b->head, h + 1, memory_order_release);
+}
+
+// Label the calling thread's track in the export
+static inline void trace_thread_name(const char *name) {
+  TraceBuffer *b = trace_buffer;
+  if (!b)
+    b = trace_buffer_new();
+  b->thread_name = name;
+}
+
+typedef struct {
+  const char *name;
+  uint64_t tsc;
+} TraceScope;
+
+static inline void trace_scope_end(TraceScope *s) {
+  uint64_t now = trace_tsc();
+  trace_emit(TRACE_KIND_SCOPE, s->name, s->tsc, (int64_t)(now - s->tsc));
+}
+
+#ifdef TRACE
+/**
+ * Record the enclosing block as one span.
+ *
+ * Usage:
+ *   {
+ *     TRACE_SCOPE("parse");
+ *     parse(chunk);
+ *   }
+ */
+#define TRACE_SCOPE(name) \
+  __attribute__((__cleanup__(trace_scope_end))) TraceScope CONCAT(_trace_, __LINE__) = {(name), trace_tsc()}
+#define TRACE_INSTANT(name)       trace_emit(TRACE_KIND_INSTANT, (name), trace_tsc(), 0)
+#define TRACE_COUNTER(name, v)    trace_emit(TRACE_KIND_COUNTER, (name), trace_tsc(), (int64_t)(v))
+#define TRACE_THREAD_NAME(name)   trace_thread_name(name)
+#else
+#define TRACE_SCOPE(name)       ((void)0)
+#define TRACE_INSTANT(name)     ((void)0)
+#define TRACE_COUNTER(name, v)  ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+/* --- Export --- */
+
+// Ticks since the clock origin; records keep the low 56 bits of the counter
+static inline int64_t trace_ticks(const TraceEvent *e) {
+  uint64_t d = (e->tsc - trace_state.tsc0) << 8;
+  return (int64_t)d >> 8;  // A scope opened before the first buffer existed starts before the origin
+}
+
+static void trace_json_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+/**
+ * @brief Write every buffer as Chrome trace-event JSON.
+ * @param out Output stream
+ * @return Records written, thread names included
+ *
+ * Timestamps are microseconds since the earliest record.
+ */
+static int64_t trace_write_json(FILE *out) {
+  TraceBuffer *head = atomic_load_explicit(&trace_state.buffers, memory_order_acquire);
+  int pid = (int)getpid();
+  fputs("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [", out);
+  if (!head) {
+    fputs("]}\n", out);
+    return 0;
+  }
+
+  // Calibrate ticks against the monotonic clock over at least 10ms
+  int64_t ns1 = trace_now_ns();
+  if (ns1 - trace_state.ns0 < 10000000) {
+    struct timespec ts = {0, 10000000 - (ns1 - trace_state.ns0)};
+    nanosleep(&ts, NULL);
+  }
+  ns1 = trace_now_ns();
+  uint64_t tsc1 = trace_tsc();
+  double us_per_tick = (ns1 - trace_state.ns0) / 1e3 / (double)(tsc1 - trace_state.tsc0);
+
+  // The earliest record is time 0
+  int64_t first = 0;
+  for (TraceBuffer *b = head; b; b = b->next) {
+    uint64_t end = atomic_load_explicit(&b->head, memory_order_acquire);
+    for (uint64_t i = end > TRACE_BUFFER_EVENTS ? end - TRACE_BUFFER_EVENTS : 0; i < end; i++) {
+      first = Min(first, trace_ticks(&b->events[i & (TRACE_BUFFER_EVENTS - 1)]));
+    }
+  }
+
+  int64_t n = 0;
+  for (TraceBuffer *b = head; b; b = b->next) {
+    if (b->thread_name) {
+      fprintf(out, "%s\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ",
+              n++ ? "," : "", pid, b->tid);
+      trace_json_string(out, b->thread_name);
+      fputs("}}", out);
+    }
+    uint64_t end = atomic_load_explicit(&b->head, memory_order_acquire);
+    uint64_t begin = end > TRACE_BUFFER_EVENTS ? end - TRACE_BUFFER_EVENTS : 0;
+    for (uint64_t i = begin; i < end; i++) {
+      const TraceEvent *e = &b->events[i & (TRACE_BUFFER_EVENTS - 1)];
+      double ts = (trace_ticks(e) - first) * us_per_tick;
+      fprintf(out, "%s\n{\"name\": ", n++ ? "," : "");
+      trace_json_string(out, e->name);
+      switch (e->kind) {
+        case TRACE_KIND_SCOPE:
+          fprintf(out, ", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f", ts, e->value * us_per_tick);
+          break;
+        case TRACE_KIND_INSTANT:
+          fprintf(out, ", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f", ts);
+          break;
+        default:
+          fprintf(out, ", \"ph\": \"C\", \"ts\": %.3f, \"args\": {\"value\": %lld}", ts, (long long)e->value);
+          break;
+      }
+      fprintf(out, ", \"pid\": %d, \"tid\": %d}", pid, b->tid);
+    }
+  }
+  fputs("\n]}\n", out);
+  return n;
+}
+
+#endif  // TRACE_H_
@@ -0,0 +1,474 @@
+/**
+ * @file ubench.h
+ * @brief Micro-benchmarks registered like UTEST cases, run with ubench_main().
+ *
+ * A benchmark body does its setup, then times a UBENCH_LOOP. The harness
+ * calls the body repeatedly: first to calibrate the iteration count until
+ * one run lasts at least --min-time, then for warmup runs, then once per
+ * sample. Results report the median, median absolute deviation and minimum
+ * time per iteration, plus throughput when the body declares how many bytes
+ * or items one iteration processes. When perf counters are available
+ * (perfctr.h), UBENCH_LOOP is bracketed by counter snapshots and results add
+ * per-iteration cycles, instructions, IPC, cache, branch and page-fault misses.
+ *
+ * Usage:
+ *   UBENCH(arena, alloc_16) {
+ *     Arena a = arena_init(NULL, GB(1));
+ *     UBENCH_BYTES(ubench, 16);
+ *     UBENCH_LOOP(ubench) {
+ *       UBENCH_DO_NOT_OPTIMIZE(New(&a, char, 16));
+ *     }
+ *     arena_release(&a);
+ *   }
+ *
+ *   // once per program, next to UTEST_STATE()
+ *   UBENCH_STATE();
+ *   ...
+ *   return ubench_main(argc, argv);  // --filter=arena.* --format=json --output=out.json
+ *
+ * Code outside UBENCH_LOOP is not timed, so per-run setup can stay in the
+ * body. State that must survive between runs belongs in statics.
+ */
+
+#ifndef UBENCH_H_
+#define UBENCH_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "perfctr.h"
+#include "utest.h"  // utest_should_filter_test()
+
+// Default samples per benchmark
+#ifndef UBENCH_SAMPLES
+#define UBENCH_SAMPLES 15
+#endif
+
+// Default warmup runs (after calibration, not recorded)
+#ifndef UBENCH_WARMUP
+#define UBENCH_WARMUP 2
+#endif
+
+// Default minimum duration of one sample
+#ifndef UBENCH_MIN_TIME_NS
+#define UBENCH_MIN_TIME_NS 10000000
+#endif
+
+typedef struct UBench {
+  int64_t iters;       // Iterations UBENCH_LOOP runs this call
+  int64_t start_ns;    // Set when the loop starts
+  int64_t elapsed_ns;  // Set when the loop ends, -1 if it never ran
+  int64_t bytes;       // Bytes processed per iteration, for throughput
+  int64_t items;       // Items processed per iteration, for throughput
+  PerfCounters *perf;  // NULL when not counting
+  PerfSnapshot perf_start;
+  PerfValues perf_sum;  // Accumulated over UBENCH_LOOP runs
+} UBench;
+
+typedef void (*ubench_fn_t)(UBench *ubench);
+
+struct ubench_case_s {
+  ubench_fn_t func;
+  const char *name;
+};
+
+struct ubench_state_s {
+  struct ubench_case_s *benches;
+  size_t benches_length;
+};
+
+extern struct ubench_state_s ubench_state;
+
+// Define the registry; exactly once per program
+#define UBENCH_STATE() struct ubench_state_s ubench_state = {0}
+
+typedef struct {
+  int samples;            // Recorded runs, 0 for UBENCH_SAMPLES
+  int warmup;             // Discarded runs, 0 for UBENCH_WARMUP, < 0 for none
+  int64_t min_sample_ns;  // Minimum run duration, 0 for UBENCH_MIN_TIME_NS
+  PerfCounters *perf;     // Opened counters to sample around each loop, or NULL
+} UBenchOptions;
+
+typedef struct {
+  const char *name;
+  int64_t iters;  // Iterations per sample
+  int samples;
+  double median_ns, mad_ns, min_ns, mean_ns;  // Per iteration
+  double bytes_per_sec, items_per_sec;       // From the median, 0 if undeclared
+  uint32_t perf_mask;                         // Events present in perf
+  PerfValues perf;                            // Per iteration, averaged over samples
+} UBenchResult;
+
+static inline int64_t ubench_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Counter reads are syscalls, so they stay outside the timed interval
+static inline int64_t ubench_begin(UBench *ubench) {
+  if (ubench->perf)
+    ubench->perf_start = perf_snapshot(ubench->perf);
+  ubench->start_ns = ubench_ns();
+  return 0;
+}
+
+static inline void ubench_end(UBench *ubench) {
+  ubench->elapsed_ns = ubench_ns() - ubench->start_ns;
+  if (ubench->perf) {
+    PerfSnapshot end = perf_snapshot(ubench->perf);
+    perf_accumulate(ubench->perf, &ubench->perf_start, &end, &ubench->perf_sum);
+  }
+}
+
+/**
+ * Timed loop, runs ubench->iters times.
+ *
+ * Usage:
+ *   UBENCH_LOOP(ubench) { work(); }
+ */
+#define UBENCH_LOOP(ubench)                                                        \
+  for (int64_t _ubench_i = ubench_begin(ubench);                                   \
+       _ubench_i < (ubench)->iters || (ubench_end(ubench), 0); _ubench_i++)
+
+// Throughput: bytes or items processed by one loop iteration
+#define UBENCH_BYTES(ubench, n) ((ubench)->bytes = (int64_t)(n))
+#define UBENCH_ITEMS(ubench, n) ((ubench)->items = (int64_t)(n))
+
+/**
+ * Force a value to be computed and kept, without otherwise using it.
+ *
+ * Usage:
+ *   UBENCH_DO_NOT_OPTIMIZE(hash(key));
+ */
+#define UBENCH_DO_NOT_OPTIMIZE(x)                   \
+  do {                                              \
+    __auto_type _ubench_v = (x);                    \
+    __asm__ volatile("" : : "g"(&_ubench_v) : "memory"); \
+  } while (0)
+
+// Make the compiler assume all memory was read and written
+#define UBENCH_CLOBBER() __asm__ volatile("" : : : "memory")
+
+static inline void ubench_register(const char *name, ubench_fn_t func) {
+  struct ubench_state_s *s = &ubench_state;
+  s->benches = realloc(s->benches, (s->benches_length + 1) * sizeof(*s->benches));
+  if (!s->benches) {
+    perror("ubench_register realloc");
+    abort();
+  }
+  s->benches[s->benches_length++] = (struct ubench_case_s){func, name};
+}
+
+#define UBENCH(SET, NAME)                                                     \
+  static void ubench_run_##SET##_##NAME(UBench *ubench);                      \
+  __attribute__((constructor)) static void ubench_register_##SET##_##NAME(void) { \
+    ubench_register(#SET "." #NAME, ubench_run_##SET##_##NAME);              \
+  }                                                                           \
+  static void ubench_run_##SET##_##NAME(UBench *ubench)
+
+/* --- Measurement --- */
+
+static inline int ubench_cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static inline double ubench_median_sorted(const double *v, int n) {
+  return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/**
+ * @brief Summarize per-iteration sample times.
+ * @param ns Samples in nanoseconds per iteration (reordered)
+ * @param n Sample count (>= 1)
+ * @param r Receives median, MAD, min and mean
+ */
+static inline void ubench_stats(double *ns, int n, UBenchResult *r) {
+  double sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += ns[i];
+  }
+  qsort(ns, n, sizeof(double), ubench_cmp_double);
+  r->samples = n;
+  r->min_ns = ns[0];
+  r->mean_ns = sum / n;
+  r->median_ns = ubench_median_sorted(ns, n);
+  for (int i = 0; i < n; i++) {
+    ns[i] = fabs(ns[i] - r->median_ns);
+  }
+  qsort(ns, n, sizeof(double), ubench_cmp_double);
+  r->mad_ns = ubench_median_sorted(ns, n);
+}
+
+static inline void ubench_call(ubench_fn_t fn, UBench *ubench) {
+  ubench->elapsed_ns = -1;
+  fn(ubench);
+  if (ubench->elapsed_ns < 0) {
+    fputs("ubench: benchmark body has no UBENCH_LOOP\n", stderr);
+    abort();
+  }
+}
+
+/**
+ * @brief Calibrate, warm up and sample one benchmark.
+ * @param fn Benchmark body
+ * @param opts Options, zero for defaults
+ * @param r Receives the results (name is left to the caller)
+ */
+static inline void ubench_measure(ubench_fn_t fn, UBenchOptions opts, UBenchResult *r) {
+  if (opts.samples <= 0)
+    opts.samples = UBENCH_SAMPLES;
+  if (opts.warmup == 0)
+    opts.warmup = UBENCH_WARMUP;
+  if (opts.min_sample_ns <= 0)
+    opts.min_sample_ns = UBENCH_MIN_TIME_NS;
+
+  // Grow the iteration count until one run is long enough to time reliably
+  UBench b = {.iters = 1, .perf = opts.perf && opts.perf->mask ? opts.perf : NULL};
+  for (;;) {
+    ubench_call(fn, &b);
+    if (b.elapsed_ns >= opts.min_sample_ns || b.iters >= ((int64_t)1 << 40))
+      break;
+    double scale = b.elapsed_ns > 0 ? 1.2 * opts.min_sample_ns / b.elapsed_ns : 10;
+    int64_t next = (int64_t)(b.iters * (scale < 10 ? scale : 10));
+    b.iters = next > b.iters ? next : b.iters + 1;
+  }
+  for (int i = 0; i < opts.warmup; i++) {
+    ubench_call(fn, &b);
+  }
+
+  double *ns = malloc(opts.samples * sizeof(double));
+  if (!ns) {
+    perror("ubench_measure malloc");
+    abort();
+  }
+  b.perf_sum = (PerfValues){0};
+  for (int i = 0; i < opts.samples; i++) {
+    ubench_call(fn, &b);
+    ns[i] = (double)b.elapsed_ns / b.iters;
+  }
+  ubench_stats(ns, opts.samples, r);
+  free(ns);
+
+  r->iters = b.iters;
+  r->bytes_per_sec = b.bytes && r->median_ns > 0 ? b.bytes * 1e9 / r->median_ns : 0;
+  r->items_per_sec = b.items && r->median_ns > 0 ? b.items * 1e9 / r->median_ns : 0;
+  if (b.perf) {
+    r->perf_mask = b.perf->mask;
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+      r->perf.v[i] = b.perf_sum.v[i] / ((double)b.iters * opts.samples);
+    }
+  }
+}
+
+/* --- Reporting --- */
+
+typedef enum { UBENCH_TEXT, UBENCH_JSON, UBENCH_CSV } UBenchFormat;
+
+static inline void ubench_fmt_time(char *buf, size_t size, double ns) {
+  if (ns < 1e3)
+    snprintf(buf, size, "%.2fns", ns);
+  else if (ns < 1e6)
+    snprintf(buf, size, "%.2fus", ns / 1e3);
+  else if (ns < 1e9)
+    snprintf(buf, size, "%.2fms", ns / 1e6);
+  else
+    snprintf(buf, size, "%.2fs", ns / 1e9);
+}
+
+static inline void ubench_fmt_rate(char *buf, size_t size, const UBenchResult *r) {
+  if (r->bytes_per_sec >= 1e9)
+    snprintf(buf, size, "%.2f GB/s", r->bytes_per_sec / 1e9);
+  else if (r->bytes_per_sec > 0)
+    snprintf(buf, size, "%.2f MB/s", r->bytes_per_sec / 1e6);
+  else if (r->items_per_sec > 0)
+    snprintf(buf, size, "%.2f M/s", r->items_per_sec / 1e6);
+  else
+    snprintf(buf, size, "-");
+}
+
+static inline bool ubench_has(const UBenchResult *r, PerfEvent e) {
+  return r->perf_mask & (1u << e);
+}
+
+// Instructions per cycle, or NAN without both counters
+static inline double ubench_ipc(const UBenchResult *r) {
+  if (!ubench_has(r, PERF_CYCLES) || !ubench_has(r, PERF_INSTRUCTIONS) || r->perf.v[PERF_CYCLES] <= 0)
+    return NAN;
+  return r->perf.v[PERF_INSTRUCTIONS] / r->perf.v[PERF_CYCLES];
+}
+
+static inline void ubench_report_begin(FILE *out, UBenchFormat format) {
+  if (format == UBENCH_JSON) {
+    fputs("[", out);
+  } else if (format == UBENCH_CSV) {
+    fputs("name,iters,samples,median_ns,mad_ns,min_ns,mean_ns,bytes_per_sec,items_per_sec,ipc", out);
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+      fprintf(out, ",%s", perf_event_names[i]);
+    }
+    fputs("\n", out);
+  } else {
+    fprintf(out, "%-40s %12s %10s %10s %10s %14s  %s\n", "benchmark", "iters", "median", "+/-mad", "min",
+            "throughput", "counters/iter");
+  }
+}
+
+// Text column: "ipc 2.10 cycles 41.0 l1d_misses 0.02 ...", or "-"
+static inline void ubench_fmt_perf(char *buf, size_t size, const UBenchResult *r) {
+  int n = 0;
+  double ipc = ubench_ipc(r);
+  if (!isnan(ipc))
+    n += snprintf(buf, size, "ipc %.2f", ipc);
+  for (int i = 0; i < PERF_EVENT_COUNT && (size_t)n < size; i++) {
+    if (ubench_has(r, i))
+      n += snprintf(buf + n, size - n, "%s%s %.3g", n ? " " : "", perf_event_names[i], r->perf.v[i]);
+  }
+  if (!n)
+    snprintf(buf, size, "-");
+}
+
+static inline void ubench_report(FILE *out, UBenchFormat format, const UBenchResult *r, int index) {
+  double ipc = ubench_ipc(r);
+  if (format == UBENCH_JSON) {
+    fprintf(out,
+            "%s\n  {\"name\": \"%s\", \"iters\": %lld, \"samples\": %d, \"median_ns\": %.3f, "
+            "\"mad_ns\": %.3f, \"min_ns\": %.3f, \"mean_ns\": %.3f, \"bytes_per_sec\": %.0f, "
+            "\"items_per_sec\": %.0f",
+            index ? "," : "", r->name, (long long)r->iters, r->samples, r->median_ns, r->mad_ns, r->min_ns,
+            r->mean_ns, r->bytes_per_sec, r->items_per_sec);
+    // Per-iteration counters, only those that were measured
+    if (r->perf_mask) {
+      fputs(", \"perf\": {", out);
+      int n = 0;
+      if (!isnan(ipc))
+        fprintf(out, "\"ipc\": %.4f", ipc), n++;
+      for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+        if (ubench_has(r, i))
+          fprintf(out, "%s\"%s\": %.4f", n++ ? ", " : "", perf_event_names[i], r->perf.v[i]);
+      }
+      fputs("}", out);
+    }
+    fputs("}", out);
+  } else if (format == UBENCH_CSV) {
+    fprintf(out, "%s,%lld,%d,%.3f,%.3f,%.3f,%.3f,%.0f,%.0f,", r->name, (long long)r->iters, r->samples,
+            r->median_ns, r->mad_ns, r->min_ns, r->mean_ns, r->bytes_per_sec, r->items_per_sec);
+    if (!isnan(ipc))
+      fprintf(out, "%.4f", ipc);
+    // Empty fields for counters that were not measured
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+      if (ubench_has(r, i))
+        fprintf(out, ",%.4f", r->perf.v[i]);
+      else
+        fputs(",", out);
+    }
+    fputs("\n", out);
+  } else {
+    char median[32], mad[32], min[32], rate[32], perf[160];
+    ubench_fmt_time(median, sizeof(median), r->median_ns);
+    ubench_fmt_time(mad, sizeof(mad), r->mad_ns);
+    ubench_fmt_time(min, sizeof(min), r->min_ns);
+    ubench_fmt_rate(rate, sizeof(rate), r);
+    ubench_fmt_perf(perf, sizeof(perf), r);
+    fprintf(out, "%-40s %12lld %10s %10s %10s %14s  %s\n", r->name, (long long)r->iters, median, mad, min, rate,
+            perf);
+  }
+  fflush(out);
+}
+
+static inline void ubench_report_end(FILE *out, UBenchFormat format) {
+  if (format == UBENCH_JSON)
+    fputs("\n]\n", out);
+}
+
+/**
+ * @brief Run the registered benchmarks selected by the command line.
+ * @param argc Argument count (argv[0] is skipped)
+ * @param argv --filter=, --list, --samples=, --warmup=, --min-time=<ms>,
+ *             --format=text|json|csv, --output=<file>, --no-perf
+ * @return 0 on success, 1 on a bad option or unwritable output
+ */
+static inline int ubench_main(int argc, const char *const argv[]) {
+  const char *filter = NULL;
+  const char *output = NULL;
+  UBenchFormat format = UBENCH_TEXT;
+  UBenchOptions opts = {0};
+  bool use_perf = true;
+
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    if (!strncmp(a, "--filter=", 9)) {
+      filter = a + 9;
+    } else if (!strcmp(a, "--list")) {
+      for (size_t k = 0; k < ubench_state.benches_length; k++) {
+        printf("%s\n", ubench_state.benches[k].name);
+      }
+      return 0;
+    } else if (!strncmp(a, "--samples=", 10)) {
+      opts.samples = atoi(a + 10);
+    } else if (!strncmp(a, "--warmup=", 9)) {
+      opts.warmup = atoi(a + 9);
+      opts.warmup = opts.warmup ? opts.warmup : -1;
+    } else if (!strncmp(a, "--min-time=", 11)) {
+      opts.min_sample_ns = (int64_t)(atof(a + 11) * 1e6);
+    } else if (!strcmp(a, "--format=json")) {
+      format = UBENCH_JSON;
+    } else if (!strcmp(a, "--format=csv")) {
+      format = UBENCH_CSV;
+    } else if (!strcmp(a, "--format=text")) {
+      format = UBENCH_TEXT;
+    } else if (!strncmp(a, "--output=", 9)) {
+      output = a + 9;
+    } else if (!strcmp(a, "--no-perf")) {
+      use_perf = false;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--filter=<glob>] [--list] [--samples=N] [--warmup=N] [--min-time=<ms>]\n"
+              "       [--format=text|json|csv] [--output=<file>] [--no-perf]\n",
+              argv[0]);
+      return strcmp(a, "--help") != 0;
+    }
+  }
+
+  FILE *out = stdout;
+  if (output && !(out = fopen(output, "w"))) {
+    perror(output);
+    return 1;
+  }
+
+  // Counters are best effort: a locked-down or virtualized host still gets timings
+  PerfCounters perf;
+  if (use_perf) {
+    perf_open(&perf);
+    if (!(perf.mask & (1u << PERF_CYCLES)))
+      fprintf(stderr, "ubench: hardware counters unavailable: %s\n", perf_status(&perf));
+    opts.perf = &perf;
+  }
+
+  ubench_report_begin(out, format);
+  // Keep progress visible on the terminal while a file is being written
+  if (out != stdout)
+    ubench_report_begin(stdout, UBENCH_TEXT);
+  int ran = 0;
+  for (size_t k = 0; k < ubench_state.benches_length; k++) {
+    const struct ubench_case_s *c = &ubench_state.benches[k];
+    if (filter && utest_should_filter_test(filter, c->name))
+      continue;
+    UBenchResult r = {.name = c->name};
+    ubench_measure(c->func, opts, &r);
+    ubench_report(out, format, &r, ran++);
+    if (out != stdout)
+      ubench_report(stdout, UBENCH_TEXT, &r, 0);
+  }
+  ubench_report_end(out, format);
+  if (out != stdout)
+    fclose(out);
+  if (use_perf)
+    perf_close(&perf);
+  return 0;
+}
+
+#endif  // UBENCH_H_
@@ -0,0 +1,402 @@
+/**
+ * @file utest_jobs.h
+ * @brief `--jobs=N` for utest: run UTEST cases in forked worker processes.
+ *
+ * The parent forks N workers and hands out tests one at a time over pipes,
+ * so a slow test never holds back a fixed shard. A worker's stdout and stderr
+ * go to a memfd the parent prints only when the test fails, sanitizer
+ * reports included. A test that crashes or exits takes down only its worker:
+ * the parent records it as failed with the signal or exit status and forks a
+ * replacement for the tests still queued. Every worker starts from the
+ * parent's pre-test state, and the before_each hook can reset per-process
+ * state (the default arena) between the tests one worker runs.
+ *
+ * Console lines appear in completion order; the xunit file is written once
+ * all tests finish, in registration order and without timings, so it does
+ * not depend on the job count or on scheduling.
+ *
+ * Usage:
+ *   // instead of utest_main(argc, argv)
+ *   return utest_jobs_main(argc, argv, NULL);  // --jobs=8 --filter=arena.* --output=tests.xml
+ *
+ * Without --jobs, and for --help or --list-tests, utest_main() runs the tests
+ * in this process as before. --random-order applies only there.
+ */
+
+#ifndef UTEST_JOBS_H_
+#define UTEST_JOBS_H_
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "utest.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define UTEST_JOBS_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define UTEST_JOBS_ASAN
+#endif
+#endif
+#ifdef UTEST_JOBS_ASAN
+#include <sanitizer/asan_interface.h>
+#endif
+
+typedef struct {
+  int result;   // UTEST_TEST_PASSED, UTEST_TEST_FAILURE or UTEST_TEST_SKIPPED
+  bool died;    // The worker exited or was killed while running the test
+  int wstatus;  // waitpid() status when died
+  int64_t ns;
+} UTestJobResult;
+
+typedef struct {
+  const struct utest_test_state_s *tests;
+  size_t tests_length;
+  const char *filter;         // utest glob, or NULL for every test
+  int jobs;                   // Worker processes; 0 for one per online CPU
+  FILE *out;                  // Progress and summary; NULL for stdout
+  FILE *xml;                  // xunit report, or NULL
+  void (*before_each)(void);  // Called in the worker before each test, or NULL
+} UTestJobs;
+
+typedef struct {
+  pid_t pid;    // 0 once reaped
+  int cmd;      // Parent -> worker: test index
+  int res;      // Worker -> parent: UTestJobResult
+  int log;      // memfd with the worker's output for its current test
+  size_t test;  // Test running, SIZE_MAX when idle
+} UTestJobsWorker;
+
+// A test that poisons a stack buffer (arena_init() on a local array) leaves
+// the poison behind when it returns. Clear the stack below this frame so the
+// next test in the same worker does not trip over it.
+__attribute__((noinline)) static void utest_jobs_unpoison_stack(void) {
+#ifdef UTEST_JOBS_ASAN
+  pthread_attr_t attr;
+  void *lo;
+  size_t size;
+  if (pthread_getattr_np(pthread_self(), &attr))
+    return;
+  pthread_attr_getstack(&attr, &lo, &size);
+  pthread_attr_destroy(&attr);
+  char *frame = __builtin_frame_address(0);
+  ASAN_UNPOISON_MEMORY_REGION(lo, frame - (char *)lo);
+#endif
+}
+
+static inline void utest_jobs_worker(const UTestJobs *jobs, int cmd, int res, int log) {
+  // Reopen stdout in append mode, so truncating the log rewinds both streams,
+  // and as a fresh stream, since a used one ignores setvbuf(): a crash then
+  // loses at most a partial line
+  if (dup2(log, STDOUT_FILENO) < 0 || !freopen(NULL, "a", stdout) || dup2(STDOUT_FILENO, STDERR_FILENO) < 0)
+    _exit(127);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  size_t i;
+  while (read(cmd, &i, sizeof(i)) == sizeof(i)) {
+    const struct utest_test_state_s *t = &jobs->tests[i];
+    if (ftruncate(log, 0))
+      _exit(127);
+    utest_jobs_unpoison_stack();
+    if (jobs->before_each)
+      jobs->before_each();
+    UTestJobResult r = {.result = UTEST_TEST_PASSED};
+    int64_t ns = utest_ns();
+    errno = 0;
+    t->func(&r.result, t->index);
+    r.ns = utest_ns() - ns;
+    fflush(stdout);
+    fflush(stderr);
+    if (write(res, &r, sizeof(r)) != sizeof(r))
+      break;
+  }
+  // Skip atexit handlers and leak checks: they belong to the parent's run
+  _exit(0);
+}
+
+// Fork a worker into slot w; the child closes every other worker's pipes so
+// that closing a command pipe is seen as end of input
+static inline void utest_jobs_spawn(const UTestJobs *jobs, UTestJobsWorker *workers, int nworkers,
+                                    UTestJobsWorker *w) {
+  int cmd[2], res[2];
+  int log = memfd_create("utest_jobs", 0);
+  if (log < 0 || pipe(cmd) || pipe(res)) {
+    perror("utest_jobs_spawn");
+    abort();
+  }
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("utest_jobs_spawn fork");
+    abort();
+  }
+  if (pid == 0) {
+    for (int k = 0; k < nworkers; k++) {
+      if (workers[k].pid > 0 && &workers[k] != w) {
+        close(workers[k].cmd);
+        close(workers[k].res);
+        close(workers[k].log);
+      }
+    }
+    close(cmd[1]);
+    close(res[0]);
+    utest_jobs_worker(jobs, cmd[0], res[1], log);
+  }
+  close(cmd[0]);
+  close(res[1]);
+  *w = (UTestJobsWorker){.pid = pid, .cmd = cmd[1], .res = res[0], .log = log, .test = SIZE_MAX};
+}
+
+static inline int utest_jobs_wait(pid_t pid) {
+  int wstatus = 0;
+  while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {
+  }
+  return wstatus;
+}
+
+static inline void utest_jobs_close(UTestJobsWorker *w) {
+  close(w->cmd);
+  close(w->res);
+  close(w->log);
+  w->pid = 0;
+}
+
+static inline void utest_jobs_dump_log(FILE *out, int log) {
+  char buf[4096];
+  off_t off = 0;
+  ssize_t n;
+  while ((n = pread(log, buf, sizeof(buf), off)) > 0) {
+    fwrite(buf, 1, n, out);
+    off += n;
+  }
+}
+
+static inline void utest_jobs_why(char *buf, size_t size, const UTestJobResult *r) {
+  if (WIFSIGNALED(r->wstatus))
+    snprintf(buf, size, "killed by signal %d (%s)", WTERMSIG(r->wstatus), strsignal(WTERMSIG(r->wstatus)));
+  else
+    snprintf(buf, size, "exited with status %d", WEXITSTATUS(r->wstatus));
+}
+
+static inline void utest_jobs_report(FILE *out, const char *const *colours, const char *name,
+                                     const UTestJobResult *r, int log) {
+  enum { RESET, GREEN, RED, YELLOW };
+  if (r->result == UTEST_TEST_FAILURE) {
+    utest_jobs_dump_log(out, log);
+    if (r->died) {
+      char why[96];
+      utest_jobs_why(why, sizeof(why), r);
+      fprintf(out, "%s[  FAILED  ]%s %s (%s)\n", colours[RED], colours[RESET], name, why);
+    } else {
+      fprintf(out, "%s[  FAILED  ]%s %s (%lldns)\n", colours[RED], colours[RESET], name, (long long)r->ns);
+    }
+  } else if (r->result == UTEST_TEST_SKIPPED) {
+    fprintf(out, "%s[  SKIPPED ]%s %s (%lldns)\n", colours[YELLOW], colours[RESET], name, (long long)r->ns);
+  } else {
+    fprintf(out, "%s[       OK ]%s %s (%lldns)\n", colours[GREEN], colours[RESET], name, (long long)r->ns);
+  }
+  fflush(out);
+}
+
+static inline void utest_jobs_write_xml(FILE *xml, const UTestJobs *jobs, const size_t *order, size_t n,
+                                        const UTestJobResult *results, size_t failed, size_t skipped) {
+  fprintf(xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  fprintf(xml, "<testsuites tests=\"%zu\" name=\"All\">\n", n);
+  fprintf(xml, "<testsuite name=\"Tests\" tests=\"%zu\" failures=\"%zu\" skipped=\"%zu\">\n", n, failed, skipped);
+  for (size_t k = 0; k < n; k++) {
+    const UTestJobResult *r = &results[order[k]];
+    fprintf(xml, "<testcase name=\"%s\">", jobs->tests[order[k]].name);
+    if (r->result == UTEST_TEST_FAILURE && r->died) {
+      char why[96];
+      utest_jobs_why(why, sizeof(why), r);
+      fprintf(xml, "<failure message=\"%s\"/>", why);
+    } else if (r->result == UTEST_TEST_FAILURE) {
+      fprintf(xml, "<failure/>");
+    } else if (r->result == UTEST_TEST_SKIPPED) {
+      fprintf(xml, "<skipped/>");
+    }
+    fprintf(xml, "</testcase>\n");
+  }
+  fprintf(xml, "</testsuite>\n</testsuites>\n");
+}
+
+/**
+ * @brief Run the tests that pass jobs->filter across jobs->jobs worker processes.
+ * @param jobs Tests and options
+ * @return Failed test count
+ */
+static inline int utest_jobs_run(const UTestJobs *jobs) {
+  enum { RESET, GREEN, RED, YELLOW };
+  FILE *out = jobs->out ? jobs->out : stdout;
+  const char *colours[] = {"\033[0m", "\033[32m", "\033[31m", "\033[33m"};
+  if (!isatty(fileno(out))) {
+    for (size_t i = 0; i < sizeof(colours) / sizeof(colours[0]); i++) {
+      colours[i] = "";
+    }
+  }
+
+  // Selected tests, in registration order
+  size_t *order = calloc(jobs->tests_length + 1, sizeof(size_t));
+  UTestJobResult *results = calloc(jobs->tests_length + 1, sizeof(UTestJobResult));
+  size_t n = 0;
+  for (size_t i = 0; i < jobs->tests_length; i++) {
+    if (!utest_should_filter_test(jobs->filter, jobs->tests[i].name))
+      order[n++] = i;
+  }
+  long nworkers = jobs->jobs > 0 ? jobs->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+  nworkers = nworkers < (long)n ? nworkers : (long)n;
+  nworkers = nworkers > 0 ? nworkers : 1;
+
+  fprintf(out, "%s[==========]%s Running %zu test cases in %ld processes.\n", colours[GREEN], colours[RESET], n,
+          nworkers);
+
+  // A worker that dies between tests must not take the parent down with it
+  void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+  UTestJobsWorker *workers = calloc(nworkers, sizeof(UTestJobsWorker));
+  struct pollfd *fds = calloc(nworkers, sizeof(struct pollfd));
+  int *polled = calloc(nworkers, sizeof(int));
+  for (int k = 0; k < nworkers && n; k++) {
+    utest_jobs_spawn(jobs, workers, nworkers, &workers[k]);
+  }
+
+  size_t next = 0, done = 0;
+  while (done < n) {
+    int nfds = 0;
+    for (int k = 0; k < nworkers; k++) {
+      UTestJobsWorker *w = &workers[k];
+      if (!w->pid && next < n)
+        utest_jobs_spawn(jobs, workers, nworkers, w);
+      if (w->pid && w->test == SIZE_MAX && next < n) {
+        // EPIPE means the worker died; its result pipe reports that below
+        w->test = order[next++];
+        if (write(w->cmd, &w->test, sizeof(w->test)) < 0 && errno != EPIPE) {
+          perror("utest_jobs_run write");
+          abort();
+        }
+      }
+      if (w->pid && w->test != SIZE_MAX) {
+        fds[nfds] = (struct pollfd){.fd = w->res, .events = POLLIN};
+        polled[nfds++] = k;
+      }
+    }
+    if (poll(fds, nfds, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("utest_jobs_run poll");
+      abort();
+    }
+    for (int p = 0; p < nfds; p++) {
+      if (!fds[p].revents)
+        continue;
+      UTestJobsWorker *w = &workers[polled[p]];
+      UTestJobResult r;
+      bool died = read(w->res, &r, sizeof(r)) != sizeof(r);
+      if (died)
+        r = (UTestJobResult){.result = UTEST_TEST_FAILURE, .died = true, .wstatus = utest_jobs_wait(w->pid)};
+      results[w->test] = r;
+      utest_jobs_report(out, colours, jobs->tests[w->test].name, &r, w->log);
+      w->test = SIZE_MAX;
+      if (died)
+        utest_jobs_close(w);
+      done++;
+    }
+  }
+
+  // Closing a command pipe tells its worker to exit
+  for (int k = 0; k < nworkers; k++) {
+    if (workers[k].pid) {
+      pid_t pid = workers[k].pid;
+      utest_jobs_close(&workers[k]);
+      utest_jobs_wait(pid);
+    }
+  }
+  signal(SIGPIPE, sigpipe);
+
+  size_t failed = 0, skipped = 0;
+  for (size_t k = 0; k < n; k++) {
+    failed += results[order[k]].result == UTEST_TEST_FAILURE;
+    skipped += results[order[k]].result == UTEST_TEST_SKIPPED;
+  }
+  fprintf(out, "%s[==========]%s %zu test cases ran.\n", colours[GREEN], colours[RESET], n);
+  fprintf(out, "%s[  PASSED  ]%s %zu tests.\n", colours[GREEN], colours[RESET], n - failed - skipped);
+  if (skipped) {
+    fprintf(out, "%s[  SKIPPED ]%s %zu tests, listed below:\n", colours[YELLOW], colours[RESET], skipped);
+    for (size_t k = 0; k < n; k++) {
+      if (results[order[k]].result == UTEST_TEST_SKIPPED)
+        fprintf(out, "%s[  SKIPPED ]%s %s\n", colours[YELLOW], colours[RESET], jobs->tests[order[k]].name);
+    }
+  }
+  if (failed) {
+    fprintf(out, "%s[  FAILED  ]%s %zu tests, listed below:\n", colours[RED], colours[RESET], failed);
+    for (size_t k = 0; k < n; k++) {
+      if (results[order[k]].result == UTEST_TEST_FAILURE)
+        fprintf(out, "%s[  FAILED  ]%s %s\n", colours[RED], colours[RESET], jobs->tests[order[k]].name);
+    }
+  }
+  if (jobs->xml)
+    utest_jobs_write_xml(jobs->xml, jobs, order, n, results, failed, skipped);
+
+  free(polled);
+  free(fds);
+  free(workers);
+  free(results);
+  free(order);
+  return (int)failed;
+}
+
+/**
+ * @brief utest_main() with `--jobs=N`; N=0 uses one worker per online CPU.
+ * @param argc Argument count
+ * @param argv Arguments: --jobs, --filter and --output apply in parallel mode
+ * @param before_each Called in the worker before each test, or NULL
+ * @return Failed test count
+ */
+static inline int utest_jobs_main(int argc, const char *const argv[], void (*before_each)(void)) {
+  UTestJobs jobs = {
+      .tests = utest_state.tests,
+      .tests_length = utest_state.tests_length,
+      .jobs = -1,
+      .before_each = before_each,
+  };
+  const char *output = NULL;
+  bool serial = false;
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    if (!strncmp(a, "--jobs=", 7)) {
+      jobs.jobs = atoi(a + 7);
+    } else if (!strncmp(a, "--filter=", 9)) {
+      jobs.filter = a + 9;
+    } else if (!strncmp(a, "--output=", 9)) {
+      output = a + 9;
+    } else if (!strcmp(a, "--help") || !strcmp(a, "--list-tests")) {
+      serial = true;
+    }
+  }
+  if (serial || jobs.jobs < 0) {
+    int failed = utest_main(argc, argv);
+    for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "--help"))
+        printf("  --jobs=<n>              Run the tests in <n> forked processes (0: one per CPU).\n");
+    }
+    return failed;
+  }
+
+  if (output && !(jobs.xml = fopen(output, "w"))) {
+    perror(output);
+    return 1;
+  }
+  int failed = utest_jobs_run(&jobs);
+  if (jobs.xml)
+    fclose(jobs.xml);
+  return failed;
+}
+
+#endif  // UTEST_JOBS_H_
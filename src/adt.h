@@ -8,12 +8,18 @@
 #ifndef _CLANGD
 #include "datatype99.h"
 
+#define NAME   ExprIndex
+#define KEY_TY uintptr_t
+#define VAL_TY int32_t
+#include "verstable.h"
+
 #define EXPR(expr)       New(arena, Expr, 1, (Expr[]){expr})
 #define OP(lhs, op, rhs) EXPR(op(EXPR(lhs), EXPR(rhs)))
 
 datatype(
     Expr,
     (Const, double),
+    (Col, int),
     (Add, Expr *, Expr *),
     (Sub, Expr *, Expr *),
     (Mul, Expr *, Expr *),
@@ -21,20 +27,737 @@ datatype(
     (Mod, Expr *, Expr *)
 );
 
-static double eval(const Expr *expr) {
+// Evaluate expr for a single row; Col(i) reads columns[i][row]
+static double eval_row(const Expr *expr, const double *const *columns, isize row) {
   match(*expr) {
     of(Const, number) return *number;
-    of(Add, lhs, rhs) return eval(*lhs) + eval(*rhs);
-    of(Sub, lhs, rhs) return eval(*lhs) - eval(*rhs);
-    of(Mul, lhs, rhs) return eval(*lhs) * eval(*rhs);
-    of(Div, lhs, rhs) return eval(*lhs) / eval(*rhs);
-    of(Mod, lhs, rhs) return fmod(eval(*lhs), eval(*rhs));
+    of(Col, index) {
+      Assert(columns && "Col needs columns");
+      return columns[*index][row];
+    }
+    of(Add, lhs, rhs) return eval_row(*lhs, columns, row) + eval_row(*rhs, columns, row);
+    of(Sub, lhs, rhs) return eval_row(*lhs, columns, row) - eval_row(*rhs, columns, row);
+    of(Mul, lhs, rhs) return eval_row(*lhs, columns, row) * eval_row(*rhs, columns, row);
+    of(Div, lhs, rhs) return eval_row(*lhs, columns, row) / eval_row(*rhs, columns, row);
+    of(Mod, lhs, rhs) return fmod(eval_row(*lhs, columns, row), eval_row(*rhs, columns, row));
   }
 
   Assert("Invalid expr");
   return -1;
 }
 
+static double eval(const Expr *expr) {
+  return eval_row(expr, NULL, 0);
+}
+
+/* --- Columnar batch evaluation --- */
+
+// Rows per block: 8KB of doubles per temporary keeps every level of the tree in L1/L2
+#ifndef EXPR_BATCH_BLOCK
+#define EXPR_BATCH_BLOCK 1024
+#endif
+
+static void expr_eval_block(Arena *arena, const Expr *expr, const double *const *columns, isize off, isize n,
+                            double *out);
+
+// Operand for rows [off, off+n): columns are read in place, constants are broadcast,
+// anything else is evaluated into buf.
+static const double *expr_operand(Arena *arena, const Expr *expr, const double *const *columns, isize off,
+                                  isize n, double *buf, bool *is_const) {
+  *is_const = false;
+  if (MATCHES(*expr, Col)) {
+    return columns[expr->data.Col._0] + off;
+  }
+  if (MATCHES(*expr, Const)) {
+    *is_const = true;
+    return &expr->data.Const._0;
+  }
+  expr_eval_block(arena, expr, columns, off, n, buf);
+  return buf;
+}
+
+// Element-wise loops over contiguous doubles; all but fmod auto-vectorize
+#define EXPR_BATCH_LOOP(op, x, y)  \
+  for (isize i = 0; i < n; i++) {  \
+    out[i] = op(x, y);             \
+  }
+#define EXPR_BATCH_ADD(x, y) ((x) + (y))
+#define EXPR_BATCH_SUB(x, y) ((x) - (y))
+#define EXPR_BATCH_MUL(x, y) ((x) * (y))
+#define EXPR_BATCH_DIV(x, y) ((x) / (y))
+#define EXPR_BATCH_MOD(x, y) fmod(x, y)
+#define EXPR_BATCH_OP(op)              \
+  do {                                 \
+    if (lconst && rconst) {            \
+      double x = *a, y = *b;           \
+      EXPR_BATCH_LOOP(op, x, y);       \
+    } else if (lconst) {               \
+      double x = *a;                   \
+      EXPR_BATCH_LOOP(op, x, b[i]);    \
+    } else if (rconst) {               \
+      double y = *b;                   \
+      EXPR_BATCH_LOOP(op, a[i], y);    \
+    } else {                           \
+      EXPR_BATCH_LOOP(op, a[i], b[i]); \
+    }                                  \
+  } while (0)
+
+static void expr_eval_binop(Arena *arena, ExprTag tag, const Expr *lhs, const Expr *rhs,
+                            const double *const *columns, isize off, isize n, double *out) {
+  {
+    Scratch(arena);
+    bool lconst, rconst;
+    // The left operand can be computed straight into out; the right one needs a temporary
+    const double *a = expr_operand(arena, lhs, columns, off, n, out, &lconst);
+    double *tmp = MATCHES(*rhs, Col) || MATCHES(*rhs, Const) ? NULL : New(arena, double, n, NO_INIT);
+    const double *b = expr_operand(arena, rhs, columns, off, n, tmp, &rconst);
+
+    switch (tag) {
+      case AddTag: EXPR_BATCH_OP(EXPR_BATCH_ADD); break;
+      case SubTag: EXPR_BATCH_OP(EXPR_BATCH_SUB); break;
+      case MulTag: EXPR_BATCH_OP(EXPR_BATCH_MUL); break;
+      case DivTag: EXPR_BATCH_OP(EXPR_BATCH_DIV); break;
+      case ModTag: EXPR_BATCH_OP(EXPR_BATCH_MOD); break;
+      default: Assert(!"Invalid binop");
+    }
+  }
+}
+
+static void expr_eval_block(Arena *arena, const Expr *expr, const double *const *columns, isize off, isize n,
+                            double *out) {
+  match(*expr) {
+    of(Const, number) {
+      for (isize i = 0; i < n; i++) {
+        out[i] = *number;
+      }
+    }
+    of(Col, index) memcpy(out, columns[*index] + off, n * sizeof(double));
+    of(Add, lhs, rhs) expr_eval_binop(arena, AddTag, *lhs, *rhs, columns, off, n, out);
+    of(Sub, lhs, rhs) expr_eval_binop(arena, SubTag, *lhs, *rhs, columns, off, n, out);
+    of(Mul, lhs, rhs) expr_eval_binop(arena, MulTag, *lhs, *rhs, columns, off, n, out);
+    of(Div, lhs, rhs) expr_eval_binop(arena, DivTag, *lhs, *rhs, columns, off, n, out);
+    of(Mod, lhs, rhs) expr_eval_binop(arena, ModTag, *lhs, *rhs, columns, off, n, out);
+  }
+}
+
+/**
+ * Evaluate expr over n rows of columnar input.
+ *
+ * Each node is evaluated for a whole block of EXPR_BATCH_BLOCK rows at a
+ * time, so interpretation cost is paid per block instead of per row.
+ * Temporaries (one block per tree level) come from arena and are released
+ * before returning. out must not alias any column.
+ *
+ * Usage:
+ *   const double *columns[] = {price, qty};
+ *   Expr *e = OP(Col(0), Mul, Col(1));
+ *   expr_eval_batch(arena, e, columns, n, out);
+ */
+static void expr_eval_batch(Arena *arena, const Expr *expr, const double *const *columns, isize n, double *out) {
+  Assert(n >= 0);
+  for (isize off = 0; off < n; off += EXPR_BATCH_BLOCK) {
+    expr_eval_block(arena, expr, columns, off, Min(n - off, EXPR_BATCH_BLOCK), out + off);
+  }
+}
+
+/* --- Parsing --- */
+
+/**
+ * @brief Result of expr_parse().
+ *
+ * On failure expr is NULL, err describes the problem and err_pos is the
+ * byte offset in the input where it was detected.
+ */
+typedef struct {
+  Expr *expr;
+  const char *err;
+  isize err_pos;
+} ExprParse;
+
+typedef struct {
+  Arena *arena;
+  astr src;
+  isize pos;
+  int depth;
+  const char *err;
+  isize err_pos;
+} ExprParser;
+
+#ifndef EXPR_PARSE_MAX_DEPTH
+#define EXPR_PARSE_MAX_DEPTH 256
+#endif
+
+static Expr *expr_parse_fail(ExprParser *p, isize pos, const char *err) {
+  if (!p->err) {
+    p->err = err;
+    p->err_pos = pos;
+  }
+  return NULL;
+}
+
+// Skip whitespace and return the next byte without consuming it, or 0 at end of input
+static char expr_peek(ExprParser *p) {
+  while (p->pos < p->src.len && (unsigned char)p->src.data[p->pos] <= ' ')
+    p->pos++;
+  return p->pos < p->src.len ? p->src.data[p->pos] : 0;
+}
+
+static bool expr_isdigit(char c) {
+  return (unsigned)(c - '0') < 10;
+}
+
+/**
+ * Scan a decimal number in place.
+ *
+ * Mantissas of up to 19 digits with a small exponent are converted exactly
+ * with one multiply or divide by a power of ten (Clinger's fast path); the
+ * rare remainder is copied to a stack buffer for strtod.
+ */
+static bool expr_scan_number(ExprParser *p, double *out) {
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *s = p->src.data;
+  isize i = p->pos, end = p->src.len, start = i;
+  uint64_t mant = 0;
+  int digits = 0, exp10 = 0;
+
+  for (; i < end && expr_isdigit(s[i]); i++, digits++) {
+    if (digits < 19)
+      mant = mant * 10 + (s[i] - '0');
+    else
+      exp10++;
+  }
+  if (i < end && s[i] == '.') {
+    i++;
+    for (; i < end && expr_isdigit(s[i]); i++, digits++) {
+      if (digits < 19) {
+        mant = mant * 10 + (s[i] - '0');
+        exp10--;
+      }
+    }
+  }
+  if (digits == 0)
+    return false;
+
+  if (i < end && (s[i] | 0x20) == 'e') {
+    isize j = i + 1;
+    bool neg = j < end && s[j] == '-';
+    j += j < end && (s[j] == '-' || s[j] == '+');
+    if (j >= end || !expr_isdigit(s[j]))
+      return false;
+    int e = 0;
+    for (; j < end && expr_isdigit(s[j]); j++)
+      e = e < 10000 ? e * 10 + (s[j] - '0') : e;
+    exp10 += neg ? -e : e;
+    i = j;
+  }
+  p->pos = i;
+
+  if (digits <= 19 && mant <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+    *out = exp10 < 0 ? (double)mant / pow10[-exp10] : (double)mant * pow10[exp10];
+    return true;
+  }
+
+  char buf[128];
+  isize len = i - start;
+  if (len >= (isize)sizeof(buf))
+    return false;
+  memcpy(buf, s + start, len);
+  buf[len] = '\0';
+  *out = strtod(buf, NULL);
+  return true;
+}
+
+static Expr *expr_parse_binary(ExprParser *p, int min_prec);
+
+static Expr *expr_parse_prefix(ExprParser *p) {
+  Arena *arena = p->arena;
+  char c = expr_peek(p);
+  isize at = p->pos;
+
+  if (expr_isdigit(c) || c == '.') {
+    double number;
+    if (!expr_scan_number(p, &number))
+      return expr_parse_fail(p, at, "malformed number");
+    return EXPR(Const(number));
+  }
+
+  if (c == '$') {
+    p->pos++;
+    isize i = p->pos;
+    int index = 0;
+    for (; i < p->src.len && expr_isdigit(p->src.data[i]); i++) {
+      index = index * 10 + (p->src.data[i] - '0');
+      if (index > 1 << 24)
+        return expr_parse_fail(p, at, "column index out of range");
+    }
+    if (i == p->pos)
+      return expr_parse_fail(p, p->pos, "expected column index after '$'");
+    p->pos = i;
+    return EXPR(Col(index));
+  }
+
+  if (p->depth >= EXPR_PARSE_MAX_DEPTH)
+    return expr_parse_fail(p, at, "expression nested too deeply");
+
+  if (c == '(') {
+    p->pos++;
+    p->depth++;
+    Expr *inner = expr_parse_binary(p, 0);
+    p->depth--;
+    if (!inner)
+      return NULL;
+    if (expr_peek(p) != ')')
+      return expr_parse_fail(p, p->pos, "expected ')'");
+    p->pos++;
+    return inner;
+  }
+
+  if (c == '-' || c == '+') {
+    p->pos++;
+    p->depth++;
+    Expr *operand = expr_parse_prefix(p);
+    p->depth--;
+    if (!operand || c == '+')
+      return operand;
+    if (MATCHES(*operand, Const)) {
+      operand->data.Const._0 = -operand->data.Const._0;
+      return operand;
+    }
+    return OP(Const(-1), Mul, *operand);
+  }
+
+  return expr_parse_fail(p, at, c ? "expected operand" : "unexpected end of input");
+}
+
+// Binding power of an infix operator, or -1 if c is not one
+static int expr_infix_prec(char c) {
+  switch (c) {
+    case '+':
+    case '-': return 1;
+    case '*':
+    case '/':
+    case '%': return 2;
+    default: return -1;
+  }
+}
+
+// Precedence climbing: parse operators binding tighter than min_prec, left-associative
+static Expr *expr_parse_binary(ExprParser *p, int min_prec) {
+  Arena *arena = p->arena;
+  Expr *lhs = expr_parse_prefix(p);
+  if (!lhs)
+    return NULL;
+
+  for (;;) {
+    char op = expr_peek(p);
+    int prec = expr_infix_prec(op);
+    if (prec <= min_prec)
+      return lhs;
+    p->pos++;
+
+    Expr *rhs = expr_parse_binary(p, prec);
+    if (!rhs)
+      return NULL;
+
+    switch (op) {
+      case '+': lhs = EXPR(Add(lhs, rhs)); break;
+      case '-': lhs = EXPR(Sub(lhs, rhs)); break;
+      case '*': lhs = EXPR(Mul(lhs, rhs)); break;
+      case '/': lhs = EXPR(Div(lhs, rhs)); break;
+      case '%': lhs = EXPR(Mod(lhs, rhs)); break;
+    }
+  }
+}
+
+/**
+ * Parse an arithmetic formula into an arena-allocated Expr.
+ *
+ * Grammar: numbers (123, 1.5, .5, 2e-3), column references ($0, $1, ...),
+ * parentheses, unary +/-, and left-associative binary + - * / % with the
+ * usual precedence. The input is scanned in place; only Expr nodes are
+ * allocated. Nodes from a failed parse are left in the arena.
+ *
+ * Usage:
+ *   ExprParse r = expr_parse(arena, astr("($0 + 5) * 2"));
+ *   if (!r.expr)
+ *     fprintf(stderr, "%s at offset %td\n", r.err, r.err_pos);
+ */
+static ExprParse expr_parse(Arena *arena, astr src) {
+  ExprParser p = {.arena = arena, .src = src, .err_pos = -1};
+  Expr *e = expr_parse_binary(&p, 0);
+  if (e && expr_peek(&p)) {
+    e = expr_parse_fail(&p, p.pos, "unexpected trailing input");
+  }
+  return (ExprParse){.expr = p.err ? NULL : e, .err = p.err, .err_pos = p.err_pos};
+}
+
+/* --- Incremental evaluation --- */
+
+/**
+ * @brief One node of an ExprGraph.
+ *
+ * Cells are stored in post-order, so every child index is smaller than its
+ * parent's and index order is a topological order.
+ */
+typedef struct {
+  ExprTag tag;
+  union {
+    struct {
+      int32_t lhs, rhs;  // Child cells; lhs is the input index for Col
+    };
+    double number;  // Const
+  };
+  int32_t deps_beg, deps_end;  // Dependents are deps[deps_beg..deps_end)
+} ExprCell;
+
+/**
+ * @brief Expr DAG with cached node values for incremental recomputation.
+ *
+ * Shared subexpressions (the same Expr pointer reached twice) become a
+ * single cell. Col(i) cells read inputs[i]. All arrays live in the arena
+ * passed to expr_graph_build().
+ */
+typedef struct {
+  ExprCell *cells;
+  double *values;  // Last computed value of each cell
+  bool *queued;    // Cell is waiting in heap
+  isize len;
+
+  int32_t *deps;        // Reverse edges: parents of each cell
+  int32_t *input_deps;  // Col cells reading input i are input_deps[input_beg[i]..input_beg[i+1])
+  int32_t *input_beg;
+  double *inputs;
+  int ninputs;
+
+  int32_t *roots;
+  isize nroots;
+
+  int32_t *heap;  // Min-heap of queued cells, capacity len
+  isize heap_len;
+} ExprGraph;
+
+typedef slice(ExprCell) ExprCells;
+
+typedef struct {
+  Arena *arena;
+  ExprIndex index;
+  ExprCells cells;
+  int ninputs;
+} ExprGraphBuilder;
+
+// Assign post-order cell indices, deduplicating shared nodes by address
+static int32_t expr_graph_visit(ExprGraphBuilder *b, const Expr *e) {
+  ExprIndex_itr it = vt_get(&b->index, (uintptr_t)e);
+  if (!vt_is_end(it))
+    return it.data->val;
+
+  ExprCell cell = {.tag = e->tag};
+  match(*e) {
+    of(Const, number) cell.number = *number;
+    of(Col, index) {
+      Assert(*index >= 0 && *index < b->ninputs && "Col index out of range");
+      cell.lhs = *index;
+    }
+    otherwise {
+      // Every remaining variant is binary with the same layout
+      cell.lhs = expr_graph_visit(b, e->data.Add._0);
+      cell.rhs = expr_graph_visit(b, e->data.Add._1);
+    }
+  }
+
+  Assert(b->cells.len < INT32_MAX);
+  int32_t id = (int32_t)b->cells.len;
+  *Push(b->arena, &b->cells) = cell;
+  vt_insert(&b->index, (uintptr_t)e, id);
+  return id;
+}
+
+static bool expr_cell_is_leaf(const ExprCell *c) {
+  return c->tag == ConstTag || c->tag == ColTag;
+}
+
+static double expr_cell_eval(const ExprGraph *g, const ExprCell *c) {
+  const double *v = g->values;
+  switch (c->tag) {
+    case ConstTag: return c->number;
+    case ColTag: return g->inputs[c->lhs];
+    case AddTag: return v[c->lhs] + v[c->rhs];
+    case SubTag: return v[c->lhs] - v[c->rhs];
+    case MulTag: return v[c->lhs] * v[c->rhs];
+    case DivTag: return v[c->lhs] / v[c->rhs];
+    case ModTag: return fmod(v[c->lhs], v[c->rhs]);
+  }
+  Assert(!"Invalid expr");
+  return -1;
+}
+
+/**
+ * Build an incremental evaluation graph over one or more roots.
+ *
+ * Every cell is evaluated once here; afterwards expr_recompute() touches
+ * only cells downstream of changed inputs. inputs is copied.
+ *
+ * Usage:
+ *   const Expr *roots[] = {price, margin};
+ *   ExprGraph g = expr_graph_build(arena, roots, 2, inputs, ninputs);
+ *   expr_graph_set(&g, 3, 101.5);
+ *   expr_graph_set(&g, 7, 0.25);
+ *   expr_recompute(&g);
+ *   double price = expr_graph_root(&g, 0);
+ */
+static ExprGraph expr_graph_build(Arena *arena, const Expr *const *roots, isize nroots, const double *inputs,
+                                  int ninputs) {
+  ExprGraphBuilder b = {.arena = arena, .ninputs = ninputs};
+  vt_init(&b.index);
+
+  ExprGraph g = {.ninputs = ninputs, .nroots = nroots};
+  g.roots = New(arena, int32_t, nroots);
+  for (isize i = 0; i < nroots; i++) {
+    g.roots[i] = expr_graph_visit(&b, roots[i]);
+  }
+  vt_cleanup(&b.index);
+
+  isize n = g.len = b.cells.len;
+  g.cells = b.cells.data;
+  g.values = New(arena, double, n);
+  g.queued = New(arena, bool, n);
+  g.heap = New(arena, int32_t, n, NO_INIT);
+  g.inputs = New(arena, double, ninputs);
+  if (ninputs > 0)
+    memcpy(g.inputs, inputs, ninputs * sizeof(double));
+
+  // Reverse edges in CSR form: count, prefix-sum, fill
+  isize nedges = 0;
+  int32_t *count = New(arena, int32_t, n + 1);
+  g.input_beg = New(arena, int32_t, ninputs + 1);
+  for (isize i = 0; i < n; i++) {
+    ExprCell *c = &g.cells[i];
+    if (c->tag == ColTag) {
+      g.input_beg[c->lhs + 1]++;
+    } else if (!expr_cell_is_leaf(c)) {
+      count[c->lhs + 1]++;
+      count[c->rhs + 1]++;
+      nedges += 2;
+    }
+  }
+  for (isize i = 0; i < n; i++) {
+    g.cells[i].deps_beg = g.cells[i].deps_end = count[i];
+    count[i + 1] += count[i];
+  }
+  for (int i = 0; i < ninputs; i++) {
+    g.input_beg[i + 1] += g.input_beg[i];
+  }
+
+  g.deps = New(arena, int32_t, nedges, NO_INIT);
+  g.input_deps = New(arena, int32_t, g.input_beg[ninputs], NO_INIT);
+  int32_t *input_fill = New(arena, int32_t, ninputs + 1, g.input_beg);
+  for (isize i = 0; i < n; i++) {
+    ExprCell *c = &g.cells[i];
+    if (c->tag == ColTag) {
+      g.input_deps[input_fill[c->lhs]++] = (int32_t)i;
+    } else if (!expr_cell_is_leaf(c)) {
+      g.deps[g.cells[c->lhs].deps_end++] = (int32_t)i;
+      g.deps[g.cells[c->rhs].deps_end++] = (int32_t)i;
+    }
+  }
+
+  // Index order is topological, so one forward pass evaluates everything
+  for (isize i = 0; i < n; i++) {
+    g.values[i] = expr_cell_eval(&g, &g.cells[i]);
+  }
+  return g;
+}
+
+static void expr_graph_enqueue(ExprGraph *g, int32_t cell) {
+  if (g->queued[cell])
+    return;
+  g->queued[cell] = true;
+
+  int32_t *h = g->heap;
+  isize i = g->heap_len++;
+  for (; i > 0 && h[(i - 1) / 2] > cell; i = (i - 1) / 2) {
+    h[i] = h[(i - 1) / 2];
+  }
+  h[i] = cell;
+}
+
+static int32_t expr_graph_dequeue(ExprGraph *g) {
+  int32_t *h = g->heap;
+  int32_t top = h[0];
+  int32_t last = h[--g->heap_len];
+  isize n = g->heap_len, i = 0;
+  for (;;) {
+    isize child = 2 * i + 1;
+    if (child >= n)
+      break;
+    if (child + 1 < n && h[child + 1] < h[child])
+      child++;
+    if (h[child] >= last)
+      break;
+    h[i] = h[child];
+    i = child;
+  }
+  h[i] = last;
+  g->queued[top] = false;
+  return top;
+}
+
+/**
+ * @brief Change one input and mark the cells that read it dirty.
+ * @param g Graph
+ * @param input Input index (the i of Col(i))
+ * @param value New value
+ *
+ * Nothing is recomputed until expr_recompute(), so a batch of updates is
+ * propagated once.
+ */
+static void expr_graph_set(ExprGraph *g, int input, double value) {
+  Assert(input >= 0 && input < g->ninputs);
+  g->inputs[input] = value;
+  for (int32_t k = g->input_beg[input]; k < g->input_beg[input + 1]; k++) {
+    expr_graph_enqueue(g, g->input_deps[k]);
+  }
+}
+
+/**
+ * @brief Re-evaluate dirty cells in topological order.
+ * @param g Graph
+ * @return Number of cells evaluated
+ *
+ * Cells are popped lowest index first, which is a topological order, so
+ * every child is final before its parent runs. A cell whose value did not
+ * change does not dirty its dependents.
+ */
+static isize expr_recompute(ExprGraph *g) {
+  isize evaluated = 0;
+  while (g->heap_len > 0) {
+    int32_t i = expr_graph_dequeue(g);
+    ExprCell *c = &g->cells[i];
+    double v = expr_cell_eval(g, c);
+    evaluated++;
+    // Bitwise compare so NaN -> NaN is "unchanged" and 0.0 -> -0.0 is not
+    if (!memcmp(&v, &g->values[i], sizeof(v)))
+      continue;
+    g->values[i] = v;
+    for (int32_t k = c->deps_beg; k < c->deps_end; k++) {
+      expr_graph_enqueue(g, g->deps[k]);
+    }
+  }
+  return evaluated;
+}
+
+// @return Cached value of the i-th root passed to expr_graph_build()
+static double expr_graph_root(const ExprGraph *g, isize i) {
+  Assert(i >= 0 && i < g->nroots);
+  return g->values[g->roots[i]];
+}
+
+/* --- Compact layout --- */
+
+/**
+ * @brief 8-byte node of a flattened Expr.
+ *
+ * Nodes are stored in post-order, so a binary node's right operand is
+ * always the node just before it and only the left operand needs an index.
+ */
+typedef struct {
+  uint32_t tag;  // ExprTag
+  uint32_t arg;  // Binary: lhs node index; Const: index into consts; Col: column
+} ExprNode;
+
+/**
+ * @brief Expr stored as one post-order array of ExprNode plus a constant pool.
+ *
+ * The root is the last node. Evaluation is a single forward pass over
+ * nodes. Shared subexpressions of the source Expr are duplicated.
+ */
+typedef struct {
+  ExprNode *nodes;
+  isize len;
+  double *consts;
+  isize nconsts;
+} ExprFlat;
+
+static void expr_flat_count(const Expr *e, isize *nodes, isize *consts) {
+  ++*nodes;
+  if (MATCHES(*e, Const)) {
+    ++*consts;
+  } else if (!MATCHES(*e, Col)) {
+    expr_flat_count(e->data.Add._0, nodes, consts);
+    expr_flat_count(e->data.Add._1, nodes, consts);
+  }
+}
+
+// Emit e in post-order and return the index of its root
+static uint32_t expr_flat_emit(ExprFlat *f, const Expr *e) {
+  ExprNode node = {.tag = e->tag};
+  match(*e) {
+    of(Const, number) {
+      node.arg = (uint32_t)f->nconsts;
+      f->consts[f->nconsts++] = *number;
+    }
+    of(Col, index) node.arg = (uint32_t)*index;
+    otherwise {
+      node.arg = expr_flat_emit(f, e->data.Add._0);
+      expr_flat_emit(f, e->data.Add._1);
+    }
+  }
+  f->nodes[f->len] = node;
+  return (uint32_t)f->len++;
+}
+
+/**
+ * Convert a pointer-based Expr into the compact post-order layout.
+ *
+ * Usage:
+ *   ExprFlat f = expr_flatten(arena, expr_parse(arena, src).expr);
+ *   double v = expr_flat_eval(arena, f, columns, row);
+ */
+static ExprFlat expr_flatten(Arena *arena, const Expr *e) {
+  isize nodes = 0, consts = 0;
+  expr_flat_count(e, &nodes, &consts);
+  Assert(nodes <= UINT32_MAX);
+
+  ExprFlat f = {0};
+  f.nodes = New(arena, ExprNode, nodes, NO_INIT);
+  f.consts = consts ? New(arena, double, consts, NO_INIT) : NULL;
+  expr_flat_emit(&f, e);
+  return f;
+}
+
+/**
+ * @brief Evaluate a flattened Expr for one row.
+ * @param arena Scratch space for one double per node, released on return
+ * @param f Flattened expression
+ * @param columns Column arrays read by Col nodes (may be NULL if there are none)
+ * @param row Row index into columns
+ * @return Value of the root node
+ */
+static double expr_flat_eval(Arena *arena, ExprFlat f, const double *const *columns, isize row) {
+  {
+    Scratch(arena);
+    double *v = New(arena, double, f.len, NO_INIT);
+    for (isize i = 0; i < f.len; i++) {
+      ExprNode n = f.nodes[i];
+      switch ((ExprTag)n.tag) {
+        case ConstTag: v[i] = f.consts[n.arg]; break;
+        case ColTag:
+          Assert(columns && "Col needs columns");
+          v[i] = columns[n.arg][row];
+          break;
+        case AddTag: v[i] = v[n.arg] + v[i - 1]; break;
+        case SubTag: v[i] = v[n.arg] - v[i - 1]; break;
+        case MulTag: v[i] = v[n.arg] * v[i - 1]; break;
+        case DivTag: v[i] = v[n.arg] / v[i - 1]; break;
+        case ModTag: v[i] = fmod(v[n.arg], v[i - 1]); break;
+        default: Assert(!"Invalid expr");
+      }
+    }
+    return f.len ? v[f.len - 1] : 0;
+  }
+}
+
 static Expr *expr(Arena *arena) {
   return OP(*OP(*OP(Const(53),
                     Add,
@@ -54,4 +777,162 @@ UTEST(datatype99, adt) {
   ASSERT_EQ(0.0, eval(expr(&arena)));
 }
 
+UTEST(datatype99, eval_batch) {
+  enum { size = KB(128), n = 2 * EXPR_BATCH_BLOCK + 17 };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  double *x = New(arena, double, n);
+  double *y = New(arena, double, n);
+  for (int i = 0; i < n; i++) {
+    x[i] = i * 0.5;
+    y[i] = 1 + i % 7;
+  }
+  const double *columns[] = {x, y};
+
+  // ((x + 5) * y - x / y) % (y + 3)
+  Expr *e = OP(*OP(*OP(*OP(Col(0), Add, Const(5)), Mul, Col(1)),
+                   Sub,
+                   *OP(Col(0), Div, Col(1))),
+               Mod,
+               *OP(Col(1), Add, Const(3)));
+
+  double *out = New(arena, double, n);
+  byte *before = arena->cur;
+  expr_eval_batch(arena, e, columns, n, out);
+  ASSERT_EQ(arena->cur, before);
+  for (int i = 0; i < n; i++) {
+    ASSERT_EQ(out[i], eval_row(e, columns, i));
+  }
+
+  expr_eval_batch(arena, EXPR(Const(2.5)), columns, 3, out);
+  ASSERT_EQ(out[2], 2.5);
+}
+
+UTEST(datatype99, parse) {
+  enum { size = KB(8) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  ExprParse r = expr_parse(arena, astr("(53 + 5 - 10) % (3 + 5)"));
+  ASSERT_TRUE(r.expr != NULL);
+  ASSERT_EQ(r.err_pos, -1);
+  ASSERT_EQ(0.0, eval(r.expr));
+
+  ASSERT_EQ(7.0, eval(expr_parse(arena, astr("1 + 2 * 3")).expr));
+  ASSERT_EQ(-1.0, eval(expr_parse(arena, astr("1-1-1")).expr));
+  ASSERT_EQ(-4.0, eval(expr_parse(arena, astr(" -(1 + 1) * +2 ")).expr));
+  ASSERT_EQ(0.0125, eval(expr_parse(arena, astr("1.25e-2")).expr));
+  ASSERT_EQ(0.5, eval(expr_parse(arena, astr(".5")).expr));
+  ASSERT_EQ(12345678901234567890.0, eval(expr_parse(arena, astr("12345678901234567890")).expr));
+  ASSERT_EQ(1e300, eval(expr_parse(arena, astr("1e300")).expr));
+
+  // Parsing stops at the astr length, not at a NUL
+  ASSERT_EQ(12.0, eval(expr_parse(arena, (astr){"12+3", 2}).expr));
+
+  double x[] = {4}, y[] = {10};
+  const double *columns[] = {x, y};
+  r = expr_parse(arena, astr("$1 / $0 - 0.5"));
+  ASSERT_EQ(2.0, eval_row(r.expr, columns, 0));
+}
+
+UTEST(datatype99, parse_errors) {
+  enum { size = KB(8) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  ExprParse r = expr_parse(arena, astr("1 +"));
+  ASSERT_TRUE(r.expr == NULL);
+  ASSERT_EQ(r.err_pos, 3);
+  ASSERT_STREQ(r.err, "unexpected end of input");
+
+  r = expr_parse(arena, astr("2 * (3 + 4"));
+  ASSERT_EQ(r.err_pos, 10);
+  ASSERT_STREQ(r.err, "expected ')'");
+
+  r = expr_parse(arena, astr("1 2"));
+  ASSERT_EQ(r.err_pos, 2);
+  ASSERT_STREQ(r.err, "unexpected trailing input");
+
+  r = expr_parse(arena, astr("1 * $x"));
+  ASSERT_EQ(r.err_pos, 5);
+
+  r = expr_parse(arena, astr("3 + 1e+"));
+  ASSERT_EQ(r.err_pos, 4);
+  ASSERT_STREQ(r.err, "malformed number");
+
+  r = expr_parse(arena, astr("1 + * 2"));
+  ASSERT_EQ(r.err_pos, 4);
+  ASSERT_STREQ(r.err, "expected operand");
+
+  r = expr_parse(arena, astr(""));
+  ASSERT_EQ(r.err_pos, 0);
+}
+
+UTEST(datatype99, incremental) {
+  enum { size = KB(32) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  // shared = $0 * $1 feeds both roots; $2 only feeds the second
+  Expr *shared = OP(Col(0), Mul, Col(1));
+  Expr *a = EXPR(Add(shared, EXPR(Const(1))));
+  Expr *b = EXPR(Sub(shared, EXPR(Div(EXPR(Col(2)), EXPR(Const(4))))));
+  const Expr *roots[] = {a, b};
+  double inputs[] = {2, 3, 8};
+
+  ExprGraph g = expr_graph_build(arena, roots, Countof(roots), inputs, Countof(inputs));
+  ASSERT_EQ(g.len, 9);  // shared is one cell
+  ASSERT_EQ(expr_graph_root(&g, 0), 7.0);
+  ASSERT_EQ(expr_graph_root(&g, 1), 4.0);
+  ASSERT_EQ(expr_recompute(&g), 0);
+
+  // $2 touches Col, Div, Sub only
+  expr_graph_set(&g, 2, 16);
+  ASSERT_EQ(expr_recompute(&g), 3);
+  ASSERT_EQ(expr_graph_root(&g, 0), 7.0);
+  ASSERT_EQ(expr_graph_root(&g, 1), 2.0);
+
+  // Batch: both factors change, shared product is evaluated once
+  expr_graph_set(&g, 0, 5);
+  expr_graph_set(&g, 1, 10);
+  ASSERT_EQ(expr_recompute(&g), 5);
+  ASSERT_EQ(expr_graph_root(&g, 0), 51.0);
+  ASSERT_EQ(expr_graph_root(&g, 1), 46.0);
+
+  // Swapping factors leaves the product unchanged: propagation stops there
+  expr_graph_set(&g, 0, 10);
+  expr_graph_set(&g, 1, 5);
+  ASSERT_EQ(expr_recompute(&g), 3);
+  ASSERT_EQ(expr_graph_root(&g, 0), 51.0);
+
+  double row[] = {10, 5, 16};
+  const double *columns[] = {&row[0], &row[1], &row[2]};
+  ASSERT_EQ(expr_graph_root(&g, 1), eval_row(b, columns, 0));
+}
+
+UTEST(datatype99, flatten) {
+  enum { size = KB(16) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  ASSERT_EQ(sizeof(ExprNode), (size_t)8);
+
+  ExprFlat f = expr_flatten(arena, expr(arena));
+  ASSERT_EQ(f.len, 9);
+  ASSERT_EQ(f.nconsts, 5);
+  ASSERT_EQ(0.0, expr_flat_eval(arena, f, NULL, 0));
+
+  double x[] = {1.5, -2, 7}, y[] = {3, 0.25, -1};
+  const double *columns[] = {x, y};
+  Expr *e = expr_parse(arena, astr("($0 - 2) * $1 / (1 + $0 % 4) - -$1")).expr;
+  f = expr_flatten(arena, e);
+  ASSERT_EQ(f.nodes[f.len - 1].tag, (uint32_t)SubTag);
+  for (int row = 0; row < 3; row++) {
+    byte *before = arena->cur;
+    ASSERT_EQ(eval_row(e, columns, row), expr_flat_eval(arena, f, columns, row));
+    ASSERT_EQ(arena->cur, before);
+  }
+}
+
 #endif // _CLANGD
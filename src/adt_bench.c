@@ -0,0 +1,135 @@
+#include "arena.h"
+#include "bench.h"
+#include "object.h"
+#include "ubench.h"
+
+static inline void* vt_arena_malloc(size_t size, Arena** ctx) {
+  return arena_malloc(size, *ctx);
+}
+
+static inline void vt_arena_free(void* ptr, size_t size, Arena** ctx) {
+  arena_free(ptr, size, *ctx);
+}
+
+#define NAME      Map_astr_astr
+#define KEY_TY    astr
+#define VAL_TY    astr
+#define CTX_TY    Arena*
+#define CMPR_FN   astr_equals
+#define HASH_FN   astr_hash
+#define MALLOC_FN vt_arena_malloc
+#define FREE_FN   vt_arena_free
+#include "verstable.h"
+
+#define BGEN_NAME   bench_queue
+#define BGEN_TYPE   int
+#define BGEN_LESS   return a < b;
+#define BGEN_MALLOC return arena_malloc(size, udata);
+#define BGEN_FREE   arena_free(ptr, size, udata);
+#include "bgen.h"
+
+enum { NKEYS = 10000, NITEMS = 1000, NSHAPES = 1024 };
+
+static astr* map_keys(void) {
+  static astr* keys;
+  if (!keys)
+    keys = bench_keys(bench_arena(), NKEYS);
+  return keys;
+}
+
+// Build from empty each iteration, rehashes included
+UBENCH(map, insert_10k) {
+  astr* keys = map_keys();
+  Arena a = arena_init(NULL, GB(1));
+  Arena* arena = &a;
+  UBENCH_ITEMS(ubench, NKEYS);
+  UBENCH_LOOP(ubench) {
+    Map_astr_astr map;
+    vt_init_with_ctx(&map, arena);
+    for (int i = 0; i < NKEYS; i++) {
+      vt_insert(&map, keys[i], keys[NKEYS - 1 - i]);
+    }
+    UBENCH_DO_NOT_OPTIMIZE(vt_size(&map));
+    arena_reset(arena);
+  }
+  arena_release(&a);
+}
+
+// Every lookup hits, in an order unrelated to insertion
+UBENCH(map, get_hit) {
+  astr* keys = map_keys();
+  Arena a = arena_init(NULL, GB(1));
+  Arena* arena = &a;
+  Map_astr_astr map;
+  vt_init_with_ctx(&map, arena);
+  for (int i = 0; i < NKEYS; i++) {
+    vt_insert(&map, keys[i], keys[NKEYS - 1 - i]);
+  }
+  UBENCH_ITEMS(ubench, NKEYS);
+  UBENCH_LOOP(ubench) {
+    isize n = 0;
+    for (int i = NKEYS - 1; i >= 0; i--) {
+      Map_astr_astr_itr it = vt_get(&map, keys[i]);
+      if (!vt_is_end(it))
+        n += it.data->val.len;
+    }
+    UBENCH_DO_NOT_OPTIMIZE(n);
+  }
+  arena_release(&a);
+}
+
+// Fill with distinct shuffled ints, then drain in order
+UBENCH(bgen, queue_push_pop_1k) {
+  static int data[NITEMS];
+  uint64_t rng = BENCH_SEED;
+  for (int i = 0; i < NITEMS; i++) {
+    data[i] = i;
+  }
+  for (int i = NITEMS - 1; i > 0; i--) {
+    int j = (int)(bench_rand(&rng) % (uint64_t)(i + 1));
+    int t = data[i];
+    data[i] = data[j];
+    data[j] = t;
+  }
+  Arena a = arena_init(NULL, GB(1));
+  Arena* arena = &a;
+  UBENCH_ITEMS(ubench, 2 * NITEMS);
+  UBENCH_LOOP(ubench) {
+    struct bench_queue* q = 0;
+    for (int i = 0; i < NITEMS; i++) {
+      bench_queue_insert(&q, data[i], 0, arena);
+    }
+    int sum = 0;
+    while (bench_queue_count(&q, 0) > 0) {
+      int val = 0;
+      bench_queue_pop_front(&q, &val, arena);
+      sum += val;
+    }
+    UBENCH_DO_NOT_OPTIMIZE(sum);
+    arena_reset(arena);
+  }
+  arena_release(&a);
+}
+
+// Virtual calls over a random mix of rectangles and triangles
+UBENCH(ishape, perim_dispatch) {
+  static IShape* shapes;
+  if (!shapes) {
+    Arena* arena = bench_arena();
+    uint64_t rng = BENCH_SEED;
+    shapes = New(arena, IShape, NSHAPES);
+    for (int i = 0; i < NSHAPES; i++) {
+      uint64_t r = bench_rand(&rng);
+      shapes[i] = r & 1 ? newRectangle(arena, r >> 8 & 63, r >> 16 & 63)
+                        : newTriangle(arena, r >> 8 & 63, r >> 16 & 63, r >> 24 & 63);
+    }
+  }
+  UBENCH_ITEMS(ubench, NSHAPES);
+  UBENCH_LOOP(ubench) {
+    int sum = 0;
+    for (int i = 0; i < NSHAPES; i++) {
+      sum += VCALL(shapes[i], perim);
+    }
+    UBENCH_DO_NOT_OPTIMIZE(sum);
+  }
+}
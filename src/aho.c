@@ -0,0 +1,97 @@
+#include "aho.h"
+#include <ctype.h>
+
+typedef slice(int32_t) AhoInts;
+
+static inline byte aho_fold(byte c, bool ignore_case) {
+  return ignore_case ? (byte)tolower(c) : c;
+}
+
+// A new state with no transitions yet (-1) and no patterns
+static int32_t aho_add_state(Arena *arena, AhoInts *delta, AhoInts *first, int nclasses) {
+  for (int c = 0; c < nclasses; c++) {
+    *Push(arena, delta) = -1;
+  }
+  *Push(arena, first) = -1;
+  return (int32_t)first->len - 1;
+}
+
+Aho *aho_compile(Arena *arena, const astr *patterns, int n, AhoOptions opts) {
+  Aho *a = New(arena, Aho);
+  a->npatterns = n;
+  a->next = New(arena, int32_t, Max(n, 1), NO_INIT);
+
+  // Bytes in no pattern share column 0
+  a->nclasses = 1;
+  for (int i = 0; i < n; i++) {
+    for (isize j = 0; j < patterns[i].len; j++) {
+      byte c = aho_fold(patterns[i].data[j], opts.ignore_case);
+      if (!a->classes[c])
+        a->classes[c] = (byte)a->nclasses++;
+    }
+  }
+  for (int c = 0; opts.ignore_case && c < 256; c++) {
+    a->classes[c] = a->classes[aho_fold(c, true)];
+  }
+  int nclasses = a->nclasses;
+
+  // Trie: delta holds the trie edges, -1 where there is none
+  AhoInts delta = {0}, first = {0};
+  aho_add_state(arena, &delta, &first, nclasses);
+  for (int i = 0; i < n; i++) {
+    a->next[i] = -1;
+    if (!patterns[i].len)
+      continue;
+    int32_t s = 0;
+    for (isize j = 0; j < patterns[i].len; j++) {
+      isize edge = s * nclasses + a->classes[(byte)patterns[i].data[j]];
+      if (delta.data[edge] < 0) {
+        int32_t t = aho_add_state(arena, &delta, &first, nclasses);
+        delta.data[edge] = t;
+      }
+      s = delta.data[edge];
+    }
+    // Duplicates chain behind the first pattern of the state, in order
+    int32_t *tail = &first.data[s];
+    while (*tail >= 0)
+      tail = &a->next[*tail];
+    *tail = i;
+  }
+  a->nstates = (int)first.len;
+  a->delta = delta.data;
+  a->first = first.data;
+  a->dict = New(arena, int32_t, a->nstates, NO_INIT);
+
+  // Breadth first, so the fail state of every state is complete before it:
+  // missing edges follow the fail state's, and dict is the nearest fail
+  // state that ends a pattern
+  Arena tmp = *arena;
+  int32_t *fail = New(&tmp, int32_t, a->nstates);
+  int32_t *queue = New(&tmp, int32_t, a->nstates, NO_INIT);
+  isize head = 0, tail = 0;
+  queue[tail++] = 0;
+  a->dict[0] = -1;
+  while (head < tail) {
+    int32_t s = queue[head++];
+    int32_t *row = a->delta + (isize)s * nclasses;
+    const int32_t *fail_row = a->delta + (isize)fail[s] * nclasses;
+    for (int c = 0; c < nclasses; c++) {
+      int32_t t = row[c];
+      if (t < 0) {
+        row[c] = s ? fail_row[c] : 0;
+        continue;
+      }
+      int32_t f = s ? fail_row[c] : 0;
+      fail[t] = f;
+      a->dict[t] = a->first[f] >= 0 ? f : a->dict[f];
+      queue[tail++] = t;
+    }
+  }
+
+  // Complement transitions into states where a pattern ends
+  for (isize i = 0; i < (isize)a->nstates * nclasses; i++) {
+    if (aho_accepts(a, a->delta[i]))
+      a->delta[i] = ~a->delta[i];
+  }
+  return a;
+}
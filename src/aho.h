@@ -0,0 +1,108 @@
+/**
+ * @file aho.h
+ * @brief Aho-Corasick matcher: any number of fixed strings found in one pass.
+ *
+ * aho_compile() puts the patterns in a trie and completes it into a DFA,
+ * so scanning costs one table load per input byte however many patterns
+ * there are. The table has a column per byte class rather than per byte:
+ * all bytes that appear in no pattern share one column, which keeps tens
+ * of thousands of patterns within a few MB. Transitions into a state where
+ * a pattern ends are stored complemented, so the scan loop tests a sign
+ * bit instead of loading a second table.
+ *
+ * Usage:
+ *   astr patterns[] = {astr("he"), astr("she"), astr("hers")};
+ *   Aho *a = aho_compile(arena, patterns, 3, (AhoOptions){0});
+ *   int32_t state = 0;
+ *   for (isize pos = 0; pos < text.len;) {
+ *     pos += aho_find(a, astr_slice(text, pos, text.len), &state);
+ *     for (AhoMatch m = {state, -1}; aho_next_match(a, &m);)
+ *       printf("pattern %d ends at %zd\n", m.pattern, pos);
+ *   }
+ *
+ * Empty patterns are ignored. The Aho is read-only once compiled and can
+ * be shared between threads, each with its own state.
+ */
+
+#ifndef AHO_H_
+#define AHO_H_
+
+#include "arena.h"
+
+typedef struct {
+  bool ignore_case;  // ASCII letters match either case
+} AhoOptions;
+
+typedef struct {
+  byte classes[256];  // Column of each byte
+  int nclasses;
+  int nstates;     // State 0 is the start
+  int32_t *delta;  // nstates x nclasses; ~next for a state where a pattern ends
+  int32_t *first;  // Per state: a pattern that ends there, or -1
+  int32_t *dict;   // Per state: the longest suffix state that ends a pattern, or -1
+  int32_t *next;   // Per pattern: the next pattern with the same text, or -1
+  int npatterns;
+} Aho;
+
+/**
+ * @brief Compile patterns into a DFA.
+ * @param arena Arena for the matcher and its build
+ * @param patterns Patterns; ids are their indexes
+ * @param n Pattern count
+ * @param opts Options, zero for defaults
+ * @return Matcher, valid as long as the arena
+ */
+Aho *aho_compile(Arena *arena, const astr *patterns, int n, AhoOptions opts);
+
+/**
+ * @brief Scan until a pattern ends.
+ * @param a Matcher
+ * @param text Bytes to scan
+ * @param state In: the state before text, 0 to start; out: the state after the scanned bytes
+ * @return Bytes scanned: just past the end of a pattern, or text.len if none ended
+ */
+static inline isize aho_find(const Aho *a, astr text, int32_t *state) {
+  const byte *p = (const byte *)text.data;
+  const int32_t *delta = a->delta;
+  const isize nclasses = a->nclasses;
+  int32_t s = *state;
+  for (isize i = 0; i < text.len; i++) {
+    int32_t next = delta[s * nclasses + a->classes[p[i]]];
+    if (ARENA_UNLIKELY(next < 0)) {
+      *state = ~next;
+      return i + 1;
+    }
+    s = next;
+  }
+  *state = s;
+  return text.len;
+}
+
+// @return Whether a pattern ends in state
+static inline bool aho_accepts(const Aho *a, int32_t state) {
+  return a->first[state] >= 0 || a->dict[state] >= 0;
+}
+
+// Position in the list of patterns that end in a state
+typedef struct {
+  int32_t state;
+  int32_t pattern;  // -1 before the first
+} AhoMatch;
+
+/**
+ * @brief Step to the next pattern that ends in m->state, longest first.
+ * @return false when there are no more
+ */
+static inline bool aho_next_match(const Aho *a, AhoMatch *m) {
+  if (m->pattern >= 0 && a->next[m->pattern] >= 0) {
+    m->pattern = a->next[m->pattern];
+    return true;
+  }
+  int32_t s = m->pattern < 0 && a->first[m->state] >= 0 ? m->state : a->dict[m->state];
+  if (s < 0)
+    return false;
+  *m = (AhoMatch){s, a->first[s]};
+  return true;
+}
+
+#endif  // AHO_H_
@@ -0,0 +1,50 @@
+#include "aho.h"
+#include "utest.h"
+
+// Every match in text as "pattern@end " pairs
+static astr aho_all(Arena* arena, const Aho* a, astr text) {
+  astr out = astr_clone(arena, astr(""));
+  int32_t state = 0;
+  for (isize pos = 0; pos < text.len;) {
+    pos += aho_find(a, astr_slice(text, pos, text.len), &state);
+    for (AhoMatch m = {state, -1}; aho_next_match(a, &m);) {
+      out = astr_concat(arena, out, astr_format(arena, "%d@%zd ", m.pattern, pos));
+    }
+  }
+  return out;
+}
+
+UTEST(aho, overlapping_patterns) {
+  Arena arena[] = {arena_init(NULL, MB(1))};
+  astr patterns[] = {astr("he"), astr("she"), astr("his"), astr("hers")};
+  Aho* a = aho_compile(arena, patterns, Countof(patterns), (AhoOptions){0});
+  ASSERT_EQ(a->nstates, 10);
+  // "she" and its suffix "he" both end at 4, longest first
+  ASSERT_TRUE(astr_equals(aho_all(arena, a, astr("ushers")), astr("1@4 0@4 3@6 ")));
+  ASSERT_TRUE(astr_equals(aho_all(arena, a, astr("hishe")), astr("2@3 1@5 0@5 ")));
+  ASSERT_TRUE(astr_equals(aho_all(arena, a, astr("HERS xyz")), astr("")));
+  arena_release(arena);
+}
+
+UTEST(aho, ignore_case) {
+  Arena arena[] = {arena_init(NULL, MB(1))};
+  astr patterns[] = {astr("GeT"), astr("/api")};
+  Aho* a = aho_compile(arena, patterns, Countof(patterns), (AhoOptions){.ignore_case = true});
+  ASSERT_TRUE(astr_equals(aho_all(arena, a, astr("get /API/x")), astr("0@3 1@8 ")));
+  Aho* exact = aho_compile(arena, patterns, Countof(patterns), (AhoOptions){0});
+  ASSERT_TRUE(astr_equals(aho_all(arena, exact, astr("get /API/x GeT")), astr("0@14 ")));
+  arena_release(arena);
+}
+
+UTEST(aho, duplicates_and_empty_patterns) {
+  Arena arena[] = {arena_init(NULL, MB(1))};
+  astr patterns[] = {astr("ab"), astr(""), astr("b"), astr("ab")};
+  Aho* a = aho_compile(arena, patterns, Countof(patterns), (AhoOptions){0});
+  ASSERT_TRUE(astr_equals(aho_all(arena, a, astr("xabab")), astr("0@3 3@3 2@3 0@5 3@5 2@5 ")));
+  Aho* none = aho_compile(arena, patterns + 1, 1, (AhoOptions){0});
+  ASSERT_EQ(none->nstates, 1);
+  int32_t state = 0;
+  ASSERT_EQ(aho_find(none, astr("abc"), &state), 3);
+  ASSERT_FALSE(aho_accepts(none, state));
+  arena_release(arena);
+}
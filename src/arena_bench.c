@@ -0,0 +1,192 @@
+#include "arena.h"
+#include "bench.h"
+#include "json.h"
+#include "ubench.h"
+
+typedef slice(int64_t) i64s;
+
+UBENCH(arena, alloc_16) {
+  Arena a = arena_init(NULL, GB(1));
+  UBENCH_BYTES(ubench, 16);
+  UBENCH_LOOP(ubench) {
+    UBENCH_DO_NOT_OPTIMIZE(New(&a, char, 16, NO_INIT));
+  }
+  arena_release(&a);
+}
+
+UBENCH(malloc, alloc_16) {
+  UBENCH_BYTES(ubench, 16);
+  UBENCH_LOOP(ubench) {
+    void *p = malloc(16);
+    UBENCH_DO_NOT_OPTIMIZE(p);
+    free(p);
+  }
+}
+
+enum { BATCH = 1000 };
+
+// Allocate a batch of small objects, then drop them all
+UBENCH(arena, alloc_batch_1k) {
+  Arena a = arena_init(NULL, GB(1));
+  UBENCH_ITEMS(ubench, BATCH);
+  UBENCH_LOOP(ubench) {
+    for (int i = 0; i < BATCH; i++) {
+      UBENCH_DO_NOT_OPTIMIZE(New(&a, char, 16 + i % 48, NO_INIT));
+    }
+    arena_reset(&a);
+  }
+  arena_release(&a);
+}
+
+UBENCH(malloc, alloc_batch_1k) {
+  static void *ptrs[BATCH];
+  UBENCH_ITEMS(ubench, BATCH);
+  UBENCH_LOOP(ubench) {
+    for (int i = 0; i < BATCH; i++) {
+      ptrs[i] = malloc(16 + i % 48);
+      UBENCH_DO_NOT_OPTIMIZE(ptrs[i]);
+    }
+    for (int i = 0; i < BATCH; i++) {
+      free(ptrs[i]);
+    }
+  }
+}
+
+// Grow one slice from empty, in place at the arena tip
+UBENCH(slice, push_1k) {
+  Arena a = arena_init(NULL, GB(1));
+  UBENCH_ITEMS(ubench, BATCH);
+  UBENCH_LOOP(ubench) {
+    i64s s = {0};
+    for (int i = 0; i < BATCH; i++) {
+      *Push(&a, &s) = i;
+    }
+    UBENCH_DO_NOT_OPTIMIZE(s.data);
+    arena_reset(&a);
+  }
+  arena_release(&a);
+}
+
+// Two slices growing alternately, so every growth after the first moves one
+UBENCH(slice, push_1k_interleaved) {
+  Arena a = arena_init(NULL, GB(1));
+  UBENCH_ITEMS(ubench, 2 * BATCH);
+  UBENCH_LOOP(ubench) {
+    i64s x = {0}, y = {0};
+    for (int i = 0; i < BATCH; i++) {
+      *Push(&a, &x) = i;
+      *Push(&a, &y) = i;
+    }
+    UBENCH_DO_NOT_OPTIMIZE(x.data);
+    UBENCH_DO_NOT_OPTIMIZE(y.data);
+    arena_reset(&a);
+  }
+  arena_release(&a);
+}
+
+UBENCH(astr, split_csv) {
+  // Static and clobbered each iteration, so the loop body cannot be hoisted
+  static astr line = {"2024-01-01,alpha,42,3.14,true,some longer text field,,last", 58};
+  UBENCH_BYTES(ubench, line.len);
+  UBENCH_LOOP(ubench) {
+    isize n = 0;
+    for (astr_split(it, ",", line)) {
+      n += it.token.len;
+    }
+    UBENCH_DO_NOT_OPTIMIZE(n);
+    UBENCH_CLOBBER();
+  }
+}
+
+// Lines, then fields, over a generated 10k-row file
+UBENCH(astr, split_csv_file) {
+  static astr csv;
+  if (!csv.data)
+    csv = bench_csv(bench_arena(), 10000);
+  UBENCH_BYTES(ubench, csv.len);
+  UBENCH_LOOP(ubench) {
+    isize n = 0;
+    for (astr_split(line, "\n", csv)) {
+      for (astr_split(it, ",", line.token)) {
+        n += it.token.len;
+      }
+    }
+    UBENCH_DO_NOT_OPTIMIZE(n);
+  }
+}
+
+UBENCH(astr, split_by_char_file) {
+  static astr csv;
+  if (!csv.data)
+    csv = bench_csv(bench_arena(), 10000);
+  UBENCH_BYTES(ubench, csv.len);
+  UBENCH_LOOP(ubench) {
+    isize n = 0;
+    for (astr_split_by_char(it, ",\n ", csv)) {
+      n += it.token.len;
+    }
+    UBENCH_DO_NOT_OPTIMIZE(n);
+  }
+}
+
+UBENCH(astr, hash) {
+  static astr key = {"user:1234567:session", 20};
+  UBENCH_BYTES(ubench, key.len);
+  UBENCH_LOOP(ubench) {
+    UBENCH_DO_NOT_OPTIMIZE(astr_hash(key));
+    UBENCH_CLOBBER();
+  }
+}
+
+UBENCH(astr, hash_keys) {
+  enum { NKEYS = 4096 };
+  static astr *keys;
+  static isize bytes;
+  if (!keys) {
+    keys = bench_keys(bench_arena(), NKEYS);
+    for (int i = 0; i < NKEYS; i++) {
+      bytes += keys[i].len;
+    }
+  }
+  UBENCH_BYTES(ubench, bytes);
+  UBENCH_ITEMS(ubench, NKEYS);
+  UBENCH_LOOP(ubench) {
+    uint64_t h = 0;
+    for (int i = 0; i < NKEYS; i++) {
+      h ^= astr_hash(keys[i]);
+    }
+    UBENCH_DO_NOT_OPTIMIZE(h);
+  }
+}
+
+UBENCH(json, get_path) {
+  static const char doc[] = "{\"name\":{\"first\":\"Janet\",\"last\":\"Prichard\"},\"age\":47,\"tags\":[1,2,3]}";
+  UBENCH_BYTES(ubench, sizeof(doc) - 1);
+  UBENCH_LOOP(ubench) {
+    UBENCH_DO_NOT_OPTIMIZE(json_int64(json_get(doc, "age")));
+  }
+}
+
+static astr bench_json_doc(void) {
+  static astr doc;
+  if (!doc.data)
+    doc = bench_json(bench_arena(), 2000);
+  return doc;
+}
+
+UBENCH(json, validn) {
+  astr doc = bench_json_doc();
+  UBENCH_BYTES(ubench, doc.len);
+  UBENCH_LOOP(ubench) {
+    UBENCH_DO_NOT_OPTIMIZE(json_validn(doc.data, doc.len));
+  }
+}
+
+// A path whose value sits near the end of a 2000-item document
+UBENCH(json, get_path_large) {
+  astr doc = bench_json_doc();
+  UBENCH_BYTES(ubench, doc.len);
+  UBENCH_LOOP(ubench) {
+    UBENCH_DO_NOT_OPTIMIZE(json_int64(json_get(doc.data, "items.1990.score")));
+  }
+}
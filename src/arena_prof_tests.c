@@ -0,0 +1,130 @@
+// Profiling is per translation unit, so this file opts in whatever the build mode
+#ifndef ARENA_PROFILE
+#define ARENA_PROFILE
+#endif
+#include <pthread.h>
+#include "arena.h"
+#include "utest.h"
+
+typedef slice(int64_t) i64s;
+
+static const ArenaProfEntry *prof_find(ArenaProfile p, int line) {
+  for (isize i = 0; i < p.len; i++) {
+    const ArenaProfEntry *e = &p.entries[i];
+    if (e->site && e->site->line == line && !strcmp(e->site->file, __FILE__))
+      return e;
+  }
+  return NULL;
+}
+
+UTEST(arena_prof, sites_and_diff) {
+  enum { size = KB(64) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+  byte mem2[size] = {0};
+  Arena prof[] = {arena_init(mem2, size)};
+
+  ArenaProfile before = arena_prof_snapshot(prof);
+  int line_new = __LINE__ + 2;
+  for (int i = 0; i < 3; i++) {
+    New(arena, int32_t, 10);
+  }
+  i64s s = {0};
+  int line_push = __LINE__ + 2;
+  for (int i = 0; i < 100; i++) {
+    *Push(arena, &s) = i;
+  }
+  int line_format = __LINE__ + 1;
+  astr f = astr_format(arena, "%d-%s", 42, "abc");
+  int line_clone = __LINE__ + 1;
+  i64s c = Clone(arena, s);  // Clone's own New is charged here, not inside the macro
+  ArenaProfile diff = arena_prof_diff(prof, before, arena_prof_snapshot(prof));
+
+  const ArenaProfEntry *e = prof_find(diff, line_new);
+  ASSERT_TRUE(e != NULL);
+  ASSERT_EQ(e->count, 3);
+  ASSERT_EQ(e->bytes, 3 * 10 * 4);
+  ASSERT_TRUE(strstr(e->site->func, "sites_and_diff") != NULL);
+
+  e = prof_find(diff, line_push);
+  ASSERT_TRUE(e != NULL);
+  ASSERT_GE(e->bytes, (int64_t)sizeof(int64_t) * s.len);
+  ASSERT_LT(e->count, 100);  // Growth allocations only
+
+  e = prof_find(diff, line_format);
+  ASSERT_TRUE(e != NULL);
+  ASSERT_EQ(e->bytes, f.len + 1);
+
+  e = prof_find(diff, line_clone);
+  ASSERT_TRUE(e != NULL);
+  ASSERT_EQ(e->bytes, (int64_t)sizeof(int64_t) * c.len);
+
+  // Sorted by bytes, totals add up
+  int64_t bytes = 0;
+  for (isize i = 0; i < diff.len; i++) {
+    ASSERT_TRUE(i == 0 || diff.entries[i - 1].bytes >= diff.entries[i].bytes);
+    bytes += diff.entries[i].bytes;
+  }
+  ASSERT_EQ(bytes, diff.bytes);
+
+  // Nothing allocated in between: the diff holds only the snapshot's own entries
+  ArenaProfile a = arena_prof_snapshot(prof);
+  ArenaProfile none = arena_prof_diff(prof, a, arena_prof_snapshot(prof));
+  ASSERT_TRUE(!prof_find(none, line_new) && !prof_find(none, line_push));
+}
+
+enum { PROF_THREADS = 4, PROF_PER_THREAD = 1000 };
+static int prof_thread_line;
+
+static void *prof_thread(void *arg) {
+  byte mem[KB(32)];
+  Arena arena[] = {arena_init(mem, sizeof(mem))};
+  prof_thread_line = __LINE__ + 2;
+  for (int i = 0; i < PROF_PER_THREAD; i++) {
+    New(arena, char, 8);
+  }
+  return NULL;
+}
+
+UTEST(arena_prof, threads_merge_and_export) {
+  enum { size = KB(256) };
+  byte mem[size] = {0};
+  Arena prof[] = {arena_init(mem, size)};
+
+  ArenaProfile before = arena_prof_snapshot(prof);
+  // Two rounds: the second round's threads adopt the tables the first left
+  for (int round = 0; round < 2; round++) {
+    pthread_t t[PROF_THREADS];
+    for (int i = 0; i < PROF_THREADS; i++) {
+      pthread_create(&t[i], NULL, prof_thread, NULL);
+    }
+    for (int i = 0; i < PROF_THREADS; i++) {
+      pthread_join(t[i], NULL);
+    }
+  }
+  ArenaProfile diff = arena_prof_diff(prof, before, arena_prof_snapshot(prof));
+  const ArenaProfEntry *e = prof_find(diff, prof_thread_line);
+  ASSERT_TRUE(e != NULL);
+  ASSERT_EQ(e->count, 2 * PROF_THREADS * PROF_PER_THREAD);
+  ASSERT_EQ(e->bytes, 8 * e->count);
+
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&buf, &len);
+  arena_prof_write_folded(out, diff);
+  fflush(out);
+  char want[128];
+  snprintf(want, sizeof(want), "prof_thread;%s:%d %lld\n", __FILE__, prof_thread_line, (long long)e->bytes);
+  ASSERT_TRUE(strstr(buf, want) != NULL);
+
+  rewind(out);
+  arena_prof_write_pprof(out, diff);
+  fflush(out);
+  ASSERT_EQ(strncmp(buf, "heap profile: ", 14), 0);
+  snprintf(want, sizeof(want), "%lld: %lld [%lld: %lld] @ %p\n", (long long)e->count, (long long)e->bytes,
+           (long long)e->count, (long long)e->bytes, e->pc);
+  ASSERT_TRUE(strstr(buf, want) != NULL);
+  ASSERT_TRUE(strstr(buf, "MAPPED_LIBRARIES:") != NULL);
+  fclose(out);
+  free(buf);
+}
@@ -0,0 +1,111 @@
+#include <signal.h>
+#include <time.h>
+#include "arena.h"
+#include "arena_registry.h"
+#include "utest.h"
+
+// The report row for a name, or NULL
+static const char *registry_row(const char *report, const char *name) {
+  size_t len = strlen(name);
+  for (const char *line = report; *line;) {
+    if (!strncmp(line, name, len) && line[len] == ' ')
+      return line;
+    const char *eol = strchr(line, '\n');
+    if (!eol)
+      break;
+    line = eol + 1;
+  }
+  return NULL;
+}
+
+static char *registry_report(void) {
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&buf, &len);
+  arena_registry_report(out);
+  fclose(out);
+  return buf;
+}
+
+UTEST(arena_registry, usage) {
+  Arena arena = arena_init(NULL, GB(1));
+  New(&arena, byte, MB(3));  // Zeroed, so every page is touched
+  ArenaUsage u = arena_usage(&arena);
+  ASSERT_EQ(u.used, (int64_t)MB(3));
+  ASSERT_GE(u.committed, u.used);
+  ASSERT_GE(u.resident, (int64_t)MB(3));
+  ASSERT_LE(u.resident, u.committed);
+  ASSERT_EQ(u.reserved, (int64_t)GB(1));
+  arena_release(&arena);
+
+  // A caller's buffer reserves only itself
+  static byte buf[KB(64)];
+  Arena fixed = arena_init(buf + 100, KB(32));
+  New(&fixed, byte, 1000);
+  u = arena_usage(&fixed);
+  ASSERT_GE(u.used, 1000);
+  ASSERT_EQ(u.committed, (int64_t)KB(32));
+  ASSERT_EQ(u.reserved, (int64_t)KB(32));
+  ASSERT_LE(u.resident, (int64_t)KB(32));
+}
+
+UTEST(arena_registry, report_by_name) {
+  Arena a = arena_init(NULL, GB(1)), b = arena_init(NULL, GB(1)), c = arena_init(NULL, MB(64));
+  ASSERT_TRUE(arena_register(&a, "test.pair"));
+  ASSERT_TRUE(arena_register(&b, "test.pair"));
+  ASSERT_TRUE(arena_register(&c, "test.solo"));
+  New(&c, byte, MB(2));
+
+  char *report = registry_report();
+  ASSERT_TRUE(strstr(report, "committed") != NULL);
+  const char *pair = registry_row(report, "test.pair");
+  const char *solo = registry_row(report, "test.solo");
+  ASSERT_TRUE(pair && solo);
+  ASSERT_EQ(atoi(pair + strlen("test.pair")), 2);
+  ASSERT_TRUE(strstr(pair, "2.0 GB\n") != NULL);  // Reserved, summed
+  ASSERT_LT(solo, pair);                          // Larger resident first
+  ASSERT_TRUE(registry_row(report, "total") != NULL);
+  free(report);
+
+  // Renaming keeps one entry; release unregisters
+  ASSERT_TRUE(arena_register(&b, "test.renamed"));
+  arena_release(&a);
+  arena_release(&c);
+  report = registry_report();
+  ASSERT_TRUE(registry_row(report, "test.pair") == NULL);
+  ASSERT_TRUE(registry_row(report, "test.solo") == NULL);
+  pair = registry_row(report, "test.renamed");
+  ASSERT_TRUE(pair != NULL);
+  ASSERT_EQ(atoi(pair + strlen("test.renamed")), 1);
+  free(report);
+
+  arena_unregister(&b);
+  report = registry_report();
+  ASSERT_TRUE(registry_row(report, "test.renamed") == NULL);
+  free(report);
+  arena_release(&b);
+}
+
+UTEST(arena_registry, signal_report) {
+  char path[] = "/tmp/arena_registry_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  Arena arena = arena_init(NULL, MB(64));
+  arena_register(&arena, "test.signal");
+
+  ASSERT_TRUE(arena_registry_watch(SIGUSR2, path));
+  raise(SIGUSR2);
+  char buf[4096] = {0};
+  for (int i = 0; i < 200 && !strstr(buf, "test.signal"); i++) {
+    nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+    FILE *f = fopen(path, "r");
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = 0;
+    fclose(f);
+  }
+  arena_registry_watch(SIGUSR2, NULL);
+  arena_release(&arena);
+  unlink(path);
+  ASSERT_TRUE(strstr(buf, "test.signal") != NULL);
+}
@@ -286,3 +286,57 @@ UTEST(astr, compare_prefix_ordering) {
   ASSERT_TRUE(astr_compare(astr("ab"), astr("abc")) < 0);
   ASSERT_TRUE(astr_compare(astr("abc"), astr("ab")) > 0);
 }
+
+UTEST(astr, count_char_matches_bytewise) {
+  char buf[3000];
+  uint64_t rng = 1;
+  for (int i = 0; i < Countof(buf); i++) {
+    rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+    buf[i] = "ab\n\xff"[rng >> 62];
+  }
+  // Every length and misalignment up to past one 255-word flush
+  for (isize len = 0; len <= Countof(buf) - 7; len += len < 40 ? 1 : 97) {
+    for (int off = 0; off < 8; off++) {
+      astr s = {buf + off, len};
+      isize want = 0;
+      for (isize i = 0; i < len; i++) {
+        want += s.data[i] == '\n';
+      }
+      ASSERT_EQ(astr_count_char(s, '\n'), want);
+    }
+  }
+  ASSERT_EQ(astr_count_char(astr("\xff\xfe\xff"), '\xff'), 2);
+}
+
+UTEST(astr, count_words_across_buffers) {
+  astr s = astr(" one\ttwo\r\n\vthree  f\xc3\xb6ur\x01 five\f\x7f six");
+  bool in_word = false;
+  ASSERT_EQ(astr_count_words(s, &in_word), 7);  // Control bytes other than whitespace are words
+  ASSERT_TRUE(in_word);
+  // Any split of s counts the same words
+  for (isize cut = 0; cut <= s.len; cut++) {
+    in_word = false;
+    isize n = astr_count_words(astr_slice(s, 0, cut), &in_word);
+    n += astr_count_words(astr_slice(s, cut, s.len), &in_word);
+    ASSERT_EQ(n, 7);
+  }
+  in_word = true;
+  ASSERT_EQ(astr_count_words(astr("continued word"), &in_word), 1);
+  ASSERT_EQ(astr_count_words(astr(""), &in_word), 0);
+  ASSERT_TRUE(in_word);
+}
+
+UTEST(astr, utf8_count_validates) {
+  isize invalid;
+  ASSERT_EQ(astr_utf8_count(astr("plain ascii text, longer than a word"), &invalid), 36);
+  ASSERT_EQ(invalid, 0);
+  // 2, 3 and 4 byte characters, including the largest code point
+  astr wide = astr("h\xc3\xa9llo \xe2\x82\xac \xf0\x9f\x98\x80 \xf4\x8f\xbf\xbf");
+  ASSERT_EQ(astr_utf8_count(wide, &invalid), 11);
+  ASSERT_EQ(invalid, 0);
+  // Stray continuation, overlong '/', surrogate, past U+10FFFF, truncated at the end
+  ASSERT_EQ(astr_utf8_count(astr("a\x80 \xc0\xaf \xed\xa0\x80 \xf4\x90\x80\x80 \xe2\x82"), &invalid), 5);
+  ASSERT_EQ(invalid, 1 + 2 + 3 + 4 + 2);
+  ASSERT_EQ(astr_utf8_count(astr(""), &invalid), 0);
+  ASSERT_EQ(invalid, 0);
+}
@@ -0,0 +1,131 @@
+/**
+ * @file bench.h
+ * @brief Reproducible datasets for the UBENCH suites (`make bench`).
+ *
+ * Every generator draws from a fixed-seed splitmix64 stream, so a dataset is
+ * byte-for-byte identical across runs and machines and results stay
+ * comparable with a stored baseline.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+#include "arena.h"
+
+#define BENCH_SEED 0x5eed5eed5eed5eedu
+
+static inline uint64_t bench_rand(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+  return z ^ (z >> 31);
+}
+
+// Datasets live for the whole run; benchmark bodies build them on first call
+static inline Arena *bench_arena(void) {
+  static Arena arena;
+  if (!arena.beg)
+    arena = arena_init(NULL, GB(1));
+  return &arena;
+}
+
+// astr_format() writes at the arena tip, so consecutive pieces are already adjacent
+static inline void bench_append(astr *s, astr piece) {
+  Assert(s->data + s->len == piece.data);
+  s->len += piece.len;
+}
+
+static const char *const bench_words[] = {
+    "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+    "india", "juliett", "kilo", "lima", "mike", "november", "oscar", "papa",
+};
+
+/**
+ * @brief CSV text: header plus nrows lines of id,name,score,ratio,flag,comment.
+ * @param arena Arena for the text
+ * @param nrows Data rows
+ */
+static inline astr bench_csv(Arena *arena, int nrows) {
+  uint64_t rng = BENCH_SEED;
+  astr csv = astr_format(arena, "id,name,score,ratio,flag,comment\n");
+  for (int i = 0; i < nrows; i++) {
+    uint64_t r = bench_rand(&rng);
+    astr row = astr_format(arena, "%d,%s,%d,%.3f,%s,%s %s\n", i, bench_words[r % 16], (int)(r >> 8) % 1000,
+                           (double)((r >> 20) % 100000) / 1000, r & (1u << 7) ? "true" : "false",
+                           bench_words[(r >> 40) % 16], bench_words[(r >> 44) % 16]);
+    bench_append(&csv, row);
+  }
+  return csv;
+}
+
+/**
+ * @brief NUL-terminated JSON document {"items": [{...}, ...], "meta": {...}}.
+ * @param arena Arena for the text
+ * @param nitems Objects in "items"
+ */
+static inline astr bench_json(Arena *arena, int nitems) {
+  uint64_t rng = BENCH_SEED;
+  astr doc = astr_format(arena, "{\"items\":[");
+  for (int i = 0; i < nitems; i++) {
+    uint64_t r = bench_rand(&rng);
+    astr item = astr_format(arena, "%s{\"id\":%d,\"name\":\"%s\",\"score\":%d,\"tags\":[\"%s\",\"%s\"],\"ok\":%s}",
+                            i ? "," : "", i, bench_words[r % 16], (int)(r >> 8) % 1000, bench_words[(r >> 40) % 16],
+                            bench_words[(r >> 44) % 16], r & 1 ? "true" : "false");
+    bench_append(&doc, item);
+  }
+  bench_append(&doc, astr_format(arena, "],\"meta\":{\"count\":%d,\"source\":\"bench\"}}", nitems));
+  doc = astr_concat(arena, doc, astr("\0"));
+  doc.len--;  // Keep the NUL for json_get(), which takes a C string
+  return doc;
+}
+
+/**
+ * @brief NDJSON events, one object per line, with a nested user object.
+ * @param arena Arena for the text
+ * @param nrows Lines
+ *
+ * Users follow a skewed distribution (a few heavy hitters), latencies a
+ * long-tailed one, so aggregations and sketches see realistic shapes.
+ */
+static inline astr bench_ndjson(Arena *arena, int nrows) {
+  uint64_t rng = BENCH_SEED;
+  astr text = {0};
+  for (int i = 0; i < nrows; i++) {
+    uint64_t r = bench_rand(&rng);
+    int user = (int)((r % 1000) * (r % 1000) / 1000);  // Skewed towards 0
+    double latency = (double)((r >> 10) % 1000) / 10 * (1 + (double)((r >> 20) % 64 == 0) * 20);
+    astr line = astr_format(arena,
+                            "{\"id\":%d,\"user\":{\"id\":\"u%d\",\"name\":\"%s\"},\"bytes\":%d,"
+                            "\"latency\":%.1f,\"tags\":[\"%s\",\"%s\"],\"ok\":%s}\n",
+                            i, user, bench_words[user % 16], (int)(r >> 32) % 100000, latency,
+                            bench_words[(r >> 40) % 16], bench_words[(r >> 44) % 16], r & 1 ? "true" : "false");
+    if (text.data)
+      bench_append(&text, line);
+    else
+      text = line;
+  }
+  return text;
+}
+
+/**
+ * @brief Distinct keys "<word>:<n>", shuffled.
+ * @param arena Arena for the keys
+ * @param n Key count
+ */
+static inline astr *bench_keys(Arena *arena, int n) {
+  uint64_t rng = BENCH_SEED;
+  astr *keys = New(arena, astr, n);
+  for (int i = 0; i < n; i++) {
+    keys[i] = astr_format(arena, "%s:%d", bench_words[bench_rand(&rng) % 16], i);
+  }
+  for (int i = n - 1; i > 0; i--) {
+    int j = (int)(bench_rand(&rng) % (uint64_t)(i + 1));
+    astr t = keys[i];
+    keys[i] = keys[j];
+    keys[j] = t;
+  }
+  return keys;
+}
+
+#endif  // BENCH_H_
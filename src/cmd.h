@@ -0,0 +1,403 @@
+/**
+ * @file cmd.h
+ * @brief Shared plumbing for the `cmd <tool>` data tools: input, output, parallel line scans.
+ *
+ * Every tool has the same shape: read one or more inputs of newline
+ * separated records, process runs of whole lines on a thread pool, and
+ * write results in input order. This header provides the three pieces:
+ *
+ * - CmdInput hands out windows of whole lines. Regular files are mmapped
+ *   and windows are views into the mapping, released from RSS once the
+ *   next window is taken; pipes and terminals are read into a buffer that
+ *   grows only for lines longer than itself.
+ * - CmdOut queues views and writes them with writev(), so chunk outputs go
+ *   to the kernel without being copied into one buffer first.
+ * - CmdScan cuts each window into one chunk per slot at line boundaries,
+ *   runs a CmdLinesFn on every chunk in parallel, and writes the chunks'
+ *   outputs (CmdSink) in order once the whole batch is done.
+ *
+ * Usage:
+ *   static void upper(void *ctx, astr lines, CmdSink *sink, Arena *scratch) {
+ *     for (astr line; cmd_next_line(&lines, &line);) {
+ *       ...
+ *       cmd_sink_put(sink, line);
+ *       cmd_sink_putc(sink, '\n');
+ *     }
+ *   }
+ *
+ *   CmdOut out = cmd_out_init(STDOUT_FILENO);
+ *   CmdScan *scan = cmd_scan_create(arena, (CmdScanOptions){.out = &out});
+ *   CmdInput in;
+ *   if (cmd_input_open(&in, path)) {
+ *     cmd_scan(scan, &in, upper, NULL);
+ *     cmd_input_close(&in);
+ *   }
+ *   cmd_scan_destroy(scan);
+ *
+ * Tools that aggregate instead of streaming leave CmdScanOptions.out NULL
+ * and keep per-thread state indexed by pool_worker_id().
+ */
+
+#ifndef CMD_H_
+#define CMD_H_
+
+#include <sys/uio.h>
+#include "arena.h"
+#include "csv.h"
+#include "json.h"
+#include "pool.h"
+
+// Bytes of input per parallel chunk
+#ifndef CMD_CHUNK_SIZE
+#define CMD_CHUNK_SIZE MB(4)
+#endif
+
+// Chunks per thread in one batch, so a slow chunk does not idle the others
+#ifndef CMD_CHUNKS_PER_THREAD
+#define CMD_CHUNKS_PER_THREAD 2
+#endif
+
+// Output size per chunk, reserved lazily with OOM_COMMIT
+#ifndef CMD_SINK_SIZE
+#define CMD_SINK_SIZE GB(1)
+#endif
+
+// Views queued before CmdOut writes them
+#ifndef CMD_OUT_IOV
+#define CMD_OUT_IOV 256
+#endif
+
+/* --- Arenas --- */
+
+// Arena of size bytes: reserved lazily with OOM_COMMIT, malloc'd otherwise
+Arena cmd_arena_init(isize size);
+
+// Release an arena from cmd_arena_init()
+void cmd_arena_release(Arena *arena);
+
+/**
+ * @brief Parse a byte count such as "512M", "8G" or "65536".
+ * @param s Number with an optional K, M, G or T suffix (powers of 1024)
+ * @param size Set to the byte count
+ * @return false if s is not a positive size
+ */
+bool cmd_parse_size(const char *s, isize *size);
+
+/**
+ * @brief Parse a whole field as a number, as strtod() reads it.
+ * @param s Field, such as a CSV column or a sort key
+ * @param x Set to the number
+ * @return false if s is empty, has bytes past the number, or is NaN
+ */
+bool cmd_parse_number(astr s, double *x);
+
+/* --- Input --- */
+
+typedef struct {
+  const char *path;  // For messages; "-" for stdin
+  int fd;
+  int err;  // errno of the first failed read, or 0
+  bool eof;
+
+  // Mapped regular file
+  byte *map;
+  isize map_len;
+  isize pos;       // Start of the next window
+  isize released;  // Pages before this are dropped from RSS
+
+  // Streamed pipe or terminal
+  byte *buf;
+  isize cap, len;
+  isize start;  // Start of the unconsumed tail of buf
+} CmdInput;
+
+/**
+ * @brief Open a file, or stdin for NULL or "-".
+ * @param in Input to initialize
+ * @param path File path
+ * @return false with a message on stderr if the file cannot be opened
+ */
+bool cmd_input_open(CmdInput *in, const char *path);
+
+/**
+ * @brief Take the next window of whole lines.
+ * @param in Input
+ * @param want Bytes wanted; windows are longer by the rest of a line
+ * @param window Set to the window; the last one may lack a final newline
+ * @return false at end of input or on a read error (see in->err)
+ *
+ * The window stays valid until the next call. Streamed input returns
+ * shorter windows when fewer bytes are ready, so `tail -f | cmd ...` keeps
+ * up with its producer.
+ */
+bool cmd_input_next(CmdInput *in, isize want, astr *window);
+
+/**
+ * @brief Take exactly one line, such as a CSV header, before the windows.
+ * @param in Input
+ * @param line Set to the line without "\n" or "\r\n", valid until the next call
+ * @return false at end of input or on a read error
+ */
+bool cmd_input_line(CmdInput *in, astr *line);
+
+void cmd_input_close(CmdInput *in);
+
+/**
+ * @brief Split the next line off the front of a run of lines.
+ * @param lines Remaining lines, advanced past the line
+ * @param line Set to the line without "\n" or "\r\n"
+ * @return false once lines is empty
+ */
+static inline bool cmd_next_line(astr *lines, astr *line) {
+  if (lines->len <= 0)
+    return false;
+  char *nl = memchr(lines->data, '\n', lines->len);
+  isize len = nl ? nl - lines->data : lines->len;
+  *line = (astr){lines->data, len};
+  lines->data += Min(len + 1, lines->len);
+  lines->len -= Min(len + 1, lines->len);
+  if (line->len && line->data[line->len - 1] == '\r')
+    line->len--;
+  return true;
+}
+
+/* --- Output --- */
+
+typedef struct {
+  int fd;
+  int err;  // errno of the first failed write, or 0
+  int niov;
+  struct iovec iov[CMD_OUT_IOV];
+} CmdOut;
+
+static inline CmdOut cmd_out_init(int fd) {
+  return (CmdOut){.fd = fd};
+}
+
+/**
+ * @brief Write all queued views.
+ * @return false if a write failed; later writes are dropped
+ */
+bool cmd_out_flush(CmdOut *out);
+
+/**
+ * @brief Queue a view for writing; it must stay valid until cmd_out_flush().
+ *
+ * Flushes first when the queue is full.
+ */
+static inline void cmd_out_push(CmdOut *out, astr s) {
+  if (s.len <= 0)
+    return;
+  if (out->niov == CMD_OUT_IOV)
+    cmd_out_flush(out);
+  out->iov[out->niov++] = (struct iovec){s.data, s.len};
+}
+
+/* --- TSV and JSON --- */
+
+// Append s to head at the arena tip with tab, newline, CR and backslash escaped
+astr cmd_tsv_cat(Arena *arena, astr head, astr s);
+
+/**
+ * @brief Append the TSV form of a json value to head at the arena tip.
+ *
+ * Strings are unescaped and then escaped as in cmd_tsv_cat(); null and
+ * missing values append nothing; numbers, booleans, objects and arrays
+ * append their raw json.
+ */
+astr cmd_json_tsv(Arena *arena, astr head, struct json v);
+
+// Whether s needs no json escapes: no quotes, backslashes, control or non-ASCII bytes
+static inline bool cmd_json_plain(astr s) {
+  for (isize i = 0; i < s.len; i++) {
+    byte c = (byte)s.data[i];
+    if (c < ' ' || c >= 0x80 || c == '"' || c == '\\')
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Append s to head at the arena tip as a quoted json string.
+ *
+ * Plain text (see cmd_json_plain()) is copied as is; anything else goes
+ * through json_escapen(), which also replaces invalid UTF-8 with U+FFFD.
+ */
+astr cmd_json_cat(Arena *arena, astr head, astr s);
+
+// Append the TSV form of a CSV field to head at the arena tip, its doubled quotes collapsed
+astr cmd_csv_tsv(Arena *arena, astr head, CsvField f);
+
+// Group key of a record at the arena tip: the TSV form of each value, tab separated
+astr cmd_json_key(Arena *arena, const struct json *vals, int n);
+
+// Group key of a CSV record at the arena tip: the TSV form of the fields at cols, tab separated
+astr cmd_csv_key(Arena *arena, const CsvField *fields, const int *cols, int n);
+
+/* --- CSV --- */
+
+// Split the first n fields of a record; fields past its end are empty
+void cmd_csv_fields(astr record, CsvField *fields, int n);
+
+/**
+ * @brief Find named columns in a CSV header line.
+ * @param header Header line
+ * @param names At least one column name
+ * @param n Names
+ * @param cols Set to the first column of each name, or -1 if it is missing
+ * @param scratch Memory for unescaping the header's fields
+ * @return Fields a record needs for every name, one past the last column; 0 if a name is missing
+ */
+int cmd_csv_columns(astr header, const astr *names, int n, int *cols, Arena scratch);
+
+/**
+ * @brief Take an input's CSV header line and find named columns in it, as cmd_csv_columns().
+ * @param tool Command name for the error message
+ * @return Fields a record needs; 0 for an empty input; -1 after a message if a name is missing or
+ *         the header could not be read
+ */
+int cmd_csv_header(CmdInput *in, const char *tool, const astr *names, int n, int *cols, Arena scratch);
+
+/* --- Temp file runs --- */
+
+// Read buffer per run, grown for larger records
+#ifndef CMD_RUN_BUF
+#define CMD_RUN_BUF (1 << 16)
+#endif
+
+// Sequential reader of one segment of a temp file, such as a spilled run
+typedef struct {
+  int fd;
+  isize off, end;       // Unread part of the segment
+  byte *buf;            // Kept across cmd_run_reader_init() calls
+  isize cap, len, pos;  // buf[pos, len) is read but not yet taken
+  int err;              // errno of a failed read, or EIO for a short segment
+} CmdRunReader;
+
+// Point r at bytes [off, end) of fd
+void cmd_run_reader_init(CmdRunReader *r, int fd, isize off, isize end);
+
+/**
+ * @brief Make the next n bytes of the segment available at r->buf + r->pos.
+ * @return false at the end of the segment or on a read error
+ *
+ * Pointers into r->buf are invalidated by the next call. The kernel is
+ * asked to read ahead the following buffer while the caller works on this one.
+ */
+bool cmd_run_reader_want(CmdRunReader *r, isize n);
+
+void cmd_run_reader_free(CmdRunReader *r);
+
+/* --- Parallel line scans --- */
+
+// Output of one chunk, built contiguously at the tip of its own arena
+typedef struct {
+  Arena arena;
+  astr text;
+} CmdSink;
+
+// Whether n more bytes fit with a bare copy: the text ends at the tip and the committed part has room
+ARENA_INLINE bool cmd_sink_fits(const CmdSink *sink, isize n) {
+  byte *cur = sink->arena.cur;
+  return sink->text.len && sink->text.data + sink->text.len == (char *)cur && n <= sink->arena.end - cur;
+}
+
+ARENA_INLINE void cmd_sink_put(CmdSink *sink, astr s) {
+  if (ARENA_LIKELY(s.len > 0 && cmd_sink_fits(sink, s.len))) {
+    ASAN_UNPOISON_MEMORY_REGION(sink->arena.cur, s.len);
+    memcpy(sink->arena.cur, s.data, s.len);
+    sink->arena.cur += s.len;
+    sink->text.len += s.len;
+    return;
+  }
+  sink->text = astr_cat_bytes(&sink->arena, sink->text, s.data, s.len);
+}
+
+ARENA_INLINE void cmd_sink_putc(CmdSink *sink, char c) {
+  if (ARENA_LIKELY(cmd_sink_fits(sink, 1))) {
+    ASAN_UNPOISON_MEMORY_REGION(sink->arena.cur, 1);
+    *sink->arena.cur++ = (byte)c;
+    sink->text.len++;
+    return;
+  }
+  sink->text = astr_cat_bytes(&sink->arena, sink->text, &c, 1);
+}
+
+// Append s as a quoted json string, see cmd_json_cat()
+static inline void cmd_sink_put_json(CmdSink *sink, astr s) {
+  if (ARENA_UNLIKELY(!cmd_json_plain(s))) {
+    sink->text = cmd_json_cat(&sink->arena, sink->text, s);
+    return;
+  }
+  cmd_sink_putc(sink, '"');
+  cmd_sink_put(sink, s);
+  cmd_sink_putc(sink, '"');
+}
+
+/**
+ * Process a run of whole lines on a pool worker. Output goes to sink (NULL
+ * when the scan has no output); scratch is reset after the call.
+ */
+typedef void (*CmdLinesFn)(void *ctx, astr lines, CmdSink *sink, Arena *scratch);
+
+typedef struct {
+  int threads;       // Pool size, 0 for one per online CPU
+  isize chunk_size;  // 0 for CMD_CHUNK_SIZE
+  CmdOut *out;       // Where chunk outputs go in input order, NULL for none
+} CmdScanOptions;
+
+typedef struct CmdScan CmdScan;
+
+CmdScan *cmd_scan_create(Arena *arena, CmdScanOptions opts);
+
+/**
+ * @brief Run fn over every line of in, a batch of chunks at a time.
+ * @param s Scan
+ * @param in Open input
+ * @param fn Chunk callback, run concurrently on the pool
+ * @param ctx Passed to fn
+ * @return false with a message on stderr on a read or write error
+ */
+bool cmd_scan(CmdScan *s, CmdInput *in, CmdLinesFn fn, void *ctx);
+
+// @return Pool threads, the range of pool_worker_id() inside a CmdLinesFn
+int cmd_scan_threads(const CmdScan *s);
+
+// @return The scan's pool, for a parallel merge once the input is done
+Pool *cmd_scan_pool(const CmdScan *s);
+
+void cmd_scan_destroy(CmdScan *s);
+
+/* --- Tools --- */
+
+/**
+ * Entry point of `cmd <tool>`: argv[0] is the tool name, results go to out.
+ * Returns the process exit status: 0, 1 for input errors, 2 for usage.
+ */
+typedef int (*CmdToolFn)(int argc, char *argv[], int out);
+
+// cmd extract -f name.last -f age [-o tsv|ndjson] [-H] [-t threads] [files]
+int cmd_extract_main(int argc, char *argv[], int out);
+
+// cmd agg --by user.id [--count] [--sum|--min|--max|--avg field] [-i ndjson|csv] [--mem 1G] [files]
+int cmd_agg_main(int argc, char *argv[], int out);
+
+// cmd sort [-k field] [-n] [-r] [-i ndjson|csv] [--mem 1G] [files]
+int cmd_sort_main(int argc, char *argv[], int out);
+
+// cmd grep -F patterns.txt [-e pattern] [-i] [--no-ids] [files]
+int cmd_grep_main(int argc, char *argv[], int out);
+
+// cmd wc [-l] [-w] [-m] [-c] [-t threads] [files]
+int cmd_wc_main(int argc, char *argv[], int out);
+
+// cmd convert --from csv|ndjson [--to ndjson|csv] [-f field] [--strings] [-t threads] [files]
+int cmd_convert_main(int argc, char *argv[], int out);
+
+// cmd topk --key user.id [-k 10] [--counters N] [-e] [-i ndjson|csv] [files]
+int cmd_topk_main(int argc, char *argv[], int out);
+
+// cmd quantiles --field latency [-q 0.5,0.99] [-k 200] [-i ndjson|csv] [files]
+int cmd_quantiles_main(int argc, char *argv[], int out);
+
+#endif  // CMD_H_
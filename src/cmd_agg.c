@@ -0,0 +1,813 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "arena_registry.h"
+#include "cmd.h"
+#include "csv.h"
+#include "json_path.h"
+#include "ketopt.h"
+#include "parallel.h"
+
+// Hash partitions of spill runs and of the final merge, as bits of the hash
+#ifndef AGG_PARTITION_BITS
+#define AGG_PARTITION_BITS 6
+#endif
+#define AGG_PARTITIONS (1 << AGG_PARTITION_BITS)
+
+// Partition levels: a partition too big to merge is split by the next bits, from bit 40 up to 60
+#define AGG_LEVELS ((60 - 40) / AGG_PARTITION_BITS)
+
+// Output buffer of each part while a partition is split
+#ifndef AGG_SPLIT_BUF
+#define AGG_SPLIT_BUF KB(64)
+#endif
+
+typedef enum { AGG_COUNT, AGG_SUM, AGG_MIN, AGG_MAX, AGG_AVG } AggOp;
+
+static const char *const agg_op_names[] = {"count", "sum", "min", "max", "avg"};
+
+typedef struct {
+  AggOp op;
+  int value;  // Index of the value field, unused for count
+} AggColumn;
+
+typedef slice(astr) AggNames;
+typedef slice(AggColumn) AggColumns;
+
+typedef struct {
+  double sum, min, max;
+  int64_t n;  // Numeric values seen
+} AggAcc;
+
+/**
+ * One group, in memory and in spill files alike: the header, an
+ * accumulator per value field, then the key padded to 8 bytes. The key is
+ * interned here, and the maps point into it.
+ */
+typedef struct {
+  uint64_t hash;
+  int64_t count;
+  isize len;
+  AggAcc acc[];
+} AggGroup;
+
+typedef struct {
+  astr s;
+  uint64_t hash;
+} AggKey;
+
+static inline uint64_t agg_key_hash(AggKey k) {
+  return k.hash;
+}
+
+static inline bool agg_key_equals(AggKey a, AggKey b) {
+  return a.hash == b.hash && astr_equals(a.s, b.s);
+}
+
+static inline void *vt_arena_malloc(size_t size, Arena **ctx) {
+  return arena_malloc(size, *ctx);
+}
+
+static inline void vt_arena_free(void *ptr, size_t size, Arena **ctx) {
+  arena_free(ptr, size, *ctx);
+}
+
+#define NAME      AggMap
+#define KEY_TY    AggKey
+#define VAL_TY    AggGroup *
+#define CTX_TY    Arena *
+#define CMPR_FN   agg_key_equals
+#define HASH_FN   agg_key_hash
+#define MALLOC_FN vt_arena_malloc
+#define FREE_FN   vt_arena_free
+#include "verstable.h"
+
+// Offsets of each partition in one spill run
+typedef struct {
+  isize off[AGG_PARTITIONS + 1];
+} AggSpill;
+
+typedef struct {
+  Arena arena;  // Groups and map, reset after each spill
+  AggMap map;
+  FILE *file;  // Spill runs, created on the first spill
+  isize size;
+  AggSpill *spills;
+  isize nspills;
+  int err;
+  AggGroup **groups;  // In-memory merge: groups ordered by partition
+  isize off[AGG_PARTITIONS + 1];
+} AggThread;
+
+// Sorted groups of one partition
+typedef struct {
+  AggGroup **groups;  // In memory, or
+  isize n, i;
+  CmdRunReader reader;  // read back from a merge file
+  AggGroup *cur;
+} AggRun;
+
+// Groups of one partition in a spill or split file
+typedef struct {
+  int fd;
+  isize off, end;
+} AggSegment;
+
+// A buffer of groups written to the split file, and the part it belongs to
+typedef struct {
+  AggSegment seg;
+  int part;
+} AggChunk;
+
+typedef slice(AggChunk) AggChunks;
+
+typedef struct {
+  Arena arena;
+  FILE *file;  // Sorted partitions, when the groups were spilled
+  isize size;
+  FILE *split;  // Parts of partitions too big to merge in memory
+  isize split_size;
+  CmdRunReader reader;
+  AggRun parts[AGG_LEVELS][AGG_PARTITIONS];  // Sorted parts of a split partition, merged back into one
+  int err;
+  bool oom;
+} AggMerge;
+
+typedef struct {
+  bool csv;
+  int nkeys;    // --by fields: slots [0, nkeys)
+  int nvalues;  // Distinct value fields: slots [nkeys, nkeys + nvalues)
+  astr *names;  // Field of each slot
+  AggColumn *columns;
+  int ncolumns;
+  isize mem, budget;  // Total and per-thread group memory before a spill
+
+  JsonPaths *paths;  // NDJSON: one path per slot
+  int *slot_col;     // CSV: column of each slot in the current file
+  int ncols;
+
+  AggThread *threads;
+  AggMerge *merges;
+  int nthreads;
+  bool spilled;
+  AggRun runs[AGG_PARTITIONS];
+} Agg;
+
+/* --- Groups --- */
+
+static inline isize agg_group_size(isize len, int nvalues) {
+  return (isize)(sizeof(AggGroup) + nvalues * sizeof(AggAcc)) + ((len + 7) & ~(isize)7);
+}
+
+static inline astr agg_group_key(const AggGroup *g, int nvalues) {
+  return (astr){(char *)(g->acc + nvalues), g->len};
+}
+
+// verstable takes buckets from the low bits and fragments from the top 4; each level takes the next bits
+static inline int agg_partition(uint64_t hash, int level) {
+  return (int)(hash >> (40 + level * AGG_PARTITION_BITS)) & (AGG_PARTITIONS - 1);
+}
+
+static AggGroup *agg_group_new(Arena *arena, AggKey key, int nvalues) {
+  isize size = agg_group_size(key.s.len, nvalues);
+  AggGroup *g = (AggGroup *)New(arena, uint64_t, size / 8, NO_INIT);
+  *g = (AggGroup){.hash = key.hash, .len = key.s.len};
+  for (int v = 0; v < nvalues; v++) {
+    g->acc[v] = (AggAcc){0, INFINITY, -INFINITY, 0};
+  }
+  char *k = (char *)(g->acc + nvalues);
+  memset(k + (key.s.len & ~(isize)7), 0, 8 * (key.s.len % 8 != 0));
+  memcpy(k, key.s.data, key.s.len);
+  return g;
+}
+
+// Fold g into a merge map; a new key takes g itself, or a copy in arena
+static void agg_merge_group(AggMap *map, Arena *arena, AggGroup *g, int nvalues) {
+  AggKey key = {agg_group_key(g, nvalues), g->hash};
+  AggMap_itr it = vt_get(map, key);
+  if (vt_is_end(it)) {
+    if (arena) {
+      isize size = agg_group_size(g->len, nvalues);
+      g = memcpy(New(arena, uint64_t, size / 8, NO_INIT), g, size);
+    }
+    vt_insert(map, (AggKey){agg_group_key(g, nvalues), g->hash}, g);
+    return;
+  }
+  AggGroup *into = it.data->val;
+  into->count += g->count;
+  for (int v = 0; v < nvalues; v++) {
+    into->acc[v].sum += g->acc[v].sum;
+    into->acc[v].min = fmin(into->acc[v].min, g->acc[v].min);
+    into->acc[v].max = fmax(into->acc[v].max, g->acc[v].max);
+    into->acc[v].n += g->acc[v].n;
+  }
+}
+
+static int agg_group_cmp(const void *x, const void *y, void *ctx) {
+  int nvalues = *(int *)ctx;
+  return astr_compare(agg_group_key(*(AggGroup **)x, nvalues), agg_group_key(*(AggGroup **)y, nvalues));
+}
+
+/* --- Spills --- */
+
+// Order a thread's groups by partition, one counting pass and one scatter
+static void agg_partition_groups(AggThread *t) {
+  isize count[AGG_PARTITIONS] = {0};
+  for (AggMap_itr it = vt_first(&t->map); !vt_is_end(it); it = vt_next(it)) {
+    count[agg_partition(it.data->key.hash, 0)]++;
+  }
+  t->off[0] = 0;
+  for (int p = 0; p < AGG_PARTITIONS; p++) {
+    t->off[p + 1] = t->off[p] + count[p];
+    count[p] = t->off[p];
+  }
+  t->groups = New(&t->arena, AggGroup *, t->off[AGG_PARTITIONS], NO_INIT);
+  for (AggMap_itr it = vt_first(&t->map); !vt_is_end(it); it = vt_next(it)) {
+    t->groups[count[agg_partition(it.data->key.hash, 0)]++] = it.data->val;
+  }
+}
+
+// Write the thread's groups as one run of partitions and start over empty
+static void agg_spill(Agg *a, AggThread *t) {
+  if (!vt_size(&t->map) || t->err)
+    return;
+  if (!t->file && !(t->file = tmpfile())) {
+    t->err = errno;
+    return;
+  }
+  agg_partition_groups(t);
+  AggSpill spill = {.off[0] = t->size};
+  for (int p = 0; p < AGG_PARTITIONS; p++) {
+    isize off = spill.off[p];
+    for (isize i = t->off[p]; i < t->off[p + 1]; i++) {
+      isize size = agg_group_size(t->groups[i]->len, a->nvalues);
+      if (fwrite(t->groups[i], size, 1, t->file) != 1) {
+        t->err = errno ? errno : EIO;
+        return;
+      }
+      off += size;
+    }
+    spill.off[p + 1] = off;
+  }
+  t->size = spill.off[AGG_PARTITIONS];
+  AggSpill *spills = realloc(t->spills, (t->nspills + 1) * sizeof(AggSpill));
+  if (!spills) {
+    perror("agg_spill realloc");
+    abort();
+  }
+  t->spills = spills;
+  t->spills[t->nspills++] = spill;
+  arena_reset(&t->arena);
+  vt_init_with_ctx(&t->map, &t->arena);
+}
+
+// Next group of the segment, valid until the next call
+static AggGroup *agg_reader_next(CmdRunReader *r, int nvalues) {
+  if (!cmd_run_reader_want(r, agg_group_size(0, nvalues)))
+    return NULL;
+  isize size = agg_group_size(((AggGroup *)(r->buf + r->pos))->len, nvalues);
+  if (!cmd_run_reader_want(r, size))
+    return NULL;
+  AggGroup *g = (AggGroup *)(r->buf + r->pos);
+  r->pos += size;
+  return g;
+}
+
+/* --- Scan --- */
+
+static void agg_lines(void *ctx, astr lines, CmdSink *sink, Arena *scratch) {
+  Agg *a = ctx;
+  AggThread *t = &a->threads[pool_worker_id()];
+  int nslots = a->nkeys + a->nvalues;
+  struct json *vals = a->csv ? NULL : New(scratch, struct json, nslots);
+  CsvField *cols = a->csv ? New(scratch, CsvField, a->ncols) : NULL;
+  double *x = New(scratch, double, a->nvalues);
+  bool *has = New(scratch, bool, a->nvalues);
+  (void)sink;
+
+  for (astr line; cmd_next_line(&lines, &line);) {
+    if (!line.len || t->err)
+      continue;
+    Arena tmp = *scratch;  // The key, gone with the line
+    astr key;
+    if (a->csv) {
+      cmd_csv_fields(line, cols, a->ncols);
+      key = cmd_csv_key(&tmp, cols, a->slot_col, a->nkeys);
+      for (int v = 0; v < a->nvalues; v++) {
+        has[v] = cmd_parse_number(cols[a->slot_col[a->nkeys + v]].text, &x[v]);
+      }
+    } else {
+      json_paths_get(a->paths, line, vals);
+      key = cmd_json_key(&tmp, vals, a->nkeys);
+      for (int v = 0; v < a->nvalues; v++) {
+        struct json val = vals[a->nkeys + v];
+        has[v] = json_type(val) == JSON_NUMBER;
+        x[v] = has[v] ? json_double(val) : 0;
+      }
+    }
+
+    AggKey k = {key, astr_hash(key)};
+    AggMap_itr it = vt_get(&t->map, k);
+    AggGroup *g;
+    if (ARENA_LIKELY(!vt_is_end(it))) {
+      g = it.data->val;
+    } else {
+      if (t->arena.cur - t->arena.beg > a->budget)
+        agg_spill(a, t);
+      g = agg_group_new(&t->arena, k, a->nvalues);
+      vt_insert(&t->map, (AggKey){agg_group_key(g, a->nvalues), k.hash}, g);
+    }
+    g->count++;
+    for (int v = 0; v < a->nvalues; v++) {
+      if (has[v]) {
+        g->acc[v].sum += x[v];
+        g->acc[v].min = fmin(g->acc[v].min, x[v]);
+        g->acc[v].max = fmax(g->acc[v].max, x[v]);
+        g->acc[v].n++;
+      }
+    }
+  }
+}
+
+/* --- Merge --- */
+
+// Spill what is left, or order it by partition for an in-memory merge
+static void agg_finish_threads(void *ctx, isize beg, isize end, Arena *scratch) {
+  Agg *a = ctx;
+  for (isize i = beg; i < end; i++) {
+    AggThread *t = &a->threads[i];
+    if (a->spilled) {
+      agg_spill(a, t);
+      if (t->file && fflush(t->file) && !t->err)
+        t->err = errno;
+    } else {
+      agg_partition_groups(t);
+    }
+  }
+  (void)scratch;
+}
+
+static bool agg_run_next(AggRun *r, int nvalues) {
+  if (r->reader.buf)
+    r->cur = agg_reader_next(&r->reader, nvalues);
+  else
+    r->cur = r->i < r->n ? r->groups[r->i++] : NULL;
+  return r->cur;
+}
+
+static inline bool agg_run_less(const AggRun *x, const AggRun *y, int nvalues) {
+  return astr_compare(agg_group_key(x->cur, nvalues), agg_group_key(y->cur, nvalues)) < 0;
+}
+
+static void agg_sift(AggRun **heap, int n, int i, int nvalues) {
+  for (;;) {
+    int least = i, l = 2 * i + 1, r = l + 1;
+    if (l < n && agg_run_less(heap[l], heap[least], nvalues))
+      least = l;
+    if (r < n && agg_run_less(heap[r], heap[least], nvalues))
+      least = r;
+    if (least == i)
+      return;
+    AggRun *swap = heap[i];
+    heap[i] = heap[least];
+    heap[least] = swap;
+    i = least;
+  }
+}
+
+// Heap of the runs that have a group, the least key on top; returns its size
+static int agg_heap_init(AggRun **heap, AggRun *runs, int nruns, int nvalues) {
+  int n = 0;
+  for (int i = 0; i < nruns; i++) {
+    if (agg_run_next(&runs[i], nvalues))
+      heap[n++] = &runs[i];
+  }
+  for (int i = n / 2 - 1; i >= 0; i--) {
+    agg_sift(heap, n, i, nvalues);
+  }
+  return n;
+}
+
+// Advance the top run past its group; returns the heap's new size
+static int agg_heap_next(AggRun **heap, int n, int nvalues) {
+  if (!agg_run_next(heap[0], nvalues))
+    heap[0] = heap[--n];
+  agg_sift(heap, n, 0, nvalues);
+  return n;
+}
+
+// Append a group to the merge file
+static void agg_merge_write(Agg *a, AggMerge *m, const AggGroup *g) {
+  isize size = agg_group_size(g->len, a->nvalues);
+  if (fwrite(g, size, 1, m->file) != 1 && !m->err)
+    m->err = errno ? errno : EIO;
+  m->size += size;
+}
+
+// Append bytes of groups of one part to the split file
+static void agg_split_write(AggMerge *m, Arena *arena, AggChunks *chunks, int part, const void *data,
+                            isize len) {
+  if (fwrite(data, len, 1, m->split) != 1 && !m->err)
+    m->err = errno ? errno : EIO;
+  *Push(arena, chunks) = (AggChunk){{fileno(m->split), m->split_size, m->split_size + len}, part};
+  m->split_size += len;
+}
+
+// Copy the groups of the segments to the split file, buffered by their part at the next level
+static AggChunks agg_split(Agg *a, AggMerge *m, const AggSegment *segs, isize nsegs, int level,
+                           Arena *arena) {
+  AggChunks chunks = {0};
+  if (!m->split && !(m->split = tmpfile())) {
+    m->err = errno;
+    return chunks;
+  }
+  byte *buf = New(arena, byte, AGG_PARTITIONS * AGG_SPLIT_BUF, NO_INIT);
+  isize used[AGG_PARTITIONS] = {0};
+  for (isize s = 0; s < nsegs; s++) {
+    cmd_run_reader_init(&m->reader, segs[s].fd, segs[s].off, segs[s].end);
+    for (AggGroup *g; (g = agg_reader_next(&m->reader, a->nvalues));) {
+      int q = agg_partition(g->hash, level + 1);
+      isize size = agg_group_size(g->len, a->nvalues);
+      if (used[q] + size > (isize)AGG_SPLIT_BUF) {
+        agg_split_write(m, arena, &chunks, q, buf + q * AGG_SPLIT_BUF, used[q]);
+        used[q] = 0;
+      }
+      if (size > (isize)AGG_SPLIT_BUF) {
+        agg_split_write(m, arena, &chunks, q, g, size);
+      } else {
+        memcpy(buf + q * AGG_SPLIT_BUF + used[q], g, size);
+        used[q] += size;
+      }
+    }
+    if (m->reader.err && !m->err)
+      m->err = m->reader.err;
+  }
+  for (int q = 0; q < AGG_PARTITIONS; q++) {
+    if (used[q])
+      agg_split_write(m, arena, &chunks, q, buf + q * AGG_SPLIT_BUF, used[q]);
+  }
+  if (fflush(m->split) && !m->err)
+    m->err = errno;
+  return chunks;
+}
+
+/**
+ * Fold the groups of one partition into a sorted run of the merge file.
+ * The merge copies every distinct group and adds a map entry for it, a few
+ * times the group bytes for short keys, so a partition with more than an
+ * eighth of a thread's budget is split by the next bits of the hash
+ * instead: each part is merged on its own, and as keys never repeat across
+ * parts, their sorted runs merge back into one.
+ */
+static AggSegment agg_merge_segments(Agg *a, AggMerge *m, const AggSegment *segs, isize nsegs, int level,
+                                     Arena arena) {
+  if (!m->file && !(m->file = tmpfile())) {
+    m->err = errno;
+    return (AggSegment){0};
+  }
+  isize bytes = 0;
+  for (isize s = 0; s < nsegs; s++) {
+    bytes += segs[s].end - segs[s].off;
+  }
+
+  if (bytes > a->budget / 8 && level + 1 < AGG_LEVELS) {
+    AggChunks chunks = agg_split(a, m, segs, nsegs, level, &arena);
+    AggRun *parts = m->parts[level];
+    for (int q = 0; q < AGG_PARTITIONS; q++) {
+      Arena tmp = arena;
+      AggSegment *sub = New(&tmp, AggSegment, Max(chunks.len, (isize)1), NO_INIT);
+      isize n = 0;
+      for (isize c = 0; c < chunks.len; c++) {
+        if (chunks.data[c].part == q)
+          sub[n++] = chunks.data[c].seg;
+      }
+      AggSegment part = agg_merge_segments(a, m, sub, n, level + 1, tmp);
+      parts[q] = (AggRun){.reader = parts[q].reader};
+      cmd_run_reader_init(&parts[q].reader, part.fd, part.off, part.end);
+    }
+    if (fflush(m->file) && !m->err)
+      m->err = errno;
+
+    AggSegment run = {fileno(m->file), m->size, m->size};
+    AggRun *heap[AGG_PARTITIONS];
+    for (int n = agg_heap_init(heap, parts, AGG_PARTITIONS, a->nvalues); n;
+         n = agg_heap_next(heap, n, a->nvalues)) {
+      agg_merge_write(a, m, heap[0]->cur);
+    }
+    for (int q = 0; q < AGG_PARTITIONS; q++) {
+      if (parts[q].reader.err && !m->err)
+        m->err = parts[q].reader.err;
+    }
+    run.end = m->size;
+    return run;
+  }
+
+  AggMap map;
+  vt_init_with_ctx(&map, &arena);
+  for (isize s = 0; s < nsegs; s++) {
+    cmd_run_reader_init(&m->reader, segs[s].fd, segs[s].off, segs[s].end);
+    for (AggGroup *g; (g = agg_reader_next(&m->reader, a->nvalues));) {
+      agg_merge_group(&map, &arena, g, a->nvalues);
+    }
+    if (m->reader.err && !m->err)
+      m->err = m->reader.err;
+  }
+  AggGroup **groups = New(&arena, AggGroup *, vt_size(&map), NO_INIT);
+  isize n = 0;
+  for (AggMap_itr it = vt_first(&map); !vt_is_end(it); it = vt_next(it)) {
+    groups[n++] = it.data->val;
+  }
+  qsort_r(groups, n, sizeof(AggGroup *), agg_group_cmp, &a->nvalues);
+  AggSegment run = {fileno(m->file), m->size, m->size};
+  for (isize i = 0; i < n; i++) {
+    agg_merge_write(a, m, groups[i]);
+  }
+  run.end = m->size;
+  return run;
+}
+
+// Fold one partition of every thread into a sorted run
+static void agg_merge_partitions(void *ctx, isize beg, isize end, Arena *scratch) {
+  Agg *a = ctx;
+  AggMerge *m = &a->merges[pool_worker_id()];
+  jmp_buf jmpbuf;
+  if (ArenaOOM(&m->arena, jmpbuf)) {
+    m->oom = true;
+    return;
+  }
+  for (isize p = beg; p < end; p++) {
+    AggRun *run = &a->runs[p];
+    if (a->spilled) {
+      // Spilled: the sorted partition goes to disk, and the arena to the next one
+      arena_reset(&m->arena);
+      isize nsegs = 0;
+      for (int i = 0; i < a->nthreads; i++) {
+        nsegs += a->threads[i].nspills;
+      }
+      AggSegment *segs = New(&m->arena, AggSegment, Max(nsegs, (isize)1), NO_INIT);
+      nsegs = 0;
+      for (int i = 0; i < a->nthreads; i++) {
+        AggThread *t = &a->threads[i];
+        for (isize s = 0; s < t->nspills; s++) {
+          segs[nsegs++] = (AggSegment){fileno(t->file), t->spills[s].off[p], t->spills[s].off[p + 1]};
+        }
+      }
+      AggSegment seg = agg_merge_segments(a, m, segs, nsegs, 0, m->arena);
+      *run = (AggRun){0};
+      cmd_run_reader_init(&run->reader, seg.fd, seg.off, seg.end);
+      continue;
+    }
+
+    AggMap map;
+    vt_init_with_ctx(&map, &m->arena);
+    for (int i = 0; i < a->nthreads; i++) {
+      AggThread *t = &a->threads[i];
+      for (isize g = t->off[p]; g < t->off[p + 1]; g++) {
+        agg_merge_group(&map, NULL, t->groups[g], a->nvalues);
+      }
+    }
+    *run = (AggRun){.groups = New(&m->arena, AggGroup *, vt_size(&map), NO_INIT)};
+    for (AggMap_itr it = vt_first(&map); !vt_is_end(it); it = vt_next(it)) {
+      run->groups[run->n++] = it.data->val;
+    }
+    qsort_r(run->groups, run->n, sizeof(AggGroup *), agg_group_cmp, &a->nvalues);
+  }
+  (void)scratch;
+}
+
+static astr agg_format_row(Arena *arena, astr row, const Agg *a, const AggGroup *g) {
+  row = astr_concat(arena, row, agg_group_key(g, a->nvalues));
+  for (int c = 0; c < a->ncolumns; c++) {
+    AggColumn col = a->columns[c];
+    const AggAcc *acc = &g->acc[col.value];
+    char num[32];
+    int len = 0;
+    if (col.op == AGG_COUNT)
+      len = snprintf(num, sizeof(num), "%lld", (long long)g->count);
+    else if (col.op == AGG_SUM)
+      len = snprintf(num, sizeof(num), "%.15g", acc->sum);
+    else if (acc->n)  // No numbers: min, max and avg are left empty
+      len = snprintf(num, sizeof(num), "%.15g",
+                     col.op == AGG_MIN ? acc->min : col.op == AGG_MAX ? acc->max : acc->sum / acc->n);
+    row = astr_cat_bytes(arena, row, "\t", 1);
+    row = astr_cat_bytes(arena, row, num, len);
+  }
+  return astr_cat_bytes(arena, row, "\n", 1);
+}
+
+// K-way merge of the sorted partitions; keys never repeat across partitions
+static bool agg_write(Agg *a, Arena arena, CmdOut *out) {
+  AggRun *heap[AGG_PARTITIONS];
+  int n = agg_heap_init(heap, a->runs, AGG_PARTITIONS, a->nvalues);
+  Arena tmp = arena;
+  astr text = {0};
+  while (n) {
+    text = agg_format_row(&tmp, text, a, heap[0]->cur);
+    n = agg_heap_next(heap, n, a->nvalues);
+    if (text.len >= (isize)CMD_CHUNK_SIZE) {
+      cmd_out_push(out, text);
+      if (!cmd_out_flush(out))
+        return false;
+      tmp = arena;
+      text = (astr){0};
+    }
+  }
+  cmd_out_push(out, text);
+  return cmd_out_flush(out);
+}
+
+/* --- Command --- */
+
+static int agg_usage(FILE *f) {
+  fputs(
+      "usage: cmd agg -b FIELD [-b FIELD ...] [aggregates] [options] [FILE ...]\n"
+      "Group NDJSON or CSV records by key and print one sorted TSV row per group.\n"
+      "  -b, --by FIELD        group key: a dotted json path or a CSV column (repeatable)\n"
+      "  -c, --count           records in the group (the default aggregate)\n"
+      "      --sum FIELD       sum of the field's numbers\n"
+      "      --min FIELD       least number, empty if none\n"
+      "      --max FIELD       greatest number, empty if none\n"
+      "      --avg FIELD       mean of the field's numbers, empty if none\n"
+      "  -i, --input FORMAT    ndjson (default) or csv with a header line\n"
+      "  -H, --header          print the column names as a first row\n"
+      "  -m, --mem SIZE        group memory before spilling to disk (default 1G)\n"
+      "  -t, --threads N       worker threads (default: one per CPU)\n",
+      f);
+  return f == stdout ? 0 : 2;
+}
+
+// Index of a value field, added on first use
+static int agg_value(Arena *arena, AggNames *values, const char *field) {
+  astr name = astr_from_cstr(arena, field);
+  for (int v = 0; v < values->len; v++) {
+    if (astr_equals(values->data[v], name))
+      return v;
+  }
+  *Push(arena, values) = name;
+  return (int)values->len - 1;
+}
+
+int cmd_agg_main(int argc, char *argv[], int out) {
+  enum { OPT_SUM = 301, OPT_MIN, OPT_MAX, OPT_AVG };
+  static const ko_longopt_t longopts[] = {
+      {"by", ko_required_argument, 'b'},     {"count", ko_no_argument, 'c'},
+      {"sum", ko_required_argument, OPT_SUM}, {"min", ko_required_argument, OPT_MIN},
+      {"max", ko_required_argument, OPT_MAX}, {"avg", ko_required_argument, OPT_AVG},
+      {"input", ko_required_argument, 'i'},  {"header", ko_no_argument, 'H'},
+      {"mem", ko_required_argument, 'm'},    {"threads", ko_required_argument, 't'},
+      {"help", ko_no_argument, 'h'},         {0},
+  };
+  Arena arena = cmd_arena_init(GB(1));
+  arena_register(&arena, "cmd.agg");
+  AggNames keys = {0}, values = {0};
+  AggColumns columns = {0};
+  Agg a = {.mem = GB(1)};
+  bool header = false;
+  int threads = 0;
+
+  ketopt_t opt = KETOPT_INIT;
+  for (int c; (c = ketopt(&opt, argc, argv, 1, "b:ci:Hm:t:h", longopts)) >= 0;) {
+    if (c == 'b') {
+      *Push(&arena, &keys) = astr_from_cstr(&arena, opt.arg);
+    } else if (c == 'c') {
+      *Push(&arena, &columns) = (AggColumn){AGG_COUNT};
+    } else if (c >= OPT_SUM && c <= OPT_AVG) {
+      *Push(&arena, &columns) = (AggColumn){AGG_SUM + (c - OPT_SUM), agg_value(&arena, &values, opt.arg)};
+    } else if (c == 'i' && (!strcmp(opt.arg, "ndjson") || !strcmp(opt.arg, "csv"))) {
+      a.csv = !strcmp(opt.arg, "csv");
+    } else if (c == 'H') {
+      header = true;
+    } else if (c == 'm') {
+      if (!cmd_parse_size(opt.arg, &a.mem)) {
+        fprintf(stderr, "cmd agg: bad size: %s\n", opt.arg);
+        cmd_arena_release(&arena);
+        return agg_usage(stderr);
+      }
+    } else if (c == 't') {
+      threads = atoi(opt.arg);
+    } else if (c == 'h') {
+      cmd_arena_release(&arena);
+      return agg_usage(stdout);
+    } else {
+      cmd_arena_release(&arena);
+      return agg_usage(stderr);
+    }
+  }
+  if (!keys.len) {
+    fputs("cmd agg: at least one -b FIELD is required\n", stderr);
+    cmd_arena_release(&arena);
+    return agg_usage(stderr);
+  }
+  if (!columns.len)
+    *Push(&arena, &columns) = (AggColumn){AGG_COUNT};
+
+  a.nkeys = (int)keys.len;
+  a.nvalues = (int)values.len;
+  a.names = New(&arena, astr, a.nkeys + a.nvalues);
+  memcpy(a.names, keys.data, keys.len * sizeof(astr));
+  memcpy(a.names + a.nkeys, values.data, values.len * sizeof(astr));
+  a.columns = columns.data;
+  a.ncolumns = (int)columns.len;
+  if (a.csv)
+    a.slot_col = New(&arena, int, a.nkeys + a.nvalues);
+  else
+    a.paths = json_paths_compile(&arena, a.names, a.nkeys + a.nvalues);
+
+  CmdScan *scan = cmd_scan_create(&arena, (CmdScanOptions){.threads = threads});
+  Pool *pool = cmd_scan_pool(scan);
+  a.nthreads = cmd_scan_threads(scan);
+  a.budget = Max(a.mem / a.nthreads, (isize)1);
+  a.threads = New(&arena, AggThread, a.nthreads);
+  a.merges = New(&arena, AggMerge, a.nthreads);
+  for (int i = 0; i < a.nthreads; i++) {
+    // Room past the budget for the group that crosses it and the map's last growth
+    a.threads[i].arena = cmd_arena_init(3 * a.budget + MB(16));
+    arena_register(&a.threads[i].arena, "cmd.agg.groups");
+    vt_init_with_ctx(&a.threads[i].map, &a.threads[i].arena);
+    a.merges[i].arena = cmd_arena_init(a.mem + MB(16));
+    arena_register(&a.merges[i].arena, "cmd.agg.merge");
+  }
+
+  int status = 0;
+  for (int i = opt.ind; i < argc || (i == opt.ind && i == argc); i++) {
+    CmdInput in;
+    if (!cmd_input_open(&in, i < argc ? argv[i] : NULL)) {
+      status = 1;
+      continue;
+    }
+    if (a.csv)
+      a.ncols = cmd_csv_header(&in, "agg", a.names, a.nkeys + a.nvalues, a.slot_col, arena);
+    if (a.ncols < 0)
+      status = 1;
+    else if ((!a.csv || a.ncols) && !cmd_scan(scan, &in, agg_lines, &a))
+      status = 1;
+    cmd_input_close(&in);
+  }
+
+  for (int i = 0; i < a.nthreads; i++) {
+    a.spilled |= a.threads[i].nspills > 0;
+  }
+  parallel_for(pool, a.nthreads, 1, agg_finish_threads, &a);
+  parallel_for(pool, AGG_PARTITIONS, 1, agg_merge_partitions, &a);
+  int err = 0;
+  bool oom = false;
+  for (int i = 0; i < a.nthreads; i++) {
+    if (a.merges[i].file && fflush(a.merges[i].file) && !a.merges[i].err)
+      a.merges[i].err = errno;
+    err = err ? err : a.threads[i].err ? a.threads[i].err : a.merges[i].err;
+    oom |= a.merges[i].oom;
+  }
+
+  CmdOut o = cmd_out_init(out);
+  if (oom) {
+    fputs("cmd agg: out of memory merging the groups\n", stderr);
+    status = 1;
+  } else if (err) {
+    fprintf(stderr, "cmd agg: spill: %s\n", strerror(err));
+    status = 1;
+  } else {
+    if (header) {
+      astr row = {0};
+      for (int k = 0; k < a.nkeys; k++) {
+        row = astr_concat(&arena, k ? astr_cat_bytes(&arena, row, "\t", 1) : row, a.names[k]);
+      }
+      for (int c = 0; c < a.ncolumns; c++) {
+        AggColumn col = a.columns[c];
+        row = astr_concat(&arena, row,
+                          col.op == AGG_COUNT ? astr("\tcount")
+                                              : astr_format(&arena, "\t%s(%.*s)", agg_op_names[col.op],
+                                                            S(a.names[a.nkeys + col.value])));
+      }
+      cmd_out_push(&o, astr_cat_bytes(&arena, row, "\n", 1));
+    }
+    if (!agg_write(&a, arena, &o)) {
+      fprintf(stderr, "cmd agg: write: %s\n", strerror(o.err));
+      status = 1;
+    }
+  }
+
+  for (int p = 0; p < AGG_PARTITIONS; p++) {
+    cmd_run_reader_free(&a.runs[p].reader);
+  }
+  for (int i = 0; i < a.nthreads; i++) {
+    if (a.threads[i].file)
+      fclose(a.threads[i].file);
+    if (a.merges[i].file)
+      fclose(a.merges[i].file);
+    if (a.merges[i].split)
+      fclose(a.merges[i].split);
+    cmd_run_reader_free(&a.merges[i].reader);
+    for (int l = 0; l < AGG_LEVELS; l++) {
+      for (int p = 0; p < AGG_PARTITIONS; p++) {
+        cmd_run_reader_free(&a.merges[i].parts[l][p].reader);
+      }
+    }
+    free(a.threads[i].spills);
+    cmd_arena_release(&a.threads[i].arena);
+    cmd_arena_release(&a.merges[i].arena);
+  }
+  cmd_scan_destroy(scan);
+  cmd_arena_release(&arena);
+  return status;
+}
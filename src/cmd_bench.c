@@ -0,0 +1,187 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include "bench.h"
+#include "cmd.h"
+#include "json_path.h"
+#include "ubench.h"
+
+enum { NROWS = 100000 };
+
+static char ndjson_path[] = "/tmp/cmd_bench_XXXXXX";
+
+static void ndjson_unlink(void) {
+  unlink(ndjson_path);
+}
+
+// bench_ndjson() written to a temp file once, removed at exit
+static astr ndjson_file(void) {
+  static astr text;
+  if (!text.data) {
+    text = bench_ndjson(bench_arena(), NROWS);
+    int fd = mkstemp(ndjson_path);
+    if (fd < 0 || write(fd, text.data, text.len) != text.len) {
+      perror("cmd_bench");
+      abort();
+    }
+    close(fd);
+    atexit(ndjson_unlink);
+  }
+  return text;
+}
+
+// Three fields per line resolved in one walk
+UBENCH(json_path, get_3_fields) {
+  astr text = ndjson_file();
+  astr paths[] = {astr("user.id"), astr("bytes"), astr("tags.1")};
+  JsonPaths *p = json_paths_compile(bench_arena(), paths, Countof(paths));
+  UBENCH_BYTES(ubench, text.len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    struct json vals[3];
+    isize n = 0;
+    astr lines = text;
+    for (astr line; cmd_next_line(&lines, &line);) {
+      json_paths_get(p, line, vals);
+      n += json_raw_length(vals[2]);
+    }
+    UBENCH_DO_NOT_OPTIMIZE(n);
+  }
+}
+
+// End to end on one thread: mmap, parse, TSV out to /dev/null
+UBENCH(cmd, extract_tsv) {
+  astr text = ndjson_file();
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  UBENCH_BYTES(ubench, text.len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    char *argv[] = {"extract", "-t", "1", "-f", "user.id", "-f", "bytes", "-f", "tags.1", ndjson_path};
+    UBENCH_DO_NOT_OPTIMIZE(cmd_extract_main(Countof(argv), argv, null));
+  }
+  close(null);
+}
+
+// Group by a skewed key, three aggregates, all groups in memory
+UBENCH(cmd, agg_by_user) {
+  astr text = ndjson_file();
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  UBENCH_BYTES(ubench, text.len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    char *argv[] = {"agg",   "-t",    "1",     "-b",      "user.id", "-c",
+                    "--sum", "bytes", "--max", "latency", ndjson_path};
+    UBENCH_DO_NOT_OPTIMIZE(cmd_agg_main(Countof(argv), argv, null));
+  }
+  close(null);
+}
+
+// Sort by a string key, spilling runs a quarter of the input long
+UBENCH(cmd, sort_by_user_spilled) {
+  astr text = ndjson_file();
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  char mem[32];
+  snprintf(mem, sizeof(mem), "%lld", (long long)text.len / 4);
+  UBENCH_BYTES(ubench, text.len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    char *argv[] = {"sort", "-t", "1", "-m", mem, "-k", "user.id", ndjson_path};
+    UBENCH_DO_NOT_OPTIMIZE(cmd_sort_main(Countof(argv), argv, null));
+  }
+  close(null);
+}
+
+// A thousand fixed strings; users u0..u99 match about a third of the lines
+UBENCH(cmd, grep_1000_patterns) {
+  astr text = ndjson_file();
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  char patterns[] = "/tmp/cmd_bench_XXXXXX";
+  FILE *f = fdopen(mkstemp(patterns), "w");
+  for (int i = 0; i < 1000; i++) {
+    if (i % 10)
+      fprintf(f, "\"bytes\":%d,\n", i * 97);
+    else
+      fprintf(f, "\"u%d\"\n", i / 10);
+  }
+  fclose(f);
+  UBENCH_BYTES(ubench, text.len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    char *argv[] = {"grep", "-t", "1", "-F", patterns, ndjson_path};
+    UBENCH_DO_NOT_OPTIMIZE(cmd_grep_main(Countof(argv), argv, null));
+  }
+  unlink(patterns);
+  close(null);
+}
+
+// Lines, words, characters and bytes on one thread: the I/O path plus the counting kernels
+UBENCH(cmd, wc_all_counts) {
+  astr text = ndjson_file();
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  UBENCH_BYTES(ubench, text.len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    char *argv[] = {"wc", "-t", "1", "-lwmc", ndjson_path};
+    UBENCH_DO_NOT_OPTIMIZE(cmd_wc_main(Countof(argv), argv, null));
+  }
+  close(null);
+}
+
+// NDJSON to CSV with the columns inferred from the first record
+UBENCH(cmd, convert_ndjson_to_csv) {
+  astr text = ndjson_file();
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  UBENCH_BYTES(ubench, text.len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    char *argv[] = {"convert", "-t", "1", "--from", "ndjson", ndjson_path};
+    UBENCH_DO_NOT_OPTIMIZE(cmd_convert_main(Countof(argv), argv, null));
+  }
+  close(null);
+}
+
+// CSV to NDJSON with numbers and booleans inferred, from the bench NDJSON flattened once
+UBENCH(cmd, convert_csv_to_ndjson) {
+  ndjson_file();
+  char csv_path[] = "/tmp/cmd_bench_XXXXXX";
+  int csv = mkstemp(csv_path);
+  char *to_csv[] = {"convert", "--from", "ndjson", "-f", "id", "-f", "user.id", "-f", "user.name",
+                    "-f", "bytes", "-f", "latency", "-f", "tags.0", "-f", "ok", ndjson_path};
+  cmd_convert_main(Countof(to_csv), to_csv, csv);
+  isize len = lseek(csv, 0, SEEK_END);
+  close(csv);
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  UBENCH_BYTES(ubench, len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    char *argv[] = {"convert", "-t", "1", "--from", "csv", csv_path};
+    UBENCH_DO_NOT_OPTIMIZE(cmd_convert_main(Countof(argv), argv, null));
+  }
+  unlink(csv_path);
+  close(null);
+}
+
+// Space-Saving over user ids, one thread: every line is one map lookup and a sift
+UBENCH(cmd, topk_user_id) {
+  astr text = ndjson_file();
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  UBENCH_BYTES(ubench, text.len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    char *argv[] = {"topk", "-t", "1", "--key", "user.id", "-k", "100", ndjson_path};
+    UBENCH_DO_NOT_OPTIMIZE(cmd_topk_main(Countof(argv), argv, null));
+  }
+  close(null);
+}
+
+// KLL sketch of one numeric field, one thread
+UBENCH(cmd, quantiles_bytes) {
+  astr text = ndjson_file();
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  UBENCH_BYTES(ubench, text.len);
+  UBENCH_ITEMS(ubench, NROWS);
+  UBENCH_LOOP(ubench) {
+    char *argv[] = {"quantiles", "-t", "1", "--field", "bytes", ndjson_path};
+    UBENCH_DO_NOT_OPTIMIZE(cmd_quantiles_main(Countof(argv), argv, null));
+  }
+  close(null);
+}
@@ -0,0 +1,326 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "arena_registry.h"
+#include "cmd.h"
+#include "csv.h"
+#include "json_path.h"
+#include "ketopt.h"
+
+typedef enum { CONVERT_NONE, CONVERT_CSV, CONVERT_NDJSON } ConvertFormat;
+
+typedef slice(astr) ConvertNames;
+
+typedef struct {
+  // CSV to NDJSON
+  astr *keys;  // `{"name":` for the first header column, `,"name":` for the others
+  int nkeys;
+  bool strings;  // Every field is a string, no numbers, booleans or nulls
+
+  // NDJSON to CSV: -f paths, or else top-level keys taken literally, dots included
+  JsonPaths *paths;
+  astr *names;
+  int ncolumns;
+} Convert;
+
+// Whether s is a json number, so an unquoted CSV field can be written as is
+static bool convert_is_number(astr s) {
+  isize i = s.len && s.data[0] == '-';
+  isize digits = i;
+  while (i < s.len && s.data[i] >= '0' && s.data[i] <= '9')
+    i++;
+  if (i == digits || (s.data[digits] == '0' && i - digits > 1))
+    return false;
+  if (i < s.len && s.data[i] == '.') {
+    digits = ++i;
+    while (i < s.len && s.data[i] >= '0' && s.data[i] <= '9')
+      i++;
+    if (i == digits)
+      return false;
+  }
+  if (i < s.len && (s.data[i] == 'e' || s.data[i] == 'E')) {
+    i += i + 1 < s.len && (s.data[i + 1] == '+' || s.data[i + 1] == '-');
+    digits = ++i;
+    while (i < s.len && s.data[i] >= '0' && s.data[i] <= '9')
+      i++;
+    if (i == digits)
+      return false;
+  }
+  return i == s.len;
+}
+
+// Whether an unquoted CSV field is a json number, true, false or null
+static bool convert_is_literal(astr s) {
+  if (!s.len)
+    return false;
+  if (s.data[0] == '-' || (s.data[0] >= '0' && s.data[0] <= '9'))
+    return convert_is_number(s);
+  if (s.len == 4)
+    return !memcmp(s.data, "true", 4) || !memcmp(s.data, "null", 4);
+  return s.len == 5 && !memcmp(s.data, "false", 5);
+}
+
+static void convert_csv_lines(void *ctx, astr lines, CmdSink *sink, Arena *scratch) {
+  Convert *c = ctx;
+  for (astr line; cmd_next_line(&lines, &line);) {
+    if (!line.len)
+      continue;
+    Arena tmp = *scratch;
+    isize pos = 0;
+    int col = 0;
+    for (CsvField f; csv_next_field(line, &pos, &f); col++) {
+      if (col < c->nkeys) {
+        cmd_sink_put(sink, c->keys[col]);
+      } else {
+        // Columns past the header are keyed by their position
+        cmd_sink_put(sink, astr_format(&tmp, "%c\"%d\":", col ? ',' : '{', col + 1));
+      }
+      astr text = f.escaped ? csv_unescape(&tmp, f.text) : f.text;
+      bool infer = !f.quoted && !c->strings;
+      if (infer && convert_is_literal(text))
+        cmd_sink_put(sink, text);
+      else if (infer && !text.len)
+        cmd_sink_put(sink, astr("null"));
+      else
+        cmd_sink_put_json(sink, text);
+    }
+    cmd_sink_put(sink, astr("}\n"));
+  }
+}
+
+/**
+ * Values of the top-level keys in c->names. Records from one producer
+ * usually repeat the first one's key order, so each key is tried against
+ * the column after the last match before the others.
+ */
+static void convert_get_names(const Convert *c, astr line, struct json *vals, Arena tmp) {
+  memset(vals, 0, c->ncolumns * sizeof(*vals));
+  struct json obj = json_parsen(line.data, line.len);
+  if (json_type(obj) != JSON_OBJECT)
+    return;
+  int col = 0;
+  for (struct json key = json_first(obj); json_exists(key); key = json_next(key)) {
+    struct json v = json_next(key);
+    astr name = {(char *)json_raw(key) + 1, (isize)json_raw_length(key) - 2};
+    if (json_string_is_escaped(key)) {
+      name.len = (isize)json_string_length(key);
+      name.data = New(&tmp, char, name.len + 1, NO_INIT);
+      json_string_copy(key, name.data, name.len + 1);
+    }
+    for (int i = 0; i < c->ncolumns; i++) {
+      int j = (col + i) % c->ncolumns;
+      if (astr_equals(name, c->names[j])) {
+        vals[j] = v;
+        col = j + 1;
+        break;
+      }
+    }
+    key = v;
+  }
+}
+
+static void convert_ndjson_lines(void *ctx, astr lines, CmdSink *sink, Arena *scratch) {
+  Convert *c = ctx;
+  int nfields = c->paths ? c->paths->nfields : c->ncolumns;
+  struct json *vals = New(scratch, struct json, nfields);
+  for (astr line; cmd_next_line(&lines, &line);) {
+    if (!line.len)
+      continue;
+    if (c->paths)
+      json_paths_get(c->paths, line, vals);
+    else
+      convert_get_names(c, line, vals, *scratch);
+    for (int f = 0; f < nfields; f++) {
+      if (f)
+        cmd_sink_putc(sink, ',');
+      struct json v = vals[f];
+      enum json_type type = json_type(v);
+      if (type == JSON_NULL)
+        continue;
+      astr raw = {(char *)json_raw(v), (isize)json_raw_length(v)};
+      if (type != JSON_STRING) {
+        sink->text = csv_cat(&sink->arena, sink->text, raw);
+        continue;
+      }
+      astr text = astr_slice(raw, 1, raw.len - 1);
+      if (json_string_is_escaped(v)) {
+        Arena tmp = *scratch;
+        text.len = (isize)json_string_length(v);
+        text.data = New(&tmp, char, text.len + 1, NO_INIT);
+        json_string_copy(v, text.data, text.len + 1);
+      }
+      sink->text = csv_cat(&sink->arena, sink->text, text);
+    }
+    cmd_sink_putc(sink, '\n');
+  }
+}
+
+// Keys of the file's CSV header, as json
+static bool convert_csv_header(Convert *c, Arena *arena, CmdInput *in) {
+  c->keys = NULL;
+  c->nkeys = 0;
+  astr header;
+  if (!cmd_input_line(in, &header))
+    return !in->err;
+  ConvertNames keys = {0};
+  isize pos = 0;
+  for (CsvField f; csv_next_field(header, &pos, &f);) {
+    astr name = f.escaped ? csv_unescape(arena, f.text) : f.text;
+    astr key = astr_cat_bytes(arena, (astr){0}, keys.len ? "," : "{", 1);
+    key = cmd_json_cat(arena, key, name);
+    *Push(arena, &keys) = astr_cat_bytes(arena, key, ":", 1);
+  }
+  c->keys = keys.data;
+  c->nkeys = (int)keys.len;
+  return true;
+}
+
+/**
+ * Columns from the top-level keys of the first record, which is converted
+ * and written with the header because it was taken from the input.
+ */
+static bool convert_infer_columns(Convert *c, Arena *arena, CmdInput *in, ConvertNames *columns, CmdOut *o) {
+  astr line = {0};
+  while (!line.len && cmd_input_line(in, &line)) {
+  }
+  if (!line.len)
+    return !in->err;
+  struct json obj = json_parsen(line.data, line.len);
+  if (json_type(obj) != JSON_OBJECT) {
+    fprintf(stderr, "cmd convert: %s: first record is not a json object\n", in->path);
+    return false;
+  }
+  line = astr_clone(arena, line);
+  for (struct json key = json_first(obj); json_exists(key); key = json_next(json_next(key))) {
+    isize len = (isize)json_string_length(key);
+    astr name = {New(arena, char, len + 1, NO_INIT), len};
+    json_string_copy(key, name.data, len + 1);
+    *Push(arena, columns) = name;
+  }
+  c->names = columns->data;
+  c->ncolumns = (int)columns->len;
+
+  // Scratch for the record's values and unescaped strings, then the output after it
+  isize size = (isize)columns->len * (isize)sizeof(struct json) + 2 * line.len + (isize)KB(4);
+  Arena scratch = arena_init(New(arena, byte, size, NO_INIT), size);
+  CmdSink sink = {*arena, {0}};
+  for (isize i = 0; i < columns->len; i++) {
+    sink.text = csv_cat(&sink.arena, sink.text, columns->data[i]);
+    cmd_sink_putc(&sink, i + 1 < columns->len ? ',' : '\n');
+  }
+  convert_ndjson_lines(c, line, &sink, &scratch);
+  cmd_out_push(o, sink.text);
+  return cmd_out_flush(o);
+}
+
+static int convert_usage(FILE *f) {
+  fputs(
+      "usage: cmd convert --from csv|ndjson [--to ndjson|csv] [options] [FILE ...]\n"
+      "Convert CSV with a header row to NDJSON, or NDJSON to CSV.\n"
+      "      --from FORMAT     csv or ndjson\n"
+      "      --to FORMAT       the other one by default\n"
+      "  -f, --field PATH      NDJSON to CSV: a column such as user.id (repeatable;\n"
+      "                        default: the top-level keys of the first record,\n"
+      "                        matched literally)\n"
+      "      --strings         CSV to NDJSON: every field is a string; otherwise\n"
+      "                        unquoted numbers, true, false and null are kept as\n"
+      "                        json and empty unquoted fields are null\n"
+      "  -t, --threads N       worker threads (default: one per CPU)\n"
+      "Each file's CSV header names its columns; fields past it are keyed by\n"
+      "their 1-based position. Quoted CSV fields cannot span lines.\n",
+      f);
+  return f == stdout ? 0 : 2;
+}
+
+static bool convert_parse_format(const char *s, ConvertFormat *format) {
+  *format = !strcmp(s, "csv") ? CONVERT_CSV : !strcmp(s, "ndjson") ? CONVERT_NDJSON : CONVERT_NONE;
+  return *format != CONVERT_NONE;
+}
+
+int cmd_convert_main(int argc, char *argv[], int out) {
+  enum { OPT_FROM = 301, OPT_TO, OPT_STRINGS };
+  static const ko_longopt_t longopts[] = {
+      {"from", ko_required_argument, OPT_FROM},  {"to", ko_required_argument, OPT_TO},
+      {"field", ko_required_argument, 'f'},      {"strings", ko_no_argument, OPT_STRINGS},
+      {"threads", ko_required_argument, 't'},    {"help", ko_no_argument, 'h'},
+      {0},
+  };
+  Arena arena = cmd_arena_init(GB(1));
+  arena_register(&arena, "cmd.convert");
+  ConvertFormat from = CONVERT_NONE, to = CONVERT_NONE;
+  ConvertNames columns = {0};
+  Convert c = {0};
+  int threads = 0;
+
+  ketopt_t opt = KETOPT_INIT;
+  for (int ch; (ch = ketopt(&opt, argc, argv, 1, "f:t:h", longopts)) >= 0;) {
+    if (ch == OPT_FROM || ch == OPT_TO) {
+      if (!convert_parse_format(opt.arg, ch == OPT_FROM ? &from : &to)) {
+        fprintf(stderr, "cmd convert: unknown format %s\n", opt.arg);
+        cmd_arena_release(&arena);
+        return convert_usage(stderr);
+      }
+    } else if (ch == 'f') {
+      *Push(&arena, &columns) = astr_from_cstr(&arena, opt.arg);
+    } else if (ch == OPT_STRINGS) {
+      c.strings = true;
+    } else if (ch == 't') {
+      threads = atoi(opt.arg);
+    } else if (ch == 'h') {
+      cmd_arena_release(&arena);
+      return convert_usage(stdout);
+    } else {
+      cmd_arena_release(&arena);
+      return convert_usage(stderr);
+    }
+  }
+  if (!from && to)
+    from = to == CONVERT_CSV ? CONVERT_NDJSON : CONVERT_CSV;
+  if (from && !to)
+    to = from == CONVERT_CSV ? CONVERT_NDJSON : CONVERT_CSV;
+  if (!from || from == to) {
+    fputs("cmd convert: --from csv or --from ndjson is required\n", stderr);
+    cmd_arena_release(&arena);
+    return convert_usage(stderr);
+  }
+
+  CmdOut o = cmd_out_init(out);
+  if (from == CONVERT_NDJSON && columns.len) {
+    c.paths = json_paths_compile(&arena, columns.data, (int)columns.len);
+    astr header = {0};
+    for (isize i = 0; i < columns.len; i++) {
+      header = csv_cat(&arena, header, columns.data[i]);
+      header = astr_cat_bytes(&arena, header, i + 1 < columns.len ? "," : "\n", 1);
+    }
+    cmd_out_push(&o, header);
+    cmd_out_flush(&o);
+  }
+
+  CmdScan *scan = cmd_scan_create(&arena, (CmdScanOptions){.threads = threads, .out = &o});
+  int status = 0;
+  for (int i = opt.ind; i < argc || (i == opt.ind && i == argc); i++) {
+    CmdInput in;
+    if (!cmd_input_open(&in, i < argc ? argv[i] : NULL)) {
+      status = 1;
+      continue;
+    }
+    bool ok;
+    if (from == CONVERT_CSV)
+      ok = convert_csv_header(&c, &arena, &in) && cmd_scan(scan, &in, convert_csv_lines, &c);
+    else
+      ok = columns.len || convert_infer_columns(&c, &arena, &in, &columns, &o);
+    // Until a record names the columns, the input holds blank lines only
+    if (ok && from == CONVERT_NDJSON && columns.len)
+      ok = cmd_scan(scan, &in, convert_ndjson_lines, &c);
+    if (!ok)
+      status = 1;
+    cmd_input_close(&in);
+    if (o.err)
+      break;
+  }
+  cmd_scan_destroy(scan);
+  if (o.err)
+    fprintf(stderr, "cmd convert: write: %s\n", strerror(o.err));
+  cmd_arena_release(&arena);
+  return status;
+}
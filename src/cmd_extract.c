@@ -0,0 +1,124 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "arena_registry.h"
+#include "cmd.h"
+#include "json_path.h"
+#include "ketopt.h"
+
+typedef struct {
+  JsonPaths *paths;
+  bool ndjson;
+  astr *keys;  // NDJSON: `"path":` per field, with the separator before it
+} Extract;
+
+static void extract_lines(void *ctx, astr lines, CmdSink *sink, Arena *scratch) {
+  Extract *x = ctx;
+  int nfields = x->paths->nfields;
+  struct json *vals = New(scratch, struct json, nfields);
+  for (astr line; cmd_next_line(&lines, &line);) {
+    if (!line.len)
+      continue;
+    json_paths_get(x->paths, line, vals);
+    for (int f = 0; f < nfields; f++) {
+      struct json v = vals[f];
+      if (x->ndjson) {
+        cmd_sink_put(sink, x->keys[f]);
+        cmd_sink_put(sink, json_exists(v) ? (astr){(char *)json_raw(v), json_raw_length(v)} : astr("null"));
+        continue;
+      }
+      if (f)
+        cmd_sink_putc(sink, '\t');
+      sink->text = cmd_json_tsv(&sink->arena, sink->text, v);
+    }
+    if (x->ndjson)
+      cmd_sink_putc(sink, '}');
+    cmd_sink_putc(sink, '\n');
+  }
+}
+
+static int extract_usage(FILE *f) {
+  fputs(
+      "usage: cmd extract -f PATH [-f PATH ...] [options] [FILE ...]\n"
+      "Print json fields of every NDJSON line, reading stdin without files.\n"
+      "  -f, --field PATH      dotted path such as user.name or tags.0 (repeatable)\n"
+      "  -o, --format FORMAT   tsv (default) or ndjson\n"
+      "  -H, --header          print the paths as a first TSV row\n"
+      "  -t, --threads N       worker threads (default: one per CPU)\n",
+      f);
+  return f == stdout ? 0 : 2;
+}
+
+int cmd_extract_main(int argc, char *argv[], int out) {
+  static const ko_longopt_t longopts[] = {
+      {"field", ko_required_argument, 'f'}, {"format", ko_required_argument, 'o'},
+      {"header", ko_no_argument, 'H'},      {"threads", ko_required_argument, 't'},
+      {"help", ko_no_argument, 'h'},        {0},
+  };
+  Arena arena = cmd_arena_init(GB(1));
+  arena_register(&arena, "cmd.extract");
+  slice(astr) fields = {0};
+  bool ndjson = false, header = false;
+  int threads = 0;
+
+  ketopt_t opt = KETOPT_INIT;
+  for (int c; (c = ketopt(&opt, argc, argv, 1, "f:o:Ht:h", longopts)) >= 0;) {
+    if (c == 'f') {
+      *Push(&arena, &fields) = astr_from_cstr(&arena, opt.arg);
+    } else if (c == 'o' && (!strcmp(opt.arg, "tsv") || !strcmp(opt.arg, "ndjson"))) {
+      ndjson = !strcmp(opt.arg, "ndjson");
+    } else if (c == 't') {
+      threads = atoi(opt.arg);
+    } else if (c == 'H') {
+      header = true;
+    } else if (c == 'h') {
+      cmd_arena_release(&arena);
+      return extract_usage(stdout);
+    } else {
+      cmd_arena_release(&arena);
+      return extract_usage(stderr);
+    }
+  }
+  if (!fields.len) {
+    fputs("cmd extract: at least one -f PATH is required\n", stderr);
+    cmd_arena_release(&arena);
+    return extract_usage(stderr);
+  }
+
+  Extract x = {json_paths_compile(&arena, fields.data, (int)fields.len), ndjson,
+               New(&arena, astr, fields.len)};
+  for (isize f = 0; f < fields.len; f++) {
+    char buf[1024];
+    size_t n = json_escapen(fields.data[f].data, fields.data[f].len, buf, sizeof(buf));
+    x.keys[f] = astr_format(&arena, "%s%.*s:", f ? "," : "{", (int)Min(n, sizeof(buf) - 1), buf);
+  }
+
+  CmdOut o = cmd_out_init(out);
+  if (header && !ndjson) {
+    astr row = {0};
+    for (isize f = 0; f < fields.len; f++) {
+      row = astr_cat_bytes(&arena, row, f ? "\t" : "", f ? 1 : 0);
+      row = astr_concat(&arena, row, fields.data[f]);
+    }
+    cmd_out_push(&o, astr_cat_bytes(&arena, row, "\n", 1));
+    cmd_out_flush(&o);
+  }
+
+  CmdScan *scan = cmd_scan_create(&arena, (CmdScanOptions){.threads = threads, .out = &o});
+  int status = 0;
+  for (int i = opt.ind; i < argc || (i == opt.ind && i == argc); i++) {
+    CmdInput in;
+    if (!cmd_input_open(&in, i < argc ? argv[i] : NULL)) {
+      status = 1;
+      continue;
+    }
+    if (!cmd_scan(scan, &in, extract_lines, &x))
+      status = 1;
+    cmd_input_close(&in);
+    if (o.err)
+      break;
+  }
+  cmd_scan_destroy(scan);
+  cmd_arena_release(&arena);
+  return status;
+}
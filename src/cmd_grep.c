@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "aho.h"
+#include "arena_registry.h"
+#include "cmd.h"
+#include "ketopt.h"
+
+typedef slice(astr) GrepPatterns;
+
+typedef struct {
+  const Aho *aho;
+  bool ids;      // Print the ids of the patterns found in each line
+  astr prefix;   // "path\t" when there are several files
+} Grep;
+
+static void grep_lines(void *ctx, astr lines, CmdSink *sink, Arena *scratch) {
+  Grep *g = ctx;
+  const Aho *a = g->aho;
+  // Number of the line each pattern was last printed for: ids print once per line
+  isize *seen = g->ids ? New(scratch, isize, Max(a->npatterns, 1)) : NULL;
+  isize nline = 0;
+  int32_t state = 0;
+  for (isize pos = 0; pos < lines.len;) {
+    pos += aho_find(a, astr_slice(lines, pos, lines.len), &state);
+    if (!aho_accepts(a, state))
+      break;
+
+    // A pattern ends at pos - 1: find its line and the others in it
+    char *nl = memrchr(lines.data, '\n', pos - 1);
+    isize beg = nl ? nl - lines.data + 1 : 0;
+    nl = memchr(lines.data + pos, '\n', lines.len - pos);
+    isize end = nl ? nl - lines.data : lines.len;
+    cmd_sink_put(sink, g->prefix);
+    if (g->ids) {
+      nline++;
+      bool sep = false;
+      for (isize at = pos;;) {
+        for (AhoMatch m = {state, -1}; aho_next_match(a, &m);) {
+          if (seen[m.pattern] == nline)
+            continue;
+          seen[m.pattern] = nline;
+          char id[16];
+          int len = snprintf(id, sizeof(id), sep ? ",%d" : "%d", m.pattern + 1);
+          cmd_sink_put(sink, (astr){id, len});
+          sep = true;
+        }
+        if (at >= end)
+          break;
+        at += aho_find(a, astr_slice(lines, at, end), &state);
+      }
+      cmd_sink_putc(sink, '\t');
+    }
+    cmd_sink_put(sink, astr_slice(lines, beg, end));
+    cmd_sink_putc(sink, '\n');
+    pos = end + 1;
+    state = 0;
+  }
+}
+
+// Append the lines of a patterns file, copied into arena
+static bool grep_read_patterns(Arena *arena, GrepPatterns *patterns, const char *path) {
+  CmdInput in;
+  if (!cmd_input_open(&in, path))
+    return false;
+  astr window;
+  while (cmd_input_next(&in, CMD_CHUNK_SIZE, &window)) {
+    astr lines = astr_clone(arena, window);
+    for (astr line; cmd_next_line(&lines, &line);) {
+      *Push(arena, patterns) = line;
+    }
+  }
+  bool ok = !in.err;
+  if (in.err)
+    fprintf(stderr, "cmd: %s: %s\n", in.path, strerror(in.err));
+  cmd_input_close(&in);
+  return ok;
+}
+
+static int grep_usage(FILE *f) {
+  fputs(
+      "usage: cmd grep -F PATTERNS_FILE [-e PATTERN ...] [options] [FILE ...]\n"
+      "Print lines that contain any of the fixed strings, each preceded by the\n"
+      "ids of the strings it contains: their line numbers in PATTERNS_FILE, then\n"
+      "the -e patterns counting on from there. Empty patterns are ignored.\n"
+      "  -F, --patterns FILE   one fixed string per line\n"
+      "  -e, --regexp PATTERN  a fixed string (repeatable)\n"
+      "  -i, --ignore-case     ASCII letters match either case\n"
+      "      --no-ids          print the matching lines only\n"
+      "  -t, --threads N       worker threads (default: one per CPU)\n"
+      "With several files, every line starts with its file name and a tab.\n",
+      f);
+  return f == stdout ? 0 : 2;
+}
+
+int cmd_grep_main(int argc, char *argv[], int out) {
+  enum { OPT_NO_IDS = 301 };
+  static const ko_longopt_t longopts[] = {
+      {"patterns", ko_required_argument, 'F'}, {"regexp", ko_required_argument, 'e'},
+      {"ignore-case", ko_no_argument, 'i'},    {"no-ids", ko_no_argument, OPT_NO_IDS},
+      {"threads", ko_required_argument, 't'},  {"help", ko_no_argument, 'h'},
+      {0},
+  };
+  Arena arena = cmd_arena_init(GB(1));
+  arena_register(&arena, "cmd.grep");
+  GrepPatterns files = {0}, inline_patterns = {0};  // Views of argv
+  Grep g = {.ids = true};
+  AhoOptions aho = {0};
+  int threads = 0;
+
+  ketopt_t opt = KETOPT_INIT;
+  for (int c; (c = ketopt(&opt, argc, argv, 1, "F:e:it:h", longopts)) >= 0;) {
+    if (c == 'F') {
+      *Push(&arena, &files) = (astr){opt.arg, strlen(opt.arg)};
+    } else if (c == 'e') {
+      *Push(&arena, &inline_patterns) = (astr){opt.arg, strlen(opt.arg)};
+    } else if (c == 'i') {
+      aho.ignore_case = true;
+    } else if (c == OPT_NO_IDS) {
+      g.ids = false;
+    } else if (c == 't') {
+      threads = atoi(opt.arg);
+    } else if (c == 'h') {
+      cmd_arena_release(&arena);
+      return grep_usage(stdout);
+    } else {
+      cmd_arena_release(&arena);
+      return grep_usage(stderr);
+    }
+  }
+  if (!files.len && !inline_patterns.len) {
+    fputs("cmd grep: -F PATTERNS_FILE or -e PATTERN is required\n", stderr);
+    cmd_arena_release(&arena);
+    return grep_usage(stderr);
+  }
+
+  GrepPatterns patterns = {0};
+  for (isize i = 0; i < files.len; i++) {
+    if (!grep_read_patterns(&arena, &patterns, files.data[i].data)) {
+      cmd_arena_release(&arena);
+      return 1;
+    }
+  }
+  for (isize i = 0; i < inline_patterns.len; i++) {
+    *Push(&arena, &patterns) = inline_patterns.data[i];
+  }
+  g.aho = aho_compile(&arena, patterns.data, (int)patterns.len, aho);
+
+  CmdOut o = cmd_out_init(out);
+  CmdScan *scan = cmd_scan_create(&arena, (CmdScanOptions){.threads = threads, .out = &o});
+  int status = 0;
+  for (int i = opt.ind; i < argc || (i == opt.ind && i == argc); i++) {
+    CmdInput in;
+    if (!cmd_input_open(&in, i < argc ? argv[i] : NULL)) {
+      status = 1;
+      continue;
+    }
+    if (argc - opt.ind > 1)
+      g.prefix = astr_format(&arena, "%s\t", in.path);
+    if (!cmd_scan(scan, &in, grep_lines, &g))
+      status = 1;
+    cmd_input_close(&in);
+    if (o.err)
+      break;
+  }
+  cmd_scan_destroy(scan);
+  cmd_arena_release(&arena);
+  return status;
+}
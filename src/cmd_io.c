@@ -0,0 +1,520 @@
+#include "cmd.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena_registry.h"
+#include "parallel.h"
+
+/* --- Arenas --- */
+
+Arena cmd_arena_init(isize size) {
+#ifdef OOM_COMMIT
+  Arena arena = arena_init(NULL, size);
+#else
+  byte *mem = malloc(size);
+  if (!mem) {
+    perror("cmd_arena_init malloc");
+    abort();
+  }
+  Arena arena = arena_init(mem, size);
+#endif
+  return arena;
+}
+
+void cmd_arena_release(Arena *arena) {
+#ifndef OOM_COMMIT
+  free(arena->beg);
+#endif
+  arena_release(arena);
+}
+
+bool cmd_parse_size(const char *s, isize *size) {
+  char *end;
+  errno = 0;
+  long long n = strtoll(s, &end, 10);
+  if (errno || end == s || n <= 0)
+    return false;
+  const char *units = "KMGT";
+  const char *unit = *end ? strchr(units, toupper((unsigned char)*end)) : NULL;
+  if (*end && (!unit || end[1]))
+    return false;
+  for (isize i = 0; unit && i <= unit - units; i++) {
+    if (n > LLONG_MAX / 1024)
+      return false;
+    n *= 1024;
+  }
+  *size = (isize)n;
+  return true;
+}
+
+bool cmd_parse_number(astr s, double *x) {
+  char buf[64];
+  if (s.len <= 0 || s.len >= (isize)sizeof(buf))
+    return false;
+  memcpy(buf, s.data, s.len);
+  buf[s.len] = 0;
+  char *end;
+  *x = strtod(buf, &end);
+  return end == buf + s.len && *x == *x;
+}
+
+/* --- Input --- */
+
+// Initial buffer for streamed input; it grows to the largest window asked for
+enum { CMD_STREAM_BUF = 1 << 16 };
+
+bool cmd_input_open(CmdInput *in, const char *path) {
+  *in = (CmdInput){.path = path && strcmp(path, "-") ? path : "-"};
+  in->fd = in->path[0] == '-' && !in->path[1] ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+  if (in->fd < 0) {
+    fprintf(stderr, "cmd: %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (!fstat(in->fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      in->map = map;
+      in->map_len = st.st_size;
+    }
+  }
+  return true;
+}
+
+static bool cmd_input_next_mapped(CmdInput *in, isize want, astr *window) {
+  // The previous window is done with: let its pages go
+  isize page = (isize)sysconf(_SC_PAGESIZE);
+  isize done = in->pos & ~(page - 1);
+  if (done > in->released) {
+    madvise(in->map + in->released, done - in->released, MADV_DONTNEED);
+    in->released = done;
+  }
+
+  if (in->pos >= in->map_len)
+    return false;
+  isize end = Min(in->pos + Max(want, 1), in->map_len);
+  byte *nl = end < in->map_len ? memchr(in->map + end - 1, '\n', in->map_len - end + 1) : NULL;
+  end = nl ? nl - in->map + 1 : in->map_len;
+  *window = (astr){(char *)in->map + in->pos, end - in->pos};
+  in->pos = end;
+  return true;
+}
+
+// With first, cut after the first newline instead of the last
+static bool cmd_input_next_stream(CmdInput *in, isize want, bool first, astr *window) {
+  // Keep the unconsumed tail, a partial line
+  in->len -= in->start;
+  memmove(in->buf, in->buf + in->start, in->len);
+  in->start = 0;
+
+  isize scanned = 0;  // Bytes of buf known to hold no newline
+  byte *nl = first && in->len ? memchr(in->buf, '\n', in->len) : NULL;
+  if (nl) {
+    // A line left over from the last read
+    *window = (astr){(char *)in->buf, nl - in->buf + 1};
+    in->start = window->len;
+    return true;
+  }
+  scanned = first ? in->len : 0;
+  for (;;) {
+    if (in->cap < want || in->cap - in->len < CMD_STREAM_BUF / 2) {
+      isize cap = Max(Max(in->cap * 2, want), (isize)CMD_STREAM_BUF);
+      byte *buf = realloc(in->buf, cap);
+      if (!buf) {
+        in->err = ENOMEM;
+        return false;
+      }
+      in->buf = buf;
+      in->cap = cap;
+    }
+    isize n = read(in->fd, in->buf + in->len, in->cap - in->len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      in->err = errno;
+      return false;
+    }
+    bool full = n == in->cap - in->len;
+    in->len += n;
+    if (n == 0) {
+      in->eof = true;
+      *window = (astr){(char *)in->buf, in->len};
+      in->start = in->len;
+      return in->len > 0;
+    }
+
+    // Enough for a window, or all that is ready: cut after the last newline
+    if (first || in->len >= want || !full) {
+      byte *nl = first ? memchr(in->buf + scanned, '\n', in->len - scanned)
+                       : memrchr(in->buf + scanned, '\n', in->len - scanned);
+      if (nl) {
+        *window = (astr){(char *)in->buf, nl - in->buf + 1};
+        in->start = window->len;
+        return true;
+      }
+      scanned = in->len;
+    }
+  }
+}
+
+bool cmd_input_next(CmdInput *in, isize want, astr *window) {
+  if (in->err || in->eof)
+    return false;
+  return in->map ? cmd_input_next_mapped(in, want, window) : cmd_input_next_stream(in, want, false, window);
+}
+
+bool cmd_input_line(CmdInput *in, astr *line) {
+  astr window;
+  if (in->err || in->eof)
+    return false;
+  // A mapped window of one byte ends at the first newline
+  if (!(in->map ? cmd_input_next_mapped(in, 1, &window) : cmd_input_next_stream(in, 1, true, &window)))
+    return false;
+  return cmd_next_line(&window, line);
+}
+
+void cmd_input_close(CmdInput *in) {
+  if (in->map)
+    munmap(in->map, in->map_len);
+  free(in->buf);
+  if (in->fd > STDIN_FILENO)
+    close(in->fd);
+  *in = (CmdInput){.fd = -1};
+}
+
+/* --- Output --- */
+
+bool cmd_out_flush(CmdOut *out) {
+  struct iovec *iov = out->iov;
+  int n = out->niov;
+  out->niov = 0;
+  while (n > 0 && !out->err) {
+    ssize_t wrote = writev(out->fd, iov, Min(n, IOV_MAX));
+    if (wrote < 0) {
+      if (errno != EINTR)
+        out->err = errno;
+      continue;
+    }
+    // Skip what was written, resuming mid-view after a short write
+    while (n > 0 && (size_t)wrote >= iov->iov_len) {
+      wrote -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (byte *)iov->iov_base + wrote;
+      iov->iov_len -= wrote;
+    }
+  }
+  return !out->err;
+}
+
+/* --- TSV and JSON --- */
+
+// Escape for a TSV special, or NULL
+static inline const char *cmd_tsv_escape(char c) {
+  return c == '\t' ? "\\t" : c == '\n' ? "\\n" : c == '\r' ? "\\r" : c == '\\' ? "\\\\" : NULL;
+}
+
+astr cmd_tsv_cat(Arena *arena, astr head, astr s) {
+  isize run = 0;
+  for (isize i = 0; i < s.len; i++) {
+    const char *esc = cmd_tsv_escape(s.data[i]);
+    if (esc) {
+      head = astr_cat_bytes(arena, head, s.data + run, i - run);
+      head = astr_cat_bytes(arena, head, esc, 2);
+      run = i + 1;
+    }
+  }
+  return astr_cat_bytes(arena, head, s.data + run, s.len - run);
+}
+
+astr cmd_json_tsv(Arena *arena, astr head, struct json v) {
+  enum json_type type = json_type(v);
+  if (type == JSON_NULL)
+    return head;
+  const char *raw = json_raw(v);
+  isize len = (isize)json_raw_length(v);
+  if (type != JSON_STRING)
+    return astr_cat_bytes(arena, head, raw, len);
+  // No escapes in the json means no tab, newline or backslash either
+  if (ARENA_LIKELY(!json_string_is_escaped(v)))
+    return astr_cat_bytes(arena, head, raw + 1, len - 2);
+
+  // Unescape at the tip, then widen the specials in place from the back
+  head = astr_clone(arena, head);
+  isize n = (isize)json_string_length(v);
+  char *s = New(arena, char, n + 1, NO_INIT);
+  json_string_copy(v, s, n + 1);
+  arena->cur--;
+  isize extra = 0;
+  for (isize i = 0; i < n; i++) {
+    extra += cmd_tsv_escape(s[i]) != NULL;
+  }
+  if (extra) {
+    New(arena, char, extra, NO_INIT);
+    for (isize i = n - 1, o = n + extra - 1; i >= 0; i--) {
+      const char *esc = cmd_tsv_escape(s[i]);
+      s[o--] = esc ? esc[1] : s[i];
+      if (esc)
+        s[o--] = '\\';
+    }
+  }
+  return head.len ? (astr){head.data, head.len + n + extra} : (astr){s, n + extra};
+}
+
+astr cmd_json_cat(Arena *arena, astr head, astr s) {
+  head = astr_clone(arena, head);
+  if (cmd_json_plain(s)) {
+    char *p = New(arena, char, s.len + 2, NO_INIT);
+    p[0] = '"';
+    memcpy(p + 1, s.data, s.len);
+    p[s.len + 1] = '"';
+    return head.len ? (astr){head.data, head.len + s.len + 2} : (astr){p, s.len + 2};
+  }
+
+  // At most 6 bytes per input byte ("\u001f"), the quotes and a terminator
+  isize cap = 6 * s.len + 3;
+  char *esc = New(arena, char, cap, NO_INIT);
+  isize n = (isize)json_escapen(s.data, s.len, esc, cap);
+  arena->cur -= cap - n;
+  return head.len ? (astr){head.data, head.len + n} : (astr){esc, n};
+}
+
+astr cmd_csv_tsv(Arena *arena, astr head, CsvField f) {
+  if (ARENA_LIKELY(!f.escaped))
+    return cmd_tsv_cat(arena, head, f.text);
+  // Each doubled quote ends a run, which goes out with one of the quotes
+  isize run = 0;
+  for (isize i = 0; i + 1 < f.text.len; i++) {
+    if (f.text.data[i] == '"' && f.text.data[i + 1] == '"') {
+      head = cmd_tsv_cat(arena, head, (astr){f.text.data + run, i + 1 - run});
+      run = ++i + 1;
+    }
+  }
+  return cmd_tsv_cat(arena, head, (astr){f.text.data + run, f.text.len - run});
+}
+
+astr cmd_json_key(Arena *arena, const struct json *vals, int n) {
+  astr key = {0};
+  for (int i = 0; i < n; i++) {
+    key = i ? astr_cat_bytes(arena, key, "\t", 1) : key;
+    key = cmd_json_tsv(arena, key, vals[i]);
+  }
+  return key;
+}
+
+astr cmd_csv_key(Arena *arena, const CsvField *fields, const int *cols, int n) {
+  astr key = {0};
+  for (int i = 0; i < n; i++) {
+    key = i ? astr_cat_bytes(arena, key, "\t", 1) : key;
+    key = cmd_csv_tsv(arena, key, fields[cols[i]]);
+  }
+  return key;
+}
+
+/* --- CSV --- */
+
+void cmd_csv_fields(astr record, CsvField *fields, int n) {
+  isize pos = 0;
+  int i = 0;
+  while (i < n && csv_next_field(record, &pos, &fields[i]))
+    i++;
+  for (; i < n; i++) {
+    fields[i] = (CsvField){0};
+  }
+}
+
+int cmd_csv_columns(astr header, const astr *names, int n, int *cols, Arena scratch) {
+  for (int i = 0; i < n; i++) {
+    cols[i] = -1;
+  }
+  isize pos = 0;
+  int col = 0;
+  for (CsvField f; csv_next_field(header, &pos, &f); col++) {
+    astr name = f.escaped ? csv_unescape(&scratch, f.text) : f.text;
+    for (int i = 0; i < n; i++) {
+      if (cols[i] < 0 && astr_equals(name, names[i]))
+        cols[i] = col;
+    }
+  }
+  int ncols = 0;
+  for (int i = 0; i < n; i++) {
+    if (cols[i] < 0)
+      return 0;
+    ncols = Max(ncols, cols[i] + 1);
+  }
+  return ncols;
+}
+
+int cmd_csv_header(CmdInput *in, const char *tool, const astr *names, int n, int *cols, Arena scratch) {
+  astr header;
+  if (!cmd_input_line(in, &header)) {
+    if (!in->err)
+      return 0;
+    fprintf(stderr, "cmd %s: %s: %s\n", tool, in->path, strerror(in->err));
+    return -1;
+  }
+  int ncols = cmd_csv_columns(header, names, n, cols, scratch);
+  for (int i = 0; !ncols && i < n; i++) {
+    if (cols[i] < 0) {
+      fprintf(stderr, "cmd %s: %s: no column %.*s\n", tool, in->path, S(names[i]));
+      return -1;
+    }
+  }
+  return ncols;
+}
+
+/* --- Temp file runs --- */
+
+void cmd_run_reader_init(CmdRunReader *r, int fd, isize off, isize end) {
+  if (!r->buf) {
+    r->cap = CMD_RUN_BUF;
+    r->buf = malloc(r->cap);
+    if (!r->buf) {
+      perror("cmd_run_reader_init malloc");
+      abort();
+    }
+  }
+  r->fd = fd;
+  r->off = off;
+  r->end = end;
+  r->len = r->pos = 0;
+  r->err = 0;
+}
+
+bool cmd_run_reader_want(CmdRunReader *r, isize n) {
+  if (r->len - r->pos >= n)
+    return true;
+  memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+  r->len -= r->pos;
+  r->pos = 0;
+  if (n > r->cap) {
+    r->cap = Max(n, 2 * r->cap);
+    byte *buf = realloc(r->buf, r->cap);
+    if (!buf) {
+      perror("cmd_run_reader_want realloc");
+      abort();
+    }
+    r->buf = buf;
+  }
+  while (r->len < n && r->off < r->end) {
+    ssize_t got = pread(r->fd, r->buf + r->len, Min(r->cap - r->len, r->end - r->off), r->off);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0) {
+      r->err = got < 0 ? errno : EIO;
+      return false;
+    }
+    r->len += got;
+    r->off += got;
+  }
+  if (r->off < r->end)
+    posix_fadvise(r->fd, r->off, Min(r->cap, r->end - r->off), POSIX_FADV_WILLNEED);
+  return r->len - r->pos >= n;
+}
+
+void cmd_run_reader_free(CmdRunReader *r) {
+  free(r->buf);
+  *r = (CmdRunReader){0};
+}
+
+/* --- Parallel line scans --- */
+
+struct CmdScan {
+  Pool *pool;
+  isize chunk_size;
+  CmdOut *out;
+  int nslots;
+  CmdSink *sinks;  // One per slot, NULL without output
+  astr *chunks;    // Current batch
+};
+
+typedef struct {
+  CmdScan *scan;
+  CmdLinesFn fn;
+  void *ctx;
+} CmdScanJob;
+
+CmdScan *cmd_scan_create(Arena *arena, CmdScanOptions opts) {
+  CmdScan *s = New(arena, CmdScan);
+  s->pool = pool_create(arena, (PoolOptions){.nthreads = opts.threads});
+  s->chunk_size = opts.chunk_size > 0 ? opts.chunk_size : (isize)CMD_CHUNK_SIZE;
+  s->out = opts.out;
+  s->nslots = pool_size(s->pool) * CMD_CHUNKS_PER_THREAD;
+  s->chunks = New(arena, astr, s->nslots);
+  if (s->out) {
+    s->sinks = New(arena, CmdSink, s->nslots);
+    for (int i = 0; i < s->nslots; i++) {
+      s->sinks[i].arena = cmd_arena_init(CMD_SINK_SIZE);
+      arena_register(&s->sinks[i].arena, "cmd.sink");
+    }
+  }
+  return s;
+}
+
+static void cmd_scan_chunks(void *arg, isize beg, isize end, Arena *scratch) {
+  CmdScanJob *job = arg;
+  CmdScan *s = job->scan;
+  // Grain 1: one chunk per call, and scratch is reset between chunks
+  job->fn(job->ctx, s->chunks[beg], s->sinks ? &s->sinks[beg] : NULL, scratch);
+}
+
+bool cmd_scan(CmdScan *s, CmdInput *in, CmdLinesFn fn, void *ctx) {
+  CmdScanJob job = {s, fn, ctx};
+  astr window;
+  while (cmd_input_next(in, s->chunk_size * s->nslots, &window)) {
+    // Equal shares of the window, each ending on a line boundary
+    isize share = Max((window.len + s->nslots - 1) / s->nslots, (isize)1);
+    int n = 0;
+    for (isize pos = 0; pos < window.len; n++) {
+      isize end = Min(pos + share, window.len);
+      char *nl = memchr(window.data + end - 1, '\n', window.len - end + 1);
+      end = nl ? nl - window.data + 1 : window.len;
+      s->chunks[n] = (astr){window.data + pos, end - pos};
+      pos = end;
+    }
+    for (int i = 0; s->sinks && i < n; i++) {
+      arena_reset(&s->sinks[i].arena);
+      s->sinks[i].text = (astr){0};
+    }
+
+    parallel_for(s->pool, n, 1, cmd_scan_chunks, &job);
+
+    if (s->out) {
+      for (int i = 0; i < n; i++) {
+        cmd_out_push(s->out, s->sinks[i].text);
+      }
+      if (!cmd_out_flush(s->out)) {
+        fprintf(stderr, "cmd: write: %s\n", strerror(s->out->err));
+        return false;
+      }
+    }
+  }
+  if (in->err) {
+    fprintf(stderr, "cmd: %s: %s\n", in->path, strerror(in->err));
+    return false;
+  }
+  return true;
+}
+
+int cmd_scan_threads(const CmdScan *s) {
+  return pool_size(s->pool);
+}
+
+Pool *cmd_scan_pool(const CmdScan *s) {
+  return s->pool;
+}
+
+void cmd_scan_destroy(CmdScan *s) {
+  pool_destroy(s->pool);
+  for (int i = 0; s->sinks && i < s->nslots; i++) {
+    cmd_arena_release(&s->sinks[i].arena);
+  }
+}
@@ -0,0 +1,194 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "arena_registry.h"
+#include "cmd.h"
+#include "csv.h"
+#include "json_path.h"
+#include "ketopt.h"
+#include "kll.h"
+
+typedef slice(double) QuantilesFractions;
+
+typedef struct {
+  bool csv;
+  int nfields;
+  astr *names;
+  JsonPaths *paths;  // NDJSON: one path per field
+  int *field_col;    // CSV: column of each field in the current file
+  int ncols;
+  Kll **sketches;  // Per pool worker, a sketch per field
+} Quantiles;
+
+static void quantiles_lines(void *ctx, astr lines, CmdSink *sink, Arena *scratch) {
+  Quantiles *q = ctx;
+  Kll **sketches = q->sketches + (isize)pool_worker_id() * q->nfields;
+  struct json *vals = q->csv ? NULL : New(scratch, struct json, q->nfields);
+  CsvField *cols = q->csv ? New(scratch, CsvField, q->ncols) : NULL;
+  (void)sink;
+
+  for (astr line; cmd_next_line(&lines, &line);) {
+    if (!line.len)
+      continue;
+    if (q->csv) {
+      cmd_csv_fields(line, cols, q->ncols);
+      for (int f = 0; f < q->nfields; f++) {
+        double x;
+        if (cmd_parse_number(cols[q->field_col[f]].text, &x))
+          kll_add(sketches[f], x);
+      }
+    } else {
+      json_paths_get(q->paths, line, vals);
+      for (int f = 0; f < q->nfields; f++) {
+        if (json_type(vals[f]) == JSON_NUMBER)
+          kll_add(sketches[f], json_double(vals[f]));
+      }
+    }
+  }
+}
+
+static int quantiles_usage(FILE *f) {
+  fputs(
+      "usage: cmd quantiles --field FIELD [--field FIELD ...] [options] [FILE ...]\n"
+      "Print estimated quantiles of numeric fields of NDJSON or CSV records, a\n"
+      "TSV row per field: the field, the count of its numbers, then a value per\n"
+      "quantile. Other values are skipped. Each thread keeps a KLL sketch of\n"
+      "about 3 K numbers per field, so memory stays bounded on endless input;\n"
+      "each value is one of the numbers, within about 1.7% of the asked rank at\n"
+      "the default K. Quantiles 0 and 1 are the exact minimum and maximum.\n"
+      "  -f, --field FIELD     a dotted json path or a CSV column (repeatable)\n"
+      "  -q, --quantiles LIST  comma separated fractions (default 0.5,0.9,0.99,0.999)\n"
+      "  -k, --size K          sketch size: larger is slower and more exact (default 200)\n"
+      "  -i, --input FORMAT    ndjson (default) or csv with a header line\n"
+      "  -H, --header          print the column names as a first row\n"
+      "  -t, --threads N       worker threads (default: one per CPU)\n",
+      f);
+  return f == stdout ? 0 : 2;
+}
+
+// Parse "0.5,0.99" into fractions in [0, 1]
+static bool quantiles_parse(Arena *arena, QuantilesFractions *qs, const char *list) {
+  qs->len = 0;
+  for (const char *s = list;; s++) {
+    char *end;
+    double q = strtod(s, &end);
+    if (end == s || !(q >= 0 && q <= 1) || (*end && *end != ','))
+      return false;
+    *Push(arena, qs) = q;
+    s = end;
+    if (!*s)
+      return true;
+  }
+}
+
+int cmd_quantiles_main(int argc, char *argv[], int out) {
+  static const ko_longopt_t longopts[] = {
+      {"field", ko_required_argument, 'f'}, {"quantiles", ko_required_argument, 'q'},
+      {"size", ko_required_argument, 'k'},  {"input", ko_required_argument, 'i'},
+      {"header", ko_no_argument, 'H'},      {"threads", ko_required_argument, 't'},
+      {"help", ko_no_argument, 'h'},        {0},
+  };
+  Arena arena = cmd_arena_init(GB(1));
+  arena_register(&arena, "cmd.quantiles");
+  slice(astr) fields = {0};
+  QuantilesFractions qs = {0};
+  quantiles_parse(&arena, &qs, "0.5,0.9,0.99,0.999");
+  Quantiles q = {0};
+  int k = 200, threads = 0;
+  bool header = false;
+
+  ketopt_t opt = KETOPT_INIT;
+  for (int c; (c = ketopt(&opt, argc, argv, 1, "f:q:k:i:Ht:h", longopts)) >= 0;) {
+    if (c == 'f') {
+      *Push(&arena, &fields) = astr_from_cstr(&arena, opt.arg);
+    } else if (c == 'q') {
+      if (!quantiles_parse(&arena, &qs, opt.arg)) {
+        fprintf(stderr, "cmd quantiles: bad quantiles: %s\n", opt.arg);
+        cmd_arena_release(&arena);
+        return quantiles_usage(stderr);
+      }
+    } else if (c == 'k' && atoi(opt.arg) >= 8) {
+      k = atoi(opt.arg);
+    } else if (c == 'i' && (!strcmp(opt.arg, "ndjson") || !strcmp(opt.arg, "csv"))) {
+      q.csv = !strcmp(opt.arg, "csv");
+    } else if (c == 'H') {
+      header = true;
+    } else if (c == 't') {
+      threads = atoi(opt.arg);
+    } else if (c == 'h') {
+      cmd_arena_release(&arena);
+      return quantiles_usage(stdout);
+    } else {
+      cmd_arena_release(&arena);
+      return quantiles_usage(stderr);
+    }
+  }
+  if (!fields.len) {
+    fputs("cmd quantiles: at least one --field FIELD is required\n", stderr);
+    cmd_arena_release(&arena);
+    return quantiles_usage(stderr);
+  }
+
+  q.nfields = (int)fields.len;
+  q.names = fields.data;
+  if (q.csv)
+    q.field_col = New(&arena, int, q.nfields);
+  else
+    q.paths = json_paths_compile(&arena, q.names, q.nfields);
+
+  CmdScan *scan = cmd_scan_create(&arena, (CmdScanOptions){.threads = threads});
+  int nthreads = cmd_scan_threads(scan);
+  q.sketches = New(&arena, Kll *, (isize)nthreads * q.nfields);
+  for (isize i = 0; i < (isize)nthreads * q.nfields; i++) {
+    q.sketches[i] = kll_new(&arena, k);
+  }
+
+  int status = 0;
+  for (int i = opt.ind; i < argc || (i == opt.ind && i == argc); i++) {
+    CmdInput in;
+    if (!cmd_input_open(&in, i < argc ? argv[i] : NULL)) {
+      status = 1;
+      continue;
+    }
+    if (q.csv)
+      q.ncols = cmd_csv_header(&in, "quantiles", q.names, q.nfields, q.field_col, arena);
+    if (q.ncols < 0)
+      status = 1;
+    else if ((!q.csv || q.ncols) && !cmd_scan(scan, &in, quantiles_lines, &q))
+      status = 1;
+    cmd_input_close(&in);
+  }
+  cmd_scan_destroy(scan);
+
+  CmdOut o = cmd_out_init(out);
+  if (header) {
+    astr row = astr_clone(&arena, astr("field\tcount"));
+    for (isize i = 0; i < qs.len; i++) {
+      row = astr_concat(&arena, row, astr_format(&arena, "\tp%g", 100 * qs.data[i]));
+    }
+    cmd_out_push(&o, astr_cat_bytes(&arena, row, "\n", 1));
+  }
+  double *x = New(&arena, double, Max(qs.len, 1), NO_INIT);
+  for (int f = 0; f < q.nfields; f++) {
+    Kll *all = kll_new(&arena, k);
+    for (int t = 0; t < nthreads; t++) {
+      kll_merge(all, q.sketches[(isize)t * q.nfields + f]);
+    }
+    kll_quantiles(all, qs.data, x, (int)qs.len, arena);
+    astr row = cmd_tsv_cat(&arena, (astr){0}, q.names[f]);
+    row = astr_concat(&arena, row, astr_format(&arena, "\t%lld", (long long)all->n));
+    for (isize i = 0; i < qs.len; i++) {
+      // Empty for a field without numbers, as in cmd agg
+      row = all->n ? astr_concat(&arena, row, astr_format(&arena, "\t%.15g", x[i]))
+                   : astr_cat_bytes(&arena, row, "\t", 1);
+    }
+    cmd_out_push(&o, astr_cat_bytes(&arena, row, "\n", 1));
+  }
+  if (!cmd_out_flush(&o)) {
+    fprintf(stderr, "cmd quantiles: write: %s\n", strerror(o.err));
+    status = 1;
+  }
+  cmd_arena_release(&arena);
+  return status;
+}
@@ -0,0 +1,585 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "arena_registry.h"
+#include "cmd.h"
+#include "csv.h"
+#include "json_path.h"
+#include "ketopt.h"
+#include "parallel.h"
+
+// Ranges of equal prefixes up to this long are finished by insertion sort
+enum { SORT_INSERTION = 16 };
+
+typedef struct {
+  astr line;
+  astr key;
+} SortRec;
+
+typedef slice(SortRec) SortRecs;
+
+// What the sort moves around: 8 bytes of key, and the record they came from
+typedef struct {
+  uint64_t prefix;
+  isize rec;
+} SortKey;
+
+// A record on its way through the merge
+typedef struct {
+  uint64_t prefix;
+  astr key, line;
+} SortItem;
+
+// Record in a run file, followed by the line and then the key if it is not part of the line
+typedef struct {
+  uint64_t prefix;
+  int32_t line_len;
+  int32_t key_off;  // Key within the line, or -1 for key bytes after it
+  int32_t key_len;
+} SortDisk;
+
+typedef struct {
+  isize off, end;
+} SortRun;
+
+typedef slice(SortRun) SortRuns;
+
+// One sorted sequence of the merge: a chunk of the batch, or a run file segment
+typedef struct {
+  const SortKey *keys;
+  isize i, n;
+  CmdRunReader reader;
+  SortItem cur;
+  bool live;
+} SortSource;
+
+typedef struct {
+  JsonPaths *path;  // NDJSON key, or NULL
+  bool csv;
+  astr key_name;
+  int key_col;  // CSV key column, -1 for the whole line
+  bool numeric, reverse;
+  isize mem;
+  isize window;  // Input read at a time, a small part of mem
+
+  Pool *pool;
+  int nthreads;
+  Arena text;   // Lines of the batch
+  Arena recs;   // SortRec per line, then its keys
+  Arena *keys;  // Per worker: keys that are not views of their line
+  SortRecs batch;
+  SortKey *order;  // Batch keys, sorted within each chunk
+  SortKey *tmp;
+  isize *chunks;   // nthreads + 1 chunk bounds
+
+  FILE *file;  // Runs
+  isize size;
+  SortRuns runs;
+  Arena arena;  // Options, runs, merge state
+} Sort;
+
+/* --- Keys --- */
+
+// Bits of a double that order like the double: negatives flipped, positives above them
+static inline uint64_t sort_double_bits(double x) {
+  uint64_t u;
+  memcpy(&u, &x, sizeof(u));
+  return u >> 63 ? ~u : u | (1ull << 63);
+}
+
+static inline uint64_t sort_prefix(astr key) {
+  byte b[8] = {0};
+  if (key.len)
+    memcpy(b, key.data, Min(key.len, (isize)8));
+  uint64_t p = 0;
+  for (int i = 0; i < 8; i++) {
+    p = p << 8 | b[i];
+  }
+  return p;
+}
+
+// The key of a line, and its prefix; with --numeric, lines without a number sort first (last with -r)
+static uint64_t sort_key(const Sort *s, astr line, Arena *keys, astr *key) {
+  double x = 0;
+  bool number = false;
+  *key = line;
+  if (s->path) {
+    struct json v;
+    json_paths_get(s->path, line, &v);
+    enum json_type type = json_type(v);
+    number = s->numeric && type == JSON_NUMBER;
+    x = number ? json_double(v) : 0;
+    // Everything but escaped strings stays a view of the line
+    if (type == JSON_NULL)
+      *key = (astr){0};
+    else if (type == JSON_STRING && json_string_is_escaped(v))
+      *key = cmd_json_tsv(keys, (astr){0}, v);
+    else if (type == JSON_STRING)
+      *key = (astr){(char *)json_raw(v) + 1, (isize)json_raw_length(v) - 2};
+    else
+      *key = (astr){(char *)json_raw(v), (isize)json_raw_length(v)};
+  } else if (s->key_col >= 0) {
+    isize pos = 0;
+    CsvField f = {0};
+    for (int c = 0; c <= s->key_col; c++) {
+      if (!csv_next_field(line, &pos, &f)) {
+        f = (CsvField){0};
+        break;
+      }
+    }
+    *key = f.escaped ? csv_unescape(keys, f.text) : f.text;
+  }
+  if (s->numeric && !number)
+    number = cmd_parse_number(*key, &x);
+
+  uint64_t prefix = sort_prefix(*key);
+  if (s->numeric) {
+    // The prefix is the whole number, so the key is not needed past here
+    prefix = number ? sort_double_bits(x) : 0;
+    *key = (astr){0};
+  }
+  return s->reverse ? ~prefix : prefix;
+}
+
+// Order of two records with equal prefixes: the rest of the key
+static inline int sort_cmp_keys(const Sort *s, astr a, astr b) {
+  if (s->numeric)
+    return 0;
+  int c = astr_compare(a, b);
+  return s->reverse ? -c : c;
+}
+
+/* --- Batch sort --- */
+
+// Stable LSD radix sort on the prefixes, skipping bytes that are the same in every key
+static SortKey *sort_radix(SortKey *keys, SortKey *tmp, isize n) {
+  isize (*count)[256] = calloc(8, sizeof(*count));
+  if (!count) {
+    perror("sort_radix calloc");
+    abort();
+  }
+  for (isize i = 0; i < n; i++) {
+    for (int b = 0; b < 8; b++) {
+      count[b][(keys[i].prefix >> (8 * b)) & 0xff]++;
+    }
+  }
+  for (int b = 0; b < 8; b++) {
+    if (n && count[b][(keys[0].prefix >> (8 * b)) & 0xff] == n)
+      continue;
+    isize sum = 0;
+    for (int d = 0; d < 256; d++) {
+      isize c = count[b][d];
+      count[b][d] = sum;
+      sum += c;
+    }
+    for (isize i = 0; i < n; i++) {
+      tmp[count[b][(keys[i].prefix >> (8 * b)) & 0xff]++] = keys[i];
+    }
+    SortKey *swap = keys;
+    keys = tmp;
+    tmp = swap;
+  }
+  free(count);
+  return keys;
+}
+
+static inline bool sort_key_less(const Sort *s, SortKey a, SortKey b) {
+  return sort_cmp_keys(s, s->batch.data[a.rec].key, s->batch.data[b.rec].key) < 0;
+}
+
+// Stable merge sort by the whole key
+static void sort_merge_keys(const Sort *s, SortKey *keys, SortKey *tmp, isize n) {
+  if (n <= SORT_INSERTION) {
+    for (isize i = 1; i < n; i++) {
+      SortKey k = keys[i];
+      isize j = i;
+      for (; j > 0 && sort_key_less(s, k, keys[j - 1]); j--) {
+        keys[j] = keys[j - 1];
+      }
+      keys[j] = k;
+    }
+    return;
+  }
+  isize half = n / 2;
+  sort_merge_keys(s, keys, tmp, half);
+  sort_merge_keys(s, keys + half, tmp + half, n - half);
+  memcpy(tmp, keys, n * sizeof(SortKey));
+  for (isize i = 0, l = 0, r = half; i < n; i++) {
+    bool right = r < n && (l == half || sort_key_less(s, tmp[r], tmp[l]));
+    keys[i] = tmp[right ? r++ : l++];
+  }
+}
+
+/**
+ * Stable sort of a range of keys that agree on their first depth bytes:
+ * radix sort on the next 8 and recurse into the ranges that tie again,
+ * until no key is longer than that. Keys with a common head such as
+ * `{"user":` then cost a few passes instead of a comparison sort.
+ */
+static void sort_ties(const Sort *s, SortKey *keys, SortKey *tmp, isize n, isize depth) {
+  uint64_t prefix = keys[0].prefix;
+  bool deeper = false;
+  for (isize i = 0; n > SORT_INSERTION && i < n; i++) {
+    astr key = s->batch.data[keys[i].rec].key;
+    keys[i].prefix = sort_prefix(astr_slice(key, Min(depth, key.len), key.len));
+    keys[i].prefix = s->reverse ? ~keys[i].prefix : keys[i].prefix;
+    deeper |= key.len > depth + 8;
+  }
+  if (!deeper) {
+    sort_merge_keys(s, keys, tmp, n);
+  } else {
+    SortKey *sorted = sort_radix(keys, tmp, n);
+    if (sorted != keys)
+      memcpy(keys, sorted, n * sizeof(SortKey));
+    for (isize i = 0, j; i < n; i = j) {
+      for (j = i + 1; j < n && keys[j].prefix == keys[i].prefix; j++) {
+      }
+      if (j - i > 1)
+        sort_ties(s, keys + i, tmp + i, j - i, depth + 8);
+    }
+  }
+  // The merge compares the first 8 bytes, which all of these share
+  for (isize i = 0; i < n; i++) {
+    keys[i].prefix = prefix;
+  }
+}
+
+// Key, prefix-sort and tie-break each chunk of the batch
+static void sort_chunks(void *ctx, isize beg, isize end, Arena *scratch) {
+  Sort *s = ctx;
+  Arena *keys = &s->keys[pool_worker_id()];
+  for (isize c = beg; c < end; c++) {
+    isize lo = s->chunks[c], n = s->chunks[c + 1] - lo;
+    SortKey *order = s->order + lo, *tmp = s->tmp + lo;
+    for (isize i = 0; i < n; i++) {
+      SortRec *r = &s->batch.data[lo + i];
+      order[i] = (SortKey){sort_key(s, r->line, keys, &r->key), lo + i};
+    }
+    SortKey *sorted = sort_radix(order, tmp, n);
+    if (sorted != order)
+      memcpy(order, sorted, n * sizeof(SortKey));
+    for (isize i = 0, j; !s->numeric && i < n; i = j) {
+      for (j = i + 1; j < n && order[j].prefix == order[i].prefix; j++) {
+      }
+      if (j - i > 1)
+        sort_ties(s, order + i, tmp + i, j - i, 8);
+    }
+  }
+  (void)scratch;
+}
+
+static void sort_batch(Sort *s) {
+  isize n = s->batch.len;
+  s->order = New(&s->recs, SortKey, n, NO_INIT);
+  s->tmp = New(&s->recs, SortKey, n, NO_INIT);
+  for (int c = 0; c <= s->nthreads; c++) {
+    s->chunks[c] = n * c / s->nthreads;
+  }
+  parallel_for(s->pool, s->nthreads, 1, sort_chunks, s);
+}
+
+/* --- Merge --- */
+
+static bool sort_source_next(SortSource *src) {
+  if (src->keys) {
+    src->live = ++src->i < src->n;
+    return src->live;
+  }
+  SortDisk d;
+  CmdRunReader *r = &src->reader;
+  src->live = cmd_run_reader_want(r, sizeof(d));
+  if (!src->live)
+    return false;
+  memcpy(&d, r->buf + r->pos, sizeof(d));
+  isize size = sizeof(d) + d.line_len + (d.key_off < 0 ? d.key_len : 0);
+  src->live = cmd_run_reader_want(r, size);
+  if (!src->live)
+    return false;
+  char *line = (char *)r->buf + r->pos + sizeof(d);
+  src->cur = (SortItem){d.prefix, {d.key_off < 0 ? line + d.line_len : line + d.key_off, d.key_len},
+                        {line, d.line_len}};
+  r->pos += size;
+  return true;
+}
+
+// In-memory sources advance lazily, so cur is read through here
+static inline SortItem sort_source_item(const Sort *s, SortSource *src) {
+  if (!src->keys)
+    return src->cur;
+  SortKey k = src->keys[src->i];
+  const SortRec *r = &s->batch.data[k.rec];
+  return (SortItem){k.prefix, r->key, r->line};
+}
+
+// Whether source a's record goes before b's; exhausted sources go last, ties by source order
+static bool sort_wins(const Sort *s, SortSource *src, int a, int b) {
+  if (!src[a].live || !src[b].live)
+    return src[a].live;
+  SortItem x = sort_source_item(s, &src[a]), y = sort_source_item(s, &src[b]);
+  int c = x.prefix != y.prefix ? (x.prefix < y.prefix ? -1 : 1) : sort_cmp_keys(s, x.key, y.key);
+  return c ? c < 0 : a < b;
+}
+
+// Append an item as a run record, or as an output line
+static astr sort_emit(Arena *arena, astr text, SortItem it, bool run) {
+  if (!run) {
+    text = astr_cat_bytes(arena, text, it.line.data, it.line.len);
+    return astr_cat_bytes(arena, text, "\n", 1);
+  }
+  char *end = it.line.data + it.line.len;
+  bool inside = !it.key.len || (it.key.data >= it.line.data && it.key.data + it.key.len <= end);
+  SortDisk d = {it.prefix, (int32_t)it.line.len, -1, (int32_t)it.key.len};
+  if (inside)
+    d.key_off = it.key.len ? (int32_t)(it.key.data - it.line.data) : 0;
+  text = astr_cat_bytes(arena, text, &d, sizeof(d));
+  text = astr_cat_bytes(arena, text, it.line.data, it.line.len);
+  return inside ? text : astr_cat_bytes(arena, text, it.key.data, it.key.len);
+}
+
+/**
+ * K-way merge of the sources through a loser tree: each internal node holds
+ * the loser of the match below it, so replacing the winner replays only its
+ * path to the root, log2(k) comparisons per record.
+ */
+static bool sort_merge(Sort *s, SortSource *src, int k, CmdOut *out, bool run) {
+  Arena arena = s->arena;
+  int *loser = New(&arena, int, Max(k, 1));
+  int *win = New(&arena, int, 2 * k);
+  for (int i = 0; i < k; i++) {
+    sort_source_next(&src[i]);
+    win[k + i] = i;
+  }
+  for (int n = k - 1; n >= 1; n--) {
+    int a = win[2 * n], b = win[2 * n + 1];
+    bool a_wins = sort_wins(s, src, a, b);
+    win[n] = a_wins ? a : b;
+    loser[n] = a_wins ? b : a;
+  }
+  int winner = k > 1 ? win[1] : 0;
+
+  Arena tmp = arena;
+  astr text = {0};
+  while (k && src[winner].live) {
+    text = sort_emit(&tmp, text, sort_source_item(s, &src[winner]), run);
+    sort_source_next(&src[winner]);
+    for (int n = (k + winner) / 2; n >= 1; n /= 2) {
+      if (sort_wins(s, src, loser[n], winner)) {
+        int swap = loser[n];
+        loser[n] = winner;
+        winner = swap;
+      }
+    }
+    if (text.len >= (isize)CMD_CHUNK_SIZE) {
+      cmd_out_push(out, text);
+      if (!cmd_out_flush(out))
+        return false;
+      s->size += run ? text.len : 0;
+      tmp = arena;
+      text = (astr){0};
+    }
+  }
+  cmd_out_push(out, text);
+  s->size += run ? text.len : 0;
+  return cmd_out_flush(out);
+}
+
+// Sources for the sorted chunks of the batch
+static void sort_batch_sources(Sort *s, SortSource *src) {
+  for (int c = 0; c < s->nthreads; c++) {
+    // Before the first key: the merge starts every source with sort_source_next()
+    src[c] = (SortSource){.keys = s->order + s->chunks[c], .i = -1, .n = s->chunks[c + 1] - s->chunks[c]};
+  }
+}
+
+// Sort the batch into a new run, then start an empty one
+static bool sort_spill(Sort *s) {
+  if (!s->file && !(s->file = tmpfile())) {
+    fprintf(stderr, "cmd sort: temp file: %s\n", strerror(errno));
+    return false;
+  }
+  sort_batch(s);
+  SortSource *src = New(&s->recs, SortSource, s->nthreads);
+  sort_batch_sources(s, src);
+  CmdOut out = cmd_out_init(fileno(s->file));
+  isize off = s->size;
+  if (!sort_merge(s, src, s->nthreads, &out, true)) {
+    fprintf(stderr, "cmd sort: temp file: %s\n", strerror(out.err));
+    return false;
+  }
+  *Push(&s->arena, &s->runs) = (SortRun){off, s->size};
+  arena_reset(&s->text);
+  arena_reset(&s->recs);
+  for (int i = 0; i < s->nthreads; i++) {
+    arena_reset(&s->keys[i]);
+  }
+  s->batch = (SortRecs){0};
+  return true;
+}
+
+// Batch memory: lines, records and the two key arrays sort_batch() adds
+static inline isize sort_batch_bytes(const Sort *s) {
+  return (isize)(s->text.cur - s->text.beg) + s->batch.cap * (isize)(sizeof(SortRec) + 2 * sizeof(SortKey));
+}
+
+static bool sort_read(Sort *s, CmdInput *in) {
+  astr window;
+  while (cmd_input_next(in, s->window, &window)) {
+    if (s->batch.len && sort_batch_bytes(s) + window.len > s->mem && !sort_spill(s))
+      return false;
+    astr lines = astr_clone(&s->text, window);
+    for (astr line; cmd_next_line(&lines, &line);) {
+      *Push(&s->recs, &s->batch) = (SortRec){line, {0}};
+    }
+  }
+  if (in->err) {
+    fprintf(stderr, "cmd: %s: %s\n", in->path, strerror(in->err));
+    return false;
+  }
+  return true;
+}
+
+/* --- Command --- */
+
+static int sort_usage(FILE *f) {
+  fputs(
+      "usage: cmd sort [-k FIELD] [options] [FILE ...]\n"
+      "Sort lines by a key, spilling sorted runs to disk past the memory budget.\n"
+      "Sorting is stable: lines with equal keys keep their input order.\n"
+      "  -k, --key FIELD       dotted json path, or CSV column (default: whole line)\n"
+      "  -n, --numeric         compare keys as numbers; non-numbers go first, or last with -r\n"
+      "  -r, --reverse         descending order\n"
+      "  -i, --input FORMAT    ndjson (default) or csv; a CSV header stays on top\n"
+      "  -m, --mem SIZE        memory for lines in flight (default 1G)\n"
+      "  -t, --threads N       worker threads (default: one per CPU)\n",
+      f);
+  return f == stdout ? 0 : 2;
+}
+
+/**
+ * Find the key column in the file's CSV header; the first file's header is
+ * kept for output. Lines are keyed when their batch is sorted, so if the
+ * column moved, the lines of earlier files are sorted into a run first.
+ */
+static bool sort_csv_header(Sort *s, CmdInput *in, CmdOut *out, bool first) {
+  astr header;
+  if (!cmd_input_line(in, &header))
+    return !in->err;
+  if (first) {
+    cmd_out_push(out, astr_cat_bytes(&s->arena, astr_clone(&s->arena, header), "\n", 1));
+    cmd_out_flush(out);
+  }
+  if (!s->key_name.len)
+    return true;
+  int col;
+  if (!cmd_csv_columns(header, &s->key_name, 1, &col, s->arena)) {
+    fprintf(stderr, "cmd sort: %s: no column %.*s\n", in->path, S(s->key_name));
+    return false;
+  }
+  if (col != s->key_col && s->batch.len && !sort_spill(s))
+    return false;
+  s->key_col = col;
+  return true;
+}
+
+int cmd_sort_main(int argc, char *argv[], int out) {
+  static const ko_longopt_t longopts[] = {
+      {"key", ko_required_argument, 'k'},   {"numeric", ko_no_argument, 'n'},
+      {"reverse", ko_no_argument, 'r'},     {"input", ko_required_argument, 'i'},
+      {"mem", ko_required_argument, 'm'},   {"threads", ko_required_argument, 't'},
+      {"help", ko_no_argument, 'h'},        {0},
+  };
+  Sort s = {.arena = cmd_arena_init(GB(1)), .key_col = -1, .mem = GB(1)};
+  arena_register(&s.arena, "cmd.sort");
+  int threads = 0;
+
+  ketopt_t opt = KETOPT_INIT;
+  for (int c; (c = ketopt(&opt, argc, argv, 1, "k:nri:m:t:h", longopts)) >= 0;) {
+    if (c == 'k') {
+      s.key_name = astr_from_cstr(&s.arena, opt.arg);
+    } else if (c == 'n') {
+      s.numeric = true;
+    } else if (c == 'r') {
+      s.reverse = true;
+    } else if (c == 'i' && (!strcmp(opt.arg, "ndjson") || !strcmp(opt.arg, "csv"))) {
+      s.csv = !strcmp(opt.arg, "csv");
+    } else if (c == 'm') {
+      if (!cmd_parse_size(opt.arg, &s.mem)) {
+        fprintf(stderr, "cmd sort: bad size: %s\n", opt.arg);
+        cmd_arena_release(&s.arena);
+        return sort_usage(stderr);
+      }
+    } else if (c == 't') {
+      threads = atoi(opt.arg);
+    } else if (c == 'h') {
+      cmd_arena_release(&s.arena);
+      return sort_usage(stdout);
+    } else {
+      cmd_arena_release(&s.arena);
+      return sort_usage(stderr);
+    }
+  }
+  if (s.key_name.len && !s.csv)
+    s.path = json_paths_compile(&s.arena, &s.key_name, 1);
+
+  s.pool = pool_create(&s.arena, (PoolOptions){.nthreads = threads});
+  s.nthreads = pool_size(s.pool);
+  s.chunks = New(&s.arena, isize, s.nthreads + 1);
+  // The batch spills before a window would take it past the budget, give or take
+  // one window: its bytes, lines that run past it, and records for every byte
+  s.window = Max(Min(s.mem / 16, (isize)CMD_CHUNK_SIZE), (isize)KB(4));
+  s.text = cmd_arena_init(s.mem + MB(64));
+  s.recs = cmd_arena_init(2 * s.mem + 4 * s.window * (isize)(sizeof(SortRec) + 2 * sizeof(SortKey)));
+  arena_register(&s.text, "cmd.sort.text");
+  arena_register(&s.recs, "cmd.sort.recs");
+  s.keys = New(&s.arena, Arena, s.nthreads);
+  for (int i = 0; i < s.nthreads; i++) {
+    s.keys[i] = cmd_arena_init(s.mem / s.nthreads + MB(16));
+    arena_register(&s.keys[i], "cmd.sort.keys");
+  }
+
+  CmdOut o = cmd_out_init(out);
+  int status = 0;
+  bool first = true;
+  for (int i = opt.ind; i < argc || (i == opt.ind && i == argc); i++) {
+    CmdInput in;
+    if (!cmd_input_open(&in, i < argc ? argv[i] : NULL)) {
+      status = 1;
+      continue;
+    }
+    if ((s.csv && !sort_csv_header(&s, &in, &o, first)) || !sort_read(&s, &in))
+      status = 1;
+    first = false;
+    cmd_input_close(&in);
+  }
+
+  // The last batch merges straight into the output with the runs before it
+  sort_batch(&s);
+  int k = (int)s.runs.len + s.nthreads;
+  SortSource *src = New(&s.arena, SortSource, k);
+  for (isize r = 0; r < s.runs.len; r++) {
+    cmd_run_reader_init(&src[r].reader, fileno(s.file), s.runs.data[r].off, s.runs.data[r].end);
+  }
+  sort_batch_sources(&s, src + s.runs.len);
+  if (!sort_merge(&s, src, k, &o, false)) {
+    fprintf(stderr, "cmd sort: write: %s\n", strerror(o.err));
+    status = 1;
+  }
+  for (int i = 0; i < k; i++) {
+    if (src[i].reader.err && !status) {
+      fprintf(stderr, "cmd sort: temp file: %s\n", strerror(src[i].reader.err));
+      status = 1;
+    }
+    cmd_run_reader_free(&src[i].reader);
+  }
+
+  if (s.file)
+    fclose(s.file);
+  pool_destroy(s.pool);
+  for (int i = 0; i < s.nthreads; i++) {
+    cmd_arena_release(&s.keys[i]);
+  }
+  cmd_arena_release(&s.recs);
+  cmd_arena_release(&s.text);
+  cmd_arena_release(&s.arena);
+  return status;
+}
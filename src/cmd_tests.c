@@ -0,0 +1,541 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "cmd.h"
+#include "utest.h"
+
+// Temp file of n lines "<i>,<i*i>\n"; returns its path in buf
+static const char* lines_file(char buf[static 32], int n) {
+  strcpy(buf, "/tmp/cmd_tests_XXXXXX");
+  FILE* f = fdopen(mkstemp(buf), "w");
+  for (int i = 0; i < n; i++) {
+    fprintf(f, "%d,%lld\n", i, (long long)i * i);
+  }
+  fclose(f);
+  return buf;
+}
+
+// Whole contents of fd from offset 0, malloc'd
+static char* read_all(int fd) {
+  off_t len = lseek(fd, 0, SEEK_END);
+  char* s = calloc(len + 1, 1);
+  pread(fd, s, len, 0);
+  return s;
+}
+
+// Echo every line with its second column doubled, in input order
+static void double_lines(void* ctx, astr lines, CmdSink* sink, Arena* scratch) {
+  for (astr line; cmd_next_line(&lines, &line);) {
+    astr second = astr_slice(line, astr_find(line, astr(",")) + 1, line.len);
+    cmd_sink_put(sink, astr_format(scratch, "%.*s,%lld\n", (int)(line.len - second.len - 1), line.data,
+                                   2 * atoll(astr_to_cstr(*scratch, second))));
+  }
+}
+
+UTEST(cmd, scan_keeps_input_order) {
+  Arena arena[] = {arena_init(NULL, MB(64))};
+  enum { n = 100000 };
+  char path[32];
+  lines_file(path, n);
+  FILE* out = tmpfile();
+  CmdOut o = cmd_out_init(fileno(out));
+  // Small chunks: many batches, and windows that cut lines everywhere
+  CmdScan* scan = cmd_scan_create(arena, (CmdScanOptions){.threads = 3, .chunk_size = 1000, .out = &o});
+  ASSERT_EQ(cmd_scan_threads(scan), 3);
+
+  CmdInput in;
+  ASSERT_TRUE(cmd_input_open(&in, path));
+  ASSERT_TRUE(in.map != NULL);
+  ASSERT_TRUE(cmd_scan(scan, &in, double_lines, NULL));
+  cmd_input_close(&in);
+
+  char* got = read_all(fileno(out));
+  char* line = got;
+  for (int i = 0; i < n; i++) {
+    char want[64];
+    int len = snprintf(want, sizeof(want), "%d,%lld\n", i, 2 * (long long)i * i);
+    ASSERT_EQ(strncmp(line, want, len), 0);
+    line += len;
+  }
+  ASSERT_EQ(*line, 0);
+  free(got);
+  cmd_scan_destroy(scan);
+  fclose(out);
+  unlink(path);
+  arena_release(arena);
+}
+
+typedef struct {
+  int fd;
+  const char* text;
+} Writer;
+
+// Dribble the text into a pipe in odd-sized pieces
+static void* write_slowly(void* arg) {
+  Writer* w = arg;
+  size_t len = strlen(w->text);
+  for (size_t pos = 0; pos < len; pos += 7) {
+    write(w->fd, w->text + pos, Min((size_t)7, len - pos));
+    if (pos % 70 == 0)
+      usleep(100);
+  }
+  close(w->fd);
+  return NULL;
+}
+
+UTEST(cmd, stream_windows_are_whole_lines) {
+  const char* text = "alpha\nbeta\r\ngamma gamma gamma\n\ndelta without newline";
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  int saved = dup(STDIN_FILENO);
+  dup2(fds[0], STDIN_FILENO);
+  close(fds[0]);
+  pthread_t t;
+  Writer w = {fds[1], text};
+  pthread_create(&t, NULL, write_slowly, &w);
+
+  CmdInput in;
+  ASSERT_TRUE(cmd_input_open(&in, "-"));
+  ASSERT_TRUE(in.map == NULL);
+  char got[128] = {0};
+  astr window;
+  bool partial = false;  // Only the last window may end mid-line
+  while (cmd_input_next(&in, 8, &window)) {
+    ASSERT_FALSE(partial);
+    ASSERT_GT(window.len, 0);
+    partial = window.data[window.len - 1] != '\n';
+    strncat(got, window.data, window.len);
+  }
+  ASSERT_TRUE(partial);
+  ASSERT_STREQ(got, text);
+  ASSERT_EQ(in.err, 0);
+  cmd_input_close(&in);
+  pthread_join(t, NULL);
+  dup2(saved, STDIN_FILENO);
+  close(saved);
+
+  astr lines = astr("a\nb\r\n\nc"), line;
+  const char* want[] = {"a", "b", "", "c"};
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(cmd_next_line(&lines, &line));
+    ASSERT_EQ(line.len, (isize)strlen(want[i]));
+    ASSERT_EQ(memcmp(line.data, want[i], line.len), 0);
+  }
+  ASSERT_FALSE(cmd_next_line(&lines, &line));
+}
+
+UTEST(cmd, extract_tsv_and_ndjson) {
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  fputs(
+      "{\"name\":{\"last\":\"Lovelace\"},\"age\":36,\"tags\":[\"math\",\"poet\"]}\n"
+      "{\"name\":{\"last\":\"Tab\\there \\\"q\\\" back\\\\slash\"},\"age\":null}\n"
+      "\n"
+      "{\"age\":7}",
+      f);
+  fclose(f);
+
+  FILE* out = tmpfile();
+  char* argv[] = {"extract", "-H", "-f", "name.last", "--field", "age", "-f", "tags.1", "-t", "2", path};
+  ASSERT_EQ(cmd_extract_main(Countof(argv), argv, fileno(out)), 0);
+  char* got = read_all(fileno(out));
+  ASSERT_STREQ(got,
+               "name.last\tage\ttags.1\n"
+               "Lovelace\t36\tpoet\n"
+               "Tab\\there \"q\" back\\\\slash\t\t\n"
+               "\t7\t\n");
+  free(got);
+  fclose(out);
+
+  out = tmpfile();
+  char* argv2[] = {"extract", "-o", "ndjson", "-f", "name.last", "-f", "age", path};
+  ASSERT_EQ(cmd_extract_main(Countof(argv2), argv2, fileno(out)), 0);
+  got = read_all(fileno(out));
+  ASSERT_STREQ(got,
+               "{\"name.last\":\"Lovelace\",\"age\":36}\n"
+               "{\"name.last\":\"Tab\\there \\\"q\\\" back\\\\slash\",\"age\":null}\n"
+               "{\"name.last\":null,\"age\":7}\n");
+  free(got);
+  fclose(out);
+  unlink(path);
+
+  char* missing[] = {"extract", "-f", "a", "/nonexistent/file"};
+  ASSERT_EQ(cmd_extract_main(Countof(missing), missing, STDOUT_FILENO), 1);
+  char* usage[] = {"extract", "--bogus"};
+  ASSERT_EQ(cmd_extract_main(Countof(usage), usage, STDOUT_FILENO), 2);
+}
+
+// Output of a tool's main, malloc'd; NULL if it failed
+static char* tool_output(CmdToolFn tool, int argc, char* argv[]) {
+  FILE* out = tmpfile();
+  char* got = tool(argc, argv, fileno(out)) ? NULL : read_all(fileno(out));
+  fclose(out);
+  return got;
+}
+
+UTEST(cmd, agg_spill_matches_memory) {
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  for (int i = 0; i < 20000; i++) {
+    if (i % 7)
+      fprintf(f, "{\"user\":{\"id\":\"u%d\"},\"bytes\":%d}\n", i % 500, i);
+    else
+      fprintf(f, "{\"user\":{\"id\":\"u%d\"},\"bytes\":\"n/a\"}\n", i % 500);
+  }
+  fclose(f);
+
+  char* in_memory[] = {"agg", "-b",    "user.id", "-c",    "--sum", "bytes",
+                       "--min", "bytes", "--max", "bytes", path};
+  char* spilled[] = {"agg", "--mem", "16K", "-t", "3",     "-b",  "user.id", "-c",
+                     "--sum", "bytes", "--min", "bytes", "--max", "bytes", path};
+  char* want = tool_output(cmd_agg_main, Countof(in_memory), in_memory);
+  char* got = tool_output(cmd_agg_main, Countof(spilled), spilled);
+  ASSERT_TRUE(want && got);
+  ASSERT_STREQ(got, want);
+  // Sorted by key: u0 < u1 < u10; u0 has 0 (a string), 500, ..., 19500
+  ASSERT_EQ(strncmp(want, "u0\t40\t", 6), 0);
+  ASSERT_TRUE(strstr(want, "\nu1\t40\t") != NULL);
+  ASSERT_TRUE(strstr(want, "\nu499\t40\t") != NULL);
+  int rows = 0;
+  for (char* p = want; (p = strchr(p, '\n')); p++)
+    rows++;
+  ASSERT_EQ(rows, 500);
+  free(want);
+  free(got);
+  unlink(path);
+}
+
+UTEST(cmd, agg_splits_partitions_past_the_budget) {
+  enum { n = 100000 };
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  // Every key in two places: the two halves spill to different runs
+  for (int i = 0; i < 2 * n; i++) {
+    fprintf(f, "{\"k\":%d,\"v\":%d}\n", i % n, i);
+  }
+  fclose(f);
+
+  // Hundreds of times the memory: partitions are split twice before they fit
+  char* in_memory[] = {"agg", "-b", "k", "-c", "--sum", "v", path};
+  char* spilled[] = {"agg", "--mem", "16K", "-t", "2", "-b", "k", "-c", "--sum", "v", path};
+  char* want = tool_output(cmd_agg_main, Countof(in_memory), in_memory);
+  char* got = tool_output(cmd_agg_main, Countof(spilled), spilled);
+  ASSERT_TRUE(want && got);
+  ASSERT_STREQ(got, want);
+  ASSERT_EQ(strncmp(want, "0\t2\t100000\n1\t2\t100002\n10\t2\t100020\n", 33), 0);
+  int rows = 0;
+  for (char* p = want; (p = strchr(p, '\n')); p++)
+    rows++;
+  ASSERT_EQ(rows, n);
+  free(want);
+  free(got);
+  unlink(path);
+}
+
+UTEST(cmd, agg_csv) {
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  fputs(
+      "host,status,latency\n"
+      "a,200,10\n"
+      "\"b, \"\"quoted\"\"\",500,\n"
+      "a,200,30\n"
+      "a,404,x\n"
+      "\"b, \"\"quoted\"\"\",500,7.5\n",
+      f);
+  fclose(f);
+
+  char* argv[] = {"agg", "-i",      "csv", "-H", "-b",    "host",    "-b",
+                  "status", "--avg", "latency", "-c", "--max", "latency", path};
+  char* got = tool_output(cmd_agg_main, Countof(argv), argv);
+  ASSERT_TRUE(got != NULL);
+  ASSERT_STREQ(got,
+               "host\tstatus\tavg(latency)\tcount\tmax(latency)\n"
+               "a\t200\t20\t2\t30\n"
+               "a\t404\t\t1\t\n"
+               "b, \"quoted\"\t500\t7.5\t2\t7.5\n");
+  free(got);
+
+  char* missing[] = {"agg", "-i", "csv", "-b", "nope", path};
+  ASSERT_EQ(cmd_agg_main(Countof(missing), missing, STDOUT_FILENO), 1);
+  char* bad_mem[] = {"agg", "-b", "host", "--mem", "lots", path};
+  ASSERT_EQ(cmd_agg_main(Countof(bad_mem), bad_mem, STDOUT_FILENO), 2);
+  unlink(path);
+
+  isize size;
+  ASSERT_TRUE(cmd_parse_size("8G", &size));
+  ASSERT_EQ(size, (isize)GB(8));
+  ASSERT_TRUE(cmd_parse_size("512k", &size));
+  ASSERT_EQ(size, (isize)KB(512));
+  ASSERT_FALSE(cmd_parse_size("0", &size));
+  ASSERT_FALSE(cmd_parse_size("1GB", &size));
+}
+
+UTEST(cmd, sort_runs_merge_in_order) {
+  enum { n = 50000 };
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  // Every key twice, a "b" line in the first half and an "a" line in the second: stability shows
+  for (int i = 0; i < n; i++) {
+    int k = (int)((i % (n / 2)) * 7919LL % (n / 2));
+    fprintf(f, "{\"k\":%d,\"tag\":\"%c\"}\n", k - n / 4, "ba"[i >= n / 2]);
+  }
+  fclose(f);
+
+  char* in_memory[] = {"sort", "-n", "-k", "k", path};
+  char* spilled[] = {"sort", "--mem", "64K", "-t", "3", "--numeric", "--key", "k", path};
+  char* want = tool_output(cmd_sort_main, Countof(in_memory), in_memory);
+  char* got = tool_output(cmd_sort_main, Countof(spilled), spilled);
+  ASSERT_TRUE(want && got);
+  ASSERT_STREQ(got, want);
+  char* line = want;
+  for (int k = -n / 4; k < n / 4; k++) {
+    for (int j = 0; j < 2; j++) {
+      char row[64];
+      int len = snprintf(row, sizeof(row), "{\"k\":%d,\"tag\":\"%c\"}\n", k, "ba"[j]);
+      ASSERT_EQ(strncmp(line, row, len), 0);
+      line += len;
+    }
+  }
+  ASSERT_EQ(*line, 0);
+  free(want);
+  free(got);
+
+  // Whole lines, descending, against the same lines ascending
+  char* up[] = {"sort", "-m", "32K", path};
+  char* down[] = {"sort", "-r", path};
+  want = tool_output(cmd_sort_main, Countof(up), up);
+  got = tool_output(cmd_sort_main, Countof(down), down);
+  ASSERT_TRUE(want && got);
+  ASSERT_EQ(strlen(got), strlen(want));
+  ASSERT_EQ(strncmp(want, "{\"k\":-1,", 8), 0);  // '-' < digits, then "-1" < "-10"
+  ASSERT_EQ(strncmp(got, "{\"k\":9999,", 10), 0);
+  free(want);
+  free(got);
+  unlink(path);
+}
+
+UTEST(cmd, sort_csv_keeps_header) {
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  fputs("name,score\n\"b, x\",10\na,9.5\n\"c\"\"\",\nb,10\n", f);
+  fclose(f);
+  char* argv[] = {"sort", "-i", "csv", "-k", "score", "-n", "-r", path};
+  char* got = tool_output(cmd_sort_main, Countof(argv), argv);
+  ASSERT_TRUE(got != NULL);
+  ASSERT_STREQ(got, "name,score\n\"b, x\",10\nb,10\na,9.5\n\"c\"\"\",\n");
+  free(got);
+  char* by_name[] = {"sort", "-i", "csv", "-k", "name", path};
+  got = tool_output(cmd_sort_main, Countof(by_name), by_name);
+  ASSERT_STREQ(got, "name,score\na,9.5\nb,10\n\"b, x\",10\n\"c\"\"\",\n");
+  free(got);
+  char* missing[] = {"sort", "-i", "csv", "-k", "nope", path};
+  ASSERT_EQ(cmd_sort_main(Countof(missing), missing, STDOUT_FILENO), 1);
+  unlink(path);
+
+  // Each file's lines are keyed by its own header
+  char other[32] = "/tmp/cmd_tests_XXXXXX";
+  strcpy(path, other);
+  f = fdopen(mkstemp(path), "w");
+  fputs("name,age\nbob,30\nal,5\n", f);
+  fclose(f);
+  f = fdopen(mkstemp(other), "w");
+  fputs("age,name\n7,zed\n40,amy\n", f);
+  fclose(f);
+  char* two[] = {"sort", "-i", "csv", "-k", "name", path, other};
+  got = tool_output(cmd_sort_main, Countof(two), two);
+  ASSERT_TRUE(got != NULL);
+  ASSERT_STREQ(got, "name,age\nal,5\n40,amy\nbob,30\n7,zed\n");
+  free(got);
+  char* by_age[] = {"sort", "-i", "csv", "-k", "age", "-n", "-t", "2", path, other};
+  got = tool_output(cmd_sort_main, Countof(by_age), by_age);
+  ASSERT_STREQ(got, "name,age\nal,5\n7,zed\nbob,30\n40,amy\n");
+  free(got);
+  unlink(path);
+  unlink(other);
+}
+
+UTEST(cmd, grep_pattern_ids) {
+  char pats[32] = "/tmp/cmd_tests_XXXXXX", path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(pats), "w");
+  fputs("she\nhe\n\nhers\n", f);
+  fclose(f);
+  f = fdopen(mkstemp(path), "w");
+  fputs("ushers\nnone\nthe end, he said\nHERS\nlast he", f);
+  fclose(f);
+  char* argv[] = {"grep", "-F", pats, "-e", "end", path};
+  char* got = tool_output(cmd_grep_main, Countof(argv), argv);
+  ASSERT_TRUE(got != NULL);
+  ASSERT_STREQ(got, "1,2,4\tushers\n2,5\tthe end, he said\n2\tlast he\n");
+  free(got);
+  char* no_ids[] = {"grep", "-i", "--no-ids", "-e", "hers", path, path};
+  got = tool_output(cmd_grep_main, Countof(no_ids), no_ids);
+  char want[256];
+  snprintf(want, sizeof(want), "%s\tushers\n%s\tHERS\n%s\tushers\n%s\tHERS\n", path, path, path, path);
+  ASSERT_STREQ(got, want);
+  free(got);
+  unlink(pats);
+  unlink(path);
+}
+
+UTEST(cmd, wc_counts_and_total) {
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  for (int i = 0; i < 5000; i++) {
+    fputs("caf\xc3\xa9 au lait\n", f);
+  }
+  fputs("no newline \xe2\x82\xac", f);
+  fclose(f);
+  char* argv[] = {"wc", "-t", "3", path};
+  char* got = tool_output(cmd_wc_main, Countof(argv), argv);
+  ASSERT_TRUE(got != NULL);
+  char want[256];
+  snprintf(want, sizeof(want), " 5000 15003 70014 %s\n", path);
+  ASSERT_STREQ(got, want);
+  free(got);
+  char* all[] = {"wc", "-lwmc", path, path};
+  got = tool_output(cmd_wc_main, Countof(all), all);
+  snprintf(want, sizeof(want), "  5000  15003  65012  70014 %s\n  5000  15003  65012  70014 %s\n"
+           " 10000  30006 130024 140028 total\n", path, path);
+  ASSERT_STREQ(got, want);
+  free(got);
+
+  f = fopen(path, "w");
+  fputs("ok\nbad \xc3\x28\n", f);
+  fclose(f);
+  char* bad[] = {"wc", "-m", path};
+  int null = open("/dev/null", O_WRONLY);
+  ASSERT_EQ(cmd_wc_main(Countof(bad), bad, null), 1);
+  close(null);
+  unlink(path);
+}
+
+UTEST(cmd, input_lines_then_windows) {
+  // One read returns everything: later lines come from the buffer, not the pipe
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  ASSERT_EQ(write(fds[1], "head\n\nnext\nrest 1\nrest 2\n", 25), 25);
+  close(fds[1]);
+  int saved = dup(STDIN_FILENO);
+  dup2(fds[0], STDIN_FILENO);
+  close(fds[0]);
+
+  CmdInput in;
+  ASSERT_TRUE(cmd_input_open(&in, "-"));
+  astr line, window;
+  const char* want[] = {"head", "", "next"};
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(cmd_input_line(&in, &line));
+    ASSERT_EQ(line.len, (isize)strlen(want[i]));
+    ASSERT_EQ(memcmp(line.data, want[i], line.len), 0);
+  }
+  ASSERT_TRUE(cmd_input_next(&in, 1024, &window));
+  ASSERT_TRUE(astr_equals(window, astr("rest 1\nrest 2\n")));
+  ASSERT_FALSE(cmd_input_next(&in, 1024, &window));
+  cmd_input_close(&in);
+  dup2(saved, STDIN_FILENO);
+  close(saved);
+}
+
+UTEST(cmd, convert_csv_ndjson_round_trip) {
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  fputs("name,\"a.b\",n,ok,zip\n\"Smith, J\",\"say \"\"hi\"\"\",-1.5e3,true,01234\n"
+        "tab\tx,\"\",,false,7,extra\n",
+        f);
+  fclose(f);
+  char* to_ndjson[] = {"convert", "--from", "csv", path};
+  char* got = tool_output(cmd_convert_main, Countof(to_ndjson), to_ndjson);
+  ASSERT_TRUE(got != NULL);
+  ASSERT_STREQ(got,
+               "{\"name\":\"Smith, J\",\"a.b\":\"say \\\"hi\\\"\",\"n\":-1.5e3,\"ok\":true,"
+               "\"zip\":\"01234\"}\n"
+               "{\"name\":\"tab\\tx\",\"a.b\":\"\",\"n\":null,\"ok\":false,\"zip\":7,\"6\":\"extra\"}\n");
+  char* strings[] = {"convert", "--from", "csv", "--strings", path};
+  char* all_strings = tool_output(cmd_convert_main, Countof(strings), strings);
+  ASSERT_TRUE(strstr(all_strings, "\"n\":\"-1.5e3\",\"ok\":\"true\"") != NULL);
+  free(all_strings);
+
+  // Back to CSV: inferred columns take "a.b" literally, -f paths go into objects
+  f = fopen(path, "w");
+  fputs(got, f);
+  fputs("\n{\"zip\":8,\"name\":\"late\",\"a.b\":{\"c\":[1,2]},\"a\":{\"b\":{\"c\":[1,2]}}}\n", f);
+  fclose(f);
+  free(got);
+  char* to_csv[] = {"convert", "--from", "ndjson", path};
+  got = tool_output(cmd_convert_main, Countof(to_csv), to_csv);
+  ASSERT_STREQ(got,
+               "name,a.b,n,ok,zip\n\"Smith, J\",\"say \"\"hi\"\"\",-1.5e3,true,01234\n"
+               "tab\tx,,,false,7\nlate,\"{\"\"c\"\":[1,2]}\",,,8\n");
+  free(got);
+  char* paths[] = {"convert", "--to", "csv", "-f", "a.b.c", "-f", "name", path};
+  got = tool_output(cmd_convert_main, Countof(paths), paths);
+  ASSERT_STREQ(got, "a.b.c,name\n,\"Smith, J\"\n,tab\tx\n\"[1,2]\",late\n");
+  free(got);
+  unlink(path);
+}
+
+UTEST(cmd, topk_heavy_hitters) {
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  // a 1000 times, b 500, c 250, and 500 keys once, interleaved
+  for (int i = 0; i < 2250; i++) {
+    const char* key = i % 9 < 4 ? "a" : i % 9 < 6 ? "b" : i % 9 == 6 ? "c" : NULL;
+    if (key)
+      fprintf(f, "{\"user\":{\"id\":\"%s\"}}\n", key);
+    else
+      fprintf(f, "{\"user\":{\"id\":\"n%d\"}}\n", i);
+  }
+  fclose(f);
+
+  // Every key fits the counters: exact
+  char* argv[] = {"topk", "--key", "user.id", "-k", "3", "-e", "-t", "3", path};
+  char* got = tool_output(cmd_topk_main, Countof(argv), argv);
+  ASSERT_TRUE(got != NULL);
+  ASSERT_STREQ(got, "a\t1000\t0\nb\t500\t0\nc\t250\t0\n");
+  free(got);
+
+  // 20 counters: the noise is overcounted, but what is heavier than 1/20 is found in order
+  char* bounded[] = {"topk", "--key", "user.id", "-k", "3", "-m", "20", "-t", "2", path};
+  got = tool_output(cmd_topk_main, Countof(bounded), bounded);
+  ASSERT_TRUE(got != NULL);
+  long a, b, c;
+  ASSERT_EQ(sscanf(got, "a\t%ld\nb\t%ld\nc\t%ld\n", &a, &b, &c), 3);
+  ASSERT_TRUE(a >= 1000 && b >= 500 && c >= 250 && c <= 250 + 2250 / 20);
+  free(got);
+
+  f = fopen(path, "w");
+  fputs("host,status\n\"b, \"\"x\"\"\",500\na,200\n\"b, \"\"x\"\"\",500\na,404\n", f);
+  fclose(f);
+  char* csv[] = {"topk", "-i", "csv", "-H", "--key", "host", "--key", "status", "-k", "2", path};
+  got = tool_output(cmd_topk_main, Countof(csv), csv);
+  ASSERT_TRUE(got != NULL);
+  ASSERT_STREQ(got, "host\tstatus\tcount\nb, \"x\"\t500\t2\na\t200\t1\n");
+  free(got);
+  unlink(path);
+}
+
+UTEST(cmd, quantiles_fields) {
+  char path[32] = "/tmp/cmd_tests_XXXXXX";
+  FILE* f = fdopen(mkstemp(path), "w");
+  // Latencies 1 to 1000 scrambled, among records without one
+  for (int i = 0; i < 1000; i++) {
+    fprintf(f, "{\"latency\":%d,\"name\":\"n%d\"}\n", 1 + (i * 7919) % 1000, i);
+    if (i % 10 == 0)
+      fputs("{\"latency\":\"slow\"}\n{}\n", f);
+  }
+  fclose(f);
+
+  // Sketches larger than the stream: exact
+  char* argv[] = {"quantiles", "-H", "--field", "latency", "-f", "name", "-q", "0,0.5,0.99,1",
+                  "-k", "2000", "-t", "3", path};
+  char* got = tool_output(cmd_quantiles_main, Countof(argv), argv);
+  ASSERT_TRUE(got != NULL);
+  ASSERT_STREQ(got, "field\tcount\tp0\tp50\tp99\tp100\nlatency\t1000\t1\t500\t990\t1000\nname\t0\t\t\t\t\n");
+  free(got);
+
+  char* bad[] = {"quantiles", "-f", "latency", "-q", "0.5,99", path};
+  ASSERT_EQ(cmd_quantiles_main(Countof(bad), bad, STDOUT_FILENO), 2);
+  unlink(path);
+}
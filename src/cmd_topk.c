@@ -0,0 +1,191 @@
+#include <errno.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "arena_registry.h"
+#include "cmd.h"
+#include "csv.h"
+#include "json_path.h"
+#include "ketopt.h"
+#include "topk.h"
+
+// Counters and keys of one thread's summary
+#ifndef TOPK_THREAD_ARENA
+#define TOPK_THREAD_ARENA MB(256)
+#endif
+
+typedef struct {
+  alignas(CACHELINE_SIZE) Arena arena;
+  Topk *topk;
+} TopkThread;
+
+typedef struct {
+  bool csv;
+  int nkeys;
+  astr *names;       // Key fields
+  JsonPaths *paths;  // NDJSON: one path per key
+  int *key_col;      // CSV: column of each key in the current file
+  int ncols;
+  TopkThread *threads;
+} TopkCmd;
+
+static void topk_cmd_lines(void *ctx, astr lines, CmdSink *sink, Arena *scratch) {
+  TopkCmd *c = ctx;
+  TopkThread *t = &c->threads[pool_worker_id()];
+  struct json *vals = c->csv ? NULL : New(scratch, struct json, c->nkeys);
+  CsvField *cols = c->csv ? New(scratch, CsvField, c->ncols) : NULL;
+  (void)sink;
+
+  for (astr line; cmd_next_line(&lines, &line);) {
+    if (!line.len)
+      continue;
+    // topk_add() copies the key it keeps, so it is built in the scratch arena
+    Arena tmp = *scratch;
+    astr key;
+    if (c->csv) {
+      cmd_csv_fields(line, cols, c->ncols);
+      key = cmd_csv_key(&tmp, cols, c->key_col, c->nkeys);
+    } else {
+      json_paths_get(c->paths, line, vals);
+      key = cmd_json_key(&tmp, vals, c->nkeys);
+    }
+    topk_add(t->topk, key, 1);
+  }
+}
+
+static int topk_cmd_usage(FILE *f) {
+  fputs(
+      "usage: cmd topk --key FIELD [--key FIELD ...] [-k N] [options] [FILE ...]\n"
+      "Print the N most frequent keys of NDJSON or CSV records, most frequent\n"
+      "first, as TSV rows of the key and its count. Each thread keeps a fixed\n"
+      "number of counters (Space-Saving), so memory stays bounded on endless\n"
+      "input: counts are exact while the distinct keys fit, and otherwise never\n"
+      "below the true count, and any key with more than 1/COUNTERS of the\n"
+      "records is found.\n"
+      "  -K, --key FIELD       key: a dotted json path or a CSV column (repeatable)\n"
+      "  -k, --top N           keys to print (default 10)\n"
+      "  -m, --counters N      counters per thread (default: the larger of 10 N and 1000)\n"
+      "  -e, --errors          add a column of how much each count may be over\n"
+      "  -i, --input FORMAT    ndjson (default) or csv with a header line\n"
+      "  -H, --header          print the column names as a first row\n"
+      "  -t, --threads N       worker threads (default: one per CPU)\n",
+      f);
+  return f == stdout ? 0 : 2;
+}
+
+int cmd_topk_main(int argc, char *argv[], int out) {
+  static const ko_longopt_t longopts[] = {
+      {"key", ko_required_argument, 'K'},      {"top", ko_required_argument, 'k'},
+      {"counters", ko_required_argument, 'm'}, {"errors", ko_no_argument, 'e'},
+      {"input", ko_required_argument, 'i'},    {"header", ko_no_argument, 'H'},
+      {"threads", ko_required_argument, 't'},  {"help", ko_no_argument, 'h'},
+      {0},
+  };
+  Arena arena = cmd_arena_init(GB(1));
+  arena_register(&arena, "cmd.topk");
+  slice(astr) keys = {0};
+  TopkCmd c = {0};
+  int top = 10, counters = 0, threads = 0;
+  bool errors = false, header = false;
+
+  ketopt_t opt = KETOPT_INIT;
+  for (int ch; (ch = ketopt(&opt, argc, argv, 1, "K:k:m:ei:Ht:h", longopts)) >= 0;) {
+    if (ch == 'K') {
+      *Push(&arena, &keys) = astr_from_cstr(&arena, opt.arg);
+    } else if (ch == 'k' && atoi(opt.arg) > 0) {
+      top = atoi(opt.arg);
+    } else if (ch == 'm' && atoi(opt.arg) > 0) {
+      counters = atoi(opt.arg);
+    } else if (ch == 'e') {
+      errors = true;
+    } else if (ch == 'i' && (!strcmp(opt.arg, "ndjson") || !strcmp(opt.arg, "csv"))) {
+      c.csv = !strcmp(opt.arg, "csv");
+    } else if (ch == 'H') {
+      header = true;
+    } else if (ch == 't') {
+      threads = atoi(opt.arg);
+    } else if (ch == 'h') {
+      cmd_arena_release(&arena);
+      return topk_cmd_usage(stdout);
+    } else {
+      cmd_arena_release(&arena);
+      return topk_cmd_usage(stderr);
+    }
+  }
+  if (!keys.len) {
+    fputs("cmd topk: at least one --key FIELD is required\n", stderr);
+    cmd_arena_release(&arena);
+    return topk_cmd_usage(stderr);
+  }
+  if (!counters)
+    counters = Max(10 * top, 1000);
+  counters = Max(counters, top);
+
+  c.nkeys = (int)keys.len;
+  c.names = keys.data;
+  if (c.csv)
+    c.key_col = New(&arena, int, c.nkeys);
+  else
+    c.paths = json_paths_compile(&arena, c.names, c.nkeys);
+
+  CmdScan *scan = cmd_scan_create(&arena, (CmdScanOptions){.threads = threads});
+  int nthreads = cmd_scan_threads(scan);
+  c.threads = New(&arena, TopkThread, nthreads);
+  for (int i = 0; i < nthreads; i++) {
+    c.threads[i].arena = cmd_arena_init(TOPK_THREAD_ARENA);
+    arena_register(&c.threads[i].arena, "cmd.topk.counters");
+    c.threads[i].topk = topk_new(&c.threads[i].arena, counters);
+  }
+
+  int status = 0;
+  for (int i = opt.ind; i < argc || (i == opt.ind && i == argc); i++) {
+    CmdInput in;
+    if (!cmd_input_open(&in, i < argc ? argv[i] : NULL)) {
+      status = 1;
+      continue;
+    }
+    if (c.csv)
+      c.ncols = cmd_csv_header(&in, "topk", c.names, c.nkeys, c.key_col, arena);
+    if (c.ncols < 0)
+      status = 1;
+    else if ((!c.csv || c.ncols) && !cmd_scan(scan, &in, topk_cmd_lines, &c))
+      status = 1;
+    cmd_input_close(&in);
+  }
+  cmd_scan_destroy(scan);
+
+  // Each thread's arena past its summary is scratch for folding that summary in
+  Topk *all = topk_new(&arena, counters);
+  for (int i = 0; i < nthreads; i++) {
+    topk_merge(all, c.threads[i].topk, c.threads[i].arena);
+  }
+  TopkItem *items = topk_items(all, &arena);
+
+  CmdOut o = cmd_out_init(out);
+  if (header) {
+    astr row = {0};
+    for (int k = 0; k < c.nkeys; k++) {
+      row = astr_concat(&arena, k ? astr_cat_bytes(&arena, row, "\t", 1) : row, c.names[k]);
+    }
+    row = astr_concat(&arena, row, errors ? astr("\tcount\terror\n") : astr("\tcount\n"));
+    cmd_out_push(&o, row);
+  }
+  for (int i = 0; i < Min(top, topk_len(all)); i++) {
+    TopkItem *it = &items[i];
+    cmd_out_push(&o, it->key);
+    if (errors)
+      cmd_out_push(&o, astr_format(&arena, "\t%lld\t%lld\n", (long long)it->count, (long long)it->error));
+    else
+      cmd_out_push(&o, astr_format(&arena, "\t%lld\n", (long long)it->count));
+  }
+  if (!cmd_out_flush(&o)) {
+    fprintf(stderr, "cmd topk: write: %s\n", strerror(o.err));
+    status = 1;
+  }
+
+  for (int i = 0; i < nthreads; i++) {
+    cmd_arena_release(&c.threads[i].arena);
+  }
+  cmd_arena_release(&arena);
+  return status;
+}
@@ -0,0 +1,178 @@
+#include <errno.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "arena_registry.h"
+#include "cmd.h"
+#include "ketopt.h"
+
+// Bytes per pass of the counting kernels, so the later passes read from L2
+#ifndef WC_BLOCK
+#define WC_BLOCK KB(64)
+#endif
+
+typedef struct {
+  alignas(CACHELINE_SIZE) isize lines;
+  isize words, chars, bytes;
+  isize invalid;  // Bytes of invalid UTF-8
+} WcCounts;
+
+typedef struct {
+  bool lines, words, chars, bytes;
+  WcCounts *threads;  // Per pool worker, summed after each file
+} Wc;
+
+static void wc_lines(void *ctx, astr lines, CmdSink *sink, Arena *scratch) {
+  Wc *w = ctx;
+  WcCounts *c = &w->threads[pool_worker_id()];
+  bool in_word = false;  // Chunks start at a line
+  c->bytes += lines.len;
+  for (isize pos = 0; pos < lines.len;) {
+    isize end = Min(pos + (isize)WC_BLOCK, lines.len);
+    // Cut before a continuation byte, unless it is past any character's reach
+    for (int back = 0; w->chars && end < lines.len && back < 3; back++) {
+      if ((lines.data[end] & 0xc0) != 0x80)
+        break;
+      end--;
+    }
+    astr block = astr_slice(lines, pos, end);
+    if (w->lines)
+      c->lines += astr_count_char(block, '\n');
+    if (w->words)
+      c->words += astr_count_words(block, &in_word);
+    if (w->chars) {
+      isize invalid;
+      c->chars += astr_utf8_count(block, &invalid);
+      c->invalid += invalid;
+    }
+    pos = end;
+  }
+}
+
+// The counts of one file, without its threads' padding
+typedef struct {
+  const char *path;  // NULL for stdin and the total
+  isize n[4];        // Lines, words, chars, bytes
+} WcRow;
+
+typedef slice(WcRow) WcRows;
+
+static int wc_usage(FILE *f) {
+  fputs(
+      "usage: cmd wc [-l] [-w] [-m] [-c] [-t N] [FILE ...]\n"
+      "Print newline, word, character and byte counts of each file, and a\n"
+      "total line for several files; -l, -w and -c by default. Words are\n"
+      "separated by ASCII whitespace and characters are UTF-8: invalid UTF-8\n"
+      "is reported on stderr with exit status 1.\n"
+      "  -l, --lines           newlines\n"
+      "  -w, --words           words\n"
+      "  -m, --chars           UTF-8 characters\n"
+      "  -c, --bytes           bytes\n"
+      "  -t, --threads N       worker threads (default: one per CPU)\n",
+      f);
+  return f == stdout ? 0 : 2;
+}
+
+int cmd_wc_main(int argc, char *argv[], int out) {
+  static const ko_longopt_t longopts[] = {
+      {"lines", ko_no_argument, 'l'},         {"words", ko_no_argument, 'w'},
+      {"chars", ko_no_argument, 'm'},         {"bytes", ko_no_argument, 'c'},
+      {"threads", ko_required_argument, 't'}, {"help", ko_no_argument, 'h'},
+      {0},
+  };
+  Arena arena = cmd_arena_init(MB(64));
+  arena_register(&arena, "cmd.wc");
+  Wc w = {0};
+  int threads = 0;
+
+  ketopt_t opt = KETOPT_INIT;
+  for (int c; (c = ketopt(&opt, argc, argv, 1, "lwmct:h", longopts)) >= 0;) {
+    if (c == 'l') {
+      w.lines = true;
+    } else if (c == 'w') {
+      w.words = true;
+    } else if (c == 'm') {
+      w.chars = true;
+    } else if (c == 'c') {
+      w.bytes = true;
+    } else if (c == 't') {
+      threads = atoi(opt.arg);
+    } else if (c == 'h') {
+      cmd_arena_release(&arena);
+      return wc_usage(stdout);
+    } else {
+      cmd_arena_release(&arena);
+      return wc_usage(stderr);
+    }
+  }
+  if (!w.lines && !w.words && !w.chars && !w.bytes)
+    w.lines = w.words = w.bytes = true;
+
+  CmdScan *scan = cmd_scan_create(&arena, (CmdScanOptions){.threads = threads});
+  int nthreads = cmd_scan_threads(scan);
+  w.threads = New(&arena, WcCounts, nthreads);
+  WcRows rows = {0};
+  WcRow total = {0};
+  int status = 0;
+  for (int i = opt.ind; i < argc || (i == opt.ind && i == argc); i++) {
+    CmdInput in;
+    if (!cmd_input_open(&in, i < argc ? argv[i] : NULL)) {
+      status = 1;
+      continue;
+    }
+    if (!cmd_scan(scan, &in, wc_lines, &w))
+      status = 1;
+    WcCounts sum = {0};
+    for (int t = 0; t < nthreads; t++) {
+      WcCounts *c = &w.threads[t];
+      sum.lines += c->lines, sum.words += c->words, sum.chars += c->chars;
+      sum.bytes += c->bytes, sum.invalid += c->invalid;
+      *c = (WcCounts){0};
+    }
+    if (sum.invalid) {
+      fprintf(stderr, "cmd wc: %s: %lld bytes of invalid UTF-8\n", in.path, (long long)sum.invalid);
+      status = 1;
+    }
+    WcRow *row = Push(&arena, &rows);
+    *row = (WcRow){i < argc ? argv[i] : NULL, {sum.lines, sum.words, sum.chars, sum.bytes}};
+    for (int k = 0; k < 4; k++) {
+      total.n[k] += row->n[k];
+    }
+    cmd_input_close(&in);
+  }
+  cmd_scan_destroy(scan);
+  if (rows.len > 1)
+    *Push(&arena, &rows) = total;
+
+  // Right-align the columns to the widest count, as wc does
+  bool shown[4] = {w.lines, w.words, w.chars, w.bytes};
+  int ncolumns = shown[0] + shown[1] + shown[2] + shown[3];
+  int width = 1;
+  for (isize r = 0; r < rows.len && ncolumns * rows.len > 1; r++) {
+    for (int k = 0; k < 4; k++) {
+      if (shown[k])
+        width = Max(width, snprintf(NULL, 0, "%lld", (long long)rows.data[r].n[k]));
+    }
+  }
+  CmdOut o = cmd_out_init(out);
+  for (isize r = 0; r < rows.len; r++) {
+    WcRow *row = &rows.data[r];
+    const char *sep = "";
+    for (int k = 0; k < 4; k++) {
+      if (!shown[k])
+        continue;
+      cmd_out_push(&o, astr_format(&arena, "%s%*lld", sep, width, (long long)row->n[k]));
+      sep = " ";
+    }
+    bool is_total = rows.len > 1 && r == rows.len - 1;
+    if (row->path || is_total)
+      cmd_out_push(&o, astr_format(&arena, " %s", is_total ? "total" : row->path));
+    cmd_out_push(&o, astr("\n"));
+  }
+  if (!cmd_out_flush(&o)) {
+    fprintf(stderr, "cmd wc: write: %s\n", strerror(o.err));
+    status = 1;
+  }
+  cmd_arena_release(&arena);
+  return status;
+}
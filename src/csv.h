@@ -0,0 +1,102 @@
+/**
+ * @file csv.h
+ * @brief RFC 4180 fields as views into a record, copied only to unescape.
+ *
+ * A record is one line (see cmd_next_line()); quoted fields may hold
+ * commas and doubled quotes but not newlines. csv_cat() writes fields
+ * back, quoted only when they need it.
+ *
+ * Usage:
+ *   isize pos = 0;
+ *   for (CsvField f; csv_next_field(line, &pos, &f);) {
+ *     astr text = f.escaped ? csv_unescape(arena, f.text) : f.text;
+ *     ...
+ *   }
+ */
+
+#ifndef CSV_H_
+#define CSV_H_
+
+#include "arena.h"
+
+typedef struct {
+  astr text;     // Field without its quotes
+  bool quoted;   // Was in quotes, so "" or "42" is text rather than empty or a number
+  bool escaped;  // Holds doubled quotes, see csv_unescape()
+} CsvField;
+
+/**
+ * @brief Split the next field off a record.
+ * @param record Whole record
+ * @param pos Start of the field, 0 for the first; past the end after the last
+ * @param field Set to the field
+ * @return false once every field was taken; "" is one empty field
+ */
+static inline bool csv_next_field(astr record, isize *pos, CsvField *field) {
+  isize i = *pos;
+  if (i > record.len)
+    return false;
+  *field = (CsvField){0};
+  if (i < record.len && record.data[i] == '"') {
+    field->quoted = true;
+    isize beg = ++i;
+    for (; i < record.len; i++) {
+      if (record.data[i] != '"')
+        continue;
+      if (i + 1 < record.len && record.data[i + 1] == '"') {
+        field->escaped = true;
+        i++;
+        continue;
+      }
+      break;
+    }
+    field->text = (astr){record.data + beg, i - beg};
+    // Anything between the closing quote and the comma is dropped
+    char *comma = i < record.len ? memchr(record.data + i, ',', record.len - i) : NULL;
+    *pos = comma ? comma - record.data + 1 : record.len + 1;
+    return true;
+  }
+  char *comma = i < record.len ? memchr(record.data + i, ',', record.len - i) : NULL;
+  isize end = comma ? comma - record.data : record.len;
+  field->text = (astr){record.data + i, end - i};
+  *pos = end + 1;
+  return true;
+}
+
+// Copy of a quoted field's text with doubled quotes collapsed
+static inline astr csv_unescape(Arena *arena, astr text) {
+  char *out = New(arena, char, text.len, NO_INIT);
+  isize n = 0;
+  for (isize i = 0; i < text.len; i++) {
+    out[n++] = text.data[i];
+    i += text.data[i] == '"' && i + 1 < text.len && text.data[i + 1] == '"';
+  }
+  return (astr){out, n};
+}
+
+/**
+ * @brief Append s to head at the arena tip as one CSV field.
+ *
+ * Fields holding a comma, quote, CR or newline are quoted with their
+ * quotes doubled; a newline inside quotes is valid CSV, though
+ * csv_next_field() cannot read it back.
+ */
+static inline astr csv_cat(Arena *arena, astr head, astr s) {
+  isize i = 0;
+  while (i < s.len && s.data[i] != ',' && s.data[i] != '"' && s.data[i] != '\n' && s.data[i] != '\r')
+    i++;
+  if (ARENA_LIKELY(i == s.len))
+    return astr_cat_bytes(arena, head, s.data, s.len);
+  head = astr_cat_bytes(arena, head, "\"", 1);
+  isize run = 0;
+  for (char *q; (q = memchr(s.data + run, '"', s.len - run));) {
+    isize end = q - s.data + 1;
+    head = astr_cat_bytes(arena, head, s.data + run, end - run);
+    head = astr_cat_bytes(arena, head, "\"", 1);
+    run = end;
+  }
+  head = astr_cat_bytes(arena, head, s.data + run, s.len - run);
+  return astr_cat_bytes(arena, head, "\"", 1);
+}
+
+#endif  // CSV_H_
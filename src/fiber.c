@@ -0,0 +1,414 @@
+#include "fiber.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "list.h"
+
+#if !defined(FIBER_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define FIBER_UCONTEXT
+#endif
+
+/* --- Context switch --- */
+
+#ifdef FIBER_UCONTEXT
+#include <ucontext.h>
+typedef ucontext_t FiberCtx;
+#else
+typedef struct {
+  void *sp;  // Saved stack pointer; registers live on the stack below it
+} FiberCtx;
+
+// Push callee-saved state, save sp to *from, load sp from *to, pop and return into it
+void fiber_ctx_switch(FiberCtx *from, FiberCtx *to);
+
+#if defined(__x86_64__)
+// Frame (low to high): mxcsr+x87 cw, r15, r14, r13, r12, rbx, rbp, return address
+__asm__(
+    ".text\n"
+    ".globl fiber_ctx_switch\n"
+    ".hidden fiber_ctx_switch\n"
+    ".type fiber_ctx_switch, @function\n"
+    "fiber_ctx_switch:\n"
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  subq $8, %rsp\n"
+    "  stmxcsr (%rsp)\n"
+    "  fnstcw 4(%rsp)\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq (%rsi), %rsp\n"
+    "  ldmxcsr (%rsp)\n"
+    "  fldcw 4(%rsp)\n"
+    "  addq $8, %rsp\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n"
+    ".size fiber_ctx_switch, .-fiber_ctx_switch\n");
+enum { FIBER_FRAME = 72 };  // Including the return address and a pad word
+#elif defined(__aarch64__)
+// Frame (low to high): x19-x28, x29 (fp), x30 (lr), d8-d15
+__asm__(
+    ".text\n"
+    ".globl fiber_ctx_switch\n"
+    ".hidden fiber_ctx_switch\n"
+    ".type fiber_ctx_switch, %function\n"
+    "fiber_ctx_switch:\n"
+    "  sub sp, sp, #160\n"
+    "  stp x19, x20, [sp, #0]\n"
+    "  stp x21, x22, [sp, #16]\n"
+    "  stp x23, x24, [sp, #32]\n"
+    "  stp x25, x26, [sp, #48]\n"
+    "  stp x27, x28, [sp, #64]\n"
+    "  stp x29, x30, [sp, #80]\n"
+    "  stp d8, d9, [sp, #96]\n"
+    "  stp d10, d11, [sp, #112]\n"
+    "  stp d12, d13, [sp, #128]\n"
+    "  stp d14, d15, [sp, #144]\n"
+    "  mov x9, sp\n"
+    "  str x9, [x0]\n"
+    "  ldr x9, [x1]\n"
+    "  mov sp, x9\n"
+    "  ldp x19, x20, [sp, #0]\n"
+    "  ldp x21, x22, [sp, #16]\n"
+    "  ldp x23, x24, [sp, #32]\n"
+    "  ldp x25, x26, [sp, #48]\n"
+    "  ldp x27, x28, [sp, #64]\n"
+    "  ldp x29, x30, [sp, #80]\n"
+    "  ldp d8, d9, [sp, #96]\n"
+    "  ldp d10, d11, [sp, #112]\n"
+    "  ldp d12, d13, [sp, #128]\n"
+    "  ldp d14, d15, [sp, #144]\n"
+    "  add sp, sp, #160\n"
+    "  ret\n"
+    ".size fiber_ctx_switch, .-fiber_ctx_switch\n");
+enum { FIBER_FRAME = 160 };
+#endif
+#endif  // FIBER_UCONTEXT
+
+/* --- Scheduler state --- */
+
+typedef struct {
+  struct list_head link;  // Wheel slot
+  uint64_t deadline;      // Tick at which the timer fires
+  bool armed;
+} FiberTimer;
+
+struct Fiber {
+  FiberCtx ctx;
+  struct list_head link;  // Run queue or free list
+  FiberTimer timer;
+  FiberFn fn;
+  void *arg;
+  byte *stack;  // Lowest usable stack address (just above the guard page)
+  isize stack_size;
+  int await_fd;     // fd registered with epoll, -1 if none
+  uint32_t events;  // Result of fiber_await_fd()
+  bool done;
+};
+
+typedef struct {
+  bool init;
+  Fiber main;  // Scheduler context, runs on the thread's own stack
+  Fiber *current;
+  struct list_head runq;
+  struct list_head free;
+  struct list_head wheel[FIBER_WHEEL_SLOTS];
+  uint64_t tick;  // Last tick processed by the wheel
+  isize ntimers;
+  isize live;
+  int epfd;
+  Arena stacks;
+#ifdef ASAN_ENABLED
+  const void *main_stack;
+  size_t main_stack_size;
+#endif
+} FiberSched;
+
+static __thread FiberSched fiber_sched;
+
+// Dispatches between non-blocking polls when the run queue never drains
+enum { FIBER_POLL_EVERY = 64, FIBER_MAX_EVENTS = 64 };
+
+static uint64_t fiber_now_tick(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000) / FIBER_TICK_MS;
+}
+
+static FiberSched *fiber_sched_get(void) {
+  FiberSched *s = &fiber_sched;
+  if (ARENA_UNLIKELY(!s->init)) {
+    INIT_LIST_HEAD(&s->runq);
+    INIT_LIST_HEAD(&s->free);
+    for (int i = 0; i < FIBER_WHEEL_SLOTS; i++) {
+      INIT_LIST_HEAD(&s->wheel[i]);
+    }
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (s->epfd < 0) {
+      perror("fiber epoll_create1");
+      abort();
+    }
+    s->tick = fiber_now_tick();
+    s->init = true;
+  }
+  return s;
+}
+
+static void fiber_switch(FiberSched *s, Fiber *from, Fiber *to, bool exiting) {
+#ifdef ASAN_ENABLED
+  void *fake_stack = NULL;
+  const void *to_stack = to == &s->main ? s->main_stack : to->stack;
+  size_t to_size = to == &s->main ? s->main_stack_size : (size_t)to->stack_size;
+  __sanitizer_start_switch_fiber(exiting ? NULL : &fake_stack, to_stack, to_size);
+#endif
+#ifdef FIBER_UCONTEXT
+  swapcontext(&from->ctx, &to->ctx);
+#else
+  fiber_ctx_switch(&from->ctx, &to->ctx);
+#endif
+#ifdef ASAN_ENABLED
+  const void *old_stack;
+  size_t old_size;
+  __sanitizer_finish_switch_fiber(fake_stack, &old_stack, &old_size);
+  if (from != &s->main) {
+    s->main_stack = old_stack;
+    s->main_stack_size = old_size;
+  }
+#endif
+}
+
+/* --- Timer wheel --- */
+
+static void fiber_timer_arm(FiberSched *s, Fiber *f, int64_t ms) {
+  uint64_t ticks = ms <= 0 ? 0 : ((uint64_t)ms + FIBER_TICK_MS - 1) / FIBER_TICK_MS;
+  uint64_t deadline = Max(fiber_now_tick() + ticks, s->tick + 1);
+  f->timer.deadline = deadline;
+  f->timer.armed = true;
+  list_add_tail(&f->timer.link, &s->wheel[deadline & (FIBER_WHEEL_SLOTS - 1)]);
+  s->ntimers++;
+}
+
+static void fiber_timer_cancel(FiberSched *s, Fiber *f) {
+  if (f->timer.armed) {
+    list_del_init(&f->timer.link);
+    f->timer.armed = false;
+    s->ntimers--;
+  }
+}
+
+static void fiber_unwatch(FiberSched *s, Fiber *f) {
+  if (f->await_fd >= 0) {
+    epoll_ctl(s->epfd, EPOLL_CTL_DEL, f->await_fd, NULL);
+    f->await_fd = -1;
+  }
+}
+
+// Fire every timer due by now; a timed-out fd wait returns 0 events
+static void fiber_timers_advance(FiberSched *s, uint64_t now) {
+  if (now <= s->tick)
+    return;
+  if (s->ntimers > 0) {
+    uint64_t from = now - s->tick >= FIBER_WHEEL_SLOTS ? now - FIBER_WHEEL_SLOTS + 1 : s->tick + 1;
+    for (uint64_t t = from; t <= now; t++) {
+      struct list_head *slot = &s->wheel[t & (FIBER_WHEEL_SLOTS - 1)];
+      Fiber *f, *next;
+      list_for_each_entry_safe(f, next, slot, timer.link) {
+        if (f->timer.deadline <= now) {
+          fiber_timer_cancel(s, f);
+          fiber_unwatch(s, f);
+          f->events = 0;
+          list_add_tail(&f->link, &s->runq);
+        }
+      }
+    }
+  }
+  s->tick = now;
+}
+
+// Milliseconds until the earliest wheel slot with a timer, -1 if none
+static int fiber_timers_timeout(FiberSched *s, uint64_t now) {
+  if (s->ntimers == 0)
+    return -1;
+  for (uint64_t t = s->tick + 1; t <= s->tick + FIBER_WHEEL_SLOTS; t++) {
+    if (!list_empty(&s->wheel[t & (FIBER_WHEEL_SLOTS - 1)]))
+      return t <= now ? 0 : (int)((t - now) * FIBER_TICK_MS);
+  }
+  return FIBER_WHEEL_SLOTS * FIBER_TICK_MS;
+}
+
+static void fiber_poll(FiberSched *s, int timeout_ms) {
+  struct epoll_event events[FIBER_MAX_EVENTS];
+  int n = epoll_wait(s->epfd, events, FIBER_MAX_EVENTS, timeout_ms);
+  for (int i = 0; i < n; i++) {
+    Fiber *f = events[i].data.ptr;
+    fiber_timer_cancel(s, f);
+    fiber_unwatch(s, f);
+    f->events = events[i].events;
+    list_add_tail(&f->link, &s->runq);
+  }
+  fiber_timers_advance(s, fiber_now_tick());
+}
+
+/* --- Stacks --- */
+
+static void fiber_trampoline(void) {
+  FiberSched *s = &fiber_sched;
+#ifdef ASAN_ENABLED
+  __sanitizer_finish_switch_fiber(NULL, &s->main_stack, &s->main_stack_size);
+#endif
+  Fiber *f = s->current;
+  f->fn(f->arg);
+  f->done = true;
+  fiber_switch(s, f, &s->main, true);
+  __builtin_unreachable();
+}
+
+// Slot layout: [guard page][stack ... ][Fiber]
+static Fiber *fiber_slot_alloc(FiberSched *s) {
+  if (!list_empty(&s->free)) {
+    Fiber *f = list_first_entry(&s->free, Fiber, link);
+    list_del_init(&f->link);
+    return f;
+  }
+
+  isize page = (isize)sysconf(_SC_PAGESIZE);
+  isize header = AlignPow2((isize)sizeof(Fiber), 64);
+  isize slot_size = page + AlignPow2(FIBER_STACK_SIZE + header, page);
+#ifdef OOM_COMMIT
+  if (!s->stacks.beg) {
+    s->stacks = arena_init(NULL, FIBER_STACK_RESERVE);
+  }
+  byte *slot = arena_alloc(&s->stacks, slot_size, page, 1, (ArenaFlag){_NO_INIT | _OOM_NULL});
+  if (!slot)
+    return NULL;
+  mprotect(slot, page, PROT_NONE);
+#else
+  // No reservation to carve from: plain aligned allocations, no guard page
+  byte *slot = aligned_alloc(page, slot_size);
+  if (!slot)
+    return NULL;
+#endif
+
+  Fiber *f = (Fiber *)(slot + slot_size - header);
+  memset(f, 0, sizeof(*f));
+  INIT_LIST_HEAD(&f->link);
+  INIT_LIST_HEAD(&f->timer.link);
+  f->stack = slot + page;
+  f->stack_size = (byte *)f - f->stack;
+  return f;
+}
+
+static void fiber_ctx_init(Fiber *f) {
+  ASAN_UNPOISON_MEMORY_REGION(f->stack, f->stack_size);
+#ifdef FIBER_UCONTEXT
+  getcontext(&f->ctx);
+  f->ctx.uc_stack.ss_sp = f->stack;
+  f->ctx.uc_stack.ss_size = f->stack_size;
+  f->ctx.uc_link = NULL;
+  makecontext(&f->ctx, fiber_trampoline, 0);
+#else
+  byte *top = (byte *)AlignDownPow2((uintptr_t)(f->stack + f->stack_size), 16);
+  void **frame = (void **)(top - FIBER_FRAME);
+  memset(frame, 0, FIBER_FRAME);
+#if defined(__x86_64__)
+  // Default MXCSR and x87 control word, six zeroed registers, return address, zero pad
+  ((uint32_t *)frame)[0] = 0x1F80;
+  ((uint16_t *)frame)[2] = 0x037F;
+  frame[7] = (void *)fiber_trampoline;
+#else
+  frame[11] = (void *)fiber_trampoline;  // x30
+#endif
+  f->ctx.sp = frame;
+#endif
+}
+
+/* --- API --- */
+
+Fiber *fiber_spawn(FiberFn fn, void *arg) {
+  FiberSched *s = fiber_sched_get();
+  Fiber *f = fiber_slot_alloc(s);
+  if (!f)
+    return NULL;
+
+  f->fn = fn;
+  f->arg = arg;
+  f->done = false;
+  f->await_fd = -1;
+  fiber_ctx_init(f);
+  list_add_tail(&f->link, &s->runq);
+  s->live++;
+  return f;
+}
+
+void fiber_run(void) {
+  FiberSched *s = fiber_sched_get();
+  Assert(!s->current && "fiber_run called from inside a fiber");
+
+  int dispatched = 0;
+  while (s->live > 0) {
+    if (list_empty(&s->runq)) {
+      fiber_poll(s, fiber_timers_timeout(s, fiber_now_tick()));
+      continue;
+    }
+    if (++dispatched % FIBER_POLL_EVERY == 0) {
+      fiber_poll(s, 0);
+    }
+
+    Fiber *f = list_first_entry(&s->runq, Fiber, link);
+    list_del_init(&f->link);
+    s->current = f;
+    fiber_switch(s, &s->main, f, false);
+    s->current = NULL;
+
+    if (f->done) {
+      list_add(&f->link, &s->free);
+      s->live--;
+    }
+  }
+}
+
+void fiber_yield(void) {
+  FiberSched *s = &fiber_sched;
+  Fiber *f = s->current;
+  if (!f)
+    return;
+  list_add_tail(&f->link, &s->runq);
+  fiber_switch(s, f, &s->main, false);
+}
+
+void fiber_sleep(int64_t ms) {
+  FiberSched *s = &fiber_sched;
+  Fiber *f = s->current;
+  Assert(f && "fiber_sleep called outside a fiber");
+  fiber_timer_arm(s, f, ms);
+  fiber_switch(s, f, &s->main, false);
+}
+
+int fiber_await_fd(int fd, uint32_t events, int64_t timeout_ms) {
+  FiberSched *s = &fiber_sched;
+  Fiber *f = s->current;
+  Assert(f && "fiber_await_fd called outside a fiber");
+
+  struct epoll_event ev = {.events = events | EPOLLONESHOT, .data.ptr = f};
+  if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    return -1;
+  f->await_fd = fd;
+  f->events = 0;
+  if (timeout_ms >= 0)
+    fiber_timer_arm(s, f, timeout_ms);
+
+  fiber_switch(s, f, &s->main, false);
+  return (int)f->events;
+}
+
+Fiber *fiber_current(void) {
+  return fiber_sched.current;
+}
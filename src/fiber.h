@@ -0,0 +1,89 @@
+/**
+ * @file fiber.h
+ * @brief Stackful coroutines with a per-thread scheduler, timers and epoll.
+ *
+ * Each thread that calls fiber_run() gets its own scheduler: a FIFO run
+ * queue, a hashed timer wheel for sleeps and timeouts, and an epoll
+ * instance for fd readiness. Fibers never migrate between threads.
+ *
+ * Stacks are fixed-size slots carved from one commit-on-demand arena
+ * reservation (pages are only backed once touched), each with a guard page
+ * below it, and are recycled when a fiber finishes. Context switches are
+ * hand-written for x86-64 and aarch64, with ucontext as the fallback.
+ *
+ * Usage:
+ *   static void worker(void *arg) {
+ *     int fd = *(int *)arg;
+ *     while (fiber_await_fd(fd, EPOLLIN, 1000) > 0) {
+ *       // read(fd, ...) will not block
+ *     }
+ *   }
+ *
+ *   fiber_spawn(worker, &fd);
+ *   fiber_run();  // returns when every fiber on this thread has finished
+ */
+
+#ifndef FIBER_H_
+#define FIBER_H_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "arena.h"
+
+// Usable stack per fiber (a guard page is added below it)
+#ifndef FIBER_STACK_SIZE
+#define FIBER_STACK_SIZE KB(64)
+#endif
+
+// Virtual address space reserved per thread for fiber stacks
+#ifndef FIBER_STACK_RESERVE
+#define FIBER_STACK_RESERVE GB(16)
+#endif
+
+// Timer wheel: slot count (power of 2) and tick length
+#ifndef FIBER_WHEEL_SLOTS
+#define FIBER_WHEEL_SLOTS 512
+#endif
+#ifndef FIBER_TICK_MS
+#define FIBER_TICK_MS 1
+#endif
+
+typedef struct Fiber Fiber;
+typedef void (*FiberFn)(void *arg);
+
+/**
+ * @brief Create a fiber on the calling thread's scheduler.
+ * @param fn Entry point
+ * @param arg Passed to fn
+ * @return New fiber, queued to run
+ *
+ * Callable before fiber_run() or from inside a fiber.
+ */
+Fiber *fiber_spawn(FiberFn fn, void *arg);
+
+/**
+ * @brief Run the calling thread's fibers until all have finished.
+ *
+ * Not callable from inside a fiber.
+ */
+void fiber_run(void);
+
+// Let other runnable fibers go first
+void fiber_yield(void);
+
+// Suspend the current fiber for at least ms milliseconds
+void fiber_sleep(int64_t ms);
+
+/**
+ * @brief Suspend the current fiber until fd is ready or the timeout expires.
+ * @param fd File descriptor (should be non-blocking)
+ * @param events EPOLLIN, EPOLLOUT, ...
+ * @param timeout_ms Timeout in milliseconds, < 0 to wait forever
+ * @return Ready epoll events, 0 on timeout, -1 with errno on error
+ */
+int fiber_await_fd(int fd, uint32_t events, int64_t timeout_ms);
+
+// @return Running fiber, or NULL when called from outside a fiber
+Fiber *fiber_current(void);
+
+#endif  // FIBER_H_
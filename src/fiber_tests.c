@@ -0,0 +1,143 @@
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "fiber.h"
+#include "utest.h"
+
+typedef struct {
+  char log[64];
+  int len;
+} Trace;
+
+typedef struct {
+  Trace* trace;
+  char name;
+  int64_t ms;
+} Step;
+
+static void yield_three(void* arg) {
+  Step* s = arg;
+  for (int i = 0; i < 3; i++) {
+    s->trace->log[s->trace->len++] = s->name;
+    fiber_yield();
+  }
+}
+
+UTEST(fiber, yield_round_robin) {
+  Trace t = {0};
+  Step a = {&t, 'a', 0}, b = {&t, 'b', 0};
+  ASSERT_TRUE(fiber_spawn(yield_three, &a) != NULL);
+  ASSERT_TRUE(fiber_spawn(yield_three, &b) != NULL);
+  ASSERT_TRUE(fiber_current() == NULL);
+  fiber_run();
+  ASSERT_STREQ(t.log, "ababab");
+}
+
+static void sleep_then_log(void* arg) {
+  Step* s = arg;
+  fiber_sleep(s->ms);
+  s->trace->log[s->trace->len++] = s->name;
+}
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+UTEST(fiber, sleep_wakes_in_deadline_order) {
+  Trace t = {0};
+  Step steps[] = {{&t, 'c', 30}, {&t, 'a', 10}, {&t, 'b', 20}, {&t, 'z', 0}};
+  for (int i = 0; i < Countof(steps); i++) {
+    fiber_spawn(sleep_then_log, &steps[i]);
+  }
+  int64_t start = now_ms();
+  fiber_run();
+  ASSERT_STREQ(t.log, "zabc");
+  ASSERT_GE(now_ms() - start, 30);
+}
+
+typedef struct {
+  int fd;
+  int got;
+  int timeouts;
+} Reader;
+
+static void pipe_reader(void* arg) {
+  Reader* r = arg;
+  char buf[16];
+  for (;;) {
+    int ev = fiber_await_fd(r->fd, EPOLLIN, 1000);
+    if (ev <= 0) {
+      r->timeouts++;
+      return;
+    }
+    ssize_t n = read(r->fd, buf, sizeof(buf));
+    if (n <= 0)
+      return;  // Writer closed
+    r->got += (int)n;
+  }
+}
+
+static void pipe_writer(void* arg) {
+  int fd = *(int*)arg;
+  for (int i = 0; i < 5; i++) {
+    fiber_sleep(2);
+    if (write(fd, "ping", 4) != 4)
+      break;
+  }
+  close(fd);
+}
+
+UTEST(fiber, await_pipe) {
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  Reader r = {.fd = fds[0]};
+  fiber_spawn(pipe_reader, &r);
+  fiber_spawn(pipe_writer, &fds[1]);
+  fiber_run();
+  close(fds[0]);
+  ASSERT_EQ(r.got, 20);
+  ASSERT_EQ(r.timeouts, 0);
+}
+
+static void await_idle(void* arg) {
+  int* out = arg;
+  *out = fiber_await_fd(out[1], EPOLLIN, 5);
+}
+
+UTEST(fiber, await_timeout) {
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  int io[2] = {-2, fds[0]};
+  fiber_spawn(await_idle, io);
+  fiber_run();
+  ASSERT_EQ(io[0], 0);
+
+  // The fd was unregistered on timeout, so it can be awaited again
+  io[0] = -2;
+  ASSERT_EQ(write(fds[1], "x", 1), 1);
+  fiber_spawn(await_idle, io);
+  fiber_run();
+  ASSERT_EQ(io[0], EPOLLIN);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static void count_and_spawn(void* arg) {
+  int* count = arg;
+  for (int i = 0; i < 10; i++) {
+    fiber_yield();
+  }
+  if (++*count % 100 == 0)
+    fiber_spawn(count_and_spawn, count);  // Reuses a finished fiber's stack
+}
+
+UTEST(fiber, many_fibers) {
+  int count = 0;
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_TRUE(fiber_spawn(count_and_spawn, &count) != NULL);
+  }
+  fiber_run();
+  ASSERT_EQ(count, 1010);
+}
@@ -0,0 +1,119 @@
+#include "json_path.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef slice(JsonPathNode) JsonPathNodes;
+
+static int json_path_child(JsonPathNodes *nodes, Arena *arena, int parent, astr key) {
+  for (int c = nodes->data[parent].child; c >= 0; c = nodes->data[c].sibling) {
+    if (astr_equals(nodes->data[c].key, key))
+      return c;
+  }
+  isize index = key.len > 0 && key.len < 19 ? 0 : -1;
+  for (isize i = 0; i < key.len && index >= 0; i++) {
+    index = key.data[i] >= '0' && key.data[i] <= '9' ? index * 10 + (key.data[i] - '0') : -1;
+  }
+  // Append as the last child, so siblings keep the order paths were given in
+  int c = (int)nodes->len;
+  *Push(arena, nodes) = (JsonPathNode){key, index, -1, -1, 0};
+  int *link = &nodes->data[parent].child;
+  while (*link >= 0) {
+    link = &nodes->data[*link].sibling;
+  }
+  *link = c;
+  nodes->data[parent].nchildren++;
+  return c;
+}
+
+JsonPaths *json_paths_compile(Arena *arena, const astr *paths, int n) {
+  JsonPaths *p = New(arena, JsonPaths);
+  p->field_node = New(arena, int, n);
+  p->nfields = n;
+
+  JsonPathNodes nodes = {0};
+  *Push(arena, &nodes) = (JsonPathNode){{0}, -1, -1, -1, 0};
+  for (int f = 0; f < n; f++) {
+    astr path = astr_clone(arena, paths[f]);
+    int node = 0;
+    for (astr_split(it, ".", path)) {
+      node = json_path_child(&nodes, arena, node, it.token);
+    }
+    p->field_node[f] = node;
+  }
+  p->nodes = nodes.data;
+  p->nnodes = (int)nodes.len;
+  return p;
+}
+
+static bool json_path_key_equals(struct json key, astr want) {
+  const char *raw = json_raw(key);
+  isize len = (isize)json_raw_length(key) - 2;
+  if (ARENA_LIKELY(!json_string_is_escaped(key)))
+    return len == want.len && !memcmp(raw + 1, want.data, len);
+  // Escaped keys are rare: unescape and compare (json_string_comparen() wants a C string)
+  if ((isize)json_string_length(key) != want.len)
+    return false;
+  char stack[256];
+  char *buf = want.len < Countof(stack) ? stack : malloc(want.len + 1);
+  if (!buf) {
+    perror("json_paths_get malloc");
+    abort();
+  }
+  json_string_copy(key, buf, want.len + 1);
+  bool eq = !memcmp(buf, want.data, want.len);
+  if (buf != stack)
+    free(buf);
+  return eq;
+}
+
+// Fill vals[] for the children of node found in v, then descend into them
+static void json_path_walk(const JsonPaths *p, int node, struct json v, struct json *vals) {
+  const JsonPathNode *n = &p->nodes[node];
+  enum json_type type = json_type(v);
+  if (type == JSON_ARRAY) {
+    for (int c = n->child; c >= 0; c = p->nodes[c].sibling) {
+      if (p->nodes[c].index >= 0) {
+        vals[c] = json_array_get(v, p->nodes[c].index);
+        if (p->nodes[c].child >= 0 && json_exists(vals[c]))
+          json_path_walk(p, c, vals[c], vals);
+      }
+    }
+    return;
+  }
+  if (type != JSON_OBJECT)
+    return;
+
+  int left = n->nchildren;
+  for (struct json key = json_first(v); left && json_exists(key);) {
+    struct json val = json_next(key);
+    for (int c = n->child; c >= 0; c = p->nodes[c].sibling) {
+      // First occurrence wins for duplicate keys, as with json_get()
+      if (!json_exists(vals[c]) && json_path_key_equals(key, p->nodes[c].key)) {
+        vals[c] = val;
+        left--;
+        if (p->nodes[c].child >= 0)
+          json_path_walk(p, c, val, vals);
+        break;
+      }
+    }
+    key = json_next(val);
+  }
+}
+
+void json_paths_get(const JsonPaths *p, astr doc, struct json *out) {
+  // Small tries resolve into a stack buffer; large ones pay for a malloc
+  struct json stack[64];
+  struct json *vals = p->nnodes <= Countof(stack) ? stack : malloc(p->nnodes * sizeof(struct json));
+  if (!vals) {
+    perror("json_paths_get malloc");
+    abort();
+  }
+  memset(vals, 0, p->nnodes * sizeof(struct json));
+  vals[0] = json_parsen(doc.data, doc.len);
+  json_path_walk(p, 0, vals[0], vals);
+  for (int f = 0; f < p->nfields; f++) {
+    out[f] = vals[p->field_node[f]];
+  }
+  if (vals != stack)
+    free(vals);
+}
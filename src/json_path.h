@@ -0,0 +1,60 @@
+/**
+ * @file json_path.h
+ * @brief Many dotted json paths compiled into one trie, resolved in one walk.
+ *
+ * json_get() re-reads its path and rescans the document from the top for
+ * every field. JsonPaths merges all requested paths ("user.id",
+ * "user.name", "tags.0") into a trie up front, so each object level is
+ * scanned once for all of its wanted keys, the scan stops as soon as they
+ * are all found, and subtrees no path goes into are skipped over unparsed.
+ *
+ * Usage:
+ *   astr paths[] = {astr("name.last"), astr("age")};
+ *   JsonPaths *p = json_paths_compile(arena, paths, 2);
+ *   struct json vals[2];
+ *   json_paths_get(p, line, vals);   // !json_exists(vals[i]) when missing
+ *
+ * A numeric segment also indexes arrays: "tags.0" is the first tag. Keys
+ * are compared after unescaping, so "a\u0062" matches the path "ab". The
+ * empty path is the whole document.
+ */
+
+#ifndef JSON_PATH_H_
+#define JSON_PATH_H_
+
+#include "arena.h"
+#include "json.h"
+
+typedef struct {
+  astr key;       // Segment, empty for the root
+  isize index;    // Segment as an array index, -1 if not numeric
+  int child;      // First child node, -1 for none
+  int sibling;    // Next child of the same parent, -1 for none
+  int nchildren;
+} JsonPathNode;
+
+typedef struct {
+  JsonPathNode *nodes;  // nodes[0] is the root
+  int nnodes;
+  int *field_node;  // Node of each compiled path, in argument order
+  int nfields;
+} JsonPaths;
+
+/**
+ * @brief Build the trie for n dotted paths.
+ * @param arena Arena for the trie; paths are copied
+ * @param paths Paths, duplicates and prefixes of each other allowed
+ * @param n Path count
+ * @return Compiled paths, read-only afterwards and shareable across threads
+ */
+JsonPaths *json_paths_compile(Arena *arena, const astr *paths, int n);
+
+/**
+ * @brief Resolve every compiled path in one json document.
+ * @param p Compiled paths
+ * @param doc Document; the results point into it
+ * @param out One value per path; non-existent when the path is missing
+ */
+void json_paths_get(const JsonPaths *p, astr doc, struct json *out);
+
+#endif  // JSON_PATH_H_
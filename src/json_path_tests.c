@@ -0,0 +1,42 @@
+#include "json_path.h"
+#include "utest.h"
+
+static bool json_is(struct json v, const char* raw) {
+  return json_exists(v) && json_raw_length(v) == strlen(raw) && !memcmp(json_raw(v), raw, strlen(raw));
+}
+
+UTEST(json_path, many_paths_one_walk) {
+  Arena arena[] = {arena_init(NULL, MB(16))};
+  astr paths[] = {astr("name.last"), astr("age"), astr("tags.1"), astr("name"),
+                  astr("missing.x"), astr("age"),  astr("ab"),     astr("")};
+  JsonPaths* p = json_paths_compile(arena, paths, Countof(paths));
+  ASSERT_EQ(p->nfields, Countof(paths));
+  // Shared prefixes and duplicates share nodes: root, name, last, age, tags, 1, missing, x, ab
+  ASSERT_EQ(p->nnodes, 9);
+
+  astr doc = astr("{\"name\":{\"first\":\"Ada\",\"last\":\"Lovelace\"},\"age\":36,"
+                  "\"tags\":[\"math\",\"poet\"],\"a\\u0062\":true,\"age\":99}");
+  struct json vals[Countof(paths)];
+  json_paths_get(p, doc, vals);
+  ASSERT_TRUE(json_is(vals[0], "\"Lovelace\""));
+  ASSERT_TRUE(json_is(vals[1], "36"));  // First of duplicate keys
+  ASSERT_TRUE(json_is(vals[2], "\"poet\""));
+  ASSERT_TRUE(json_is(vals[3], "{\"first\":\"Ada\",\"last\":\"Lovelace\"}"));
+  ASSERT_FALSE(json_exists(vals[4]));
+  ASSERT_TRUE(json_is(vals[5], "36"));
+  ASSERT_TRUE(json_is(vals[6], "true"));  // Escaped key
+  ASSERT_EQ(json_raw_length(vals[7]), (size_t)doc.len);
+
+  // Same answers as json_get() on documents of other shapes
+  const char* docs[] = {"{\"name\":\"flat\",\"age\":[1]}", "[1,2]", "", "not json", "{\"tags\":{\"1\":\"key\"}}"};
+  for (int d = 0; d < Countof(docs); d++) {
+    json_paths_get(p, (astr){(char*)docs[d], strlen(docs[d])}, vals);
+    for (int f = 0; f < 6; f++) {
+      struct json want = json_get(docs[d], paths[f].data);
+      ASSERT_EQ(json_exists(vals[f]), json_exists(want));
+      if (json_exists(want))
+        ASSERT_EQ(json_raw(vals[f]), json_raw(want));
+    }
+  }
+  arena_release(arena);
+}
@@ -0,0 +1,151 @@
+#include "kll.h"
+#include <math.h>
+#include <stdlib.h>
+
+// Capacity of a level depth levels below the top
+static inline int32_t kll_level_cap(int k, int depth) {
+  return (int32_t)ceil(k * pow(2.0 / 3, depth)) + 1;
+}
+
+static inline int32_t kll_level_len(const Kll *s, int h) {
+  return s->lev[h + 1] - s->lev[h];
+}
+
+// Add an empty level on top; every level below loses capacity
+static void kll_grow(Kll *s) {
+  Assert(s->nlevels < KLL_MAX_LEVELS);
+  s->lev[s->nlevels + 1] = s->cap;
+  s->nlevels++;
+  s->max_size = 0;
+  for (int h = 0; h < s->nlevels; h++) {
+    s->max_size += kll_level_cap(s->k, s->nlevels - 1 - h);
+  }
+}
+
+Kll *kll_new(Arena *arena, int k) {
+  Kll *s = New(arena, Kll);
+  s->k = Max(k, 8);
+  // Room for a full sketch of every level and a second one being merged in
+  for (int d = 0; d < KLL_MAX_LEVELS; d++) {
+    s->cap += 2 * kll_level_cap(s->k, d);
+  }
+  s->items = New(arena, double, s->cap, NO_INIT);
+  s->lev[0] = s->cap;
+  s->min = INFINITY;
+  s->max = -INFINITY;
+  s->rng = 0x9e3779b97f4a7c15;
+  kll_grow(s);
+  return s;
+}
+
+static int kll_double_cmp(const void *x, const void *y) {
+  double a = *(const double *)x, b = *(const double *)y;
+  return (a > b) - (a < b);
+}
+
+/**
+ * Sort level h and move every other sample up to level h + 1, leaving the
+ * first sample behind if there is an odd number. The survivors are written
+ * to the top of the level, where they join the level above, and the levels
+ * below move up into the gap.
+ */
+static void kll_compact(Kll *s, int h) {
+  int32_t beg = s->lev[h], end = s->lev[h + 1];
+  double *x = s->items;
+  qsort(x + beg, end - beg, sizeof(double), kll_double_cmp);
+  int32_t odd = (end - beg) & 1, m = (end - beg) / 2;
+  s->rng ^= s->rng << 13, s->rng ^= s->rng >> 7, s->rng ^= s->rng << 17;
+  int32_t from = beg + odd + (int32_t)(s->rng >> 63);
+  // Backwards, as the destinations are past the sources still to read
+  for (int32_t i = m - 1; i >= 0; i--) {
+    x[end - m + i] = x[from + 2 * i];
+  }
+  s->lev[h + 1] = end - m;
+  memmove(x + s->lev[0] + m, x + s->lev[0], (beg + odd - s->lev[0]) * sizeof(double));
+  for (int i = 0; i <= h; i++) {
+    s->lev[i] += m;
+  }
+}
+
+static void kll_compress(Kll *s) {
+  for (int h = 0; h < s->nlevels; h++) {
+    if (kll_level_len(s, h) < kll_level_cap(s->k, s->nlevels - 1 - h))
+      continue;
+    if (h + 1 == s->nlevels)
+      kll_grow(s);
+    kll_compact(s, h);
+    if (s->cap - s->lev[0] < s->max_size)
+      break;
+  }
+}
+
+void kll_add(Kll *s, double x) {
+  if (isnan(x))
+    return;
+  s->items[--s->lev[0]] = x;
+  s->n++;
+  s->min = fmin(s->min, x);
+  s->max = fmax(s->max, x);
+  if (s->cap - s->lev[0] >= s->max_size)
+    kll_compress(s);
+}
+
+void kll_merge(Kll *into, const Kll *from) {
+  while (into->nlevels < from->nlevels) {
+    kll_grow(into);
+  }
+  // Each of from's levels goes at the top of into's, the levels below moving down for it
+  for (int h = 0; h < from->nlevels; h++) {
+    int32_t len = kll_level_len(from, h);
+    double *x = into->items;
+    memmove(x + into->lev[0] - len, x + into->lev[0], (into->lev[h + 1] - into->lev[0]) * sizeof(double));
+    for (int i = 0; i <= h; i++) {
+      into->lev[i] -= len;
+    }
+    memcpy(x + into->lev[h + 1] - len, from->items + from->lev[h], len * sizeof(double));
+  }
+  into->n += from->n;
+  into->min = fmin(into->min, from->min);
+  into->max = fmax(into->max, from->max);
+  while (into->cap - into->lev[0] >= into->max_size) {
+    kll_compress(into);
+  }
+}
+
+typedef struct {
+  double x;
+  int64_t weight;
+} KllSample;
+
+static int kll_sample_cmp(const void *x, const void *y) {
+  return kll_double_cmp(&((const KllSample *)x)->x, &((const KllSample *)y)->x);
+}
+
+void kll_quantiles(const Kll *s, const double *q, double *x, int n, Arena scratch) {
+  int32_t size = s->cap - s->lev[0];
+  KllSample *samples = New(&scratch, KllSample, Max(size, 1), NO_INIT);
+  isize ns = 0;
+  for (int h = 0; h < s->nlevels; h++) {
+    for (int32_t i = s->lev[h]; i < s->lev[h + 1]; i++) {
+      samples[ns++] = (KllSample){s->items[i], (int64_t)1 << h};
+    }
+  }
+  qsort(samples, ns, sizeof(KllSample), kll_sample_cmp);
+  for (int i = 0; i < n; i++) {
+    if (!s->n) {
+      x[i] = NAN;
+    } else if (q[i] <= 0) {
+      x[i] = s->min;
+    } else if (q[i] >= 1) {
+      x[i] = s->max;
+    } else {
+      // The first sample whose cumulative weight reaches the rank
+      double rank = q[i] * s->n;
+      int64_t seen = 0;
+      isize j = 0;
+      while (j < ns - 1 && (double)(seen += samples[j].weight) < rank)
+        j++;
+      x[i] = samples[j].x;
+    }
+  }
+}
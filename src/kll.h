@@ -0,0 +1,70 @@
+/**
+ * @file kll.h
+ * @brief KLL quantile sketch: approximate ranks and quantiles of a stream of numbers.
+ *
+ * The sketch keeps levels of samples, each sample at level h standing for
+ * 2^h numbers. New numbers go to level 0; a level that outgrows its
+ * capacity is sorted and compacted, every other sample moving up a level
+ * from a random start, so the expected error is zero. Capacities shrink by
+ * 2/3 per level down from the top, which keeps the whole sketch within
+ * about 3k samples however long the stream, for a rank error of about
+ * 1.7% at k = 200 and falling as 1/k.
+ *
+ * Usage:
+ *   Kll *s = kll_new(arena, 200);
+ *   for (...)
+ *     kll_add(s, x);
+ *   double q[] = {0.5, 0.99}, x[2];
+ *   kll_quantiles(s, q, x, 2, *arena);
+ *
+ * Sketches of separate threads combine with kll_merge() into a sketch of
+ * the union of their streams, with the same error bound.
+ */
+
+#ifndef KLL_H_
+#define KLL_H_
+
+#include "arena.h"
+
+// Levels of a sketch, enough for 2^60 numbers
+#ifndef KLL_MAX_LEVELS
+#define KLL_MAX_LEVELS 61
+#endif
+
+typedef struct {
+  double *items;  // Levels from 0 up, level h at [lev[h], lev[h + 1]); free room before lev[0]
+  int32_t cap;
+  int32_t lev[KLL_MAX_LEVELS + 1];
+  int nlevels;
+  int32_t max_size;  // Samples that trigger a compaction: the sum of the level capacities
+  int k;
+  int64_t n;  // Numbers added
+  double min, max;
+  uint64_t rng;
+} Kll;
+
+/**
+ * @brief Create an empty sketch.
+ * @param arena Arena for the sketch, allocated once
+ * @param k Capacity of the top level, at least 8: the error falls as 1/k
+ * @return Sketch, valid as long as the arena
+ */
+Kll *kll_new(Arena *arena, int k);
+
+// Add a number; NaN is ignored
+void kll_add(Kll *s, double x);
+
+// Fold a sketch of the same k into another, as if into had seen both streams; from is unchanged
+void kll_merge(Kll *into, const Kll *from);
+
+/**
+ * @brief Estimate quantiles.
+ * @param s Sketch
+ * @param q Fractions of the numbers, each in [0, 1]: 0 gives the exact minimum and 1 the maximum
+ * @param x Set to a number that was added, of about rank q * s->n; NaN for an empty sketch
+ * @param n Quantiles wanted
+ * @param scratch Temporary memory for the sorted samples
+ */
+void kll_quantiles(const Kll *s, const double *q, double *x, int n, Arena scratch);
+
+#endif  // KLL_H_
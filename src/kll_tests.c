@@ -0,0 +1,75 @@
+#include <math.h>
+#include "kll.h"
+#include "utest.h"
+
+// 0, 1, ..., n - 1 in a scrambled order: multiplying by an odd number permutes mod 2^k
+static double kll_scrambled(int64_t i, int64_t n) {
+  return (double)((i * 2654435761) & (n - 1));
+}
+
+UTEST(kll, exact_while_small) {
+  Arena arena[] = {arena_init(NULL, MB(1))};
+  Kll* s = kll_new(arena, 200);
+  double q[] = {0, 0.25, 0.5, 0.99, 1};
+  double x[Countof(q)];
+  kll_quantiles(s, q, x, Countof(q), *arena);
+  ASSERT_TRUE(isnan(x[2]));
+  for (int i = 100; i >= 1; i--) {
+    kll_add(s, i);
+  }
+  kll_add(s, NAN);
+  ASSERT_EQ(s->n, 100);
+  kll_quantiles(s, q, x, Countof(q), *arena);
+  ASSERT_EQ(x[0], 1);
+  ASSERT_EQ(x[1], 25);
+  ASSERT_EQ(x[2], 50);
+  ASSERT_EQ(x[3], 99);
+  ASSERT_EQ(x[4], 100);
+  arena_release(arena);
+}
+
+UTEST(kll, rank_error_bounded) {
+  Arena arena[] = {arena_init(NULL, MB(1))};
+  enum { N = 1 << 20 };
+  Kll* s = kll_new(arena, 200);
+  for (int64_t i = 0; i < N; i++) {
+    kll_add(s, kll_scrambled(i, N));
+  }
+  ASSERT_LE(s->cap - s->lev[0], 3 * 200 + 2 * s->nlevels);
+  double q[] = {0.01, 0.1, 0.5, 0.9, 0.99, 0.999};
+  double x[Countof(q)];
+  kll_quantiles(s, q, x, Countof(q), *arena);
+  for (int i = 0; i < Countof(q); i++) {
+    ASSERT_LT(fabs(x[i] / N - q[i]), 0.02);
+  }
+  arena_release(arena);
+}
+
+UTEST(kll, merge_keeps_bounds) {
+  Arena arena[] = {arena_init(NULL, MB(1))};
+  enum { N = 1 << 20, PARTS = 8 };
+  Kll* parts[PARTS];
+  for (int p = 0; p < PARTS; p++) {
+    parts[p] = kll_new(arena, 200);
+  }
+  // Parts of unequal sizes and ranges, so the merges meet different level counts
+  for (int64_t i = 0; i < N; i++) {
+    double v = kll_scrambled(i, N);
+    kll_add(parts[(int)v < N / 2 ? 0 : 1 + (i % (PARTS - 1))], -v);
+  }
+  Kll* all = kll_new(arena, 200);
+  for (int p = 0; p < PARTS; p++) {
+    kll_merge(all, parts[p]);
+  }
+  ASSERT_EQ(all->n, N);
+  ASSERT_EQ(all->min, -(N - 1));
+  ASSERT_EQ(all->max, 0);
+  ASSERT_LT(all->cap - all->lev[0], all->max_size);
+  double q[] = {0.01, 0.25, 0.5, 0.75, 0.99};
+  double x[Countof(q)];
+  kll_quantiles(all, q, x, Countof(q), *arena);
+  for (int i = 0; i < Countof(q); i++) {
+    ASSERT_LT(fabs(-x[i] / N - (1 - q[i])), 0.02);
+  }
+  arena_release(arena);
+}
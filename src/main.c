@@ -7,9 +7,21 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include "arena.h"
+#include "arena_prof.h"
+#include "arena_registry.h"
+#include "cmd.h"
 #include "debug.h"
+#include "sampler.h"
+#include "trace.h"
+#include "ubench.h"
 #include "utest.h"
+#include "utest_jobs.h"
 UTEST_STATE();
+UBENCH_STATE();
+ARENA_PROF_STATE();
+ARENA_REGISTRY_STATE();
+TRACE_STATE();
+SAMPLER_STATE();
 
 /* --- Default Thread-Local Arena --- */
 
@@ -52,6 +64,7 @@ static inline Arena* arena_default(void) {
   default_arena = &storage;
 #endif
 
+  arena_register(default_arena, "default");
   return default_arena;
 }
 
@@ -100,6 +113,15 @@ static inline void arena_default_restore(Arena snapshot) {
   }
 }
 
+// Run before each test in a --jobs worker: every test starts from an empty default arena
+static void arena_default_fresh(void) {
+  if (default_arena && default_arena->beg) {
+    arena_reset(default_arena);
+  } else {
+    default_arena = NULL;  // Released by the demos; arena_default() makes a new one
+  }
+}
+
 astr test_astr(Arena arena[static 1]) {
   {
     // Scratch(arena);
@@ -306,16 +328,102 @@ UTEST(slice, clone_and_push) {
   ASSERT_EQ(copy.data[2], 42);
 }
 
+#ifdef ARENA_PROFILE
+// ARENA_PROF=<file> writes folded stacks, otherwise the top sites go to stderr
+static void arena_prof_at_exit(void) {
+  Arena arena = arena_init(NULL, GB(1));
+  ArenaProfile p = arena_prof_snapshot(&arena);
+  const char* path = getenv("ARENA_PROF");
+  FILE* out = path ? fopen(path, "w") : NULL;
+  if (out) {
+    arena_prof_write_folded(out, p);
+    fclose(out);
+  } else {
+    arena_prof_report(stderr, p, 20);
+  }
+  arena_release(&arena);
+}
+#endif
+
+#ifdef TRACE
+// TRACE_OUT=<file> writes the per-thread timelines as Chrome trace JSON
+static void trace_at_exit(void) {
+  const char* path = getenv("TRACE_OUT");
+  FILE* out = path ? fopen(path, "w") : NULL;
+  if (out) {
+    trace_write_json(out);
+    fclose(out);
+  }
+}
+#endif
+
+// SAMPLER_OUT=<file> profiles the whole run into folded stacks, at SAMPLER_HZ=<n> (default 99)
+static void sampler_at_exit(void) {
+  sampler_stop();
+  FILE* out = fopen(getenv("SAMPLER_OUT"), "w");
+  if (!out) {
+    perror("SAMPLER_OUT");
+    return;
+  }
+#ifdef OOM_COMMIT
+  Arena arena = arena_init(NULL, GB(1));
+  sampler_write_folded(out, &arena);
+  arena_release(&arena);
+#else
+  __autofree byte* mem = malloc(MB(256));
+  Arena arena = arena_init(mem, mem ? MB(256) : 0);
+  sampler_write_folded(out, &arena);
+#endif
+  fclose(out);
+}
+
+// `cmd <tool> ...` data tools (cmd.h)
+static const struct {
+  const char* name;
+  CmdToolFn main;
+} cmd_tools[] = {
+    {"extract", cmd_extract_main},
+    {"agg", cmd_agg_main},
+    {"sort", cmd_sort_main},
+    {"grep", cmd_grep_main},
+    {"wc", cmd_wc_main},
+    {"convert", cmd_convert_main},
+    {"topk", cmd_topk_main},
+    {"quantiles", cmd_quantiles_main},
+};
+
 int main(int argc, const char* argv[]) {
 #ifdef __COSMOCC__
   ShowCrashReports();
 #endif
+#ifdef ARENA_PROFILE
+  atexit(arena_prof_at_exit);
+#endif
+#ifdef TRACE
+  atexit(trace_at_exit);
+#endif
+  // `kill -USR2 <pid>` reports the registered arenas to stderr, or appends to ARENA_REPORT_OUT=<file>
+  arena_registry_watch(SIGUSR2, getenv("ARENA_REPORT_OUT"));
+  if (getenv("SAMPLER_OUT")) {
+    const char* hz = getenv("SAMPLER_HZ");
+    if (sampler_start(hz ? atoi(hz) : 0))
+      atexit(sampler_at_exit);
+  }
+
+  // `cmd bench [options]` runs the UBENCH benchmarks instead of the demos and tests
+  if (argc > 1 && !strcmp(argv[1], "bench"))
+    return ubench_main(argc - 1, argv + 1);
+  for (int i = 0; argc > 1 && i < Countof(cmd_tools); i++) {
+    if (!strcmp(argv[1], cmd_tools[i].name))
+      return cmd_tools[i].main(argc - 1, (char**)argv + 1, STDOUT_FILENO);
+  }
 
   Arena* arena = arena_default();
 
   jmp_buf jmpbuf;
   if (ArenaOOM(arena, jmpbuf)) {
     fputs("!!! OOM exit !!!\n", stderr);
+    arena_registry_report(stderr);
     exit(1);
   }
 
@@ -358,5 +466,5 @@ int main(int argc, const char* argv[]) {
   arena_release(arena);
   getchar();
 
-  return utest_main(argc, argv);
+  return utest_jobs_main(argc, argv, arena_default_fresh);
 }
@@ -0,0 +1,251 @@
+/**
+ * @file parallel.h
+ * @brief Parallel for, reduce and inclusive scan over slices, on top of pool.h.
+ *
+ * Work is cut into fixed chunks of `grain` elements and chunk ranges are
+ * split in halves across the pool. Chunk boundaries depend only on the
+ * length and grain, and partial results are combined in chunk order, so
+ * results are deterministic (even for floating point) for a given grain.
+ * A grain <= 0 picks one from the slice length and the pool size.
+ *
+ * ParallelFor takes a range callback that receives a per-chunk scratch
+ * arena (a Scratch of the worker arena, reclaimed after the chunk):
+ *
+ *   static void scale(void *ctx, isize beg, isize end, Arena *scratch) {
+ *     i64s *s = ctx;
+ *     for (isize i = beg; i < end; i++) s->data[i] *= 2;
+ *   }
+ *   ParallelFor(pool, fibs, 0, scale, &fibs);
+ *
+ * Reduce and scan are generated per element type, bgen-style. PAR_OP is the
+ * body of an associative `PAR_TYPE op(PAR_TYPE a, PAR_TYPE b)`:
+ *
+ *   #define PAR_NAME i64_sum
+ *   #define PAR_TYPE int64_t
+ *   #define PAR_OP   return a + b;
+ *   #include "parallel.h"
+ *
+ *   int64_t total = ParallelReduce(i64_sum, pool, fibs, 0);
+ *   ParallelScan(i64_sum, pool, fibs);  // fibs[i] = fibs[0] + ... + fibs[i]
+ */
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include "pool.h"
+
+// Smallest automatic chunk, so per-chunk overhead stays well below the work
+#ifndef PARALLEL_MIN_GRAIN
+#define PARALLEL_MIN_GRAIN 2048
+#endif
+
+// Automatic chunking aims for this many chunks per worker, for load balance
+#ifndef PARALLEL_CHUNKS_PER_WORKER
+#define PARALLEL_CHUNKS_PER_WORKER 8
+#endif
+
+// Process elements [beg, end); scratch is reset after each call
+typedef void (*ParallelRangeFn)(void *ctx, isize beg, isize end, Arena *scratch);
+
+typedef struct {
+  ParallelRangeFn fn;
+  void *ctx;
+  isize n, grain;
+} ParallelJob;
+
+typedef struct {
+  const ParallelJob *job;
+  isize lo, hi;  // Chunk indices
+} ParallelSpan;
+
+/**
+ * @brief Chunk size for n elements on pool.
+ * @param pool Pool that will run the chunks
+ * @param n Element count
+ * @param grain Requested chunk size, or <= 0 for automatic
+ * @return Chunk size >= 1
+ */
+static isize parallel_grain(const Pool *pool, isize n, isize grain) {
+  if (grain > 0)
+    return grain;
+  isize target = (isize)pool_size(pool) * PARALLEL_CHUNKS_PER_WORKER;
+  return Max((n + target - 1) / target, (isize)PARALLEL_MIN_GRAIN);
+}
+
+static void parallel_span_task(void *arg) {
+  ParallelSpan span = *(ParallelSpan *)arg;
+  const ParallelJob *job = span.job;
+
+  // Hand off the upper half until one chunk is left
+  TaskGroup g = {0};
+  while (span.hi - span.lo > 1) {
+    isize mid = span.lo + (span.hi - span.lo) / 2;
+    ParallelSpan *right = New(pool_arena(), ParallelSpan);
+    *right = (ParallelSpan){job, mid, span.hi};
+    pool_spawn(&g, parallel_span_task, right);
+    span.hi = mid;
+  }
+
+  Arena *arena = pool_arena();
+  {
+    Scratch(arena);
+    isize beg = span.lo * job->grain;
+    job->fn(job->ctx, beg, Min(beg + job->grain, job->n), arena);
+  }
+  pool_wait(&g);
+}
+
+/**
+ * @brief Call fn over [0, n) in chunks of grain elements on pool.
+ * @param pool Pool (may be called from outside or inside a pool task)
+ * @param n Element count
+ * @param grain Chunk size, or <= 0 for automatic
+ * @param fn Range callback
+ * @param ctx Passed to fn
+ *
+ * Returns after every chunk has run.
+ */
+static void parallel_for(Pool *pool, isize n, isize grain, ParallelRangeFn fn, void *ctx) {
+  if (n <= 0)
+    return;
+  ParallelJob job = {fn, ctx, n, parallel_grain(pool, n, grain)};
+  ParallelSpan span = {&job, 0, (n + job.grain - 1) / job.grain};
+  if (pool_worker_id() >= 0)
+    parallel_span_task(&span);
+  else
+    pool_run(pool, parallel_span_task, &span);
+}
+
+/**
+ * Run a range callback over every index of a slice.
+ *
+ * Usage:
+ *   ParallelFor(pool, fibs, 0, scale, &fibs);
+ */
+#define ParallelFor(pool, slice, grain, fn, ctx) parallel_for(pool, (slice).len, grain, fn, ctx)
+
+/**
+ * Fold a slice with a generated PAR_NAME: init op s[0] op s[1] op ...
+ *
+ * Usage:
+ *   int64_t total = ParallelReduce(i64_sum, pool, fibs, 0);
+ */
+#define ParallelReduce(name, pool, slice, init) name##_reduce(pool, (slice).data, (slice).len, init, 0)
+
+/**
+ * In-place inclusive prefix scan of a slice with a generated PAR_NAME.
+ *
+ * Usage:
+ *   ParallelScan(i64_sum, pool, fibs);
+ */
+#define ParallelScan(name, pool, slice) name##_scan(pool, (slice).data, (slice).len, 0)
+
+#endif  // PARALLEL_H_
+
+/* --- Typed reduce/scan generator --- */
+
+#ifdef PAR_NAME
+
+#ifndef PAR_TYPE
+#error PAR_TYPE required
+#endif
+#ifndef PAR_OP
+#error PAR_OP required
+#endif
+
+#define PAR_CC(a, b)  a##b
+#define PAR_C(a, b)   PAR_CC(a, b)
+#define PAR_API(name) PAR_C(PAR_C(PAR_NAME, _), name)
+
+typedef struct {
+  PAR_TYPE *data;
+  PAR_TYPE *partials;  // One per chunk
+  isize grain;
+} PAR_API(ctx);
+
+static inline PAR_TYPE PAR_API(op)(PAR_TYPE a, PAR_TYPE b) {
+  PAR_OP
+}
+
+// Fold one chunk into partials[chunk]
+static void PAR_API(fold_chunk)(void *arg, isize beg, isize end, Arena *scratch) {
+  PAR_API(ctx) *c = arg;
+  PAR_TYPE acc = c->data[beg];
+  for (isize i = beg + 1; i < end; i++) {
+    acc = PAR_API(op)(acc, c->data[i]);
+  }
+  c->partials[beg / c->grain] = acc;
+}
+
+/**
+ * @brief Reduce data[0..n) to init op data[0] op ... op data[n-1].
+ * @param pool Pool
+ * @param data Elements
+ * @param n Element count
+ * @param init Leftmost operand
+ * @param grain Chunk size, or <= 0 for automatic
+ * @return Reduced value (init if n == 0)
+ */
+static PAR_TYPE PAR_API(reduce)(Pool *pool, const PAR_TYPE *data, isize n, PAR_TYPE init, isize grain) {
+  if (n <= 0)
+    return init;
+  grain = parallel_grain(pool, n, grain);
+  isize nchunks = (n + grain - 1) / grain;
+
+  __autofree PAR_TYPE *partials = malloc(nchunks * sizeof(PAR_TYPE));
+  Assert(partials);
+  PAR_API(ctx) c = {(PAR_TYPE *)data, partials, grain};
+  parallel_for(pool, n, grain, PAR_API(fold_chunk), &c);
+
+  PAR_TYPE acc = init;
+  for (isize i = 0; i < nchunks; i++) {
+    acc = PAR_API(op)(acc, partials[i]);
+  }
+  return acc;
+}
+
+// Scan one chunk in place, seeded with the inclusive total of all chunks before it
+static void PAR_API(scan_chunk)(void *arg, isize beg, isize end, Arena *scratch) {
+  PAR_API(ctx) *c = arg;
+  isize chunk = beg / c->grain;
+  PAR_TYPE acc = chunk ? PAR_API(op)(c->partials[chunk - 1], c->data[beg]) : c->data[beg];
+  c->data[beg] = acc;
+  for (isize i = beg + 1; i < end; i++) {
+    c->data[i] = acc = PAR_API(op)(acc, c->data[i]);
+  }
+}
+
+/**
+ * @brief In-place inclusive scan: data[i] = data[0] op ... op data[i].
+ * @param pool Pool
+ * @param data Elements
+ * @param n Element count
+ * @param grain Chunk size, or <= 0 for automatic
+ *
+ * Two passes: chunk totals in parallel, a short serial scan over the
+ * totals, then every chunk scans itself from its carry-in in parallel.
+ */
+static void PAR_API(scan)(Pool *pool, PAR_TYPE *data, isize n, isize grain) {
+  if (n <= 0)
+    return;
+  grain = parallel_grain(pool, n, grain);
+  isize nchunks = (n + grain - 1) / grain;
+
+  __autofree PAR_TYPE *partials = malloc(nchunks * sizeof(PAR_TYPE));
+  Assert(partials);
+  PAR_API(ctx) c = {data, partials, grain};
+  parallel_for(pool, n, grain, PAR_API(fold_chunk), &c);
+  for (isize i = 1; i < nchunks; i++) {
+    partials[i] = PAR_API(op)(partials[i - 1], partials[i]);
+  }
+  parallel_for(pool, n, grain, PAR_API(scan_chunk), &c);
+}
+
+#undef PAR_CC
+#undef PAR_C
+#undef PAR_API
+#undef PAR_NAME
+#undef PAR_TYPE
+#undef PAR_OP
+
+#endif  // PAR_NAME
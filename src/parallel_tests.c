@@ -0,0 +1,88 @@
+#include "parallel.h"
+#include "utest.h"
+
+typedef slice(int64_t) i64s;
+typedef slice(double) f64s;
+
+#define PAR_NAME i64_sum
+#define PAR_TYPE int64_t
+#define PAR_OP   return a + b;
+#include "parallel.h"
+
+#define PAR_NAME i64_max
+#define PAR_TYPE int64_t
+#define PAR_OP   return a > b ? a : b;
+#include "parallel.h"
+
+#define PAR_NAME f64_sum
+#define PAR_TYPE double
+#define PAR_OP   return a + b;
+#include "parallel.h"
+
+static void fill_index(void* ctx, isize beg, isize end, Arena* scratch) {
+  i64s* s = ctx;
+  // Scratch is private to the chunk and reclaimed afterwards
+  int64_t* tmp = New(scratch, int64_t, end - beg, NO_INIT);
+  for (isize i = beg; i < end; i++) {
+    tmp[i - beg] = i;
+  }
+  memcpy(s->data + beg, tmp, (end - beg) * sizeof(int64_t));
+}
+
+UTEST(parallel, for_reduce_scan) {
+  enum { size = KB(64), n = 100003 };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+  Pool* pool = pool_create(arena, (PoolOptions){.nthreads = 4, .arena_size = MB(16), .deque_size = 256});
+
+  __autofree int64_t* data = malloc(n * sizeof(int64_t));
+  i64s s = {data, n, n};
+  ParallelFor(pool, s, 1000, fill_index, &s);
+  for (int i = 0; i < n; i++) {
+    ASSERT_EQ(s.data[i], (int64_t)i);
+  }
+
+  ASSERT_EQ(ParallelReduce(i64_sum, pool, s, 7), 7 + (int64_t)n * (n - 1) / 2);
+  ASSERT_EQ(ParallelReduce(i64_max, pool, s, -1), (int64_t)n - 1);
+  i64s empty = {0};
+  ASSERT_EQ(ParallelReduce(i64_sum, pool, empty, 42), 42);
+
+  ParallelScan(i64_sum, pool, s);
+  for (int64_t i = 0; i < n; i++) {
+    ASSERT_EQ(s.data[i], i * (i + 1) / 2);
+  }
+
+  // Odd grain so chunk boundaries do not line up with the automatic ones
+  for (int i = 0; i < n; i++) {
+    s.data[i] = 1;
+  }
+  i64_sum_scan(pool, s.data, s.len, 333);
+  ASSERT_EQ(s.data[n - 1], (int64_t)n);
+  ASSERT_EQ(s.data[332], 333);
+  ASSERT_EQ(s.data[333], 334);
+
+  pool_destroy(pool);
+}
+
+UTEST(parallel, deterministic_float_reduce) {
+  enum { size = KB(64), n = 50000 };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  __autofree double* data = malloc(n * sizeof(double));
+  for (int i = 0; i < n; i++) {
+    data[i] = 1.0 / (1 + i % 97) * (i % 2 ? 1e-8 : 1e8);
+  }
+  f64s s = {data, n, n};
+
+  // Same grain, different worker counts: bitwise identical sums
+  Pool* p2 = pool_create(arena, (PoolOptions){.nthreads = 2, .arena_size = MB(16), .deque_size = 256});
+  Pool* p5 = pool_create(arena, (PoolOptions){.nthreads = 5, .arena_size = MB(16), .deque_size = 256});
+  double a = f64_sum_reduce(p2, s.data, s.len, 0.0, 1024);
+  double b = f64_sum_reduce(p5, s.data, s.len, 0.0, 1024);
+  double c = f64_sum_reduce(p5, s.data, s.len, 0.0, 1024);
+  ASSERT_EQ(memcmp(&a, &b, sizeof(a)), 0);
+  ASSERT_EQ(memcmp(&b, &c, sizeof(b)), 0);
+  pool_destroy(p2);
+  pool_destroy(p5);
+}
@@ -0,0 +1,71 @@
+#include <sys/mman.h>
+#include "arena.h"
+#include "perfctr.h"
+#include "ubench.h"
+#include "utest.h"
+
+// Hosts differ in what they allow, so each check runs only for the events
+// that opened; with none at all every operation must still be a no-op
+UTEST(perfctr, scope_counts_or_degrades) {
+  PerfCounters pc;
+  uint32_t mask = perf_open(&pc);
+  ASSERT_EQ(mask, pc.mask);
+  ASSERT_TRUE(strlen(perf_status(&pc)) > 0);
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    ASSERT_EQ(pc.fd[i] >= 0, (int)((mask >> i) & 1));
+  }
+
+  enum { pages = 64 };
+  long page = sysconf(_SC_PAGESIZE);
+  char *mem = mmap(NULL, pages * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE((void *)mem, MAP_FAILED);
+  {
+    PerfScope(&pc);
+    for (int i = 0; i < pages; i++) {
+      mem[i * page] = 1;
+    }
+    UBENCH_CLOBBER();
+  }
+  munmap(mem, pages * page);
+
+  ASSERT_EQ(pc.regions, mask ? 1 : 0);
+  if (mask & (1u << PERF_PAGE_FAULTS))
+    ASSERT_GE(pc.total.v[PERF_PAGE_FAULTS], pages / 2.0);
+  if (mask & (1u << PERF_INSTRUCTIONS))
+    ASSERT_GE(pc.total.v[PERF_INSTRUCTIONS], (double)pages);
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    if (!(mask & (1u << i)))
+      ASSERT_EQ(pc.total.v[i], 0.0);
+  }
+
+  perf_close(&pc);
+  ASSERT_EQ(pc.mask, 0u);
+  {
+    PerfScope(&pc);  // Closed counters: nothing is read or added
+  }
+  ASSERT_EQ(pc.regions, mask ? 1 : 0);
+}
+
+static void touch_bench(UBench *ubench) {
+  static char buf[KB(4)];
+  UBENCH_LOOP(ubench) {
+    for (int i = 0; i < (int)sizeof(buf); i += 64) {
+      buf[i]++;
+    }
+    UBENCH_CLOBBER();
+  }
+}
+
+UTEST(perfctr, ubench_reports_per_iteration) {
+  PerfCounters pc;
+  perf_open(&pc);
+  UBenchResult r = {.name = "touch"};
+  ubench_measure(touch_bench, (UBenchOptions){.samples = 3, .warmup = -1, .min_sample_ns = 100000, .perf = &pc},
+                 &r);
+  ASSERT_EQ(r.perf_mask, pc.mask);
+  if (pc.mask & (1u << PERF_INSTRUCTIONS))
+    ASSERT_GE(r.perf.v[PERF_INSTRUCTIONS], 64.0);  // At least one instruction per touched line
+  if (!(pc.mask & (1u << PERF_CYCLES)))
+    ASSERT_TRUE(isnan(ubench_ipc(&r)));
+  perf_close(&pc);
+}
@@ -0,0 +1,306 @@
+#include "pipeline.h"
+#include <pthread.h>
+#include <time.h>
+#include "arena_registry.h"
+#include "ring.h"
+#include "sampler.h"
+#include "trace.h"
+
+/* --- Bounded batch queue --- */
+
+typedef struct {
+  MpmcRing *ring;
+  _Atomic isize depth_max;  // Depth statistics, sampled after every push
+  _Atomic int64_t depth_sum, pushes;
+} PipeQueue;
+
+static isize pipe_pow2(isize n) {
+  isize pow2 = 1;
+  while (pow2 < n) {
+    pow2 *= 2;
+  }
+  return pow2;
+}
+
+// Capacity is rounded up to a power of 2
+static void queue_init(Arena *arena, PipeQueue *q, isize cap) {
+  q->ring = mpmc_create(arena, pipe_pow2(cap));
+}
+
+// Blocks while the queue is full
+static void queue_push(PipeQueue *q, PipeBatch *b) {
+  mpmc_push_wait(q->ring, (void *const *)&b, 1);
+  isize depth = mpmc_len(q->ring);
+  if (depth > atomic_load_explicit(&q->depth_max, memory_order_relaxed))
+    atomic_store_explicit(&q->depth_max, depth, memory_order_relaxed);
+  atomic_fetch_add_explicit(&q->depth_sum, depth, memory_order_relaxed);
+  atomic_fetch_add_explicit(&q->pushes, 1, memory_order_relaxed);
+}
+
+// Blocks while the queue is empty; NULL once it is closed and drained
+static PipeBatch *queue_pop(PipeQueue *q) {
+  void *b;
+  return mpmc_pop_wait(q->ring, &b, 1) ? b : NULL;
+}
+
+static void queue_close(PipeQueue *q) {
+  mpmc_close(q->ring);
+}
+
+/* --- Pipeline --- */
+
+typedef struct {
+  PipeStageDef def;
+  PipeQueue *in, *out;   // NULL for the source and the sink respectively
+  _Atomic int running;  // Replicas not yet finished
+  _Atomic int64_t batches_in, items_in, batches_out, items_out;
+  _Atomic int64_t busy_ns, wait_in_ns, wait_out_ns;
+  _Atomic int64_t start_ns, end_ns;
+} Stage;
+
+typedef struct {
+  Pipeline *pipe;
+  PipeCtx ctx;
+  Arena scratch;
+  pthread_t thread;
+} Replica;
+
+struct Pipeline {
+  Stage *stages;
+  int nstages;
+  Replica *replicas;
+  int nreplicas;
+  PipeQueue *queues;  // queues[i] connects stage i to stage i + 1
+  PipeQueue free;     // Recycled batches
+  PipeBatch *batches;
+  isize nbatches;
+  bool ran;
+};
+
+static int64_t pipe_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static Arena pipe_arena_init(isize size) {
+#ifdef OOM_COMMIT
+  return arena_init(NULL, size);
+#else
+  byte *mem = malloc(size);
+  if (!mem) {
+    perror("pipeline_create malloc");
+    abort();
+  }
+  return arena_init(mem, size);
+#endif
+}
+
+static void pipe_arena_release(Arena *arena) {
+#ifndef OOM_COMMIT
+  free(arena->beg);
+#endif
+  arena_release(arena);
+}
+
+Pipeline *pipeline_create(Arena *arena, const PipeStageDef *stages, int nstages, PipelineOptions opts) {
+  Assert(nstages >= 1);
+  if (opts.queue_cap <= 0)
+    opts.queue_cap = PIPE_QUEUE_CAP;
+  opts.queue_cap = pipe_pow2(opts.queue_cap);
+  if (opts.batch_arena_size <= 0)
+    opts.batch_arena_size = PIPE_BATCH_ARENA_SIZE;
+  if (opts.scratch_size <= 0)
+    opts.scratch_size = PIPE_SCRATCH_SIZE;
+
+  Pipeline *p = New(arena, Pipeline);
+  p->nstages = nstages;
+  p->stages = New(arena, Stage, nstages);
+  p->queues = New(arena, PipeQueue, nstages);
+  for (int i = 0; i < nstages; i++) {
+    Stage *st = &p->stages[i];
+    st->def = stages[i];
+    if (st->def.workers <= 0)
+      st->def.workers = 1;
+    p->nreplicas += st->def.workers;
+    if (i + 1 < nstages) {
+      queue_init(arena, &p->queues[i], opts.queue_cap);
+      st->out = &p->queues[i];
+      p->stages[i + 1].in = st->out;
+    }
+  }
+
+  // Enough batches that every queue can be full while each replica holds
+  // one input and one output batch, so pipe_batch_new() cannot deadlock
+  p->nbatches = (nstages - 1) * opts.queue_cap + 2 * p->nreplicas + 1;
+  p->batches = New(arena, PipeBatch, p->nbatches);
+  queue_init(arena, &p->free, p->nbatches);
+  for (isize i = 0; i < p->nbatches; i++) {
+    p->batches[i].arena = pipe_arena_init(opts.batch_arena_size);
+    arena_register(&p->batches[i].arena, "pipeline.batch");
+    queue_push(&p->free, &p->batches[i]);
+  }
+
+  p->replicas = New(arena, Replica, p->nreplicas);
+  for (int i = 0, r = 0; i < nstages; i++) {
+    for (int k = 0; k < p->stages[i].def.workers; k++, r++) {
+      Replica *rep = &p->replicas[r];
+      rep->pipe = p;
+      rep->scratch = pipe_arena_init(opts.scratch_size);
+      arena_register(&rep->scratch, "pipeline.scratch");
+      rep->ctx = (PipeCtx){p, i, k, &rep->scratch, p->stages[i].def.user};
+    }
+  }
+  return p;
+}
+
+static void pipe_recycle(Pipeline *p, PipeBatch *b) {
+  b->items = (PipeItems){0};
+  arena_reset(&b->arena);
+  queue_push(&p->free, b);
+}
+
+PipeBatch *pipe_batch_new(PipeCtx *ctx) {
+  Stage *st = &ctx->pipe->stages[ctx->stage];
+  TRACE_SCOPE("wait_free_batch");
+  int64_t t0 = pipe_now_ns();
+  PipeBatch *b = queue_pop(&ctx->pipe->free);
+  atomic_fetch_add_explicit(&st->wait_out_ns, pipe_now_ns() - t0, memory_order_relaxed);
+  return b;
+}
+
+void pipe_emit(PipeCtx *ctx, PipeBatch *b) {
+  Stage *st = &ctx->pipe->stages[ctx->stage];
+  if (!st->out || b->items.len == 0) {
+    pipe_recycle(ctx->pipe, b);
+    return;
+  }
+  atomic_fetch_add_explicit(&st->batches_out, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&st->items_out, b->items.len, memory_order_relaxed);
+  TRACE_SCOPE("wait_out");
+  int64_t t0 = pipe_now_ns();
+  queue_push(st->out, b);
+  atomic_fetch_add_explicit(&st->wait_out_ns, pipe_now_ns() - t0, memory_order_relaxed);
+}
+
+// Call the stage once, timing it and resetting the replica's scratch arena
+static bool pipe_call(Replica *rep, Stage *st, PipeBatch *in) {
+  TRACE_SCOPE(st->def.name ? st->def.name : "stage");
+  int64_t t0 = pipe_now_ns();
+  bool more = st->def.fn(&rep->ctx, in);
+  atomic_fetch_add_explicit(&st->busy_ns, pipe_now_ns() - t0, memory_order_relaxed);
+  arena_reset(&rep->scratch);
+  return more;
+}
+
+static void *pipe_replica_main(void *arg) {
+  Replica *rep = arg;
+  Pipeline *p = rep->pipe;
+  Stage *st = &p->stages[rep->ctx.stage];
+  TRACE_THREAD_NAME(st->def.name);
+  sampler_thread_start();
+
+  int64_t zero = 0;
+  atomic_compare_exchange_strong(&st->start_ns, &zero, pipe_now_ns());
+
+  if (!st->in) {
+    while (pipe_call(rep, st, NULL)) {
+    }
+  } else {
+    bool more = true;
+    for (;;) {
+      PipeBatch *b;
+      {
+        TRACE_SCOPE("wait_in");
+        int64_t t0 = pipe_now_ns();
+        b = queue_pop(st->in);
+        atomic_fetch_add_explicit(&st->wait_in_ns, pipe_now_ns() - t0, memory_order_relaxed);
+      }
+      if (!b)
+        break;
+      if (more) {
+        atomic_fetch_add_explicit(&st->batches_in, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&st->items_in, b->items.len, memory_order_relaxed);
+        more = pipe_call(rep, st, b);
+      }
+      pipe_recycle(p, b);
+    }
+  }
+
+  int64_t end = pipe_now_ns();
+  int64_t prev = atomic_load(&st->end_ns);
+  while (prev < end && !atomic_compare_exchange_weak(&st->end_ns, &prev, end)) {
+  }
+  // The last replica to finish ends the stream for the next stage
+  if (atomic_fetch_sub(&st->running, 1) == 1 && st->out)
+    queue_close(st->out);
+  return NULL;
+}
+
+void pipeline_run(Pipeline *p) {
+  Assert(!p->ran && "pipeline_run called twice");
+  p->ran = true;
+  for (int i = 0; i < p->nstages; i++) {
+    atomic_store(&p->stages[i].running, p->stages[i].def.workers);
+  }
+  for (int i = 0; i < p->nreplicas; i++) {
+    if (pthread_create(&p->replicas[i].thread, NULL, pipe_replica_main, &p->replicas[i])) {
+      perror("pipeline_run pthread_create");
+      abort();
+    }
+  }
+  for (int i = 0; i < p->nreplicas; i++) {
+    pthread_join(p->replicas[i].thread, NULL);
+  }
+}
+
+void pipeline_destroy(Pipeline *p) {
+  for (int i = 0; i < p->nreplicas; i++) {
+    pipe_arena_release(&p->replicas[i].scratch);
+  }
+  for (isize i = 0; i < p->nbatches; i++) {
+    pipe_arena_release(&p->batches[i].arena);
+  }
+}
+
+PipeStageStats pipeline_stats(const Pipeline *p, int i) {
+  Assert(i >= 0 && i < p->nstages);
+  Stage *st = &p->stages[i];
+  PipeStageStats s = {
+      .name = st->def.name,
+      .batches_in = atomic_load_explicit(&st->batches_in, memory_order_relaxed),
+      .items_in = atomic_load_explicit(&st->items_in, memory_order_relaxed),
+      .batches_out = atomic_load_explicit(&st->batches_out, memory_order_relaxed),
+      .items_out = atomic_load_explicit(&st->items_out, memory_order_relaxed),
+      .busy_ns = atomic_load_explicit(&st->busy_ns, memory_order_relaxed),
+      .wait_in_ns = atomic_load_explicit(&st->wait_in_ns, memory_order_relaxed),
+      .wait_out_ns = atomic_load_explicit(&st->wait_out_ns, memory_order_relaxed),
+  };
+
+  int64_t start = atomic_load(&st->start_ns), end = atomic_load(&st->end_ns);
+  if (start)
+    s.wall_ns = (end >= start ? end : pipe_now_ns()) - start;
+  if (st->in) {
+    int64_t pushes = atomic_load_explicit(&st->in->pushes, memory_order_relaxed);
+    s.depth_max = atomic_load_explicit(&st->in->depth_max, memory_order_relaxed);
+    s.depth_avg = pushes ? (double)atomic_load_explicit(&st->in->depth_sum, memory_order_relaxed) / pushes : 0;
+  }
+  return s;
+}
+
+void pipeline_report(const Pipeline *p, FILE *out) {
+  fprintf(out, "%-12s %7s %10s %12s %12s %6s %8s %9s %11s\n", "stage", "workers", "batches", "items",
+          "items/s", "busy%", "wait_in%", "wait_out%", "depth");
+  for (int i = 0; i < p->nstages; i++) {
+    PipeStageStats s = pipeline_stats(p, i);
+    int workers = p->stages[i].def.workers;
+    // Sources are measured by what they produce, every other stage by what it consumes
+    int64_t batches = i == 0 ? s.batches_out : s.batches_in;
+    int64_t items = i == 0 ? s.items_out : s.items_in;
+    double wall = s.wall_ns > 0 ? (double)s.wall_ns : 1;
+    double thread_ns = wall * workers;
+    fprintf(out, "%-12s %7d %10lld %12lld %12.0f %6.1f %8.1f %9.1f %5.1f/%-5td\n", s.name ? s.name : "?", workers,
+            (long long)batches, (long long)items, items / (wall / 1e9), 100.0 * s.busy_ns / thread_ns,
+            100.0 * s.wait_in_ns / thread_ns, 100.0 * s.wait_out_ns / thread_ns, s.depth_avg, s.depth_max);
+  }
+}
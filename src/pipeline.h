@@ -0,0 +1,171 @@
+/**
+ * @file pipeline.h
+ * @brief Linear pipeline of concurrent stages connected by bounded batch queues.
+ *
+ * Each stage runs on its own thread (or several replica threads sharing the
+ * same input queue) and passes batches of records to the next stage through
+ * a bounded lock-free MPMC ring (ring.h). A full queue blocks the producer,
+ * so a slow stage throttles everything upstream of it instead of letting
+ * memory grow.
+ *
+ * Records are opaque pointers. They live in the batch's own arena, which is
+ * reset when the batch is recycled after the consuming stage returns, so
+ * data flows downstream without copies or frees. Every replica also owns a
+ * scratch arena that is reset after each call.
+ *
+ * Usage:
+ *   static bool split(PipeCtx *ctx, PipeBatch *in) {
+ *     PipeBatch *out = pipe_batch_new(ctx);
+ *     for (isize i = 0; i < in->items.len; i++) {
+ *       astr *chunk = in->items.data[i];
+ *       for (astr_split_by_char(it, "\n", *chunk)) {
+ *         pipe_batch_push(out, New(&out->arena, astr, 1, &it.token));
+ *       }
+ *     }
+ *     pipe_emit(ctx, out);
+ *     return true;
+ *   }
+ *
+ *   PipeStageDef stages[] = {
+ *     {.name = "read", .fn = read_chunks},  // Source: called with in == NULL until it returns false
+ *     {.name = "split", .fn = split, .workers = 2},
+ *     {.name = "count", .fn = count_lines, .user = &total},
+ *   };
+ *   Pipeline *p = pipeline_create(arena, stages, Countof(stages), (PipelineOptions){0});
+ *   pipeline_run(p);
+ *   pipeline_report(p, stderr);
+ *   pipeline_destroy(p);
+ *
+ * A stage that wants data parallelism within a batch can run ParallelFor on
+ * a Pool from inside its callback; stages themselves never run as pool tasks
+ * because they block on their queues.
+ */
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include "arena.h"
+
+// Batches per queue between two stages
+#ifndef PIPE_QUEUE_CAP
+#define PIPE_QUEUE_CAP 8
+#endif
+
+// Arena size per batch, reserved lazily with OOM_COMMIT
+#ifndef PIPE_BATCH_ARENA_SIZE
+#define PIPE_BATCH_ARENA_SIZE MB(64)
+#endif
+
+// Scratch arena size per stage replica, reserved lazily with OOM_COMMIT
+#ifndef PIPE_SCRATCH_SIZE
+#define PIPE_SCRATCH_SIZE MB(64)
+#endif
+
+typedef void *PipeItem;
+typedef slice(PipeItem) PipeItems;
+
+typedef struct PipeBatch {
+  PipeItems items;  // Records, allocated from arena
+  Arena arena;      // Reset when the batch is recycled
+} PipeBatch;
+
+typedef struct Pipeline Pipeline;
+
+// Per-call context handed to stage callbacks
+typedef struct PipeCtx {
+  Pipeline *pipe;
+  int stage;       // Stage index
+  int replica;     // Replica index within the stage
+  Arena *scratch;  // Reset after every call
+  void *user;      // PipeStageDef.user
+} PipeCtx;
+
+/**
+ * Stage callback. Sources (stage 0) get in == NULL and are called until they
+ * return false. Other stages get one input batch per call, recycled when the
+ * call returns; returning false stops the stage early (remaining input is
+ * drained and dropped so upstream stages can finish).
+ */
+typedef bool (*PipeStageFn)(PipeCtx *ctx, PipeBatch *in);
+
+typedef struct {
+  const char *name;
+  PipeStageFn fn;
+  void *user;
+  int workers;  // Replica threads, 0 for 1
+} PipeStageDef;
+
+typedef struct {
+  isize queue_cap;         // Batches per queue (rounded up to a power of 2), 0 for PIPE_QUEUE_CAP
+  isize batch_arena_size;  // 0 for PIPE_BATCH_ARENA_SIZE
+  isize scratch_size;      // 0 for PIPE_SCRATCH_SIZE
+} PipelineOptions;
+
+typedef struct {
+  const char *name;
+  int64_t batches_in, items_in;    // Consumed from the input queue
+  int64_t batches_out, items_out;  // Emitted to the output queue
+  int64_t busy_ns;                 // Inside the stage callback, summed over replicas
+  int64_t wait_in_ns;              // Blocked on an empty input queue
+  int64_t wait_out_ns;             // Blocked on a full output queue or no free batch
+  int64_t wall_ns;                 // First start to last finish
+  isize depth_max;                 // Input queue depth: maximum seen
+  double depth_avg;                // Input queue depth: average over pushes
+} PipeStageStats;
+
+/**
+ * @brief Build a pipeline of nstages stages.
+ * @param arena Arena for the pipeline, its queues and batch headers
+ * @param stages Stage definitions, stage 0 is the source
+ * @param nstages Number of stages (>= 1)
+ * @param opts Options, zero for defaults
+ * @return Pipeline ready for pipeline_run()
+ */
+Pipeline *pipeline_create(Arena *arena, const PipeStageDef *stages, int nstages, PipelineOptions opts);
+
+/**
+ * @brief Start every stage and wait until the source is exhausted and all
+ *        batches have drained through the last stage.
+ * @param p Pipeline (runs once)
+ */
+void pipeline_run(Pipeline *p);
+
+/**
+ * @brief Release batch and scratch arenas.
+ * @param p Pipeline
+ */
+void pipeline_destroy(Pipeline *p);
+
+/**
+ * @brief Take an empty batch for output, blocking while none is free.
+ * @param ctx Calling stage's context
+ * @return Batch with no items and a reset arena
+ *
+ * Emit each batch before taking the next: the batch supply is sized for one
+ * unemitted output batch per replica.
+ */
+PipeBatch *pipe_batch_new(PipeCtx *ctx);
+
+/**
+ * @brief Send a batch to the next stage, blocking while its queue is full.
+ * @param ctx Calling stage's context
+ * @param b Batch from pipe_batch_new(), owned by the pipeline afterwards
+ *
+ * Empty batches, and any batch emitted by the last stage, are recycled.
+ */
+void pipe_emit(PipeCtx *ctx, PipeBatch *b);
+
+// Append a record to a batch
+static inline void pipe_batch_push(PipeBatch *b, void *item) {
+  *Push(&b->arena, &b->items) = item;
+}
+
+// @return Counters for stage i (safe to call while running)
+PipeStageStats pipeline_stats(const Pipeline *p, int i);
+
+// Print a per-stage throughput and queue depth table
+void pipeline_report(const Pipeline *p, FILE *out);
+
+#endif  // PIPELINE_H_
@@ -0,0 +1,117 @@
+#include <unistd.h>
+#include "pipeline.h"
+#include "utest.h"
+
+typedef struct {
+  int batches, per_batch;
+  int next;
+} Source;
+
+static bool gen_ints(PipeCtx* ctx, PipeBatch* in) {
+  Source* src = ctx->user;
+  if (src->next == src->batches)
+    return false;
+  PipeBatch* out = pipe_batch_new(ctx);
+  for (int i = 0; i < src->per_batch; i++) {
+    pipe_batch_push(out, New(&out->arena, int64_t, 1, &(int64_t){src->next * src->per_batch + i}));
+  }
+  src->next++;
+  pipe_emit(ctx, out);
+  return true;
+}
+
+static bool square(PipeCtx* ctx, PipeBatch* in) {
+  PipeBatch* out = pipe_batch_new(ctx);
+  // Scratch is private to this replica and reset after the call
+  int64_t* tmp = New(ctx->scratch, int64_t, in->items.len, NO_INIT);
+  for (isize i = 0; i < in->items.len; i++) {
+    int64_t v = *(int64_t*)in->items.data[i];
+    tmp[i] = v * v;
+    pipe_batch_push(out, &tmp[i]);
+  }
+  // Records must live in the output batch, not in scratch
+  for (isize i = 0; i < out->items.len; i++) {
+    out->items.data[i] = New(&out->arena, int64_t, 1, (int64_t*)out->items.data[i]);
+  }
+  pipe_emit(ctx, out);
+  return true;
+}
+
+typedef struct {
+  _Atomic int64_t sum;
+  int stop_after;  // Batches to accept before returning false, 0 for all
+  int seen;
+  int sleep_us;
+} Sink;
+
+static bool sum_ints(PipeCtx* ctx, PipeBatch* in) {
+  Sink* sink = ctx->user;
+  for (isize i = 0; i < in->items.len; i++) {
+    atomic_fetch_add(&sink->sum, *(int64_t*)in->items.data[i]);
+  }
+  if (sink->sleep_us)
+    usleep(sink->sleep_us);
+  return !sink->stop_after || ++sink->seen < sink->stop_after;
+}
+
+UTEST(pipeline, three_stage_sum_of_squares) {
+  enum { size = KB(64) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  Source src = {.batches = 500, .per_batch = 100};
+  Sink sink = {0};
+  PipeStageDef stages[] = {
+      {.name = "gen", .fn = gen_ints, .user = &src},
+      {.name = "square", .fn = square, .workers = 3},
+      {.name = "sum", .fn = sum_ints, .user = &sink},
+  };
+  PipelineOptions opts = {.queue_cap = 4, .batch_arena_size = MB(1), .scratch_size = MB(1)};
+  Pipeline* p = pipeline_create(arena, stages, Countof(stages), opts);
+  pipeline_run(p);
+
+  int64_t n = (int64_t)src.batches * src.per_batch;
+  ASSERT_EQ(atomic_load(&sink.sum), (n - 1) * n * (2 * n - 1) / 6);
+
+  PipeStageStats gen = pipeline_stats(p, 0), sq = pipeline_stats(p, 1), sum = pipeline_stats(p, 2);
+  ASSERT_EQ(gen.batches_out, 500);
+  ASSERT_EQ(sq.items_in, n);
+  ASSERT_EQ(sq.items_out, n);
+  ASSERT_EQ(sum.batches_in, 500);
+  ASSERT_LE(sq.depth_max, 4);
+  ASSERT_LE(sum.depth_max, 4);
+  ASSERT_GT(sum.wall_ns, 0);
+  pipeline_destroy(p);
+}
+
+UTEST(pipeline, backpressure_and_early_stop) {
+  enum { size = KB(64) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  // Slow sink behind a 2-batch queue: the source spends time blocked
+  Source src = {.batches = 40, .per_batch = 10};
+  Sink sink = {.sleep_us = 500};
+  PipeStageDef stages[] = {
+      {.name = "gen", .fn = gen_ints, .user = &src},
+      {.name = "slow", .fn = sum_ints, .user = &sink},
+  };
+  PipelineOptions opts = {.queue_cap = 2, .batch_arena_size = KB(64), .scratch_size = KB(64)};
+  Pipeline* p = pipeline_create(arena, stages, Countof(stages), opts);
+  pipeline_run(p);
+  PipeStageStats gen = pipeline_stats(p, 0), slow = pipeline_stats(p, 1);
+  ASSERT_EQ(slow.items_in, 400);
+  ASSERT_LE(slow.depth_max, 2);
+  ASSERT_GT(gen.wait_out_ns, 0);
+  pipeline_destroy(p);
+
+  // A sink that stops early still lets the source run to completion
+  src = (Source){.batches = 100, .per_batch = 1};
+  sink = (Sink){.stop_after = 3};
+  p = pipeline_create(arena, stages, Countof(stages), (PipelineOptions){.batch_arena_size = KB(64)});
+  pipeline_run(p);
+  ASSERT_EQ(src.next, 100);
+  ASSERT_EQ(pipeline_stats(p, 1).batches_in, 3);
+  ASSERT_EQ(atomic_load(&sink.sum), 0 + 1 + 2);
+  pipeline_destroy(p);
+}
@@ -0,0 +1,353 @@
+#include "pool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "arena_registry.h"
+#include "sampler.h"
+
+typedef struct Task Task;
+struct Task {
+  TaskFn fn;
+  void *arg;
+  TaskGroup *group;
+  Task *next;  // Injection list link
+};
+
+/* --- Chase-Lev deque ---
+ * Le, Pop, Cohen, Zappa Nardelli: "Correct and Efficient Work-Stealing for
+ * Weak Memory Models" (PPoPP 2013). Fixed capacity: callers handle full.
+ */
+
+typedef struct {
+  alignas(CACHELINE_SIZE) _Atomic isize top;
+  alignas(CACHELINE_SIZE) _Atomic isize bottom;
+  _Atomic(Task *) *buf;
+  isize mask;
+} Deque;
+
+static bool deque_push(Deque *d, Task *t) {
+  isize b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  isize top = atomic_load_explicit(&d->top, memory_order_acquire);
+  if (b - top > d->mask)
+    return false;
+  atomic_store_explicit(&d->buf[b & d->mask], t, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  return true;
+}
+
+static Task *deque_pop(Deque *d) {
+  isize b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  isize top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+  Task *t = NULL;
+  if (top <= b) {
+    t = atomic_load_explicit(&d->buf[b & d->mask], memory_order_relaxed);
+    if (top == b) {
+      // Last element: race against thieves for it
+      if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst,
+                                                   memory_order_relaxed))
+        t = NULL;
+      atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+  } else {
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return t;
+}
+
+static Task *deque_steal(Deque *d) {
+  isize top = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  isize b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (top >= b)
+    return NULL;
+
+  Task *t = atomic_load_explicit(&d->buf[top & d->mask], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst,
+                                               memory_order_relaxed))
+    return NULL;
+  return t;
+}
+
+/* --- Pool --- */
+
+typedef struct {
+  Deque deque;
+  Pool *pool;
+  Arena arena;
+  pthread_t thread;
+  uint64_t rng;
+  int id;
+} Worker;
+
+struct Pool {
+  Worker *workers;
+  int nworkers;
+  bool pin;
+
+  _Atomic isize inflight;  // Tasks spawned or injected but not finished
+  _Atomic bool shutdown;
+
+  // Eventcount for idle workers: bump epoch after publishing work
+  alignas(CACHELINE_SIZE) _Atomic uint64_t epoch;
+  _Atomic int sleepers;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  Task *inject;  // Root tasks from pool_run(), guarded by lock
+  _Atomic bool has_inject;
+
+  pthread_mutex_t run_lock;
+};
+
+static __thread Worker *pool_self = NULL;
+
+enum { POOL_SPIN = 64 };
+
+static void pool_notify(Pool *pool) {
+  atomic_fetch_add(&pool->epoch, 1);
+  if (atomic_load(&pool->sleepers) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+static Task *pool_take_inject(Pool *pool) {
+  if (!atomic_load_explicit(&pool->has_inject, memory_order_acquire))
+    return NULL;
+  pthread_mutex_lock(&pool->lock);
+  Task *t = pool->inject;
+  if (t) {
+    pool->inject = t->next;
+    atomic_store(&pool->has_inject, pool->inject != NULL);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return t;
+}
+
+// xorshift64
+static uint64_t pool_rand(Worker *w) {
+  uint64_t x = w->rng;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return w->rng = x;
+}
+
+static Task *pool_find_work(Worker *w) {
+  Task *t = deque_pop(&w->deque);
+  if (t)
+    return t;
+
+  Pool *pool = w->pool;
+  int n = pool->nworkers;
+  int start = (int)(pool_rand(w) % (uint64_t)n);
+  for (int i = 0; i < n; i++) {
+    Worker *victim = &pool->workers[(start + i) % n];
+    if (victim != w && (t = deque_steal(&victim->deque)))
+      return t;
+  }
+  return pool_take_inject(pool);
+}
+
+static void pool_execute(Pool *pool, Task *t) {
+  t->fn(t->arg);
+  if (t->group)
+    atomic_fetch_sub_explicit(&t->group->pending, 1, memory_order_release);
+  if (atomic_fetch_sub_explicit(&pool->inflight, 1, memory_order_acq_rel) == 1) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+static void *pool_worker_main(void *arg) {
+  Worker *w = arg;
+  Pool *pool = w->pool;
+  pool_self = w;
+  sampler_thread_start();
+
+  if (pool->pin) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->id % (ncpu > 0 ? ncpu : 1), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  jmp_buf jmpbuf;
+  if (ArenaOOM(&w->arena, jmpbuf)) {
+    fprintf(stderr, "!!! OOM in pool worker %d !!!\n", w->id);
+    abort();
+  }
+
+  int idle = 0;
+  while (!atomic_load_explicit(&pool->shutdown, memory_order_relaxed)) {
+    uint64_t seen = atomic_load(&pool->epoch);
+    Task *t = pool_find_work(w);
+    if (t) {
+      pool_execute(pool, t);
+      idle = 0;
+      continue;
+    }
+    if (++idle < POOL_SPIN) {
+      sched_yield();
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->sleepers, 1);
+    while (atomic_load(&pool->epoch) == seen && !atomic_load(&pool->shutdown)) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    atomic_fetch_sub(&pool->sleepers, 1);
+    pthread_mutex_unlock(&pool->lock);
+    idle = 0;
+  }
+  return NULL;
+}
+
+Pool *pool_create(Arena *arena, PoolOptions opts) {
+  if (opts.nthreads <= 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    opts.nthreads = ncpu > 0 ? (int)ncpu : 1;
+  }
+  if (opts.arena_size <= 0)
+    opts.arena_size = POOL_ARENA_SIZE;
+  if (opts.deque_size <= 0)
+    opts.deque_size = POOL_DEQUE_SIZE;
+  Assert(IsPow2(opts.deque_size) && "deque_size must be power of 2");
+
+  Pool *pool = New(arena, Pool);
+  pool->nworkers = opts.nthreads;
+  pool->pin = opts.pin;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pthread_mutex_init(&pool->run_lock, NULL);
+
+  pool->workers = New(arena, Worker, opts.nthreads);
+  for (int i = 0; i < opts.nthreads; i++) {
+    Worker *w = &pool->workers[i];
+    w->pool = pool;
+    w->id = i;
+    w->rng = 0x9e3779b97f4a7c15ull * (uint64_t)(i + 1);
+    w->deque.buf = New(arena, _Atomic(Task *), opts.deque_size);
+    w->deque.mask = opts.deque_size - 1;
+#ifdef OOM_COMMIT
+    w->arena = arena_init(NULL, opts.arena_size);
+#else
+    byte *mem = malloc(opts.arena_size);
+    if (!mem) {
+      perror("pool_create malloc");
+      abort();
+    }
+    w->arena = arena_init(mem, opts.arena_size);
+#endif
+    arena_register(&w->arena, "pool.worker");
+  }
+
+  for (int i = 0; i < opts.nthreads; i++) {
+    Worker *w = &pool->workers[i];
+    if (pthread_create(&w->thread, NULL, pool_worker_main, w)) {
+      perror("pool_create pthread_create");
+      abort();
+    }
+  }
+  return pool;
+}
+
+void pool_destroy(Pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  atomic_store(&pool->shutdown, true);
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->nworkers; i++) {
+    Worker *w = &pool->workers[i];
+    pthread_join(w->thread, NULL);
+#ifndef OOM_COMMIT
+    free(w->arena.beg);
+#endif
+    arena_release(&w->arena);
+  }
+
+  pthread_cond_destroy(&pool->wake);
+  pthread_cond_destroy(&pool->done);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->run_lock);
+}
+
+void pool_run(Pool *pool, TaskFn fn, void *arg) {
+  Assert(!pool_self && "pool_run called from inside a task");
+  pthread_mutex_lock(&pool->run_lock);
+
+  Task root = {.fn = fn, .arg = arg};
+  atomic_fetch_add(&pool->inflight, 1);
+  pthread_mutex_lock(&pool->lock);
+  root.next = pool->inject;
+  pool->inject = &root;
+  atomic_store(&pool->has_inject, true);
+  pthread_mutex_unlock(&pool->lock);
+  pool_notify(pool);
+
+  pthread_mutex_lock(&pool->lock);
+  while (atomic_load(&pool->inflight) > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  // Every task has finished and only this thread can submit more: safe to reset
+  for (int i = 0; i < pool->nworkers; i++) {
+    arena_reset(&pool->workers[i].arena);
+  }
+  pthread_mutex_unlock(&pool->run_lock);
+}
+
+void pool_spawn(TaskGroup *group, TaskFn fn, void *arg) {
+  Worker *w = pool_self;
+  Assert(w && "pool_spawn called outside the pool");
+
+  Task *t = New(&w->arena, Task);
+  t->fn = fn;
+  t->arg = arg;
+  t->group = group;
+  atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&w->pool->inflight, 1, memory_order_relaxed);
+
+  if (!deque_push(&w->deque, t)) {
+    pool_execute(w->pool, t);
+    return;
+  }
+  pool_notify(w->pool);
+}
+
+void pool_wait(TaskGroup *group) {
+  Worker *w = pool_self;
+  Assert(w && "pool_wait called outside the pool");
+
+  while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+    Task *t = pool_find_work(w);
+    if (t)
+      pool_execute(w->pool, t);
+    else
+      sched_yield();
+  }
+}
+
+Arena *pool_arena(void) {
+  Assert(pool_self && "pool_arena called outside the pool");
+  return &pool_self->arena;
+}
+
+int pool_worker_id(void) {
+  return pool_self ? pool_self->id : -1;
+}
+
+int pool_size(const Pool *pool) {
+  return pool->nworkers;
+}
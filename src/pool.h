@@ -0,0 +1,134 @@
+/**
+ * @file pool.h
+ * @brief Work-stealing thread pool with fork/join tasks and per-worker arenas.
+ *
+ * Each worker owns a Chase-Lev deque: it pushes and pops spawned tasks at the
+ * bottom while idle workers steal from the top. Tasks and their data are
+ * allocated from the spawning worker's arena, which is reset once a
+ * pool_run() call has finished and every task is done.
+ *
+ * The arenas are not reset when a task group completes. A worker's arena is
+ * shared by every task it runs, including tasks it steals while it waits in
+ * pool_wait(), and what those tasks allocate may be handed to a parent on
+ * another worker, as may data the waiting task allocated after its spawns.
+ * Nothing tells the pool when such memory is dead before pool_run() ends. A
+ * long pool_run() that wants memory back sooner should allocate short-lived
+ * data from a copy of pool_arena() (Arena tmp = *pool_arena()), or split the
+ * work into several pool_run() calls, as CmdScan does with one per batch.
+ *
+ * Usage:
+ *   static void fib(void *arg) {
+ *     Fib *f = arg;
+ *     if (f->n < 2) { f->out = f->n; return; }
+ *     Fib *a = New(pool_arena(), Fib, 1, &(Fib){.n = f->n - 1});
+ *     Fib b = {.n = f->n - 2};
+ *     TaskGroup g = {0};
+ *     pool_spawn(&g, fib, a);
+ *     fib(&b);
+ *     pool_wait(&g);
+ *     f->out = a->out + b.out;
+ *   }
+ *
+ *   Pool *pool = pool_create(arena, (PoolOptions){0});
+ *   Fib f = {.n = 30};
+ *   pool_run(pool, fib, &f);
+ *   pool_destroy(pool);
+ */
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdatomic.h>
+#include "arena.h"
+
+#ifndef CACHELINE_SIZE
+#define CACHELINE_SIZE 64
+#endif
+
+// Per-worker arena size, reserved lazily with OOM_COMMIT
+#ifndef POOL_ARENA_SIZE
+#define POOL_ARENA_SIZE GB(1)
+#endif
+
+// Per-worker deque capacity; a spawn into a full deque runs inline
+#ifndef POOL_DEQUE_SIZE
+#define POOL_DEQUE_SIZE 4096
+#endif
+
+typedef void (*TaskFn)(void *arg);
+
+/**
+ * @brief Join counter for tasks spawned with pool_spawn().
+ *
+ * Zero-initialize, spawn into it, then pool_wait() before it goes out of
+ * scope.
+ */
+typedef struct TaskGroup {
+  _Atomic isize pending;
+} TaskGroup;
+
+typedef struct {
+  int nthreads;      // Worker count, 0 for one per online CPU
+  bool pin;          // Pin worker i to CPU i
+  isize arena_size;  // Per-worker arena size, 0 for POOL_ARENA_SIZE
+  isize deque_size;  // Per-worker deque capacity (power of 2), 0 for POOL_DEQUE_SIZE
+} PoolOptions;
+
+typedef struct Pool Pool;
+
+/**
+ * @brief Start a pool of worker threads.
+ * @param arena Arena for the pool and worker bookkeeping
+ * @param opts Options, zero for defaults
+ * @return Running pool
+ */
+Pool *pool_create(Arena *arena, PoolOptions opts);
+
+/**
+ * @brief Stop and join all workers and release their arenas.
+ * @param pool Pool from pool_create()
+ *
+ * The pool's own memory belongs to the arena given to pool_create().
+ */
+void pool_destroy(Pool *pool);
+
+/**
+ * @brief Run fn(arg) on the pool and wait for it and every task it spawned.
+ * @param pool Pool
+ * @param fn Root task
+ * @param arg Argument passed to fn
+ *
+ * Must be called from outside the pool. Calls from several threads are
+ * serialized. Worker arenas are reset before returning, so nothing
+ * allocated from pool_arena() survives the call.
+ */
+void pool_run(Pool *pool, TaskFn fn, void *arg);
+
+/**
+ * @brief Spawn fn(arg) as a child task of the current task.
+ * @param group Join counter to wait on with pool_wait()
+ * @param fn Task function
+ * @param arg Argument passed to fn (must outlive the task)
+ *
+ * Only callable from inside a task.
+ */
+void pool_spawn(TaskGroup *group, TaskFn fn, void *arg);
+
+/**
+ * @brief Wait until all tasks spawned into group have finished.
+ * @param group Join counter
+ *
+ * The calling worker runs pending tasks while it waits.
+ */
+void pool_wait(TaskGroup *group);
+
+// @return Arena of the calling worker (only valid inside a task)
+Arena *pool_arena(void);
+
+// @return Index of the calling worker, or -1 outside the pool
+int pool_worker_id(void);
+
+// @return Number of workers in pool
+int pool_size(const Pool *pool);
+
+#endif  // POOL_H_
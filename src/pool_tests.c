@@ -0,0 +1,89 @@
+#include "pool.h"
+#include "utest.h"
+
+typedef struct {
+  int n;
+  int64_t out;
+} Fib;
+
+static void fib_task(void* arg) {
+  Fib* f = arg;
+  if (f->n < 2) {
+    f->out = f->n;
+    return;
+  }
+  Fib* a = New(pool_arena(), Fib);
+  a->n = f->n - 1;
+  Fib b = {.n = f->n - 2};
+
+  TaskGroup g = {0};
+  pool_spawn(&g, fib_task, a);
+  fib_task(&b);
+  pool_wait(&g);
+  f->out = a->out + b.out;
+}
+
+UTEST(pool, fork_join_fib) {
+  enum { size = KB(64) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  Pool* pool = pool_create(arena, (PoolOptions){.nthreads = 4, .arena_size = MB(16), .deque_size = 256});
+  Fib f = {.n = 20};
+  pool_run(pool, fib_task, &f);
+  ASSERT_EQ(f.out, 6765);
+
+  // Pool is reusable after a run
+  f = (Fib){.n = 15};
+  pool_run(pool, fib_task, &f);
+  ASSERT_EQ(f.out, 610);
+  pool_destroy(pool);
+}
+
+typedef struct {
+  _Atomic int64_t sum;
+  _Atomic int ran_on[8];
+  Arena* arenas[8];
+} Fanout;
+
+static Fanout fanout;
+
+static void fanout_leaf(void* arg) {
+  int id = pool_worker_id();
+  atomic_fetch_add(&fanout.sum, (int64_t)(intptr_t)arg);
+  atomic_fetch_add(&fanout.ran_on[id], 1);
+  fanout.arenas[id] = pool_arena();
+  New(pool_arena(), char, 100);
+}
+
+static void fanout_root(void* arg) {
+  TaskGroup g = {0};
+  for (intptr_t i = 1; i <= 10000; i++) {
+    pool_spawn(&g, fanout_leaf, (void*)i);
+  }
+  pool_wait(&g);
+}
+
+UTEST(pool, fanout_overflows_deque) {
+  enum { size = KB(64) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  // 10000 spawns into a 64-slot deque: the excess runs inline
+  Pool* pool = pool_create(arena, (PoolOptions){.nthreads = 3, .deque_size = 64, .pin = true});
+  ASSERT_EQ(pool_size(pool), 3);
+  memset(&fanout, 0, sizeof(fanout));
+  pool_run(pool, fanout_root, NULL);
+  ASSERT_EQ(atomic_load(&fanout.sum), (int64_t)10000 * 10001 / 2);
+
+  int total = 0;
+  for (int i = 0; i < 3; i++) {
+    total += atomic_load(&fanout.ran_on[i]);
+    // Worker arenas are reset once the run completes
+    if (fanout.arenas[i])
+      ASSERT_EQ(fanout.arenas[i]->cur, fanout.arenas[i]->beg);
+  }
+  ASSERT_EQ(total, 10000);
+  ASSERT_EQ(pool_worker_id(), -1);
+  pool_destroy(pool);
+}
@@ -0,0 +1,401 @@
+#include "reader.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+typedef enum { SLOT_IDLE, SLOT_QUEUED, SLOT_DONE } SlotState;
+
+typedef struct {
+  byte *buf;
+  int64_t off;   // File offset of buf[0]
+  isize filled;  // Bytes read so far
+  int err;       // errno of a failed read
+  bool eof;      // A read returned 0 before the buffer was full
+  SlotState state;
+  struct iovec iov;  // Unregistered reads
+} ReaderSlot;
+
+/* --- io_uring over raw syscalls --- */
+
+typedef struct {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_len, cq_len, sqes_len;
+  unsigned pending;  // SQEs written but not yet passed to io_uring_enter
+} Uring;
+
+static bool uring_init(Uring *u, unsigned entries) {
+  struct io_uring_params p = {0};
+  int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (fd < 0)
+    return false;
+
+  u->fd = fd;
+  u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single)
+    u->sq_len = u->cq_len = Max(u->sq_len, u->cq_len);
+
+  u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  u->cq_ptr = single || u->sq_ptr == MAP_FAILED
+                  ? u->sq_ptr
+                  : mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = u->cq_ptr == MAP_FAILED
+                ? MAP_FAILED
+                : mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) {
+    if (u->sq_ptr != MAP_FAILED)
+      munmap(u->sq_ptr, u->sq_len);
+    if (!single && u->cq_ptr != MAP_FAILED)
+      munmap(u->cq_ptr, u->cq_len);
+    close(fd);
+    return false;
+  }
+
+  byte *sq = u->sq_ptr, *cq = u->cq_ptr;
+  u->sq_head = (unsigned *)(sq + p.sq_off.head);
+  u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *)(sq + p.sq_off.array);
+  u->cq_head = (unsigned *)(cq + p.cq_off.head);
+  u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  u->pending = 0;
+  return true;
+}
+
+static void uring_free(Uring *u) {
+  munmap(u->sqes, u->sqes_len);
+  if (u->cq_ptr != u->sq_ptr)
+    munmap(u->cq_ptr, u->cq_len);
+  munmap(u->sq_ptr, u->sq_len);
+  close(u->fd);
+}
+
+// Callers keep at most sq_entries reads in flight, so the SQ is never full
+static struct io_uring_sqe *uring_sqe(Uring *u) {
+  unsigned tail = *u->sq_tail;
+  unsigned idx = tail & *u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  u->sq_array[idx] = idx;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  u->pending++;
+  return sqe;
+}
+
+// Submit pending SQEs and wait for at least min_complete completions
+static int uring_enter(Uring *u, unsigned min_complete) {
+  for (;;) {
+    long n = syscall(__NR_io_uring_enter, u->fd, u->pending, min_complete,
+                     min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (n >= 0) {
+      u->pending -= (unsigned)n;
+      return 0;
+    }
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      return errno;
+  }
+}
+
+/* --- Reader --- */
+
+struct FileReader {
+  int fd;
+  int depth;
+  isize buf_size;
+  ReaderSlot *slots;
+  int64_t next_off;  // Offset of the next read to issue
+  int head;          // Slot to deliver next
+  int held;          // Slot delivered to the consumer, -1 if none
+  bool eof;
+  bool closing;
+  int err;
+
+  // io_uring backend
+  bool uring;
+  bool fixed;  // Buffers registered, reads use READ_FIXED
+  Uring ring;
+  int inflight;
+
+  // pread() backend
+  pthread_t *threads;
+  int nthreads;
+  pthread_mutex_t lock;
+  pthread_cond_t work, done;
+  int *queue;  // FIFO of queued slot indices, depth entries
+  int q_head, q_len;
+  bool stop;
+};
+
+static void reader_submit_uring(FileReader *r, int i) {
+  ReaderSlot *s = &r->slots[i];
+  struct io_uring_sqe *sqe = uring_sqe(&r->ring);
+  sqe->fd = r->fd;
+  sqe->off = (uint64_t)(s->off + s->filled);
+  sqe->user_data = (uint64_t)i;
+  if (r->fixed) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->addr = (uint64_t)(uintptr_t)(s->buf + s->filled);
+    sqe->len = (uint32_t)(r->buf_size - s->filled);
+    sqe->buf_index = (uint16_t)i;
+  } else {
+    s->iov = (struct iovec){s->buf + s->filled, (size_t)(r->buf_size - s->filled)};
+    sqe->opcode = IORING_OP_READV;
+    sqe->addr = (uint64_t)(uintptr_t)&s->iov;
+    sqe->len = 1;
+  }
+  r->inflight++;
+}
+
+// Queue a read of the next unread offset into slot i
+static void reader_issue(FileReader *r, int i) {
+  ReaderSlot *s = &r->slots[i];
+  s->off = r->next_off;
+  s->filled = 0;
+  s->err = 0;
+  s->eof = false;
+  s->state = SLOT_QUEUED;
+  r->next_off += r->buf_size;
+
+  if (r->uring) {
+    reader_submit_uring(r, i);
+  } else {
+    pthread_mutex_lock(&r->lock);
+    r->queue[(r->q_head + r->q_len++) % r->depth] = i;
+    pthread_cond_signal(&r->work);
+    pthread_mutex_unlock(&r->lock);
+  }
+}
+
+// Drain the CQ; short reads are resubmitted for the remainder
+static void reader_reap(FileReader *r) {
+  Uring *u = &r->ring;
+  unsigned head = *u->cq_head;
+  unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+    ReaderSlot *s = &r->slots[cqe->user_data];
+    int res = cqe->res;
+    r->inflight--;
+
+    if (res == -EINTR || res == -EAGAIN) {
+      res = 0;
+      if (!r->closing) {
+        reader_submit_uring(r, (int)cqe->user_data);
+        continue;
+      }
+    }
+    if (res < 0) {
+      s->err = -res;
+    } else if (res == 0) {
+      s->eof = true;
+    } else {
+      s->filled += res;
+      if (s->filled < r->buf_size && !r->closing) {
+        reader_submit_uring(r, (int)cqe->user_data);
+        continue;
+      }
+    }
+    s->state = SLOT_DONE;
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void *reader_thread(void *arg) {
+  FileReader *r = arg;
+  pthread_mutex_lock(&r->lock);
+  for (;;) {
+    while (!r->q_len && !r->stop) {
+      pthread_cond_wait(&r->work, &r->lock);
+    }
+    if (r->stop)
+      break;
+    ReaderSlot *s = &r->slots[r->queue[r->q_head]];
+    r->q_head = (r->q_head + 1) % r->depth;
+    r->q_len--;
+    pthread_mutex_unlock(&r->lock);
+
+    isize filled = 0;
+    int err = 0;
+    bool eof = false;
+    while (filled < r->buf_size) {
+      ssize_t n = pread(r->fd, s->buf + filled, (size_t)(r->buf_size - filled), s->off + filled);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        err = errno;
+        break;
+      }
+      if (n == 0) {
+        eof = true;
+        break;
+      }
+      filled += n;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    s->filled = filled;
+    s->err = err;
+    s->eof = eof;
+    s->state = SLOT_DONE;
+    pthread_cond_broadcast(&r->done);
+  }
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+FileReader *file_reader_open(Arena *arena, int fd, FileReaderOptions opts) {
+  if (opts.depth <= 0)
+    opts.depth = READER_DEPTH;
+  if (opts.buf_size <= 0)
+    opts.buf_size = READER_BUF_SIZE;
+  if (opts.nthreads <= 0)
+    opts.nthreads = READER_THREADS;
+
+  FileReader *r = New(arena, FileReader);
+  r->fd = fd;
+  r->depth = opts.depth;
+  r->buf_size = opts.buf_size;
+  r->held = -1;
+  r->slots = New(arena, ReaderSlot, opts.depth);
+  isize page = (isize)sysconf(_SC_PAGESIZE);
+  for (int i = 0; i < opts.depth; i++) {
+    r->slots[i].buf = arena_alloc(arena, opts.buf_size, page, 1, NO_INIT);
+  }
+
+  // Reads are issued at explicit offsets, which pipes and sockets reject
+  if (lseek(fd, 0, SEEK_CUR) < 0) {
+    r->err = errno;
+    return r;
+  }
+
+  r->uring = !opts.force_pread && uring_init(&r->ring, (unsigned)opts.depth);
+  if (r->uring && opts.register_bufs) {
+    // Best effort: fails under a low RLIMIT_MEMLOCK, plain reads still work
+    struct iovec *iov = New(arena, struct iovec, opts.depth);
+    for (int i = 0; i < opts.depth; i++) {
+      iov[i] = (struct iovec){r->slots[i].buf, (size_t)opts.buf_size};
+    }
+    r->fixed = !syscall(__NR_io_uring_register, r->ring.fd, IORING_REGISTER_BUFFERS, iov, opts.depth);
+  }
+
+  if (!r->uring) {
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->work, NULL);
+    pthread_cond_init(&r->done, NULL);
+    r->queue = New(arena, int, opts.depth);
+    r->nthreads = Min(opts.nthreads, opts.depth);
+    r->threads = New(arena, pthread_t, r->nthreads);
+    for (int i = 0; i < r->nthreads; i++) {
+      if (pthread_create(&r->threads[i], NULL, reader_thread, r)) {
+        perror("file_reader_open pthread_create");
+        abort();
+      }
+    }
+  }
+
+  for (int i = 0; i < r->depth; i++) {
+    reader_issue(r, i);
+  }
+  if (r->uring) {
+    r->err = uring_enter(&r->ring, 0);
+  }
+  return r;
+}
+
+bool file_reader_next(FileReader *r, astr *chunk) {
+  if (r->held >= 0) {
+    // Recycle the previous chunk's buffer for the next unread offset
+    int i = r->held;
+    r->held = -1;
+    r->slots[i].state = SLOT_IDLE;
+    if (!r->eof && !r->err)
+      reader_issue(r, i);
+  }
+  if (r->err)
+    return false;
+
+  // An idle head slot was never issued: the reader is past end of file
+  ReaderSlot *s = &r->slots[r->head];
+  if (r->uring) {
+    if (s->state == SLOT_IDLE)
+      return false;
+    while (s->state != SLOT_DONE) {
+      int err = uring_enter(&r->ring, 1);
+      if (err) {
+        r->err = err;
+        return false;
+      }
+      reader_reap(r);
+    }
+    if (r->ring.pending)
+      r->err = uring_enter(&r->ring, 0);
+  } else {
+    pthread_mutex_lock(&r->lock);
+    bool idle = s->state == SLOT_IDLE;
+    while (!idle && s->state != SLOT_DONE) {
+      pthread_cond_wait(&r->done, &r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+    if (idle)
+      return false;
+  }
+
+  if (s->err) {
+    r->err = s->err;
+    return false;
+  }
+  if (s->eof)
+    r->eof = true;
+  if (s->filled == 0)
+    return false;
+
+  *chunk = (astr){(char *)s->buf, s->filled};
+  r->held = r->head;
+  r->head = (r->head + 1) % r->depth;
+  return true;
+}
+
+int file_reader_error(const FileReader *r) {
+  return r->err;
+}
+
+bool file_reader_uring(const FileReader *r) {
+  return r->uring;
+}
+
+void file_reader_close(FileReader *r) {
+  r->closing = true;
+  if (r->uring) {
+    // The kernel may still write into the buffers until every read completes
+    while (r->inflight > 0) {
+      if (uring_enter(&r->ring, 1))
+        break;
+      reader_reap(r);
+    }
+    uring_free(&r->ring);
+  } else if (r->threads) {
+    pthread_mutex_lock(&r->lock);
+    r->stop = true;
+    pthread_cond_broadcast(&r->work);
+    pthread_mutex_unlock(&r->lock);
+    for (int i = 0; i < r->nthreads; i++) {
+      pthread_join(r->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->work);
+    pthread_cond_destroy(&r->done);
+  }
+}
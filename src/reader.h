@@ -0,0 +1,93 @@
+/**
+ * @file reader.h
+ * @brief Asynchronous sequential file reader on io_uring, handing out astr chunks.
+ *
+ * A fixed set of equal-sized buffers is carved from an arena and kept in
+ * flight at consecutive file offsets, so the next chunks are being read
+ * while the current one is parsed. Chunks come back strictly in file order;
+ * each stays valid until the following file_reader_next() call, which
+ * recycles its buffer for the next unread offset.
+ *
+ * io_uring is driven through raw syscalls (no liburing). Buffers can be
+ * registered with the ring to skip per-read page pinning. When io_uring is
+ * unavailable (old kernel, seccomp, io_uring_disabled) a few threads issue
+ * blocking pread() calls instead, with the same interface and ordering.
+ *
+ * Usage:
+ *   FileReader *r = file_reader_open(arena, fd, (FileReaderOptions){0});
+ *   astr chunk;
+ *   while (file_reader_next(r, &chunk)) {
+ *     parse(chunk);
+ *   }
+ *   if (file_reader_error(r)) ...
+ *   file_reader_close(r);
+ *
+ * The fd must support positioned reads (regular file or block device).
+ * Chunks are split at buffer boundaries, not at record boundaries.
+ */
+
+#ifndef READER_H_
+#define READER_H_
+
+#include "arena.h"
+
+// Buffers in flight
+#ifndef READER_DEPTH
+#define READER_DEPTH 8
+#endif
+
+// Bytes per buffer (and per chunk, except the last)
+#ifndef READER_BUF_SIZE
+#define READER_BUF_SIZE MB(1)
+#endif
+
+// pread() threads used when io_uring is unavailable
+#ifndef READER_THREADS
+#define READER_THREADS 4
+#endif
+
+typedef struct {
+  int depth;           // Buffers in flight, 0 for READER_DEPTH
+  isize buf_size;      // Bytes per buffer, 0 for READER_BUF_SIZE
+  bool register_bufs;  // Register buffers with the ring (best effort)
+  bool force_pread;    // Skip io_uring and use the pread() threads
+  int nthreads;        // pread() threads, 0 for READER_THREADS
+} FileReaderOptions;
+
+typedef struct FileReader FileReader;
+
+/**
+ * @brief Start reading fd from offset 0.
+ * @param arena Arena for the reader and its buffers (page-aligned)
+ * @param fd Open file descriptor, owned by the caller
+ * @param opts Options, zero for defaults
+ * @return Reader with the first depth reads already in flight
+ */
+FileReader *file_reader_open(Arena *arena, int fd, FileReaderOptions opts);
+
+/**
+ * @brief Wait for the next chunk in file order.
+ * @param r Reader
+ * @param chunk Set to a view of the chunk's bytes
+ * @return false at end of file or on error (see file_reader_error())
+ *
+ * The previous chunk's buffer is recycled by this call, so views into it
+ * must not be used afterwards.
+ */
+bool file_reader_next(FileReader *r, astr *chunk);
+
+// @return errno of the first failed read, or 0
+int file_reader_error(const FileReader *r);
+
+// @return true if r runs on io_uring, false for the pread() fallback
+bool file_reader_uring(const FileReader *r);
+
+/**
+ * @brief Wait for reads still in flight and release kernel and thread resources.
+ * @param r Reader
+ *
+ * Buffers stay in the arena given to file_reader_open().
+ */
+void file_reader_close(FileReader *r);
+
+#endif  // READER_H_
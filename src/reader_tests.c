@@ -0,0 +1,91 @@
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "reader.h"
+#include "utest.h"
+
+// Temp file holding n bytes of a position-dependent pattern
+static FILE* pattern_file(isize n) {
+  FILE* f = tmpfile();
+  for (isize i = 0; i < n; i++) {
+    fputc((int)(i * 7 + i / 251) & 0xff, f);
+  }
+  fflush(f);
+  return f;
+}
+
+// Read the whole file through a reader and check every byte and chunk order
+static bool read_back(Arena* arena, FILE* f, isize n, FileReaderOptions opts, int* nchunks) {
+  FileReader* r = file_reader_open(arena, fileno(f), opts);
+  isize pos = 0;
+  bool ok = true;
+  *nchunks = 0;
+  astr chunk;
+  while (file_reader_next(r, &chunk)) {
+    ok &= chunk.len > 0 && chunk.len <= opts.buf_size;
+    for (isize i = 0; i < chunk.len && ok; i++) {
+      ok &= (byte)chunk.data[i] == (byte)((pos + i) * 7 + (pos + i) / 251);
+    }
+    pos += chunk.len;
+    ++*nchunks;
+  }
+  ok &= pos == n && file_reader_error(r) == 0;
+  file_reader_close(r);
+  return ok;
+}
+
+UTEST(reader, uring_and_pread_in_order) {
+  Arena arena[] = {arena_init(NULL, MB(64))};
+  enum { n = 300001, buf = 4096 };
+  FILE* f = pattern_file(n);
+  int nchunks;
+
+  FileReaderOptions opts = {.depth = 4, .buf_size = buf};
+  ASSERT_TRUE(read_back(arena, f, n, opts, &nchunks));
+  ASSERT_EQ(nchunks, (n + buf - 1) / buf);
+
+  opts.register_bufs = true;
+  ASSERT_TRUE(read_back(arena, f, n, opts, &nchunks));
+  ASSERT_EQ(nchunks, (n + buf - 1) / buf);
+
+  opts = (FileReaderOptions){.depth = 6, .buf_size = buf, .force_pread = true, .nthreads = 3};
+  ASSERT_TRUE(read_back(arena, f, n, opts, &nchunks));
+  ASSERT_EQ(nchunks, (n + buf - 1) / buf);
+
+  // Exact multiple of the buffer size, and more buffers than chunks
+  fclose(f);
+  f = pattern_file(8 * buf);
+  opts = (FileReaderOptions){.depth = 16, .buf_size = buf};
+  ASSERT_TRUE(read_back(arena, f, 8 * buf, opts, &nchunks));
+  ASSERT_EQ(nchunks, 8);
+  opts.force_pread = true;
+  ASSERT_TRUE(read_back(arena, f, 8 * buf, opts, &nchunks));
+  ASSERT_EQ(nchunks, 8);
+  fclose(f);
+  arena_release(arena);
+}
+
+UTEST(reader, empty_and_error) {
+  Arena arena[] = {arena_init(NULL, MB(16))};
+  FILE* f = tmpfile();
+  int nchunks;
+  ASSERT_TRUE(read_back(arena, f, 0, (FileReaderOptions){.buf_size = 4096}, &nchunks));
+  ASSERT_EQ(nchunks, 0);
+  ASSERT_TRUE(read_back(arena, f, 0, (FileReaderOptions){.buf_size = 4096, .force_pread = true}, &nchunks));
+  ASSERT_EQ(nchunks, 0);
+  fclose(f);
+
+  // Pipes do not support positioned reads
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  for (int force = 0; force < 2; force++) {
+    FileReader* r = file_reader_open(arena, fds[0], (FileReaderOptions){.buf_size = 4096, .force_pread = force});
+    astr chunk;
+    ASSERT_FALSE(file_reader_next(r, &chunk));
+    ASSERT_EQ(file_reader_error(r), ESPIPE);
+    file_reader_close(r);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  arena_release(arena);
+}
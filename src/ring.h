@@ -0,0 +1,356 @@
+/**
+ * @file ring.h
+ * @brief Bounded lock-free ring queues of pointers: SPSC and MPMC, with batch ops.
+ *
+ * SpscRing is a Lamport ring for one producer and one consumer. Each side
+ * keeps a private copy of the other side's index and only reloads the
+ * shared one when the copy says the ring is full (or empty), so the common
+ * case touches no cache line written by the other thread.
+ *
+ * MpmcRing is Vyukov's bounded MPMC queue: every cell carries a sequence
+ * number telling producers and consumers whose turn it is, and a position
+ * counter per side is claimed with CAS. Batch operations claim a run of
+ * consecutive ready cells with a single CAS.
+ *
+ * The try operations never block and return how many items they moved.
+ * The _wait variants sleep on a futex when the ring is full or empty; a
+ * waker only pays for a syscall when someone is actually asleep. Closing a
+ * ring makes blocked and future waiting pops return 0 once it is drained.
+ *
+ * Usage:
+ *   MpmcRing *q = mpmc_create(arena, 1024);
+ *   // producers
+ *   mpmc_push_wait(q, items, n);
+ *   // consumers
+ *   void *batch[64];
+ *   isize k;
+ *   while ((k = mpmc_pop_wait(q, batch, 64)) > 0) { ... }
+ *   // once every producer is done
+ *   mpmc_close(q);
+ *
+ * Storage comes from the arena passed at creation; capacity must be a power
+ * of 2.
+ */
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "arena.h"
+
+#ifndef CACHELINE_SIZE
+#define CACHELINE_SIZE 64
+#endif
+
+/* --- Futex-backed wait/notify --- */
+
+// Eventcount: waiters snapshot seq, re-check their condition, then sleep on seq
+typedef struct {
+  _Atomic uint32_t seq;
+  _Atomic uint32_t waiters;
+} RingEvent;
+
+static inline uint32_t ring_event_prepare(RingEvent *ev) {
+  atomic_fetch_add(&ev->waiters, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  return atomic_load_explicit(&ev->seq, memory_order_relaxed);
+}
+
+static inline void ring_event_cancel(RingEvent *ev) {
+  atomic_fetch_sub_explicit(&ev->waiters, 1, memory_order_relaxed);
+}
+
+static inline void ring_event_wait(RingEvent *ev, uint32_t seq) {
+  syscall(SYS_futex, (uint32_t *)&ev->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+  atomic_fetch_sub_explicit(&ev->waiters, 1, memory_order_relaxed);
+}
+
+// Call after publishing the state change waiters are waiting for
+static inline void ring_event_notify(RingEvent *ev) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ev->waiters, memory_order_relaxed)) {
+    atomic_fetch_add_explicit(&ev->seq, 1, memory_order_relaxed);
+    syscall(SYS_futex, (uint32_t *)&ev->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+/* --- SPSC --- */
+
+typedef struct {
+  alignas(CACHELINE_SIZE) _Atomic isize head;  // Next slot to pop, written by the consumer
+  isize tail_cache;                            // Consumer's copy of tail
+  alignas(CACHELINE_SIZE) _Atomic isize tail;  // Next slot to push, written by the producer
+  isize head_cache;                            // Producer's copy of head
+  alignas(CACHELINE_SIZE) void **buf;
+  isize mask;
+  _Atomic bool closed;
+  RingEvent not_empty, not_full;
+} SpscRing;
+
+/**
+ * @brief Create an SPSC ring.
+ * @param arena Arena for the ring and its slots
+ * @param cap Capacity, power of 2
+ * @return Empty ring
+ */
+static inline SpscRing *spsc_create(Arena *arena, isize cap) {
+  Assert(IsPow2(cap) && "ring capacity must be power of 2");
+  SpscRing *r = New(arena, SpscRing);
+  r->buf = New(arena, void *, cap, NO_INIT);
+  r->mask = cap - 1;
+  return r;
+}
+
+// Push up to n items without blocking (producer only). @return Items pushed
+static inline isize spsc_push_n(SpscRing *r, void *const *items, isize n) {
+  isize tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  isize room = r->mask + 1 - (tail - r->head_cache);
+  if (room < n) {
+    r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+    room = r->mask + 1 - (tail - r->head_cache);
+  }
+  n = Min(n, room);
+  for (isize i = 0; i < n; i++) {
+    r->buf[(tail + i) & r->mask] = items[i];
+  }
+  if (n > 0) {
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    ring_event_notify(&r->not_empty);
+  }
+  return n;
+}
+
+// Pop up to n items without blocking (consumer only). @return Items popped
+static inline isize spsc_pop_n(SpscRing *r, void **out, isize n) {
+  isize head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  isize avail = r->tail_cache - head;
+  if (avail < n) {
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    avail = r->tail_cache - head;
+  }
+  n = Min(n, avail);
+  for (isize i = 0; i < n; i++) {
+    out[i] = r->buf[(head + i) & r->mask];
+  }
+  if (n > 0) {
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+    ring_event_notify(&r->not_full);
+  }
+  return n;
+}
+
+static inline bool spsc_push(SpscRing *r, void *item) {
+  return spsc_push_n(r, &item, 1);
+}
+
+static inline bool spsc_pop(SpscRing *r, void **item) {
+  return spsc_pop_n(r, item, 1);
+}
+
+// Push all n items, sleeping while the ring is full
+static inline void spsc_push_wait(SpscRing *r, void *const *items, isize n) {
+  while (n > 0) {
+    isize k = spsc_push_n(r, items, n);
+    if (k == 0) {
+      uint32_t seq = ring_event_prepare(&r->not_full);
+      if ((k = spsc_push_n(r, items, n)) == 0) {
+        ring_event_wait(&r->not_full, seq);
+        continue;
+      }
+      ring_event_cancel(&r->not_full);
+    }
+    items += k;
+    n -= k;
+  }
+}
+
+/**
+ * @brief Pop between 1 and n items, sleeping while the ring is empty.
+ * @return Items popped, 0 once the ring is closed and drained
+ */
+static inline isize spsc_pop_wait(SpscRing *r, void **out, isize n) {
+  for (;;) {
+    isize k = spsc_pop_n(r, out, n);
+    if (k > 0)
+      return k;
+    uint32_t seq = ring_event_prepare(&r->not_empty);
+    bool closed = atomic_load_explicit(&r->closed, memory_order_acquire);
+    if ((k = spsc_pop_n(r, out, n)) > 0 || closed) {
+      ring_event_cancel(&r->not_empty);
+      return k;
+    }
+    ring_event_wait(&r->not_empty, seq);
+  }
+}
+
+// Producer is done: wake the consumer once the ring drains
+static inline void spsc_close(SpscRing *r) {
+  atomic_store_explicit(&r->closed, true, memory_order_release);
+  ring_event_notify(&r->not_empty);
+}
+
+// @return Items currently queued (approximate while both sides run)
+static inline isize spsc_len(SpscRing *r) {
+  return atomic_load_explicit(&r->tail, memory_order_relaxed) - atomic_load_explicit(&r->head, memory_order_relaxed);
+}
+
+/* --- MPMC ---
+ * Vyukov, "Bounded MPMC queue" (1024cores.net). Cell i is free for the
+ * producer at position p when seq == p, and holds an item for the consumer
+ * at position p when seq == p + 1.
+ */
+
+typedef struct {
+  _Atomic isize seq;
+  void *item;
+} MpmcCell;
+
+typedef struct {
+  alignas(CACHELINE_SIZE) _Atomic isize enq;  // Next position to push
+  alignas(CACHELINE_SIZE) _Atomic isize deq;  // Next position to pop
+  alignas(CACHELINE_SIZE) MpmcCell *cells;
+  isize mask;
+  _Atomic bool closed;
+  RingEvent not_empty, not_full;
+} MpmcRing;
+
+/**
+ * @brief Create an MPMC ring.
+ * @param arena Arena for the ring and its cells
+ * @param cap Capacity, power of 2
+ * @return Empty ring
+ */
+static inline MpmcRing *mpmc_create(Arena *arena, isize cap) {
+  Assert(IsPow2(cap) && "ring capacity must be power of 2");
+  MpmcRing *r = New(arena, MpmcRing);
+  r->cells = New(arena, MpmcCell, cap);
+  r->mask = cap - 1;
+  for (isize i = 0; i < cap; i++) {
+    atomic_store_explicit(&r->cells[i].seq, i, memory_order_relaxed);
+  }
+  return r;
+}
+
+// Push up to n items without blocking. @return Items pushed
+static inline isize mpmc_push_n(MpmcRing *r, void *const *items, isize n) {
+  isize pos = atomic_load_explicit(&r->enq, memory_order_relaxed);
+  for (;;) {
+    // Count the run of free cells starting at pos
+    isize k = 0;
+    for (; k < n; k++) {
+      isize seq = atomic_load_explicit(&r->cells[(pos + k) & r->mask].seq, memory_order_acquire);
+      if (seq != pos + k)
+        break;
+    }
+    if (k == 0) {
+      isize seq = atomic_load_explicit(&r->cells[pos & r->mask].seq, memory_order_acquire);
+      if (seq < pos)
+        return 0;  // Full: the consumer of the previous lap has not popped it yet
+      pos = atomic_load_explicit(&r->enq, memory_order_relaxed);
+      continue;
+    }
+    if (atomic_compare_exchange_weak_explicit(&r->enq, &pos, pos + k, memory_order_relaxed,
+                                              memory_order_relaxed)) {
+      for (isize i = 0; i < k; i++) {
+        MpmcCell *c = &r->cells[(pos + i) & r->mask];
+        c->item = items[i];
+        atomic_store_explicit(&c->seq, pos + i + 1, memory_order_release);
+      }
+      ring_event_notify(&r->not_empty);
+      return k;
+    }
+  }
+}
+
+// Pop up to n items without blocking. @return Items popped
+static inline isize mpmc_pop_n(MpmcRing *r, void **out, isize n) {
+  isize pos = atomic_load_explicit(&r->deq, memory_order_relaxed);
+  for (;;) {
+    // Count the run of filled cells starting at pos
+    isize k = 0;
+    for (; k < n; k++) {
+      isize seq = atomic_load_explicit(&r->cells[(pos + k) & r->mask].seq, memory_order_acquire);
+      if (seq != pos + k + 1)
+        break;
+    }
+    if (k == 0) {
+      isize seq = atomic_load_explicit(&r->cells[pos & r->mask].seq, memory_order_acquire);
+      if (seq < pos + 1)
+        return 0;  // Empty
+      pos = atomic_load_explicit(&r->deq, memory_order_relaxed);
+      continue;
+    }
+    if (atomic_compare_exchange_weak_explicit(&r->deq, &pos, pos + k, memory_order_relaxed,
+                                              memory_order_relaxed)) {
+      for (isize i = 0; i < k; i++) {
+        MpmcCell *c = &r->cells[(pos + i) & r->mask];
+        out[i] = c->item;
+        atomic_store_explicit(&c->seq, pos + i + r->mask + 1, memory_order_release);
+      }
+      ring_event_notify(&r->not_full);
+      return k;
+    }
+  }
+}
+
+static inline bool mpmc_push(MpmcRing *r, void *item) {
+  return mpmc_push_n(r, &item, 1);
+}
+
+static inline bool mpmc_pop(MpmcRing *r, void **item) {
+  return mpmc_pop_n(r, item, 1);
+}
+
+// Push all n items, sleeping while the ring is full
+static inline void mpmc_push_wait(MpmcRing *r, void *const *items, isize n) {
+  while (n > 0) {
+    isize k = mpmc_push_n(r, items, n);
+    if (k == 0) {
+      uint32_t seq = ring_event_prepare(&r->not_full);
+      if ((k = mpmc_push_n(r, items, n)) == 0) {
+        ring_event_wait(&r->not_full, seq);
+        continue;
+      }
+      ring_event_cancel(&r->not_full);
+    }
+    items += k;
+    n -= k;
+  }
+}
+
+/**
+ * @brief Pop between 1 and n items, sleeping while the ring is empty.
+ * @return Items popped, 0 once the ring is closed and drained
+ */
+static inline isize mpmc_pop_wait(MpmcRing *r, void **out, isize n) {
+  for (;;) {
+    isize k = mpmc_pop_n(r, out, n);
+    if (k > 0)
+      return k;
+    uint32_t seq = ring_event_prepare(&r->not_empty);
+    bool closed = atomic_load_explicit(&r->closed, memory_order_acquire);
+    if ((k = mpmc_pop_n(r, out, n)) > 0 || closed) {
+      ring_event_cancel(&r->not_empty);
+      return k;
+    }
+    ring_event_wait(&r->not_empty, seq);
+  }
+}
+
+// All producers are done: wake every consumer once the ring drains
+static inline void mpmc_close(MpmcRing *r) {
+  atomic_store_explicit(&r->closed, true, memory_order_release);
+  ring_event_notify(&r->not_empty);
+}
+
+// @return Items currently queued (approximate while other threads run)
+static inline isize mpmc_len(MpmcRing *r) {
+  isize n = atomic_load_explicit(&r->enq, memory_order_relaxed) - atomic_load_explicit(&r->deq, memory_order_relaxed);
+  return Min(Max(n, (isize)0), r->mask + 1);
+}
+
+#endif  // RING_H_
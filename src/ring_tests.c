@@ -0,0 +1,159 @@
+#include <pthread.h>
+#include "ring.h"
+#include "utest.h"
+
+UTEST(ring, try_ops_partial_and_close) {
+  enum { size = KB(16) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  void* items[10];
+  for (intptr_t i = 0; i < 10; i++) {
+    items[i] = (void*)(i + 1);
+  }
+  void* out[10];
+
+  SpscRing* s = spsc_create(arena, 8);
+  ASSERT_EQ(spsc_pop_n(s, out, 4), 0);
+  ASSERT_EQ(spsc_push_n(s, items, 10), 8);  // Only 8 fit
+  ASSERT_EQ(spsc_len(s), 8);
+  ASSERT_EQ(spsc_pop_n(s, out, 3), 3);
+  ASSERT_EQ(out[0], items[0]);
+  ASSERT_EQ(out[2], items[2]);
+  ASSERT_EQ(spsc_push_n(s, items + 8, 2), 2);  // Wraps around
+  ASSERT_EQ(spsc_pop_n(s, out, 10), 7);
+  ASSERT_EQ(out[6], items[9]);
+  spsc_close(s);
+  ASSERT_EQ(spsc_pop_wait(s, out, 10), 0);
+
+  MpmcRing* m = mpmc_create(arena, 8);
+  ASSERT_FALSE(mpmc_pop(m, out));
+  ASSERT_EQ(mpmc_push_n(m, items, 10), 8);
+  ASSERT_FALSE(mpmc_push(m, items[0]));
+  ASSERT_EQ(mpmc_pop_n(m, out, 5), 5);
+  ASSERT_EQ(out[4], items[4]);
+  ASSERT_EQ(mpmc_push_n(m, items, 10), 5);
+  ASSERT_EQ(mpmc_len(m), 8);
+  mpmc_close(m);
+  // Closing does not drop queued items
+  ASSERT_EQ(mpmc_pop_wait(m, out, 10), 8);
+  ASSERT_EQ(out[2], items[7]);
+  ASSERT_EQ(out[3], items[0]);
+  ASSERT_EQ(mpmc_pop_wait(m, out, 10), 0);
+}
+
+enum { SPSC_N = 200000 };
+
+static void* spsc_producer(void* arg) {
+  SpscRing* s = arg;
+  void* batch[7];
+  for (intptr_t i = 1; i <= SPSC_N;) {
+    isize k = 0;
+    for (; k < 1 + i % 7 && i <= SPSC_N; k++, i++) {
+      batch[k] = (void*)i;
+    }
+    spsc_push_wait(s, batch, k);
+  }
+  spsc_close(s);
+  return NULL;
+}
+
+UTEST(ring, spsc_threads_in_order) {
+  enum { size = KB(16) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  SpscRing* s = spsc_create(arena, 64);
+  pthread_t t;
+  pthread_create(&t, NULL, spsc_producer, s);
+
+  intptr_t expect = 1;
+  void* out[16];
+  isize k;
+  bool ordered = true;
+  while ((k = spsc_pop_wait(s, out, 16)) > 0) {
+    for (isize i = 0; i < k; i++) {
+      ordered &= (intptr_t)out[i] == expect++;
+    }
+  }
+  pthread_join(t, NULL);
+  ASSERT_TRUE(ordered);
+  ASSERT_EQ(expect, (intptr_t)SPSC_N + 1);
+}
+
+enum { MPMC_PRODUCERS = 4, MPMC_CONSUMERS = 4, MPMC_PER_PRODUCER = 50000 };
+
+typedef struct {
+  MpmcRing* ring;
+  int id;
+  _Atomic int* producers_left;
+  int64_t sum, count;
+  bool ordered;
+} MpmcWorker;
+
+static void* mpmc_producer(void* arg) {
+  MpmcWorker* w = arg;
+  void* batch[5];
+  for (intptr_t i = 1; i <= MPMC_PER_PRODUCER;) {
+    isize k = 0;
+    for (; k < 5 && i <= MPMC_PER_PRODUCER; k++, i++) {
+      batch[k] = (void*)(((intptr_t)w->id << 32) | i);
+    }
+    mpmc_push_wait(w->ring, batch, k);
+  }
+  if (atomic_fetch_sub(w->producers_left, 1) == 1)
+    mpmc_close(w->ring);
+  return NULL;
+}
+
+static void* mpmc_consumer(void* arg) {
+  MpmcWorker* w = arg;
+  intptr_t last[MPMC_PRODUCERS] = {0};
+  void* out[8];
+  isize k;
+  w->ordered = true;
+  while ((k = mpmc_pop_wait(w->ring, out, 1 + w->id % 8)) > 0) {
+    for (isize i = 0; i < k; i++) {
+      intptr_t v = (intptr_t)out[i];
+      int p = (int)(v >> 32);
+      intptr_t seq = v & 0xffffffff;
+      // Items from one producer reach any single consumer in push order
+      w->ordered &= seq > last[p];
+      last[p] = seq;
+      w->sum += seq;
+      w->count++;
+    }
+  }
+  return NULL;
+}
+
+UTEST(ring, mpmc_threads_no_loss) {
+  enum { size = KB(16) };
+  byte mem[size] = {0};
+  Arena arena[] = {arena_init(mem, size)};
+
+  MpmcRing* ring = mpmc_create(arena, 128);
+  _Atomic int left = MPMC_PRODUCERS;
+  MpmcWorker prod[MPMC_PRODUCERS], cons[MPMC_CONSUMERS];
+  pthread_t threads[MPMC_PRODUCERS + MPMC_CONSUMERS];
+  for (int i = 0; i < MPMC_CONSUMERS; i++) {
+    cons[i] = (MpmcWorker){ring, i, &left, 0, 0, true};
+    pthread_create(&threads[i], NULL, mpmc_consumer, &cons[i]);
+  }
+  for (int i = 0; i < MPMC_PRODUCERS; i++) {
+    prod[i] = (MpmcWorker){ring, i, &left, 0, 0, true};
+    pthread_create(&threads[MPMC_CONSUMERS + i], NULL, mpmc_producer, &prod[i]);
+  }
+  for (int i = 0; i < MPMC_PRODUCERS + MPMC_CONSUMERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  int64_t sum = 0, count = 0;
+  for (int i = 0; i < MPMC_CONSUMERS; i++) {
+    ASSERT_TRUE(cons[i].ordered);
+    sum += cons[i].sum;
+    count += cons[i].count;
+  }
+  ASSERT_EQ(count, (int64_t)MPMC_PRODUCERS * MPMC_PER_PRODUCER);
+  ASSERT_EQ(sum, (int64_t)MPMC_PRODUCERS * MPMC_PER_PRODUCER * (MPMC_PER_PRODUCER + 1) / 2);
+}
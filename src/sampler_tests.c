@@ -0,0 +1,150 @@
+#include <pthread.h>
+#include "arena.h"
+#include "sampler.h"
+#include "utest.h"
+
+// Frame pointers whatever the build mode, and no clones renaming the symbols
+#define SAMPLER_FRAMES __attribute__((noipa, optimize("no-omit-frame-pointer")))
+
+static int64_t sampler_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+SAMPLER_FRAMES static uint64_t sampler_spin(int64_t ns) {
+  uint64_t x = 1;
+  for (int64_t end = sampler_cpu_ns() + ns; sampler_cpu_ns() < end;) {
+    for (int i = 0; i < 1000; i++) {
+      x = x * 6364136223846793005u + 1442695040888963407u;
+    }
+  }
+  return x;
+}
+
+SAMPLER_FRAMES static uint64_t sampler_outer(int64_t ns) {
+  return sampler_spin(ns) + 1;
+}
+
+SAMPLER_FRAMES static uint64_t sampler_worker_spin(int64_t ns) {
+  return sampler_spin(ns) + 2;
+}
+
+static void *sampler_worker(void *arg) {
+  sampler_thread_start();
+  *(uint64_t *)arg = sampler_worker_spin(100000000);
+  return NULL;
+}
+
+// Samples whose stack ends with the given frames
+static int64_t sampler_count(const char *folded, const char *suffix) {
+  int64_t n = 0;
+  size_t len = strlen(suffix);
+  for (const char *line = folded; *line;) {
+    const char *eol = strchr(line, '\n');
+    const char *space = eol;
+    while (space > line && *space != ' ') {
+      space--;
+    }
+    if ((size_t)(space - line) >= len && !memcmp(space - len, suffix, len))
+      n += atoll(space + 1);
+    line = eol + 1;
+  }
+  return n;
+}
+
+UTEST(sampler, folded_stacks_by_thread) {
+  ASSERT_TRUE(sampler_start(1000));
+  uint64_t worker_result = 0;
+  pthread_t t;
+  pthread_create(&t, NULL, sampler_worker, &worker_result);
+  uint64_t result = sampler_outer(100000000);
+  pthread_join(t, NULL);
+  sampler_stop();
+  ASSERT_NE(result, worker_result);
+
+  Arena arena = arena_init(NULL, GB(1));
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&buf, &len);
+  int64_t samples = sampler_write_folded(out, &arena);
+  fclose(out);
+  arena_release(&arena);
+
+  // CPU-time timers expire on scheduler ticks, as few as 10 per 100ms of CPU at
+  // CONFIG_HZ=100: expect each spin attributed, not a rate
+  int64_t outer = sampler_count(buf, "sampler_outer;sampler_spin");
+  int64_t worker = sampler_count(buf, "sampler_worker;sampler_worker_spin;sampler_spin");
+  ASSERT_GT(outer, 0);
+  ASSERT_GT(worker, 0);
+  ASSERT_GE(samples, outer + worker);
+  free(buf);
+
+  // Stopped: no more samples
+  int64_t before = 0;
+  for (SamplerThread *st = sampler_state.threads; st; st = st->next) {
+    before += st->head;
+  }
+  sampler_spin(20000000);
+  int64_t after = 0;
+  for (SamplerThread *st = sampler_state.threads; st; st = st->next) {
+    after += st->head;
+  }
+  ASSERT_EQ(before, after);
+}
+
+static isize sampler_rings(void) {
+  isize n = 0;
+  for (SamplerThread *st = sampler_state.threads; st; st = st->next) {
+    n++;
+  }
+  return n;
+}
+
+// Samples in the rings and in the folded stacks of exited threads
+static int64_t sampler_held(void) {
+  int64_t n = 0;
+  for (SamplerThread *st = sampler_state.threads; st; st = st->next) {
+    n += Min(st->head, (uint64_t)SAMPLER_RING_SAMPLES);
+  }
+  for (isize b = 0; b < sampler_state.nbuckets; b++) {
+    for (SamplerStack *k = sampler_state.buckets[b]; k; k = k->next) {
+      n += k->count;
+    }
+  }
+  return n;
+}
+
+static void *sampler_short_worker(void *arg) {
+  sampler_thread_start();
+  *(SamplerThread **)arg = sampler_thread;
+  sampler_worker_spin(20000000);
+  return NULL;
+}
+
+UTEST(sampler, exited_threads_rings_reused) {
+  ASSERT_TRUE(sampler_start(1000));
+  SamplerThread *first = NULL;
+  pthread_t t;
+  pthread_create(&t, NULL, sampler_short_worker, &first);
+  pthread_join(t, NULL);
+  isize rings = sampler_rings();
+  // One thread at a time: each adopts the ring the last one left, its samples folded
+  for (int i = 0; i < 16; i++) {
+    int64_t held = sampler_held();
+    SamplerThread *ring = NULL;
+    pthread_create(&t, NULL, sampler_short_worker, &ring);
+    pthread_join(t, NULL);
+    ASSERT_TRUE(ring != NULL);
+    ASSERT_GE(sampler_held(), held);
+  }
+  sampler_stop();
+  ASSERT_EQ(sampler_rings(), rings);
+  ASSERT_TRUE(first != NULL);
+
+  Arena arena = arena_init(NULL, GB(1));
+  FILE *out = fopen("/dev/null", "w");
+  ASSERT_EQ(sampler_write_folded(out, &arena), sampler_held());
+  fclose(out);
+  arena_release(&arena);
+}
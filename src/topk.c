@@ -0,0 +1,225 @@
+#include "topk.h"
+#include <stdlib.h>
+
+typedef struct {
+  astr s;
+  uint64_t hash;
+} TopkKey;
+
+static inline uint64_t topk_key_hash(TopkKey k) {
+  return k.hash;
+}
+
+static inline bool topk_key_equals(TopkKey a, TopkKey b) {
+  return a.hash == b.hash && astr_equals(a.s, b.s);
+}
+
+static inline void *topk_malloc(size_t size, Arena **ctx) {
+  return arena_malloc(size, *ctx);
+}
+
+static inline void topk_free(void *ptr, size_t size, Arena **ctx) {
+  arena_free(ptr, size, *ctx);
+}
+
+#define NAME      TopkMap
+#define KEY_TY    TopkKey
+#define VAL_TY    int32_t
+#define CTX_TY    Arena *
+#define CMPR_FN   topk_key_equals
+#define HASH_FN   topk_key_hash
+#define MALLOC_FN topk_malloc
+#define FREE_FN   topk_free
+#include "verstable.h"
+
+typedef struct {
+  TopkItem item;
+  uint64_t hash;
+  isize cap;    // Bytes at item.key.data
+  int32_t pos;  // Index in the heap
+} TopkCounter;
+
+struct Topk {
+  Arena *arena;
+  TopkMap map;  // Key to counter, reserved up front so it never grows
+  TopkCounter *counters;
+  int32_t *heap;  // Counters in use, least count first
+  int n, cap;
+  int64_t total;
+};
+
+Topk *topk_new(Arena *arena, int counters) {
+  Topk *t = New(arena, Topk);
+  t->arena = arena;
+  t->cap = Max(counters, 1);
+  t->counters = New(arena, TopkCounter, t->cap);
+  t->heap = New(arena, int32_t, t->cap, NO_INIT);
+  vt_init_with_ctx(&t->map, arena);
+  if (!vt_reserve(&t->map, t->cap)) {
+    perror("topk_new reserve");
+    abort();
+  }
+  return t;
+}
+
+static inline int64_t topk_count(const Topk *t, int pos) {
+  return t->counters[t->heap[pos]].item.count;
+}
+
+static void topk_sift_down(Topk *t, int pos) {
+  int32_t c = t->heap[pos];
+  int64_t count = t->counters[c].item.count;
+  for (;;) {
+    int least = 2 * pos + 1;
+    if (least >= t->n)
+      break;
+    if (least + 1 < t->n && topk_count(t, least + 1) < topk_count(t, least))
+      least++;
+    if (count <= topk_count(t, least))
+      break;
+    t->heap[pos] = t->heap[least];
+    t->counters[t->heap[pos]].pos = pos;
+    pos = least;
+  }
+  t->heap[pos] = c;
+  t->counters[c].pos = pos;
+}
+
+static void topk_sift_up(Topk *t, int pos) {
+  int32_t c = t->heap[pos];
+  int64_t count = t->counters[c].item.count;
+  while (pos > 0 && topk_count(t, (pos - 1) / 2) > count) {
+    t->heap[pos] = t->heap[(pos - 1) / 2];
+    t->counters[t->heap[pos]].pos = pos;
+    pos = (pos - 1) / 2;
+  }
+  t->heap[pos] = c;
+  t->counters[c].pos = pos;
+}
+
+// Copy key into the counter, in its own bytes when they are long enough
+static void topk_set_key(Topk *t, TopkCounter *c, astr key, uint64_t hash) {
+  if (!c->item.key.data || key.len > c->cap) {
+    c->cap = Max(key.len, Max(2 * c->cap, (isize)16));
+    c->item.key.data = New(t->arena, char, c->cap, NO_INIT);
+  }
+  memcpy(c->item.key.data, key.data, key.len);
+  c->item.key.len = key.len;
+  c->hash = hash;
+}
+
+// The count of a key the summary has no counter for can be up to its least count
+static inline int64_t topk_floor(const Topk *t) {
+  return t->n == t->cap ? topk_count(t, 0) : 0;
+}
+
+void topk_add(Topk *t, astr key, int64_t weight) {
+  TopkKey k = {key, astr_hash(key)};
+  t->total += weight;
+  TopkMap_itr it = vt_get(&t->map, k);
+  if (!vt_is_end(it)) {
+    TopkCounter *c = &t->counters[it.data->val];
+    c->item.count += weight;
+    topk_sift_down(t, c->pos);
+    return;
+  }
+
+  int64_t floor = topk_floor(t);
+  bool evict = t->n == t->cap;
+  int32_t i;
+  if (!evict) {
+    i = t->n;
+    t->heap[t->n++] = i;
+  } else {
+    i = t->heap[0];
+    TopkCounter *c = &t->counters[i];
+    vt_erase(&t->map, (TopkKey){c->item.key, c->hash});
+  }
+  TopkCounter *c = &t->counters[i];
+  topk_set_key(t, c, key, k.hash);
+  c->item.count = floor + weight;
+  c->item.error = floor;
+  vt_insert(&t->map, (TopkKey){c->item.key, k.hash}, i);
+  if (evict)
+    topk_sift_down(t, 0);
+  else
+    topk_sift_up(t, t->n - 1);
+}
+
+typedef struct {
+  TopkItem item;
+  uint64_t hash;
+} TopkMerged;
+
+static int topk_item_cmp(const void *x, const void *y) {
+  const TopkItem *a = x, *b = y;
+  if (a->count != b->count)
+    return a->count > b->count ? -1 : 1;
+  return astr_compare(a->key, b->key);
+}
+
+void topk_merge(Topk *into, const Topk *from, Arena scratch) {
+  int64_t into_floor = topk_floor(into), from_floor = topk_floor(from);
+  TopkMerged *merged = New(&scratch, TopkMerged, into->n + from->n, NO_INIT);
+  bool *matched = New(&scratch, bool, from->n);
+  isize n = 0;
+  for (int i = 0; i < into->n; i++) {
+    const TopkCounter *c = &into->counters[i];
+    TopkMerged *m = &merged[n++];
+    *m = (TopkMerged){c->item, c->hash};
+    m->item.key = astr_from_bytes(&scratch, c->item.key.data, c->item.key.len);
+    TopkMap_itr it = vt_get((TopkMap *)&from->map, (TopkKey){c->item.key, c->hash});
+    if (vt_is_end(it)) {
+      m->item.count += from_floor;
+      m->item.error += from_floor;
+    } else {
+      const TopkItem *other = &from->counters[it.data->val].item;
+      m->item.count += other->count;
+      m->item.error += other->error;
+      matched[it.data->val] = true;
+    }
+  }
+  for (int i = 0; i < from->n; i++) {
+    const TopkCounter *c = &from->counters[i];
+    if (matched[i])
+      continue;
+    TopkMerged *m = &merged[n++];
+    *m = (TopkMerged){c->item, c->hash};
+    m->item.count += into_floor;
+    m->item.error += into_floor;
+  }
+  // TopkItem leads TopkMerged, so the items sort in place
+  qsort(merged, n, sizeof(TopkMerged), topk_item_cmp);
+
+  // Rebuild: the heaviest go back in order, which is already a heap the other way round
+  vt_clear(&into->map);
+  into->n = (int)Min(n, (isize)into->cap);
+  for (int i = 0; i < into->n; i++) {
+    TopkMerged *m = &merged[i];
+    TopkCounter *c = &into->counters[i];
+    topk_set_key(into, c, m->item.key, m->hash);
+    c->item.count = m->item.count;
+    c->item.error = m->item.error;
+    vt_insert(&into->map, (TopkKey){c->item.key, c->hash}, i);
+    into->heap[into->n - 1 - i] = i;
+    c->pos = into->n - 1 - i;
+  }
+  into->total += from->total;
+}
+
+int topk_len(const Topk *t) {
+  return t->n;
+}
+
+int64_t topk_total(const Topk *t) {
+  return t->total;
+}
+
+TopkItem *topk_items(const Topk *t, Arena *arena) {
+  TopkItem *items = New(arena, TopkItem, Max(t->n, 1), NO_INIT);
+  for (int i = 0; i < t->n; i++) {
+    items[i] = t->counters[i].item;
+  }
+  qsort(items, t->n, sizeof(TopkItem), topk_item_cmp);
+  return items;
+}
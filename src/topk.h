@@ -0,0 +1,72 @@
+/**
+ * @file topk.h
+ * @brief Space-Saving heavy hitters: the heaviest keys of a stream in bounded memory.
+ *
+ * A Topk has a fixed number of counters, each a key and a count. A key
+ * with a counter adds to it; any other key takes over the counter with the
+ * least count and starts from that count, which it records as its error.
+ * Every count is so an upper bound of the key's weight and count - error a
+ * lower bound, and every key heavier than total / counters has a counter.
+ * The counters form a min-heap, so the least is at hand, and a verstable
+ * map from key to counter finds a key's counter.
+ *
+ * Usage:
+ *   Topk *t = topk_new(arena, 1000);
+ *   for (...)
+ *     topk_add(t, key, 1);
+ *   TopkItem *items = topk_items(t, arena);  // topk_len(t) items, heaviest first
+ *
+ * Keys are copied into the arena, and a counter reuses its key's bytes for
+ * the next key that fits, so memory is bounded by the counters and the key
+ * lengths however long the stream. Summaries of separate threads combine
+ * with topk_merge(), whose error bounds hold for the union of the streams.
+ */
+
+#ifndef TOPK_H_
+#define TOPK_H_
+
+#include "arena.h"
+
+typedef struct {
+  astr key;
+  int64_t count;  // Upper bound of the key's weight
+  int64_t error;  // Most the count can exceed the weight by
+} TopkItem;
+
+typedef struct Topk Topk;
+
+/**
+ * @brief Create an empty summary.
+ * @param arena Arena for the counters, the map and the keys
+ * @param counters Counters kept: more are slower but exact for lighter keys
+ * @return Summary, valid as long as the arena
+ */
+Topk *topk_new(Arena *arena, int counters);
+
+// Add weight to key; key is copied
+void topk_add(Topk *t, astr key, int64_t weight);
+
+/**
+ * @brief Fold a summary into another, as if into had seen both streams.
+ * @param into Summary to update
+ * @param from Summary to add, unchanged
+ * @param scratch Temporary memory, separate from into's arena
+ *
+ * A key missing from one summary is counted as that summary's least count,
+ * the most it can weigh there, and the heaviest counters are kept.
+ */
+void topk_merge(Topk *into, const Topk *from, Arena scratch);
+
+// @return Counters in use: the number of topk_items()
+int topk_len(const Topk *t);
+
+// @return Sum of the weights added
+int64_t topk_total(const Topk *t);
+
+/**
+ * @brief List the counters, by count from the heaviest, then by key.
+ * @return topk_len(t) items in arena; their keys are valid until t changes
+ */
+TopkItem *topk_items(const Topk *t, Arena *arena);
+
+#endif  // TOPK_H_
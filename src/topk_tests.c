@@ -0,0 +1,100 @@
+#include "topk.h"
+#include "utest.h"
+
+// A key of a skewed stream: key i, of 1000, is drawn with probability about 1 / ((i + 1) (i + 2))
+static int topk_skewed(uint64_t *rng) {
+  *rng = *rng * 6364136223846793005ull + 1442695040888963407ull;
+  double u = (double)(*rng >> 11) / (double)(1ull << 53);
+  return Max((int)(1 / (u + 1e-3)) - 1, 0);
+}
+
+UTEST(topk, exact_with_room) {
+  Arena arena[] = {arena_init(NULL, MB(1))};
+  Topk* t = topk_new(arena, 8);
+  const char* words[] = {"b", "a", "c", "a", "b", "a", "", "c", "a"};
+  for (int i = 0; i < Countof(words); i++) {
+    topk_add(t, (astr){(char*)words[i], strlen(words[i])}, 1);
+  }
+  topk_add(t, astr("c"), 10);
+  ASSERT_EQ(topk_len(t), 4);
+  ASSERT_EQ(topk_total(t), 19);
+  TopkItem* items = topk_items(t, arena);
+  ASSERT_TRUE(astr_equals(items[0].key, astr("c")));
+  ASSERT_EQ(items[0].count, 12);
+  ASSERT_TRUE(astr_equals(items[1].key, astr("a")));
+  ASSERT_EQ(items[1].count, 4);
+  ASSERT_TRUE(astr_equals(items[2].key, astr("b")));
+  ASSERT_TRUE(astr_equals(items[3].key, astr("")));
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(items[i].error, 0);
+  }
+  arena_release(arena);
+}
+
+UTEST(topk, heavy_hitters_within_bounds) {
+  Arena arena[] = {arena_init(NULL, MB(8))};
+  enum { KEYS = 1000, DRAWS = 200000, COUNTERS = 64 };
+  int64_t* truth = New(arena, int64_t, KEYS);
+  Topk* t = topk_new(arena, COUNTERS);
+  uint64_t rng = 1;
+  for (int i = 0; i < DRAWS; i++) {
+    int key = topk_skewed(&rng);
+    truth[key]++;
+    // Keys of every length, so counters move between short and long keys
+    Arena tmp = *arena;
+    topk_add(t, astr_format(&tmp, "%0*d", 1 + key % 40, key), 1);
+  }
+  ASSERT_EQ(topk_len(t), COUNTERS);
+  TopkItem* items = topk_items(t, arena);
+  for (int i = 0; i < COUNTERS; i++) {
+    int key = atoi(astr_to_cstr(*arena, items[i].key));
+    ASSERT_LE(items[i].count - items[i].error, truth[key]);
+    ASSERT_GE(items[i].count, truth[key]);
+    ASSERT_TRUE(i == 0 || items[i - 1].count >= items[i].count);
+  }
+  // Every key heavier than DRAWS / COUNTERS has a counter; the heaviest lead
+  for (int key = 0; key < KEYS; key++) {
+    bool found = false;
+    for (int i = 0; i < COUNTERS && !found; i++) {
+      found = atoi(astr_to_cstr(*arena, items[i].key)) == key;
+    }
+    ASSERT_TRUE(found || truth[key] <= DRAWS / COUNTERS);
+  }
+  ASSERT_EQ(atoi(astr_to_cstr(*arena, items[0].key)), 0);
+  ASSERT_EQ(atoi(astr_to_cstr(*arena, items[1].key)), 1);
+  arena_release(arena);
+}
+
+UTEST(topk, merge_keeps_bounds) {
+  Arena arena[] = {arena_init(NULL, MB(8))};
+  enum { KEYS = 1000, DRAWS = 100000, COUNTERS = 32, PARTS = 4 };
+  int64_t* truth = New(arena, int64_t, KEYS);
+  Topk* parts[PARTS];
+  for (int p = 0; p < PARTS; p++) {
+    parts[p] = topk_new(arena, COUNTERS);
+  }
+  uint64_t rng = 7;
+  for (int i = 0; i < DRAWS; i++) {
+    int key = topk_skewed(&rng);
+    truth[key]++;
+    char buf[16];
+    topk_add(parts[i % PARTS], (astr){buf, snprintf(buf, sizeof(buf), "k%d", key)}, 1);
+  }
+  Topk* all = topk_new(arena, COUNTERS);
+  for (int p = 0; p < PARTS; p++) {
+    topk_merge(all, parts[p], *arena);
+  }
+  ASSERT_EQ(topk_total(all), DRAWS);
+  ASSERT_EQ(topk_len(all), COUNTERS);
+  TopkItem* items = topk_items(all, arena);
+  for (int i = 0; i < COUNTERS; i++) {
+    int key = atoi(astr_to_cstr(*arena, astr_slice(items[i].key, 1, items[i].key.len)));
+    ASSERT_LE(items[i].count - items[i].error, truth[key]);
+    ASSERT_GE(items[i].count, truth[key]);
+  }
+  ASSERT_TRUE(astr_equals(items[0].key, astr("k0")));
+  // The merged summary keeps counting
+  topk_add(all, astr("k0"), 5);
+  ASSERT_EQ(topk_items(all, arena)[0].count, items[0].count + 5);
+  arena_release(arena);
+}
@@ -0,0 +1,21 @@
+// Measures the enabled cost, so this file traces whatever the build mode
+#ifndef TRACE
+#define TRACE
+#endif
+#include "trace.h"
+#include "ubench.h"
+
+UBENCH(trace, scope) {
+  UBENCH_ITEMS(ubench, 1);
+  UBENCH_LOOP(ubench) {
+    TRACE_SCOPE("bench_scope");
+    UBENCH_CLOBBER();
+  }
+}
+
+UBENCH(trace, counter) {
+  UBENCH_ITEMS(ubench, 1);
+  UBENCH_LOOP(ubench) {
+    TRACE_COUNTER("bench_counter", _ubench_i);
+  }
+}
@@ -0,0 +1,147 @@
+// Tracing is per translation unit, so this file opts in whatever the build mode
+#ifndef TRACE
+#define TRACE
+#endif
+#include <pthread.h>
+#include "json.h"
+#include "trace.h"
+#include "utest.h"
+
+typedef struct {
+  int tid;
+  char wrap_name[32];
+} TraceWorker;
+
+static void *trace_worker(void *arg) {
+  TraceWorker *w = arg;
+  TRACE_THREAD_NAME("trace_worker");
+  w->tid = (int)syscall(SYS_gettid);
+  {
+    TRACE_SCOPE("outer");
+    {
+      TRACE_SCOPE("inner");
+      struct timespec ts = {0, 200000};
+      nanosleep(&ts, NULL);
+    }
+    TRACE_COUNTER("depth", 7);
+    TRACE_INSTANT("tick");
+  }
+  // Overfill the ring: only the newest TRACE_BUFFER_EVENTS survive
+  for (int i = 0; i < TRACE_BUFFER_EVENTS + 100; i++) {
+    TRACE_INSTANT(w->wrap_name);
+  }
+  return NULL;
+}
+
+// First event of this thread with the given name and phase
+static struct json trace_find(struct json events, int tid, const char *name, const char *ph) {
+  for (struct json e = json_first(events); json_exists(e); e = json_next(e)) {
+    if (json_int(json_object_get(e, "tid")) == tid && !json_string_compare(json_object_get(e, "name"), name) &&
+        !json_string_compare(json_object_get(e, "ph"), ph))
+      return e;
+  }
+  return (struct json){0};
+}
+
+UTEST(trace, scopes_counters_instants_json) {
+  TraceWorker w = {0};
+  snprintf(w.wrap_name, sizeof(w.wrap_name), "wrap-%p", (void *)&w);
+  pthread_t t;
+  pthread_create(&t, NULL, trace_worker, &w);
+  pthread_join(t, NULL);
+
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&buf, &len);
+  int64_t n = trace_write_json(out);
+  fclose(out);
+  ASSERT_GT(n, (int64_t)TRACE_BUFFER_EVENTS);
+  ASSERT_TRUE(json_valid(buf));
+
+  struct json events = json_object_get(json_parse(buf), "traceEvents");
+  struct json meta = trace_find(events, w.tid, "thread_name", "M");
+  ASSERT_TRUE(json_exists(meta));
+  ASSERT_EQ(json_string_compare(json_object_get(json_object_get(meta, "args"), "name"), "trace_worker"), 0);
+
+  // The scopes and the counter were overwritten by the flood of instants
+  ASSERT_FALSE(json_exists(trace_find(events, w.tid, "outer", "X")));
+  int wraps = 0;
+  for (struct json e = json_first(events); json_exists(e); e = json_next(e)) {
+    wraps += json_int(json_object_get(e, "tid")) == w.tid &&
+             !json_string_compare(json_object_get(e, "name"), w.wrap_name);
+  }
+  ASSERT_EQ(wraps, TRACE_BUFFER_EVENTS);
+  free(buf);
+}
+
+UTEST(trace, nested_scopes_in_order) {
+  int tid = (int)syscall(SYS_gettid);
+  uint64_t mark = trace_buffer ? trace_buffer->head : 0;
+  {
+    TRACE_SCOPE("nested_outer");
+    TRACE_COUNTER("nested_depth", 42);
+    {
+      TRACE_SCOPE("nested_inner");
+      struct timespec ts = {0, 100000};
+      nanosleep(&ts, NULL);
+    }
+  }
+  ASSERT_EQ(trace_buffer->head - mark, 3u);
+  ASSERT_EQ(trace_buffer->tid, tid);
+
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&buf, &len);
+  trace_write_json(out);
+  fclose(out);
+  ASSERT_TRUE(json_valid(buf));
+
+  struct json events = json_object_get(json_parse(buf), "traceEvents");
+  struct json outer = trace_find(events, tid, "nested_outer", "X");
+  struct json inner = trace_find(events, tid, "nested_inner", "X");
+  struct json counter = trace_find(events, tid, "nested_depth", "C");
+  ASSERT_TRUE(json_exists(outer) && json_exists(inner) && json_exists(counter));
+  ASSERT_EQ(json_int(json_object_get(json_object_get(counter, "args"), "value")), 42);
+
+  double outer_ts = json_double(json_object_get(outer, "ts"));
+  double outer_dur = json_double(json_object_get(outer, "dur"));
+  double inner_ts = json_double(json_object_get(inner, "ts"));
+  double inner_dur = json_double(json_object_get(inner, "dur"));
+  ASSERT_GE(inner_dur, 50.0);  // Slept 100us; allow for a coarse calibration
+  ASSERT_LE(outer_ts, inner_ts);
+  ASSERT_LE(inner_ts + inner_dur, outer_ts + outer_dur + 0.01);
+  free(buf);
+}
+
+static void *trace_short_worker(void *arg) {
+  TRACE_INSTANT("short");
+  *(TraceBuffer **)arg = trace_buffer;
+  return NULL;
+}
+
+static int trace_buffers(void) {
+  int n = 0;
+  for (TraceBuffer *b = atomic_load(&trace_state.buffers); b; b = b->next) {
+    n++;
+  }
+  return n;
+}
+
+UTEST(trace, exited_threads_buffers_reused) {
+  TraceBuffer *first = NULL;
+  pthread_t t;
+  pthread_create(&t, NULL, trace_short_worker, &first);
+  pthread_join(t, NULL);
+  int before = trace_buffers();
+  // One thread at a time: each adopts the buffer the last one left, events reset
+  for (int i = 0; i < 16; i++) {
+    TraceBuffer *b = NULL;
+    pthread_create(&t, NULL, trace_short_worker, &b);
+    pthread_join(t, NULL);
+    ASSERT_TRUE(b != NULL);
+    ASSERT_EQ(atomic_load(&b->head), 1u);
+    ASSERT_TRUE(b->thread_name == NULL);
+  }
+  ASSERT_EQ(trace_buffers(), before);
+  ASSERT_TRUE(first != NULL);
+}
@@ -0,0 +1,45 @@
+#include "arena.h"
+#include "ubench.h"
+#include "utest.h"
+
+UTEST(ubench, stats) {
+  double ns[] = {12, 10, 11, 50, 10, 13, 11};
+  UBenchResult r = {0};
+  ubench_stats(ns, Countof(ns), &r);
+  ASSERT_EQ(r.samples, 7);
+  ASSERT_EQ(r.min_ns, 10.0);
+  ASSERT_EQ(r.median_ns, 11.0);
+  // |x - 11| = 1 1 0 39 1 2 0 -> median 1, unaffected by the outlier
+  ASSERT_EQ(r.mad_ns, 1.0);
+  ASSERT_NEAR(r.mean_ns, 117.0 / 7, 1e-9);
+
+  double even[] = {4, 1, 3, 2};
+  ubench_stats(even, Countof(even), &r);
+  ASSERT_EQ(r.median_ns, 2.5);
+  ASSERT_EQ(r.mad_ns, 1.0);
+}
+
+static int64_t spin_calls;
+
+static void spin_bench(UBench* ubench) {
+  spin_calls++;
+  UBENCH_ITEMS(ubench, 4);
+  UBENCH_LOOP(ubench) {
+    for (int i = 0; i < 4; i++) {
+      UBENCH_DO_NOT_OPTIMIZE(i * 3);
+    }
+  }
+}
+
+UTEST(ubench, calibrates_and_samples) {
+  UBenchResult r = {.name = "spin"};
+  spin_calls = 0;
+  ubench_measure(spin_bench, (UBenchOptions){.samples = 5, .warmup = 1, .min_sample_ns = 200000}, &r);
+  ASSERT_GT(r.iters, 100);  // Calibrated well past a single iteration
+  ASSERT_EQ(r.samples, 5);
+  ASSERT_GT(spin_calls, 5 + 1);  // Calibration runs, one warmup, five samples
+  ASSERT_GT(r.median_ns, 0.0);
+  ASSERT_LE(r.min_ns, r.median_ns);
+  ASSERT_NEAR(r.items_per_sec, 4e9 / r.median_ns, 1.0);
+  ASSERT_EQ(r.bytes_per_sec, 0.0);
+}
@@ -0,0 +1,100 @@
+#include <signal.h>
+#include "utest.h"
+#include "utest_jobs.h"
+
+static void jobs_pass(int *result, size_t index) {
+  printf("pass output\n");
+}
+
+static void jobs_fail(int *result, size_t index) {
+  printf("fail output %zu\n", index);
+  *result = UTEST_TEST_FAILURE;
+}
+
+static void jobs_skip(int *result, size_t index) {
+  *result = UTEST_TEST_SKIPPED;
+}
+
+static void jobs_crash(int *result, size_t index) {
+  printf("before crash\n");
+  raise(SIGKILL);
+}
+
+static void jobs_exit(int *result, size_t index) {
+  exit(3);
+}
+
+static int jobs_before_each_calls;
+
+// Counts per worker: a fresh fork starts from the parent's 0
+static void jobs_before_each(void) {
+  jobs_before_each_calls++;
+}
+
+static void jobs_count(int *result, size_t index) {
+  if (jobs_before_each_calls < 1)
+    *result = UTEST_TEST_FAILURE;
+}
+
+static int jobs_run(const struct utest_test_state_s *tests, size_t n, int nworkers, const char *filter,
+                    char **console, char **xml) {
+  size_t console_len = 0, xml_len = 0;
+  UTestJobs jobs = {
+      .tests = tests,
+      .tests_length = n,
+      .filter = filter,
+      .jobs = nworkers,
+      .out = open_memstream(console, &console_len),
+      .xml = open_memstream(xml, &xml_len),
+      .before_each = jobs_before_each,
+  };
+  int failed = utest_jobs_run(&jobs);
+  fclose(jobs.out);
+  fclose(jobs.xml);
+  return failed;
+}
+
+UTEST(utest_jobs, results_crashes_and_xml) {
+  const struct utest_test_state_s tests[] = {
+      {jobs_pass, 0, "jobs.pass"},   {jobs_fail, 7, "jobs.fail"},   {jobs_crash, 0, "jobs.crash"},
+      {jobs_pass, 0, "jobs.pass2"},  {jobs_skip, 0, "jobs.skip"},   {jobs_exit, 0, "jobs.exit"},
+      {jobs_count, 0, "jobs.count"}, {jobs_pass, 0, "other.pass"},
+  };
+  const size_t n = sizeof(tests) / sizeof(tests[0]);
+
+  char *console = NULL, *xml = NULL;
+  ASSERT_EQ(jobs_run(tests, n, 3, "jobs.*", &console, &xml), 3);
+
+  // Output is kept for failures only; crashed workers were replaced
+  ASSERT_TRUE(strstr(console, "Running 7 test cases in 3 processes.") != NULL);
+  ASSERT_TRUE(strstr(console, "fail output 7\n") != NULL);
+  ASSERT_TRUE(strstr(console, "before crash\n") != NULL);
+  ASSERT_TRUE(strstr(console, "pass output") == NULL);
+  ASSERT_TRUE(strstr(console, "[  FAILED  ] jobs.crash (killed by signal 9") != NULL);
+  ASSERT_TRUE(strstr(console, "[  FAILED  ] jobs.exit (exited with status 3)") != NULL);
+  ASSERT_TRUE(strstr(console, "[  PASSED  ] 3 tests.") != NULL);
+  ASSERT_TRUE(strstr(console, "other.pass") == NULL);
+
+  const char *want =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<testsuites tests=\"7\" name=\"All\">\n"
+      "<testsuite name=\"Tests\" tests=\"7\" failures=\"3\" skipped=\"1\">\n"
+      "<testcase name=\"jobs.pass\"></testcase>\n"
+      "<testcase name=\"jobs.fail\"><failure/></testcase>\n"
+      "<testcase name=\"jobs.crash\"><failure message=\"killed by signal 9 (Killed)\"/></testcase>\n"
+      "<testcase name=\"jobs.pass2\"></testcase>\n"
+      "<testcase name=\"jobs.skip\"><skipped/></testcase>\n"
+      "<testcase name=\"jobs.exit\"><failure message=\"exited with status 3\"/></testcase>\n"
+      "<testcase name=\"jobs.count\"></testcase>\n"
+      "</testsuite>\n</testsuites>\n";
+  ASSERT_STREQ(xml, want);
+  ASSERT_EQ(jobs_before_each_calls, 0);  // Only the workers ran it
+  free(console);
+  free(xml);
+
+  // Same report with one worker
+  ASSERT_EQ(jobs_run(tests, n, 1, "jobs.*", &console, &xml), 3);
+  ASSERT_STREQ(xml, want);
+  free(console);
+  free(xml);
+}